@@ -0,0 +1,558 @@
+/*
+	Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "libs/pilight/core/threads.h"
+#include "libs/pilight/core/pilight.h"
+#include "libs/pilight/core/options.h"
+#include "libs/pilight/core/log.h"
+#include "libs/pilight/core/datetime.h"
+#include "libs/pilight/core/gc.h"
+#include "libs/pilight/core/dso.h"
+#include "libs/pilight/core/capture.h"
+#include "libs/pilight/core/history.h"
+#include "libs/pilight/core/atom.h"
+#include "libs/pilight/config/config.h"
+#include "libs/pilight/config/hardware.h"
+#include "libs/pilight/lua_c/lua.h"
+
+#include "libs/pilight/protocols/protocol.h"
+
+typedef struct trains_t {
+	int hwtype;
+	int length;
+	int *pulses;
+	struct trains_t *next;
+} trains_t;
+
+typedef struct stats_t {
+	struct protocol_t *protocol;
+	unsigned long calls;
+	unsigned long decoded;
+	unsigned long allocs;
+	uint64_t time;
+} stats_t;
+
+static struct trains_t *trains = NULL;
+static struct stats_t *stats = NULL;
+static int nrstats = 0;
+
+static char *lua_root = LUA_ROOT;
+
+/*
+ * Count allocations by wrapping the glibc allocator.
+ * This includes the allocations done by the shared
+ * pilight library and other dependencies.
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_calloc(size_t, size_t);
+
+static unsigned long allocs = 0;
+
+void *malloc(size_t a) {
+	__sync_add_and_fetch(&allocs, 1);
+	return __libc_malloc(a);
+}
+
+void *realloc(void *a, size_t b) {
+	__sync_add_and_fetch(&allocs, 1);
+	return __libc_realloc(a, b);
+}
+
+void *calloc(size_t a, size_t b) {
+	__sync_add_and_fetch(&allocs, 1);
+	return __libc_calloc(a, b);
+}
+#else
+static unsigned long allocs = 0;
+#endif
+
+int main_gc(void) {
+	log_shell_disable();
+
+	while(trains) {
+		struct trains_t *tmp = trains;
+		trains = trains->next;
+		FREE(tmp->pulses);
+		FREE(tmp);
+	}
+	if(stats != NULL) {
+		FREE(stats);
+	}
+	nrstats = 0;
+
+	datetime_gc();
+	options_gc();
+
+	eventpool_gc();
+	config_gc();
+	protocol_gc();
+	threads_gc();
+
+	plua_gc();
+	dso_gc();
+	log_gc();
+	gc_clear();
+	atom_gc();
+
+	FREE(progname);
+	xfree();
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+
+	return EXIT_SUCCESS;
+}
+
+static void close_cb(uv_handle_t *handle) {
+	FREE(handle);
+}
+
+static void walk_cb(uv_handle_t *handle, void *arg) {
+	if(!uv_is_closing(handle)) {
+		uv_close(handle, close_cb);
+	}
+}
+
+static void main_loop1(void) {
+	uv_stop(uv_default_loop());
+	uv_walk(uv_default_loop(), walk_cb, NULL);
+	uv_run(uv_default_loop(), UV_RUN_ONCE);
+
+	while(uv_loop_close(uv_default_loop()) == UV_EBUSY) {
+		usleep(10);
+	}
+}
+
+static int load(char *file) {
+	struct capture_t *capture = NULL;
+	struct trains_t *tail = NULL;
+	unsigned long long timestamp = 0;
+	char hardware[256];
+	int pulses[MAXPULSESTREAMLENGTH+1];
+	int length = 0, nr = 0, ret = 0;
+
+	if((capture = capture_open(file, 0)) == NULL) {
+		return -1;
+	}
+
+	struct lua_state_t *state = plua_get_free_state();
+	while((ret = capture_read(capture, &timestamp, hardware, sizeof(hardware), pulses, &length, MAXPULSESTREAMLENGTH)) == 1) {
+		if(length == 0) {
+			continue;
+		}
+		struct trains_t *node = MALLOC(sizeof(struct trains_t));
+		if(node == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		if((node->pulses = MALLOC(sizeof(int)*length)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		memcpy(node->pulses, pulses, sizeof(int)*length);
+		node->length = length;
+		node->next = NULL;
+
+		/*
+		 * Pulse trains of hardware not present in the
+		 * config are matched against all protocols.
+		 */
+		node->hwtype = config_hardware_get_type(state->L, hardware);
+
+		if(tail == NULL) {
+			trains = node;
+		} else {
+			tail->next = node;
+		}
+		tail = node;
+		nr++;
+	}
+	assert(plua_check_stack(state->L, 0) == 0);
+	plua_clear_state(state);
+
+	capture_close(capture);
+
+	if(ret == -1) {
+		logprintf(LOG_ERR, "capture file %s is corrupt after %d pulse trains", file, nr);
+		return -1;
+	}
+	return nr;
+}
+
+static void replay(int iterations) {
+	struct protocols_t *pnode = protocols;
+	struct trains_t *node = NULL;
+	unsigned long nrtrains = 0, nrdecoded = 0, start_allocs = allocs;
+	uint64_t start = 0, elapsed = 0;
+	int i = 0, x = 0;
+
+	while(pnode != NULL) {
+		if(pnode->listener->parseCode != NULL && pnode->listener->validate != NULL) {
+			if((stats = REALLOC(stats, sizeof(struct stats_t)*(nrstats+1))) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+			memset(&stats[nrstats], 0, sizeof(struct stats_t));
+			stats[nrstats++].protocol = pnode->listener;
+		}
+		pnode = pnode->next;
+	}
+
+	start = uv_hrtime();
+	for(i=0;i<iterations;i++) {
+		node = trains;
+		while(node != NULL) {
+			int plslen = node->pulses[node->length-1]/PULSE_DIV;
+			for(x=0;x<nrstats;x++) {
+				struct protocol_t *protocol = stats[x].protocol;
+				unsigned long a = allocs;
+				uint64_t t = uv_hrtime();
+
+				if(protocol_parse_code(protocol, node->pulses, node->length, plslen, node->hwtype) == 0) {
+					struct JsonNode *json = protocol_create_message(protocol, NULL);
+					if(json != NULL) {
+						json_delete(json);
+					}
+					stats[x].decoded++;
+					nrdecoded++;
+				}
+
+				stats[x].time += uv_hrtime() - t;
+				stats[x].allocs += allocs - a;
+				stats[x].calls++;
+			}
+			nrtrains++;
+			node = node->next;
+		}
+	}
+	elapsed = uv_hrtime() - start;
+
+	printf("replayed %lu pulse trains in %.3f seconds\n", nrtrains, (double)elapsed/1e9);
+	printf("%.0f trains/second, %lu decoded messages\n", (elapsed > 0) ? (double)nrtrains/((double)elapsed/1e9) : 0.0, nrdecoded);
+#ifdef __GLIBC__
+	printf("%lu allocations, %.1f per pulse train\n", allocs - start_allocs, (nrtrains > 0) ? (double)(allocs - start_allocs)/nrtrains : 0.0);
+#endif
+	printf("\n%-24s %10s %10s %12s %12s\n", "protocol", "calls", "decoded", "avg ns", "allocs");
+	for(x=0;x<nrstats;x++) {
+		printf("%-24s %10lu %10lu %12.0f %12lu\n",
+			stats[x].protocol->id, stats[x].calls, stats[x].decoded,
+			(double)stats[x].time/stats[x].calls, stats[x].allocs);
+	}
+}
+
+#define BENCH_SERIES	16
+
+/*
+ * Stores values of a number of devices in a temporary
+ * history root and scans them back, raw and per hour.
+ */
+static int history_bench(int values) {
+	struct JsonNode *jsend = NULL, *jvalues = NULL, *jchild = NULL;
+	struct dirent *file = NULL;
+	struct stat st;
+	char root[] = "/tmp/pilight-bench-XXXXXX", device[32];
+	double number[BENCH_SERIES];
+	unsigned long nr = 0, bytes = 0;
+	uint64_t start = 0, elapsed = 0;
+	int64_t ts = 1500000000;
+	int i = 0, x = 0, step = 0;
+	DIR *d = NULL;
+
+	if(mkdtemp(root) == NULL || history_init(root) != 0) {
+		logprintf(LOG_ERR, "cannot create a history root in /tmp");
+		return -1;
+	}
+
+	for(x=0;x<BENCH_SERIES;x++) {
+		number[x] = 20.0;
+	}
+
+	start = uv_hrtime();
+	for(i=0;i<values/BENCH_SERIES;i++) {
+		ts += 60;
+		for(x=0;x<BENCH_SERIES;x++) {
+			snprintf(device, sizeof(device), "bench%d", x);
+			/* Temperature like values with a tenth of a degree */
+			number[x] = round((number[x]+((rand()%3)-1)*0.1)*10)/10;
+			history_add(device, "temperature", ts, number[x]);
+			nr++;
+		}
+	}
+	history_gc();
+	elapsed = uv_hrtime() - start;
+
+	printf("stored %lu values in %.3f seconds\n", nr, (double)elapsed/1e9);
+	printf("%.0f values/second\n", (elapsed > 0) ? (double)nr/((double)elapsed/1e9) : 0.0);
+
+	if((d = opendir(root)) != NULL) {
+		while((file = readdir(d)) != NULL) {
+			char path[strlen(root)+strlen(file->d_name)+2];
+			snprintf(path, sizeof(path), "%s/%s", root, file->d_name);
+			if(file->d_name[0] != '.' && stat(path, &st) == 0) {
+				bytes += st.st_size;
+			}
+		}
+		closedir(d);
+	}
+	printf("%lu bytes on disk, %.2f bytes per value\n", bytes, (nr > 0) ? (double)bytes/nr : 0.0);
+
+	history_init(root);
+	for(step=0;step<=3600;step+=3600) {
+		nr = 0;
+		start = uv_hrtime();
+		for(x=0;x<BENCH_SERIES;x++) {
+			snprintf(device, sizeof(device), "bench%d", x);
+			if((jsend = history_print(device, "temperature", 0, ts, step)) != NULL) {
+				if((jvalues = json_find_member(jsend, "values")) != NULL &&
+				   (jchild = json_find_member(jvalues, "temperature")) != NULL) {
+					jchild = json_first_child(jchild);
+					while(jchild) {
+						nr++;
+						jchild = jchild->next;
+					}
+				}
+				json_delete(jsend);
+			}
+		}
+		elapsed = uv_hrtime() - start;
+		printf("scanned %lu %s values in %.3f seconds, %.0f values/second\n", nr,
+			(step == 0) ? "raw" : "hourly", (double)elapsed/1e9, (elapsed > 0) ? (double)nr/((double)elapsed/1e9) : 0.0);
+	}
+	history_gc();
+
+	if((d = opendir(root)) != NULL) {
+		while((file = readdir(d)) != NULL) {
+			char path[strlen(root)+strlen(file->d_name)+2];
+			snprintf(path, sizeof(path), "%s/%s", root, file->d_name);
+			if(file->d_name[0] != '.') {
+				unlink(path);
+			}
+		}
+		closedir(d);
+	}
+	rmdir(root);
+
+	return 0;
+}
+
+/*
+ * Converts timestamps to local time in a couple of
+ * timezones. First in steps of a minute, like the
+ * datetime protocol and rules do, then at random
+ * moments spread over ten years.
+ */
+static int datetime_bench(int conversions) {
+	char *zones[] = { "Europe/Amsterdam", "America/New_York", "Australia/Sydney", "Asia/Tokyo", "UTC" };
+	int nrzones = sizeof(zones)/sizeof(zones[0]);
+	uint64_t start = 0, elapsed = 0;
+	time_t t = 1500000000;
+	struct tm tm;
+	int i = 0, random = 0;
+
+	datetime_init();
+	memset(&tm, 0, sizeof(struct tm));
+
+	for(random=0;random<=1;random++) {
+		start = uv_hrtime();
+		for(i=0;i<conversions;i++) {
+			if(random == 1) {
+				t = 1500000000 + (time_t)(rand()%(10*365*24*60))*60;
+			} else {
+				t += 60;
+			}
+			if(localtime_l(t, &tm, zones[i%nrzones]) != 0) {
+				logprintf(LOG_ERR, "cannot convert %ld to %s", (long)t, zones[i%nrzones]);
+				return -1;
+			}
+		}
+		elapsed = uv_hrtime() - start;
+		printf("converted %d %s timestamps in %.3f seconds, %.0f conversions/second\n", conversions,
+			(random == 0) ? "sequential" : "random", (double)elapsed/1e9, (elapsed > 0) ? (double)conversions/((double)elapsed/1e9) : 0.0);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	memcpy((void *)&pth_main_id, &pth_cur_id, sizeof(uv_thread_t));
+
+	atomicinit();
+	struct options_t *options = NULL;
+	char *configtmp = CONFIG_FILE, *file = NULL;
+	int help = 0, iterations = 1, ret = EXIT_FAILURE;
+
+	gc_attach(main_gc);
+
+	/* Catch all exit signals for gc */
+	gc_catch();
+
+	if((progname = MALLOC(14)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(progname, "pilight-bench");
+
+	log_shell_enable();
+	log_file_disable();
+	log_level_set(LOG_NOTICE);
+
+	options_add(&options, "H", "help", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "V", "version", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "C", "config", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "R", "replay", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "N", "iterations", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "[0-9]+");
+	options_add(&options, "T", "history", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "[0-9]+");
+	options_add(&options, "D", "datetime", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "[0-9]+");
+	options_add(&options, "Ls", "storage-root", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "Ll", "lua-root", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
+
+	if(options_parse(options, argc, argv, 1) == -1) {
+		help = 1;
+	}
+
+	if(options_exists(options, "H") == 0 || help == 1 ||
+	   (options_exists(options, "R") != 0 && options_exists(options, "T") != 0 &&
+	    options_exists(options, "D") != 0)) {
+		printf("Usage: %s [options]\n", progname);
+		printf("\t -H  --help\t\t\tdisplay usage summary\n");
+		printf("\t -V  --version\t\t\tdisplay version\n");
+		printf("\t -C  --config\t\t\tconfig file\n");
+		printf("\t -R  --replay=xxxx\t\tcapture file to replay\n");
+		printf("\t -N  --iterations=xxxx\t\tnumber of times to replay the capture\n");
+		printf("\t -T  --history=xxxx\t\tnumber of values to store in the history\n");
+		printf("\t -D  --datetime=xxxx\t\tnumber of local time conversions to do\n");
+		printf("\t -Ls --storage-root=xxxx\tlocation of the storage lua modules\n");
+		printf("\t -Ll --lua-root=xxxx\t\tlocation of the plain lua modules\n");
+		goto close;
+	}
+
+	if(options_exists(options, "V") == 0) {
+		printf("%s v%s\n", progname, PILIGHT_VERSION);
+		goto close;
+	}
+
+	if(options_exists(options, "T") == 0) {
+		int values = 0;
+		options_get_number(options, "T", &values);
+		if(history_bench(values) == 0) {
+			ret = EXIT_SUCCESS;
+		}
+		goto close;
+	}
+
+	if(options_exists(options, "D") == 0) {
+		int conversions = 0;
+		options_get_number(options, "D", &conversions);
+		if(datetime_bench(conversions) == 0) {
+			ret = EXIT_SUCCESS;
+		}
+		goto close;
+	}
+
+	if(options_exists(options, "C") == 0) {
+		options_get_string(options, "C", &configtmp);
+	}
+
+	options_get_string(options, "R", &file);
+
+	if(options_exists(options, "N") == 0) {
+		options_get_number(options, "N", &iterations);
+		if(iterations <= 0) {
+			iterations = 1;
+		}
+	}
+
+	if(options_exists(options, "Ls") == 0) {
+		char *arg = NULL;
+		options_get_string(options, "Ls", &arg);
+		if(config_root(arg) == -1) {
+			logprintf(LOG_ERR, "%s is not valid storage lua modules path", arg);
+			goto close;
+		}
+	}
+
+	if(options_exists(options, "Ll") == 0) {
+		options_get_string(options, "Ll", &lua_root);
+	}
+
+	{
+		int len = strlen(lua_root)+strlen("lua/?/?.lua")+1;
+		char *lua_path = MALLOC(len);
+
+		if(lua_path == NULL) {
+			OUT_OF_MEMORY
+		}
+
+		plua_init();
+
+		memset(lua_path, '\0', len);
+		snprintf(lua_path, len, "%s/?/?.lua", lua_root);
+		plua_package_path(lua_path);
+
+		memset(lua_path, '\0', len);
+		snprintf(lua_path, len, "%s/?.lua", lua_root);
+		plua_package_path(lua_path);
+
+		FREE(lua_path);
+	}
+
+	if(config_set_file(configtmp) == EXIT_FAILURE) {
+		goto close;
+	}
+
+	eventpool_init(EVENTPOOL_NO_THREADS);
+
+	protocol_init();
+	hardware_init();
+	config_init();
+
+	struct lua_state_t *state = plua_get_free_state();
+	if(config_read(state->L, CONFIG_SETTINGS | CONFIG_HARDWARE) != EXIT_SUCCESS) {
+		assert(plua_check_stack(state->L, 0) == 0);
+		plua_clear_state(state);
+		goto close;
+	}
+	assert(plua_check_stack(state->L, 0) == 0);
+	plua_clear_state(state);
+
+	/*
+	 * Only measure the decoding itself
+	 */
+	log_level_set(LOG_ERR);
+
+	if(load(file) <= 0) {
+		logprintf(LOG_ERR, "no pulse trains to replay in %s", file);
+		goto close;
+	}
+
+	replay(iterations);
+	ret = EXIT_SUCCESS;
+
+close:
+	options_delete(options);
+	main_loop1();
+	main_gc();
+
+	return ret;
+}
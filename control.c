@@ -28,6 +28,7 @@
 #include "libs/pilight/core/ssdp.h"
 #include "libs/pilight/core/dso.h"
 #include "libs/pilight/core/gc.h"
+#include "libs/pilight/core/atom.h"
 #include "libs/pilight/lua_c/lua.h"
 
 #include "libs/pilight/config/config.h"
@@ -50,7 +51,7 @@ int main(int argc, char **argv) {
 	char *device = NULL, *state = NULL, *values = NULL;
 	char *server = NULL, *configtmp = CONFIG_FILE;
 	int has_values = 0, sockfd = 0, hasconfarg = 0;
-	int port = 0, showhelp = 0, showversion = 0;
+	int port = 0, showhelp = 0, showversion = 0, showprofile = 0;
 
 	log_file_disable();
 	log_shell_enable();
@@ -73,6 +74,7 @@ int main(int argc, char **argv) {
 	options_add(&options, "C", "config", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "I", "instance", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "Ls", "storage-root", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "[0-9]{1,4}");
+	options_add(&options, "p", "profile", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
 
 	if(options_parse(options, argc, argv, 1) == -1) {
 		printf("Usage: %s -l location -d device -s state\n", progname);
@@ -88,6 +90,10 @@ int main(int argc, char **argv) {
 		showversion = 1;
 	}
 
+	if(options_exists(options, "p") == 0) {
+		showprofile = 1;
+	}
+
 	if(options_exists(options, "d") == 0) {
 		options_get_string(options, "d", &device);
 	}
@@ -142,11 +148,12 @@ int main(int argc, char **argv) {
 		printf("\t -Ls --storage-root=xxxx\tlocation of storage lua modules\n");
 		printf("\t -Ll --lua-root=xxxx\t\tlocation of the plain lua modules\n");
 		printf("\t\t\t\t\t-v dimlevel=10\n");
+		printf("\t -p --profile\t\t\tshow the time spent in each lua module\n");
 		goto close;
 	}
 
-	if(device == NULL || state == NULL ||
-	   strlen(device) == 0 || strlen(state) == 0) {
+	if(showprofile == 0 && (device == NULL || state == NULL ||
+	   strlen(device) == 0 || strlen(state) == 0)) {
 		printf("Usage: %s -d device -s state\n", progname);
 		goto close;
 	}
@@ -213,6 +220,41 @@ int main(int argc, char **argv) {
 		goto close;
 	}
 
+	if(showprofile == 1) {
+		socket_write(sockfd, "{\"action\":\"request profile\"}");
+		if(socket_read(sockfd, &recvBuff, 0) == 0 && (json = json_decode(recvBuff)) != NULL) {
+			if(json_find_string(json, "message", &message) == 0 &&
+			   strcmp(message, "profile") == 0 &&
+			   (tmp = json_find_member(json, "profile")) != NULL) {
+				struct JsonNode *jchilds = json_first_child(tmp);
+				char *module = NULL, *method = NULL;
+				double calls = 0.0, errors = 0.0, total = 0.0, max = 0.0, avg = 0.0, memory = 0.0;
+
+				printf("%-32s %-20s %8s %6s %12s %10s %10s %10s\n",
+					"module", "method", "calls", "errors", "total (ms)", "max (ms)", "avg (ms)", "mem (kB)");
+				while(jchilds) {
+					if(json_find_string(jchilds, "module", &module) == 0 &&
+					   json_find_string(jchilds, "method", &method) == 0) {
+						json_find_number(jchilds, "calls", &calls);
+						json_find_number(jchilds, "errors", &errors);
+						json_find_number(jchilds, "total", &total);
+						json_find_number(jchilds, "max", &max);
+						json_find_number(jchilds, "avg", &avg);
+						json_find_number(jchilds, "memory", &memory);
+						printf("%-32s %-20s %8.0f %6.0f %12.3f %10.3f %10.3f %10.1f\n",
+							module, method, calls, errors, total/1000, max/1000, avg/1000, memory/1024);
+					}
+					jchilds = jchilds->next;
+				}
+				tmp = NULL;
+			} else {
+				logprintf(LOG_ERR, "failed to request the lua profile");
+			}
+			json_delete(json);
+		}
+		goto close;
+	}
+
 	json = json_mkobject();
 	json_append_member(json, "action", json_mkstring("request config"));
 	output = json_stringify(json, NULL);
@@ -221,8 +263,7 @@ int main(int argc, char **argv) {
 	json_delete(json);
 
 	if(socket_read(sockfd, &recvBuff, 0) == 0) {
-		if(json_validate(recvBuff) == true) {
-			json = json_decode(recvBuff);
+		if((json = json_decode(recvBuff)) != NULL) {
 			if(json_find_string(json, "message", &message) == 0) {
 				if(strcmp(message, "config") == 0) {
 					struct JsonNode *jconfig = NULL;
@@ -354,6 +395,7 @@ close:
 	log_gc();
 	threads_gc();
 	gc_clear();
+	atom_gc();
 	FREE(progname);
 	xfree();
 
@@ -58,10 +58,17 @@
 #include "libs/pilight/core/firmware.h"
 #include "libs/pilight/core/proc.h"
 #include "libs/pilight/core/ntp.h"
+#include "libs/pilight/core/http.h"
+#include "libs/pilight/core/capture.h"
+#include "libs/pilight/core/shm.h"
+#include "libs/pilight/core/history.h"
+#include "libs/pilight/core/atom.h"
+#include "libs/pilight/core/w1.h"
 #include "libs/pilight/config/config.h"
 #include "libs/pilight/config/hardware.h"
 #include "libs/pilight/lua_c/lua.h"
 #include "libs/pilight/lua_c/table.h"
+#include "libs/pilight/lua_c/profile.h"
 
 #ifdef EVENTS
 	#include "libs/pilight/events/events.h"
@@ -79,6 +86,8 @@
 #include "libs/pilight/config/devices.h"
 #include "libs/pilight/config/settings.h"
 #include "libs/pilight/config/gui.h"
+#include "libs/pilight/config/coalesce.h"
+#include "libs/pilight/config/sync.h"
 
 static uv_signal_t **signal_req = NULL;
 static int signals[5] = { SIGINT, SIGQUIT, SIGTERM, SIGABRT, SIGTSTP };
@@ -115,11 +124,79 @@ typedef struct sendqueue_t {
 	int code[MAXPULSESTREAMLENGTH];
 	int length;
 	char uuid[UUID_LENGTH];
+	/* Protocol, uuid and id values of the device */
+	char *dest;
+	int priority;
+	int band;
+	unsigned long airtime;
+	uint64_t queued;
+	uint64_t deadline;
+	/* Order in which frames were queued */
+	unsigned long seq;
 	struct sendqueue_t *next;
 } sendqueue_t;
 
 static struct sendqueue_t *sendqueue;
-static struct sendqueue_t *sendqueue_head;
+
+/*
+ * Frames are sent in order of their deadline. The
+ * deadline is the moment a frame was queued plus the
+ * budget of its priority. User actions therefore go
+ * before rules and rules before retransmissions, while
+ * a lower priority frame that waited long enough still
+ * gets its turn. Frames for the same device are never
+ * reordered, so a frame never gets a deadline earlier
+ * than the frames pending for its device.
+ */
+#define SENDQUEUE_USER				0
+#define SENDQUEUE_RULE				1
+#define SENDQUEUE_RETRANSMIT	2
+#define SENDQUEUE_PRIORITIES	3
+
+static unsigned int sendqueue_budget[SENDQUEUE_PRIORITIES] = { 0, 500, 2000 };
+
+/*
+ * The hardware modules leave this many milliseconds
+ * between two frames on top of their airtime.
+ */
+#define SENDQUEUE_GAP					100
+
+/*
+ * Airtime is tracked per band with a credit that
+ * refills at the configured duty cycle, up to the
+ * amount of airtime allowed in one hour.
+ */
+#define SENDQUEUE_BAND433			0
+#define SENDQUEUE_BAND868			1
+#define SENDQUEUE_BANDS				2
+#define SENDQUEUE_DUTY_WINDOW	3600000
+
+typedef struct sendqueue_band_t {
+	char *name;
+	double duty;
+	double credit;
+	uint64_t stamp;
+	int limited;
+	unsigned long long airtime;
+} sendqueue_band_t;
+
+static struct sendqueue_band_t sendqueue_bands[SENDQUEUE_BANDS] = {
+	{ "433", 100.0, -1, 0, 0, 0 },
+	{ "868", 100.0, -1, 0, 0, 0 }
+};
+
+static struct {
+	unsigned long sent;
+	unsigned long merged;
+	unsigned long dropped;
+	unsigned long sent_priority[SENDQUEUE_PRIORITIES];
+	uint64_t latency;
+	uint64_t latency_max;
+} sendqueue_stats;
+
+/* The sender is quiet until this moment */
+static uint64_t sendqueue_idle = 0;
+static unsigned long sendqueue_seq = 0;
 
 typedef struct recvqueue_t {
 	int raw[MAXPULSESTREAMLENGTH];
@@ -187,13 +264,23 @@ static int sockfd = 0;
 static pthread_t logpth;
 /* While loop conditions */
 static unsigned short main_loop = 1;
-/* Reset repeats after a certain amount of time */
-static struct timeval tv;
+/* Write received pulse trains to this capture file */
+static struct capture_t *capture = NULL;
 /* Are we running standalone */
 static int standalone = 0;
 /* Do we need to connect to a master server:port? */
 static char *master_server = NULL;
 static int master_port = 0;
+/* Do we tell our nodes which received codes to forward */
+static int node_filter = 1;
+/*
+ * With protocol-prune only the protocols of our devices and
+ * those in protocol-listen decode received codes, unless a
+ * client like pilight-receive listens along.
+ */
+static int protocol_prune = 0;
+static struct protocols_t *listeners = NULL;
+static volatile int nrreceivers = 0;
 
 static int adhoc_pending = 0;
 static char *configtmp = NULL;
@@ -243,6 +330,22 @@ static void *reason_socket_send_free(void *param) {
 	return NULL;
 }
 
+static void receivers_update(void) {
+	struct clients_t *tmp_clients = clients;
+	int nr = 0;
+
+	while(tmp_clients) {
+		if(tmp_clients->receiver == 1 && tmp_clients->forward == 0) {
+			nr++;
+		}
+		tmp_clients = tmp_clients->next;
+	}
+	if(protocol_prune == 1 && (nr > 0) != (nrreceivers > 0)) {
+		logprintf(LOG_DEBUG, "%s all protocols for receivers", (nr > 0) ? "enabled" : "disabled");
+	}
+	nrreceivers = nr;
+}
+
 static void client_remove(int id) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -263,9 +366,75 @@ static void client_remove(int id) {
 			break;
 		}
 	}
+	receivers_update();
 }
 
-static void broadcast_queue(char *protoname, struct JsonNode *json, enum origin_t origin) {
+/* Called with the recvqueue lock held */
+static void listeners_gc(void) {
+	struct protocols_t *tmp = NULL;
+
+	while(listeners) {
+		tmp = listeners;
+		listeners = listeners->next;
+		FREE(tmp);
+	}
+}
+
+/*
+ * Selects the protocols that are used by a device or
+ * named in protocol-listen. Protocols are matched like
+ * those of a device in the config.
+ */
+static void listeners_build(void) {
+	struct protocols_t *pnode = protocols, *node = NULL, *tail = NULL;
+	struct lua_state_t *state = NULL;
+	char *name = NULL;
+	int match = 0, nr = 0, total = 0, i = 0;
+
+	if(protocol_prune == 0) {
+		return;
+	}
+
+	state = plua_get_free_state();
+	pthread_mutex_lock(&recvqueue_lock);
+	listeners_gc();
+	while(pnode) {
+		total++;
+		match = devices_protocol_used(pnode->listener);
+
+		i = 0;
+		while(match == 0 && config_setting_get_string(state->L, "protocol-listen", i++, &name) == 0) {
+			if(protocol_device_exists(pnode->listener, name) == 0) {
+				match = 1;
+			}
+			FREE(name);
+		}
+
+		if(match == 1) {
+			if((node = MALLOC(sizeof(struct protocols_t))) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+			node->listener = pnode->listener;
+			node->name = NULL;
+			node->next = NULL;
+			if(tail == NULL) {
+				listeners = node;
+			} else {
+				tail->next = node;
+			}
+			tail = node;
+			nr++;
+		}
+		pnode = pnode->next;
+	}
+	pthread_mutex_unlock(&recvqueue_lock);
+	assert(plua_check_stack(state->L, 0) == 0);
+	plua_clear_state(state);
+
+	logprintf(LOG_INFO, "%d of %d protocols decode received codes", nr, total);
+}
+
+static void broadcast_enqueue(char *protoname, struct JsonNode *json, enum origin_t origin) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	if(main_loop == 1) {
@@ -309,6 +478,25 @@ static void broadcast_queue(char *protoname, struct JsonNode *json, enum origin_
 	}
 }
 
+static void broadcast_coalesced(char *protoname, struct JsonNode *json) {
+	broadcast_enqueue(protoname, json, RECEIVER);
+}
+
+static void broadcast_queue(char *protoname, struct JsonNode *json, enum origin_t origin) {
+	/*
+	 * Received updates are coalesced per device
+	 * before they reach the clients and rules.
+	 */
+	if(origin == RECEIVER) {
+		if(coalesce_message(protoname, json) == 1) {
+			return;
+		}
+	} else {
+		coalesce_forget(protoname, json);
+	}
+	broadcast_enqueue(protoname, json, origin);
+}
+
 void *broadcast(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -482,8 +670,16 @@ void *broadcast(void *param) {
 						}
 						tmp_clients = tmp_clients->next;
 					}
+					if(strcmp(out, "{}") != 0 && nrchilds > 1) {
+						shm_publish_message(bcqueue->protoname, bcqueue->jmessage);
+					}
 
-					if(pilight.runmode == ADHOC && sockfd > 0) {
+					/*
+					 * Codes that match none of the devices of
+					 * our master aren't forwarded to it.
+					 */
+					if(pilight.runmode == ADHOC && sockfd > 0 &&
+					   (bcqueue->origin != RECEIVER || devices_filter_match(bcqueue->protoname, bcqueue->jmessage) == 0)) {
 						struct JsonNode *jupdate = json_decode(internal);
 						json_append_member(jupdate, "action", json_mkstring("update"));
 						char *ret = json_stringify(jupdate, NULL);
@@ -554,32 +750,11 @@ static void receive_queue(int *raw, int rawlen, int plslen, int hwtype) {
 static void receiver_create_message(protocol_t *protocol) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	if(protocol->message != NULL) {
-		char *valid = json_stringify(protocol->message, NULL);
-		json_delete(protocol->message);
-		if(valid != NULL && json_validate(valid) == true) {
-			struct JsonNode *jmessage = json_mkobject();
-
-			json_append_member(jmessage, "message", json_decode(valid));
-			json_append_member(jmessage, "origin", json_mkstring("receiver"));
-			json_append_member(jmessage, "protocol", json_mkstring(protocol->id));
-			if(strlen(pilight_uuid) > 0) {
-				json_append_member(jmessage, "uuid", json_mkstring(pilight_uuid));
-			}
-			if(protocol->repeats > -1) {
-				json_append_member(jmessage, "repeats", json_mknumber(protocol->repeats, 0));
-			}
-			char *output = json_stringify(jmessage, NULL);
-			struct JsonNode *json = json_decode(output);
-			broadcast_queue(protocol->id, json, RECEIVER);
-			json_free(output);
-			json_delete(json);
-			json = NULL;
-			json_delete(jmessage);
-		}
-		json_free(valid);
+	struct JsonNode *json = protocol_create_message(protocol, pilight_uuid);
+	if(json != NULL) {
+		broadcast_queue(protocol->id, json, RECEIVER);
+		json_delete(json);
 	}
-	protocol->message = NULL;
 }
 
 static void receive_parse_api(struct JsonNode *code, int hwtype) {
@@ -629,42 +804,15 @@ void *receive_parse_code(void *param) {
 			struct protocol_t *protocol = NULL;
 			struct protocols_t *pnode = protocols;
 
+			if(protocol_prune == 1 && nrreceivers == 0) {
+				pnode = listeners;
+			}
+
 			while(pnode != NULL && main_loop) {
 				protocol = pnode->listener;
 
-				if((protocol->hwtype == recvqueue->hwtype || protocol->hwtype == -1 || recvqueue->hwtype == -1) &&
-				   (protocol->parseCode != NULL && protocol->validate != NULL)) {
-
-					if(recvqueue->rawlen < MAXPULSESTREAMLENGTH) {
-						protocol->raw = recvqueue->raw;
-					}
-					protocol->rawlen = recvqueue->rawlen;
-
-					if(protocol->validate() == 0) {
-						logprintf(LOG_DEBUG, "possible %s protocol", protocol->id);
-						gettimeofday(&tv, NULL);
-						if(protocol->first > 0) {
-							protocol->first = protocol->second;
-						}
-						protocol->second = 1000000 * (unsigned int)tv.tv_sec + (unsigned int)tv.tv_usec;
-						if(protocol->first == 0) {
-							protocol->first = protocol->second;
-						}
-
-						/* Reset # of repeats after a certain delay */
-						if(((int)protocol->second-(int)protocol->first) > 500000) {
-							protocol->repeats = 0;
-						}
-
-						protocol->repeats++;
-						if(protocol->parseCode != NULL) {
-							logprintf(LOG_DEBUG, "recevied pulse length of %d", recvqueue->plslen);
-							logprintf(LOG_DEBUG, "caught minimum # of repeats %d of %s", protocol->repeats, protocol->id);
-							logprintf(LOG_DEBUG, "called %s parseRaw()", protocol->id);
-							protocol->parseCode();
-							receiver_create_message(protocol);
-						}
-					}
+				if(protocol_parse_code(protocol, recvqueue->raw, recvqueue->rawlen, recvqueue->plslen, recvqueue->hwtype) == 0) {
+					receiver_create_message(protocol);
 				}
 				pnode = pnode->next;
 			}
@@ -681,9 +829,294 @@ void *receive_parse_code(void *param) {
 	return (void *)NULL;
 }
 
+static int sendqueue_priority(enum origin_t origin) {
+	switch((int)origin) {
+		case SENDER:
+		case MASTER:
+		case ORIGIN_WEBSERVER:
+			return SENDQUEUE_USER;
+		case ORIGIN_ACTION:
+		case RULE:
+			return SENDQUEUE_RULE;
+		default:
+			return SENDQUEUE_RETRANSMIT;
+	}
+}
+
+/* Only called before the sender is started */
+static void sendqueue_set_duty(int band, double duty) {
+	sendqueue_bands[band].duty = duty;
+	sendqueue_bands[band].credit = -1;
+}
+
+/*
+ * Returns the airtime a band can use right
+ * now in microseconds. Called with the lock held.
+ */
+static double sendqueue_credit(struct sendqueue_band_t *band, uint64_t now, double *max) {
+	*max = (band->duty/100)*SENDQUEUE_DUTY_WINDOW*1000;
+	if(band->credit < 0) {
+		band->credit = *max;
+	} else if(now > band->stamp) {
+		band->credit += (double)(now-band->stamp)*1000*(band->duty/100);
+		if(band->credit > *max) {
+			band->credit = *max;
+		}
+	}
+	band->stamp = now;
+	return band->credit;
+}
+
+static void sendqueue_unlink(struct sendqueue_t *node, struct sendqueue_t *prev) {
+	if(prev == NULL) {
+		sendqueue = node->next;
+	} else {
+		prev->next = node->next;
+	}
+	node->next = NULL;
+	sendqueue_number--;
+}
+
+/*
+ * Takes the first frame in deadline order that can be
+ * sent right now out of the queue. When all frames have
+ * to wait for the hardware or their band, the number of
+ * milliseconds until the first can go is returned in
+ * wait. Called with the lock held.
+ */
+static struct sendqueue_t *sendqueue_take(uint64_t now, uint64_t *wait) {
+	struct sendqueue_t *node = sendqueue, *prev = NULL, *tmp = NULL;
+	double credit = 0.0, max = 0.0, need = 0.0;
+	uint64_t w = 0;
+
+	*wait = SENDQUEUE_DUTY_WINDOW;
+	while(node) {
+		/*
+		 * A frame waits as long as an earlier frame
+		 * for the same device is still pending.
+		 */
+		tmp = sendqueue;
+		while(tmp != node && strcmp(tmp->dest, node->dest) != 0) {
+			tmp = tmp->next;
+		}
+		if(tmp != node) {
+			prev = node;
+			node = node->next;
+			continue;
+		}
+		if(node->band == -1) {
+			break;
+		}
+		/*
+		 * Wait until the previous frame left the
+		 * hardware, so frames are no longer dropped
+		 * by the buffers of the hardware modules.
+		 */
+		if(now < sendqueue_idle) {
+			if(sendqueue_idle-now < *wait) {
+				*wait = sendqueue_idle-now;
+			}
+			prev = node;
+			node = node->next;
+			continue;
+		}
+		struct sendqueue_band_t *band = &sendqueue_bands[node->band];
+		credit = sendqueue_credit(band, now, &max);
+		need = ((double)node->airtime < max) ? (double)node->airtime : max;
+		if(credit >= need) {
+			band->limited = 0;
+			break;
+		}
+		if(band->limited == 0) {
+			logprintf(LOG_NOTICE, "%s band reached its duty cycle of %.1f%%, delaying frames", band->name, band->duty);
+			band->limited = 1;
+		}
+		w = (uint64_t)((need-credit)/(band->duty*10))+1;
+		if(w < *wait) {
+			*wait = w;
+		}
+		prev = node;
+		node = node->next;
+	}
+
+	if(node != NULL) {
+		sendqueue_unlink(node, prev);
+
+		if(node->band > -1) {
+			sendqueue_bands[node->band].credit -= node->airtime;
+			sendqueue_bands[node->band].airtime += node->airtime;
+		}
+
+		sendqueue_stats.sent++;
+		sendqueue_stats.sent_priority[node->priority]++;
+		sendqueue_stats.latency += now-node->queued;
+		if(now-node->queued > sendqueue_stats.latency_max) {
+			sendqueue_stats.latency_max = now-node->queued;
+		}
+	}
+	return node;
+}
+
+/*
+ * Inserts a frame after all frames with the same
+ * or an earlier deadline. The deadline is moved up
+ * to that of the last frame pending for the same
+ * device first. Called with the lock held.
+ */
+static void sendqueue_insert(struct sendqueue_t *mnode) {
+	struct sendqueue_t *node = sendqueue, *prev = NULL;
+
+	while(node) {
+		if(strcmp(node->dest, mnode->dest) == 0 && node->deadline > mnode->deadline) {
+			mnode->deadline = node->deadline;
+		}
+		node = node->next;
+	}
+
+	node = sendqueue;
+	while(node && node->deadline <= mnode->deadline) {
+		prev = node;
+		node = node->next;
+	}
+	mnode->next = node;
+	if(prev == NULL) {
+		sendqueue = mnode;
+	} else {
+		prev->next = mnode;
+	}
+	sendqueue_number++;
+}
+
+static void sendqueue_free(struct sendqueue_t *node) {
+	if(node->message != NULL) {
+		FREE(node->message);
+	}
+	if(node->settings != NULL) {
+		FREE(node->settings);
+	}
+	if(node->dest != NULL) {
+		FREE(node->dest);
+	}
+	FREE(node->protoname);
+	FREE(node);
+}
+
+/*
+ * The destination of a frame is the protocol, the
+ * uuid and the values of the id options of the device.
+ */
+static char *sendqueue_dest(struct protocol_t *protocol, char *uuid, struct JsonNode *jcode) {
+	struct options_t *opt = protocol->options;
+	struct JsonNode *jid = NULL;
+	char *dest = NULL, *value = NULL;
+	int len = strlen(protocol->id)+strlen(uuid)+2;
+
+	if((dest = MALLOC(len)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	snprintf(dest, len, "%s %s", protocol->id, uuid);
+
+	while(opt) {
+		if(opt->conftype == DEVICES_ID && (jid = json_find_member(jcode, opt->name)) != NULL) {
+			value = json_stringify(jid, NULL);
+			len += strlen(opt->name)+strlen(value)+2;
+			if((dest = REALLOC(dest, len)) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+			strcat(dest, " ");
+			strcat(dest, opt->name);
+			strcat(dest, "=");
+			strcat(dest, value);
+			json_free(value);
+		}
+		opt = opt->next;
+	}
+
+	return dest;
+}
+
+static int sendqueue_equal(struct sendqueue_t *a, struct sendqueue_t *b) {
+	if(a->length != b->length ||
+		 memcmp(a->code, b->code, sizeof(int)*a->length) != 0) {
+		return -1;
+	}
+	if(a->settings == NULL || b->settings == NULL) {
+		return (a->settings == b->settings) ? 0 : -1;
+	}
+	return (strcmp(a->settings, b->settings) == 0) ? 0 : -1;
+}
+
+/*
+ * A frame equal to the last one pending for the same
+ * device is merged into it. The pending frame
+ * takes over the most urgent priority and deadline of
+ * the two. An equal frame with other frames for the same
+ * destination queued after it is dropped instead, so the
+ * new frame keeps its place after those. Called with the
+ * lock held.
+ */
+static int sendqueue_merge(struct sendqueue_t *mnode) {
+	struct sendqueue_t *node = sendqueue, *prev = NULL;
+	struct sendqueue_t *last = NULL, *lprev = NULL;
+	struct sendqueue_t *dup = NULL, *dprev = NULL;
+
+	while(node) {
+		if(strcmp(node->dest, mnode->dest) == 0) {
+			if(last == NULL || node->seq > last->seq) {
+				last = node;
+				lprev = prev;
+			}
+			if(sendqueue_equal(node, mnode) == 0) {
+				dup = node;
+				dprev = prev;
+			}
+		}
+		prev = node;
+		node = node->next;
+	}
+	if(dup == NULL) {
+		return -1;
+	}
+
+	if(dup != last) {
+		sendqueue_unlink(dup, dprev);
+		sendqueue_free(dup);
+		sendqueue_stats.merged++;
+		return -1;
+	}
+
+	if(mnode->priority < last->priority) {
+		last->priority = mnode->priority;
+		last->origin = mnode->origin;
+	}
+	if(mnode->deadline < last->deadline) {
+		last->deadline = mnode->deadline;
+		sendqueue_unlink(last, lprev);
+		sendqueue_insert(last);
+	}
+	sendqueue_stats.merged++;
+	return 0;
+}
+
+static void sendqueue_wait(uint64_t ms) {
+	struct timeval tp;
+	struct timespec ts;
+
+	gettimeofday(&tp, NULL);
+	ts.tv_sec = tp.tv_sec + (ms / 1000);
+	ts.tv_nsec = (tp.tv_usec * 1000) + ((ms % 1000) * 1000000);
+	if(ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&sendqueue_signal, &sendqueue_lock, &ts);
+}
+
 void *send_code(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
+	struct sendqueue_t *node = NULL;
+	uint64_t now = 0, wait = 0;
 	int i = 0;
 
 	/* Make sure the pilight sender gets
@@ -701,44 +1134,54 @@ void *send_code(void *param) {
 
 	while(main_loop) {
 		if(sendqueue_number > 0) {
-			pthread_mutex_lock(&sendqueue_lock);
-
-			logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
+			now = uv_hrtime()/1000000;
+			if((node = sendqueue_take(now, &wait)) == NULL) {
+				sendqueue_wait(wait);
+				continue;
+			}
+			if(node->band > -1) {
+				sendqueue_idle = now+(node->airtime/1000)+SENDQUEUE_GAP;
+			}
 
 			sending = 1;
+			pthread_mutex_unlock(&sendqueue_lock);
+
+			logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
 
-			struct protocol_t *protocol = sendqueue->protopt;
+			struct protocol_t *protocol = node->protopt;
 
 			struct JsonNode *message = NULL;
 
-			if(sendqueue->message != NULL && strcmp(sendqueue->message, "{}") != 0) {
-				if(json_validate(sendqueue->message) == true) {
+			if(node->message != NULL && strcmp(node->message, "{}") != 0) {
+				struct JsonNode *jmessage = NULL;
+				if((jmessage = json_decode(node->message)) != NULL) {
 					if(message == NULL) {
 						message = json_mkobject();
 					}
 					json_append_member(message, "origin", json_mkstring("sender"));
 					json_append_member(message, "protocol", json_mkstring(protocol->id));
-					json_append_member(message, "message", json_decode(sendqueue->message));
-					if(strlen(sendqueue->uuid) > 0) {
-						json_append_member(message, "uuid", json_mkstring(sendqueue->uuid));
+					json_append_member(message, "message", jmessage);
+					if(strlen(node->uuid) > 0) {
+						json_append_member(message, "uuid", json_mkstring(node->uuid));
 					}
 					json_append_member(message, "repeat", json_mknumber(1, 0));
 				}
 			}
-			if(sendqueue->settings != NULL && strcmp(sendqueue->settings, "{}") != 0) {
-				if(json_validate(sendqueue->settings) == true) {
+			if(node->settings != NULL && strcmp(node->settings, "{}") != 0) {
+				struct JsonNode *jsettings = NULL;
+				if((jsettings = json_decode(node->settings)) != NULL) {
 					if(message == NULL) {
 						message = json_mkobject();
 					}
-					json_append_member(message, "settings", json_decode(sendqueue->settings));
+					json_append_member(message, "settings", jsettings);
 				}
 			}
 
 			if(protocol->hwtype == RF433 || protocol->hwtype == RF868) {
 				logprintf(LOG_DEBUG, "**** RAW CODE ****");
 				if(log_level_get() >= LOG_DEBUG) {
-					for(i=0;i<sendqueue->length;i++) {
-						printf("%d ", sendqueue->code[i]);
+					for(i=0;i<node->length;i++) {
+						printf("%d ", node->code[i]);
 					}
 					printf("\n");
 				}
@@ -750,44 +1193,35 @@ void *send_code(void *param) {
 				char key[255];
 				memset(&key, 0, 255);
 
-				plua_metatable_set_number(table, "rawlen", sendqueue->length);
+				plua_metatable_set_number(table, "rawlen", node->length);
 				plua_metatable_set_number(table, "txrpt", protocol->txrpt);
 				plua_metatable_set_string(table, "protocol", protocol->id);
 				plua_metatable_set_number(table, "hwtype", protocol->hwtype);
 				plua_metatable_set_string(table, "uuid", "0");
 
-				for(i=0;i<sendqueue->length;i++) {
+				for(i=0;i<node->length;i++) {
 					snprintf(key, 255, "pulses.%d", i+1);
-					plua_metatable_set_number(table, key, sendqueue->code[i]);
+					plua_metatable_set_number(table, key, node->code[i]);
 				}
 
 				eventpool_trigger(REASON_SEND_CODE+10000, reason_send_code_free, table);
 			}
 
 			if(strcmp(protocol->id, "raw") == 0) {
-				int plslen = sendqueue->code[sendqueue->length-1]/PULSE_DIV;
-				receive_queue(sendqueue->code, sendqueue->length, plslen, -1);
+				int plslen = node->code[node->length-1]/PULSE_DIV;
+				receive_queue(node->code, node->length, plslen, -1);
 			}
 
 			if(message != NULL) {
-				broadcast_queue(sendqueue->protoname, message, sendqueue->origin);
+				broadcast_queue(node->protoname, message, node->origin);
 				json_delete(message);
 				message = NULL;
 			}
 
-			struct sendqueue_t *tmp = sendqueue;
-			if(tmp->message != NULL) {
-				FREE(tmp->message);
-			}
-			if(tmp->settings != NULL) {
-				FREE(tmp->settings);
-			}
-			FREE(tmp->protoname);
-			sendqueue = sendqueue->next;
-			FREE(tmp);
-			sendqueue_number--;
+			sendqueue_free(node);
+
+			pthread_mutex_lock(&sendqueue_lock);
 			sending = 0;
-			pthread_mutex_unlock(&sendqueue_lock);
 		} else {
 			pthread_cond_wait(&sendqueue_signal, &sendqueue_lock);
 		}
@@ -800,7 +1234,7 @@ static int send_queue(struct JsonNode *json, enum origin_t origin) {
 	pthread_mutex_lock(&sendqueue_lock);
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	int match = 0, raw[MAXPULSESTREAMLENGTH-1];
+	int match = 0, i = 0, raw[MAXPULSESTREAMLENGTH-1];
 	struct timeval tcurrent;
 	struct clients_t *tmp_clients = NULL;
 	char *uuid = NULL, *buffer = NULL;
@@ -877,18 +1311,17 @@ static int send_queue(struct JsonNode *json, enum origin_t origin) {
 						}
 						gettimeofday(&tcurrent, NULL);
 						mnode->origin = origin;
+						mnode->next = NULL;
 						mnode->id = 1000000 * (unsigned int)tcurrent.tv_sec + (unsigned int)tcurrent.tv_usec;
 						mnode->message = NULL;
 						if(protocol->message != NULL) {
 							char *jsonstr = json_stringify(protocol->message, NULL);
 							json_delete(protocol->message);
-							if(json_validate(jsonstr) == true) {
-								if((mnode->message = MALLOC(strlen(jsonstr)+1)) == NULL) {
-									fprintf(stderr, "out of memory\n");
-									exit(EXIT_FAILURE);
-								}
-								strcpy(mnode->message, jsonstr);
+							if((mnode->message = MALLOC(strlen(jsonstr)+1)) == NULL) {
+								fprintf(stderr, "out of memory\n");
+								exit(EXIT_FAILURE);
 							}
+							strcpy(mnode->message, jsonstr);
 							json_free(jsonstr);
 							protocol->message = NULL;
 						}
@@ -933,15 +1366,29 @@ static int send_queue(struct JsonNode *json, enum origin_t origin) {
 						} else {
 							memset(mnode->uuid, '\0', UUID_LENGTH);
 						}
-						if(sendqueue_number == 0) {
-							sendqueue = mnode;
-							sendqueue_head = mnode;
+						mnode->dest = sendqueue_dest(protocol, mnode->uuid, jcode);
+
+						mnode->airtime = 0;
+						mnode->band = -1;
+						if(protocol->hwtype == RF433 || protocol->hwtype == RF868) {
+							mnode->band = (protocol->hwtype == RF433) ? SENDQUEUE_BAND433 : SENDQUEUE_BAND868;
+							for(i=0;i<mnode->length;i++) {
+								mnode->airtime += (mnode->code[i] > 0) ? mnode->code[i] : 0;
+							}
+							mnode->airtime *= (protocol->txrpt > 0) ? protocol->txrpt : 1;
+						}
+						mnode->priority = sendqueue_priority(origin);
+						mnode->queued = uv_hrtime()/1000000;
+						mnode->deadline = mnode->queued + sendqueue_budget[mnode->priority];
+						mnode->seq = sendqueue_seq++;
+
+						if(sendqueue_merge(mnode) == 0) {
+							sendqueue_free(mnode);
 						} else {
-							sendqueue_head->next = mnode;
-							sendqueue_head = mnode;
+							sendqueue_insert(mnode);
 						}
-						sendqueue_number++;
 					} else {
+						sendqueue_stats.dropped++;
 						logprintf(LOG_ERR, "send queue full");
 						pthread_mutex_unlock(&sendqueue_lock);
 						return -1;
@@ -1167,6 +1614,7 @@ static void socket_parse_data(int i, char *buffer) {
 	struct JsonNode *options = NULL;
 	struct clients_t *tmp_clients = NULL;
 	struct clients_t *client = NULL;
+	struct JsonError jerror;
 	int sd = -1;
 	int addrlen = sizeof(address);
 	char *action = NULL, *media = NULL, *status = NULL;
@@ -1191,11 +1639,10 @@ static void socket_parse_data(int i, char *buffer) {
 		if(strstr(buffer, " HTTP/")) {
 			client_webserver_parse_code(i, buffer);
 			socket_close(sd);
-		} else if(json_validate(buffer) == true) {
+		} else if((json = json_decode_ex(buffer, &jerror)) != NULL) {
 #else
-		if(json_validate(buffer) == true) {
+		if((json = json_decode_ex(buffer, &jerror)) != NULL) {
 #endif
-			json = json_decode(buffer);
 			if((json_find_string(json, "action", &action)) == 0) {
 				tmp_clients = clients;
 				while(tmp_clients) {
@@ -1298,6 +1745,7 @@ static void socket_parse_data(int i, char *buffer) {
 							}
 						}
 					}
+					receivers_update();
 					socket_write(sd, "{\"status\":\"success\"}");
 				} else if(strcmp(action, "send") == 0) {
 					if(send_queue(json, SENDER) == 0) {
@@ -1431,18 +1879,37 @@ static void socket_parse_data(int i, char *buffer) {
 				} else if(strcmp(action, "request config") == 0) {
 					struct JsonNode *jsend = json_mkobject();
 					struct JsonNode *jconfig = NULL;
+					struct JsonNode *jversions = NULL;
 					if(client->forward == 1) {
 						jconfig = config_print(CONFIG_FORWARD, client->media);
 					} else {
 						jconfig = config_print(CONFIG_INTERNAL, client->media);
 					}
 					json_append_member(jsend, "message", json_mkstring("config"));
+					if(jconfig != NULL && (jversions = json_find_member(json, "versions")) != NULL) {
+						json_append_member(jsend, "delta", json_mknumber(1, 0));
+						json_append_member(jsend, "removed", sync_delta(jconfig, jversions));
+					}
 					json_append_member(jsend, "config", jconfig);
+					if(client->forward == 1 && node_filter == 1) {
+						struct JsonNode *jfilter = devices_filter_print();
+						if(jfilter != NULL) {
+							json_append_member(jsend, "filter", jfilter);
+						}
+					}
 					char *output = json_stringify(jsend, NULL);
 					str_replace("%", "%%", &output);
 					socket_write(sd, output);
 					json_free(output);
 					json_delete(jsend);
+				} else if(strcmp(action, "request profile") == 0) {
+					struct JsonNode *jsend = json_mkobject();
+					json_append_member(jsend, "message", json_mkstring("profile"));
+					json_append_member(jsend, "profile", plua_profile_print());
+					char *output = json_stringify(jsend, NULL);
+					socket_write(sd, output);
+					json_free(output);
+					json_delete(jsend);
 				} else if(strcmp(action, "request values") == 0) {
 					struct JsonNode *jsend = json_mkobject();
 					struct JsonNode *jvalues = devices_values(client->media);
@@ -1507,6 +1974,9 @@ static void socket_parse_data(int i, char *buffer) {
 				error = 1;
 			}
 			json_delete(json);
+		} else {
+			logprintf(LOG_DEBUG, "invalid json at line %d, column %d: %s",
+				jerror.line, jerror.column, jerror.message);
 		}
 	}
 	if(error == 1) {
@@ -1517,8 +1987,12 @@ static void socket_parse_data(int i, char *buffer) {
 
 /* Rewrite code start */
 
-static int socket_parse_responses(char *buffer, char *media, char **respons) {
-	struct JsonNode *json = NULL;
+/*
+ * The json argument holds the already decoded buffer,
+ * or NULL when it was no valid json, and is always
+ * freed by this function.
+ */
+static int socket_parse_responses(char *buffer, struct JsonNode *json, char *media, char **respons) {
 	char *action = NULL, *status = NULL;
 
 	if(strcmp(buffer, "HEART") == 0) {
@@ -1526,14 +2000,14 @@ static int socket_parse_responses(char *buffer, char *media, char **respons) {
 			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 		}
 		strcpy(*respons, "BEAT");
+		json_delete(json);
 		return 0;
 	}	else {
 		if(pilight.runmode != ADHOC) {
 			logprintf(LOG_DEBUG, "socket recv: %s", buffer);
 		}
 
-		if(json_validate(buffer) == true) {
-			json = json_decode(buffer);
+		if(json != NULL) {
 			if((json_find_string(json, "status", &status)) == 0) {
 				if(strcmp(status, "success") == 0) {
 					if((*respons = MALLOC(strlen("{\"status\":\"success\"}")+1)) == NULL) {
@@ -1790,8 +2264,13 @@ static int socket_parse_responses(char *buffer, char *media, char **respons) {
 				} else if(strcmp(action, "request config") == 0) {
 					struct JsonNode *jsend = json_mkobject();
 					struct JsonNode *jconfig = NULL;
+					struct JsonNode *jversions = NULL;
 					jconfig = config_print(CONFIG_INTERNAL, media);
 					json_append_member(jsend, "message", json_mkstring("config"));
+					if(jconfig != NULL && (jversions = json_find_member(json, "versions")) != NULL) {
+						json_append_member(jsend, "delta", json_mknumber(1, 0));
+						json_append_member(jsend, "removed", sync_delta(jconfig, jversions));
+					}
 					json_append_member(jsend, "config", jconfig);
 					char *output = json_stringify(jsend, NULL);
 					str_replace("%", "%%", &output);
@@ -1803,6 +2282,19 @@ static int socket_parse_responses(char *buffer, char *media, char **respons) {
 					json_delete(jsend);
 					json_delete(json);
 					return 0;
+				} else if(strcmp(action, "request profile") == 0) {
+					struct JsonNode *jsend = json_mkobject();
+					json_append_member(jsend, "message", json_mkstring("profile"));
+					json_append_member(jsend, "profile", plua_profile_print());
+					char *output = json_stringify(jsend, NULL);
+					if((*respons = MALLOC(strlen(output)+1)) == NULL) {
+						OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+					}
+					strcpy(*respons, output);
+					json_free(output);
+					json_delete(jsend);
+					json_delete(json);
+					return 0;
 				} else if(strcmp(action, "request values") == 0) {
 					struct JsonNode *jsend = json_mkobject();
 #ifdef PILIGHT_REWRITE
@@ -1828,6 +2320,7 @@ static int socket_parse_responses(char *buffer, char *media, char **respons) {
 			}
 		}
 	}
+	json_delete(json);
 	return -1;
 }
 
@@ -1843,7 +2336,7 @@ static void *socket_parse_data1(int reason, void *param, void *userdata) {
 	struct clients_t *client = NULL;
 	char *action = NULL, *media = NULL, *status = NULL, *respons = NULL;
 	char all[] = "all";
-	int error = 0, exists = 0, sd = -1;
+	int error = 0, exists = 0, sd = -1, ret = 0;
 
 	if(strlen(data->type) == 0) {
 		logprintf(LOG_ERR, "socket data misses a socket type");
@@ -1872,8 +2365,7 @@ static void *socket_parse_data1(int reason, void *param, void *userdata) {
 		media = client->media;
 	}
 
-	if(json_validate(data->buffer) == true) {
-		json = json_decode(data->buffer);
+	if((json = json_decode(data->buffer)) != NULL) {
 		if((json_find_string(json, "action", &action)) == 0) {
 			if(strcmp(action, "identify") == 0) {
 				/* Check if client doesn't already exist */
@@ -1963,11 +2455,13 @@ static void *socket_parse_data1(int reason, void *param, void *userdata) {
 							client->next = clients;
 							clients = client;
 						}
+						receivers_update();
 						socket_write(sd, "{\"status\":\"success\"}");
 						json_delete(json);
 						return NULL;
 					}
 				}
+				receivers_update();
 				json_delete(json);
 				return NULL;
 			/*
@@ -2031,7 +2525,11 @@ static void *socket_parse_data1(int reason, void *param, void *userdata) {
 		}
 	}
 
-	if(socket_parse_responses(data->buffer, media, &respons) == 0) {
+	/* The decoded message is handed over */
+	ret = socket_parse_responses(data->buffer, json, media, &respons);
+	json = NULL;
+
+	if(ret == 0) {
 		struct reason_socket_send_t *data1 = MALLOC(sizeof(struct reason_socket_send_t));
 		if(data1 == NULL) {
 			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
@@ -2101,6 +2599,12 @@ static void *receivePulseTrain1(int reason, void *param, void *userdata) {
 
 	int plslen = buffer[(int)length-1]/PULSE_DIV;
 	if(length > 0) {
+		if(capture != NULL) {
+			struct timeval tv;
+			gettimeofday(&tv, NULL);
+			capture_write(capture, 1000000ULL * tv.tv_sec + tv.tv_usec, hardware, buffer, length);
+		}
+		shm_publish_pulses(hardware, hwtype, buffer, length);
 		receive_queue(buffer, length, plslen, hwtype);
 	}
 
@@ -2114,6 +2618,7 @@ void *clientize(void *param) {
 	struct ssdp_list_t *ssdp_list = NULL;
 	struct JsonNode *json = NULL;
 	struct JsonNode *joptions = NULL;
+	struct JsonError jerror;
   char *recvBuff = NULL, *output = NULL;
 	char *message = NULL, *action = NULL;
 	char *origin = NULL, *protocol = NULL;
@@ -2174,6 +2679,7 @@ void *clientize(void *param) {
 
 		json = json_mkobject();
 		json_append_member(json, "action", json_mkstring("request config"));
+		sync_request(json);
 		output = json_stringify(json, NULL);
 		if(socket_write(sockfd, output) != (strlen(output)+strlen(EOSS))) {
 			json_free(output);
@@ -2185,13 +2691,20 @@ void *clientize(void *param) {
 
 		if(socket_read(sockfd, &recvBuff, 0) == 0) {
 			logprintf(LOG_DEBUG, "socket recv: %s", recvBuff);
-			if(json_validate(recvBuff) == true) {
-				json = json_decode(recvBuff);
+			if((json = json_decode_ex(recvBuff, &jerror)) == NULL) {
+				logprintf(LOG_WARNING, "invalid master configuration at line %d, column %d: %s",
+					jerror.line, jerror.column, jerror.message);
+			} else {
 				if(json_find_string(json, "message", &message) == 0) {
 					if(strcmp(message, "config") == 0) {
 						struct JsonNode *jconfig = NULL;
-						if((jconfig = json_find_member(json, "config")) != NULL) {
-
+						int changed = sync_receive(json, &jconfig);
+						struct JsonNode *jfilter = json_find_member(json, "filter");
+						if(changed == 0) {
+							logprintf(LOG_DEBUG, "master configuration unchanged");
+							config_synced = 1;
+							devices_filter_set(jfilter);
+						} else if(changed == 1) {
 							pthread_mutex_lock(&config_lock);
 							gui_gc();
 							devices_gc();
@@ -2203,9 +2716,15 @@ void *clientize(void *param) {
 							if(config_parse(jconfig, CONFIG_DEVICES) == 0) {
 								logprintf(LOG_DEBUG, "loaded master configuration");
 								config_synced = 1;
+								devices_filter_set(jfilter);
+								listeners_build();
 							} else {
 								logprintf(LOG_WARNING, "failed to load master configuration");
+								sync_reset();
 							}
+						} else {
+							logprintf(LOG_WARNING, "failed to load master configuration");
+							sync_reset();
 						}
 					}
 				}
@@ -2234,8 +2753,7 @@ void *clientize(void *param) {
 			char **array = NULL;
 			unsigned int z = explode(recvBuff, "\n", &array), q = 0;
 			for(q=0;q<z;q++) {
-				if(json_validate(array[q]) == true) {
-					json = json_decode(array[q]);
+				if((json = json_decode(array[q])) != NULL) {
 					if(json_find_string(json, "action", &action) == 0) {
 						if(strcmp(action, "send") == 0 ||
 						   strcmp(action, "control") == 0) {
@@ -2403,15 +2921,27 @@ int main_gc(void) {
 	ssdp_gc();
 	options_gc();
 	socket_gc();
+	coalesce_gc();
+	sync_gc();
+	shm_gc();
+	history_gc();
 
 	pthread_mutex_lock(&config_lock);
 	config_gc();
 	pthread_mutex_unlock(&config_lock);
 
 	protocol_gc();
+	w1_gc();
+	host2ip_gc();
 	ntp_gc();
 	whitelist_free();
 	threads_gc();
+	/* The receiving threads are gone now */
+	if(capture != NULL) {
+		capture_close(capture);
+		capture = NULL;
+	}
+	listeners_gc();
 #ifndef _WIN32
 	wiringXGC();
 #endif
@@ -2423,6 +2953,8 @@ int main_gc(void) {
 	uv_stop(uv_default_loop());
 	options_delete(options);
 	gc_clear();
+	/* Last, after everything that can still hold atoms */
+	atom_gc();
 	FREE(progname);
 	xfree();
 
@@ -2550,6 +3082,35 @@ static void pilight_stats(uv_timer_t *timer_req) {
 			json_append_member(procProtocol->message, "values", code);
 			json_append_member(procProtocol->message, "origin", json_mkstring("core"));
 			json_append_member(procProtocol->message, "type", json_mknumber(PROCESS, 0));
+			{
+				unsigned long forwarded = 0, suppressed = 0;
+				coalesce_stats(&forwarded, &suppressed);
+				logprintf(LOG_DEBUG, "device updates: %lu forwarded, %lu suppressed", forwarded, suppressed);
+			}
+			{
+				pthread_mutex_lock(&sendqueue_lock);
+				logprintf(LOG_DEBUG, "send queue: %d pending, %lu sent (user: %lu, rule: %lu, other: %lu), %lu merged, %lu dropped",
+					sendqueue_number, sendqueue_stats.sent, sendqueue_stats.sent_priority[SENDQUEUE_USER],
+					sendqueue_stats.sent_priority[SENDQUEUE_RULE], sendqueue_stats.sent_priority[SENDQUEUE_RETRANSMIT],
+					sendqueue_stats.merged, sendqueue_stats.dropped);
+				logprintf(LOG_DEBUG, "send queue latency: %lu ms average, %lu ms max, airtime 433: %llu ms, 868: %llu ms",
+					(unsigned long)((sendqueue_stats.sent > 0) ? sendqueue_stats.latency/sendqueue_stats.sent : 0),
+					(unsigned long)sendqueue_stats.latency_max,
+					sendqueue_bands[SENDQUEUE_BAND433].airtime/1000, sendqueue_bands[SENDQUEUE_BAND868].airtime/1000);
+				pthread_mutex_unlock(&sendqueue_lock);
+			}
+			{
+				unsigned long hits = 0, misses = 0;
+				http_pool_stats(&hits, &misses);
+				logprintf(LOG_DEBUG, "http connections: %lu reused, %lu new", hits, misses);
+			}
+			{
+				struct plua_pool_stats_t pool;
+				plua_pool_stats(&pool);
+				logprintf(LOG_DEBUG, "lua states: %d/%d, waits: %lu (<1ms: %lu, <10ms: %lu, <100ms: %lu, <1s: %lu, >=1s: %lu)",
+					pool.states, pool.max, pool.waits, pool.wait[0], pool.wait[1],
+					pool.wait[2], pool.wait[3], pool.wait[4]);
+			}
 			struct clients_t *tmp_clients = clients;
 			while(tmp_clients) {
 				if(tmp_clients->cpu > 0 && tmp_clients->ram > 0) {
@@ -2644,6 +3205,7 @@ int start_pilight(int argc, char **argv) {
 	options_add(&options, "Ls", "storage-root", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "Ll", "lua-root", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "D", "debug", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "W", "capture", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "256", "stacktracer", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "257", "threadprofiler", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "258", "debuglevel", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "[0-2]{1}");
@@ -2692,6 +3254,14 @@ int start_pilight(int argc, char **argv) {
 		nodaemon = 1;
 	}
 
+	if(options_exists(options, "W") == 0) {
+		char *arg = NULL;
+		options_get_string(options, "W", &arg);
+		if((capture = capture_open(arg, 1)) == NULL) {
+			goto clear;
+		}
+	}
+
 	if(options_exists(options, "257") == 0) {
 		threadprofiler = 1;
 		verbosity = LOG_ERR;
@@ -2737,6 +3307,8 @@ int start_pilight(int argc, char **argv) {
 									"\t -Ls --storage-root=xxxx\tlocation of the storage lua modules\n"
 									"\t -Ll --lua-root=xxxx\t\tlocation of the plain lua modules\n"
 									"\n"
+									"\t -W  --capture=xxxx\t\twrite received pulse trains to file\n"
+									"\n"
 									/*"\t     --stacktracer\t\tshow internal function calls\n"
 									"\t     --threadprofiler\t\tshow per thread cpu usage\n"
 									"\t     --debuglevel\t\tshow additional development info\n"*/,
@@ -2947,6 +3519,77 @@ int start_pilight(int argc, char **argv) {
 
 	log_level_set(verbosity);
 
+	{
+		int interval = 0, onchange = 0;
+		struct lua_state_t *state = plua_get_free_state();
+		config_setting_get_number(state->L, "coalesce-interval", 0, &interval);
+		config_setting_get_number(state->L, "coalesce-on-change", 0, &onchange);
+		assert(plua_check_stack(state->L, 0) == 0);
+		plua_clear_state(state);
+		coalesce_init(interval, onchange, broadcast_coalesced);
+	}
+
+	{
+		int duty433 = 100, duty868 = 100;
+		struct lua_state_t *state = plua_get_free_state();
+		config_setting_get_number(state->L, "duty-cycle-433", 0, &duty433);
+		config_setting_get_number(state->L, "duty-cycle-868", 0, &duty868);
+		assert(plua_check_stack(state->L, 0) == 0);
+		plua_clear_state(state);
+		sendqueue_set_duty(SENDQUEUE_BAND433, duty433);
+		sendqueue_set_duty(SENDQUEUE_BAND868, duty868);
+	}
+
+	{
+		struct lua_state_t *state = plua_get_free_state();
+		config_setting_get_number(state->L, "node-filter", 0, &node_filter);
+		config_setting_get_number(state->L, "protocol-prune", 0, &protocol_prune);
+		assert(plua_check_stack(state->L, 0) == 0);
+		plua_clear_state(state);
+	}
+
+	{
+		int shm = 0;
+		struct lua_state_t *state = plua_get_free_state();
+		config_setting_get_number(state->L, "shm-enable", 0, &shm);
+		assert(plua_check_stack(state->L, 0) == 0);
+		plua_clear_state(state);
+		if(shm == 1) {
+			shm_init();
+		}
+	}
+
+	{
+		struct lua_state_t *state = plua_get_free_state();
+		if(config_setting_get_string(state->L, "history-root", 0, &stmp) == 0) {
+			assert(plua_check_stack(state->L, 0) == 0);
+			plua_clear_state(state);
+			history_init(stmp);
+			FREE(stmp);
+		} else {
+			assert(plua_check_stack(state->L, 0) == 0);
+			plua_clear_state(state);
+		}
+	}
+
+	{
+		int luastates = NRLUASTATES_DEFAULT;
+		struct lua_state_t *state = plua_get_free_state();
+		config_setting_get_number(state->L, "lua-states", 0, &luastates);
+		assert(plua_check_stack(state->L, 0) == 0);
+		plua_clear_state(state);
+		plua_set_max_states(luastates);
+	}
+
+	{
+		int profile = 0;
+		struct lua_state_t *state = plua_get_free_state();
+		config_setting_get_number(state->L, "lua-profile", 0, &profile);
+		assert(plua_check_stack(state->L, 0) == 0);
+		plua_clear_state(state);
+		plua_profile_enable(profile);
+	}
+
 	{
 		struct lua_state_t *state = plua_get_free_state();
 		if(config_setting_get_string(state->L, "log-file", 0, &stmp) == 0) {
@@ -3197,6 +3840,7 @@ int start_pilight(int argc, char **argv) {
 	pthread_mutex_init(&recvqueue_lock, &recvqueue_attr);
 	pthread_cond_init(&recvqueue_signal, NULL);
 	recvqueue_init = 1;
+	listeners_build();
 
 	pthread_mutexattr_init(&bcqueue_attr);
 	pthread_mutexattr_settype(&bcqueue_attr, PTHREAD_MUTEX_RECURSIVE);
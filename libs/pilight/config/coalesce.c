@@ -0,0 +1,413 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifndef _WIN32
+	#ifdef __mips__
+		#define __USE_UNIX98
+	#endif
+#endif
+#include <pthread.h>
+
+#include "../../libuv/uv.h"
+#include "../core/pilight.h"
+#include "../core/common.h"
+#include "../core/options.h"
+#include "../core/mem.h"
+#include "../core/log.h"
+#include "../core/json.h"
+#include "../protocols/protocol.h"
+#include "coalesce.h"
+
+/*
+ * Received updates are coalesced per device, identified
+ * by the protocol and the values of its id options.
+ * Updates that arrive within the minimum interval after
+ * the last forwarded one are held back, only the newest
+ * is forwarded once the interval has passed. With the
+ * on change option, updates with the same values as the
+ * last forwarded one are dropped.
+ */
+#define COALESCE_BUCKETS	256
+
+typedef struct coalesce_t {
+	char *key;
+	unsigned int hash;
+	char *protoname;
+	char *last;
+	struct JsonNode *pending;
+	uint64_t sent;
+	uint64_t seen;
+	struct coalesce_t *next;
+} coalesce_t;
+
+static struct coalesce_t *coalesce[COALESCE_BUCKETS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uv_timer_t *timer_req = NULL;
+static void (*flush)(char *protoname, struct JsonNode *json) = NULL;
+static int interval = 0;
+static int onchange = 0;
+static unsigned long forwarded = 0;
+static unsigned long suppressed = 0;
+
+static unsigned int coalesce_hash(const char *key) {
+	unsigned int hash = 5381;
+	while(*key) {
+		hash = ((hash << 5) + hash) + (unsigned char)*key++;
+	}
+	return hash;
+}
+
+static char *coalesce_key(char *protoname, struct JsonNode *jmessage) {
+	struct protocols_t *pnode = protocols;
+	struct options_t *opt = NULL;
+	struct JsonNode *jid = NULL;
+	char *key = NULL, *value = NULL;
+	int len = strlen(protoname)+1;
+
+	if((key = MALLOC(len)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	strcpy(key, protoname);
+
+	while(pnode) {
+		if(strcmp(pnode->listener->id, protoname) == 0) {
+			opt = pnode->listener->options;
+			break;
+		}
+		pnode = pnode->next;
+	}
+
+	while(opt) {
+		if(opt->conftype == DEVICES_ID && (jid = json_find_member(jmessage, opt->name)) != NULL) {
+			value = json_stringify(jid, NULL);
+			len += strlen(opt->name)+strlen(value)+2;
+			if((key = REALLOC(key, len)) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+			strcat(key, " ");
+			strcat(key, opt->name);
+			strcat(key, "=");
+			strcat(key, value);
+			json_free(value);
+		}
+		opt = opt->next;
+	}
+
+	return key;
+}
+
+static struct coalesce_t *coalesce_find(char *key, unsigned int hash) {
+	struct coalesce_t *node = coalesce[hash % COALESCE_BUCKETS];
+
+	while(node) {
+		if(node->hash == hash && strcmp(node->key, key) == 0) {
+			return node;
+		}
+		node = node->next;
+	}
+	return NULL;
+}
+
+static struct coalesce_t *coalesce_get(char *protoname, char *key) {
+	struct coalesce_t *node = NULL;
+	unsigned int hash = coalesce_hash(key);
+
+	if((node = coalesce_find(key, hash)) != NULL) {
+		return node;
+	}
+
+	if((node = MALLOC(sizeof(struct coalesce_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(node, 0, sizeof(struct coalesce_t));
+	if((node->key = STRDUP(key)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((node->protoname = STRDUP(protoname)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	node->hash = hash;
+	node->next = coalesce[hash % COALESCE_BUCKETS];
+	coalesce[hash % COALESCE_BUCKETS] = node;
+
+	return node;
+}
+
+static void coalesce_free(struct coalesce_t *node) {
+	if(node->pending != NULL) {
+		json_delete(node->pending);
+	}
+	if(node->last != NULL) {
+		FREE(node->last);
+	}
+	FREE(node->protoname);
+	FREE(node->key);
+	FREE(node);
+}
+
+/*
+ * Returns 0 when the update should be forwarded
+ * right away, 1 when it was held back or dropped.
+ */
+int coalesce_message(char *protoname, struct JsonNode *json) {
+	struct coalesce_t *node = NULL;
+	struct JsonNode *jmessage = NULL;
+	char *key = NULL, *content = NULL;
+	uint64_t now = 0;
+
+	if(interval == 0 && onchange == 0) {
+		return 0;
+	}
+	if((jmessage = json_find_member(json, "message")) == NULL) {
+		return 0;
+	}
+
+	key = coalesce_key(protoname, jmessage);
+	content = json_stringify(jmessage, NULL);
+	now = uv_hrtime()/1000000;
+
+	pthread_mutex_lock(&lock);
+	node = coalesce_get(protoname, key);
+	node->seen = now;
+	FREE(key);
+
+	if(node->last != NULL && interval > 0 && now-node->sent < (uint64_t)interval) {
+		char *tmp = json_stringify(json, NULL);
+		if(node->pending != NULL) {
+			json_delete(node->pending);
+			suppressed++;
+		}
+		node->pending = json_decode(tmp);
+		json_free(tmp);
+		json_free(content);
+		pthread_mutex_unlock(&lock);
+		return 1;
+	}
+
+	if(node->pending != NULL) {
+		json_delete(node->pending);
+		node->pending = NULL;
+		suppressed++;
+	}
+
+	if(onchange == 1 && node->last != NULL && strcmp(node->last, content) == 0) {
+		suppressed++;
+		json_free(content);
+		pthread_mutex_unlock(&lock);
+		return 1;
+	}
+
+	if(node->last != NULL) {
+		FREE(node->last);
+	}
+	if((node->last = STRDUP(content)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	json_free(content);
+	node->sent = now;
+	forwarded++;
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+/*
+ * The device was updated from elsewhere, e.g. by a
+ * client or a rule, so the last forwarded update
+ * no longer tells its state.
+ */
+void coalesce_forget(char *protoname, struct JsonNode *json) {
+	struct coalesce_t *node = NULL;
+	struct JsonNode *jmessage = NULL;
+	char *key = NULL;
+
+	if(interval == 0 && onchange == 0) {
+		return;
+	}
+	if((jmessage = json_find_member(json, "message")) == NULL) {
+		return;
+	}
+
+	key = coalesce_key(protoname, jmessage);
+
+	pthread_mutex_lock(&lock);
+	if((node = coalesce_find(key, coalesce_hash(key))) != NULL && node->last != NULL) {
+		FREE(node->last);
+		node->last = NULL;
+	}
+	pthread_mutex_unlock(&lock);
+
+	FREE(key);
+}
+
+static void coalesce_flush(uv_timer_t *req) {
+	struct coalesce_t *node = NULL, *prev = NULL, *tmp = NULL;
+	struct coalesce_t *list = NULL;
+	struct JsonNode *jmessage = NULL;
+	uint64_t now = uv_hrtime()/1000000;
+	uint64_t expire = COALESCE_EXPIRE;
+	char *content = NULL;
+	int i = 0;
+
+	if((uint64_t)interval*10 > expire) {
+		expire = (uint64_t)interval*10;
+	}
+
+	pthread_mutex_lock(&lock);
+	for(i=0;i<COALESCE_BUCKETS;i++) {
+		prev = NULL;
+		node = coalesce[i];
+		while(node) {
+			if(node->pending != NULL && now-node->sent >= (uint64_t)interval) {
+				if((jmessage = json_find_member(node->pending, "message")) != NULL) {
+					content = json_stringify(jmessage, NULL);
+					if(onchange == 1 && node->last != NULL && strcmp(node->last, content) == 0) {
+						json_delete(node->pending);
+						suppressed++;
+					} else {
+						/*
+						 * Collect the updates to forward, they're
+						 * handed over outside of the lock.
+						 */
+						if((tmp = MALLOC(sizeof(struct coalesce_t))) == NULL) {
+							OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+						}
+						memset(tmp, 0, sizeof(struct coalesce_t));
+						if((tmp->protoname = STRDUP(node->protoname)) == NULL) {
+							OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+						}
+						tmp->pending = node->pending;
+						tmp->next = list;
+						list = tmp;
+
+						if(node->last != NULL) {
+							FREE(node->last);
+						}
+						if((node->last = STRDUP(content)) == NULL) {
+							OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+						}
+						node->sent = now;
+						forwarded++;
+					}
+					json_free(content);
+				} else {
+					json_delete(node->pending);
+				}
+				node->pending = NULL;
+			}
+
+			if(node->pending == NULL && now-node->seen > expire) {
+				tmp = node;
+				node = node->next;
+				if(prev == NULL) {
+					coalesce[i] = node;
+				} else {
+					prev->next = node;
+				}
+				coalesce_free(tmp);
+				continue;
+			}
+			prev = node;
+			node = node->next;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	while(list) {
+		tmp = list;
+		list = list->next;
+		if(flush != NULL) {
+			flush(tmp->protoname, tmp->pending);
+		}
+		json_delete(tmp->pending);
+		FREE(tmp->protoname);
+		FREE(tmp);
+	}
+}
+
+void coalesce_init(int _interval, int _onchange, void (*callback)(char *protoname, struct JsonNode *json)) {
+	/* Make sure we run in the main thread */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	pthread_mutex_lock(&lock);
+	interval = (_interval > 0) ? _interval : 0;
+	onchange = (_onchange == 1) ? 1 : 0;
+	flush = callback;
+	pthread_mutex_unlock(&lock);
+
+	if(interval == 0 && onchange == 0) {
+		return;
+	}
+
+	if(timer_req == NULL) {
+		if((timer_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		uv_timer_init(uv_default_loop(), timer_req);
+		/*
+		 * Check the held back updates ten times per
+		 * interval, but no more than every 10ms.
+		 */
+		int repeat = (interval >= 100) ? interval/10 : 10;
+		if(interval == 0) {
+			repeat = 1000;
+		}
+		uv_timer_start(timer_req, coalesce_flush, repeat, repeat);
+	}
+
+	logprintf(LOG_DEBUG, "coalescing device updates with a %d ms interval%s",
+		interval, (onchange == 1) ? ", only on change" : "");
+}
+
+void coalesce_stats(unsigned long *_forwarded, unsigned long *_suppressed) {
+	pthread_mutex_lock(&lock);
+	*_forwarded = forwarded;
+	*_suppressed = suppressed;
+	pthread_mutex_unlock(&lock);
+}
+
+static void close_cb(uv_handle_t *handle) {
+	FREE(handle);
+}
+
+int coalesce_gc(void) {
+	struct coalesce_t *node = NULL;
+	int i = 0;
+
+	if(timer_req != NULL) {
+		uv_timer_stop(timer_req);
+		uv_close((uv_handle_t *)timer_req, close_cb);
+		timer_req = NULL;
+	}
+
+	pthread_mutex_lock(&lock);
+	if(forwarded > 0 || suppressed > 0) {
+		logprintf(LOG_DEBUG, "coalesced device updates: %lu forwarded, %lu suppressed", forwarded, suppressed);
+	}
+	for(i=0;i<COALESCE_BUCKETS;i++) {
+		while(coalesce[i]) {
+			node = coalesce[i];
+			coalesce[i] = coalesce[i]->next;
+			coalesce_free(node);
+		}
+	}
+	interval = 0;
+	onchange = 0;
+	forwarded = 0;
+	suppressed = 0;
+	flush = NULL;
+	pthread_mutex_unlock(&lock);
+
+	logprintf(LOG_DEBUG, "garbage collected coalesce library");
+	return 0;
+}
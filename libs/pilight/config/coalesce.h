@@ -0,0 +1,26 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _COALESCE_H_
+#define _COALESCE_H_
+
+#include "../core/json.h"
+
+/*
+ * Devices that haven't sent anything for this
+ * long (in ms) are forgotten.
+ */
+#define COALESCE_EXPIRE	60000
+
+void coalesce_init(int interval, int onchange, void (*callback)(char *protoname, struct JsonNode *json));
+int coalesce_message(char *protoname, struct JsonNode *json);
+void coalesce_forget(char *protoname, struct JsonNode *json);
+void coalesce_stats(unsigned long *forwarded, unsigned long *suppressed);
+int coalesce_gc(void);
+
+#endif
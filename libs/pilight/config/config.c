@@ -256,14 +256,15 @@ int config_read(lua_State *L, unsigned short objects) {
 	/* Read JSON config file */
 	if(file_get_contents(string, &content) == 0) {
 		/* Validate JSON and turn into JSON object */
-		if(json_validate(content) == false) {
-			logprintf(LOG_ERR, "config is not in a valid json format");
+		struct JsonError jerror;
+		struct JsonNode *root = NULL;
+		if((root = json_decode_ex(content, &jerror)) == NULL) {
+			logprintf(LOG_ERR, "config is not in a valid json format, %s at line %d, column %d",
+				jerror.message, jerror.line, jerror.column);
 			FREE(content);
 			return EXIT_FAILURE;
 		}
 
-		struct JsonNode *root = json_decode(content);
-
 		if(config_parse(root, objects) == -1) {
 			json_delete(root);
 			FREE(content);
@@ -285,14 +286,14 @@ struct JsonNode *config_print(int level, const char *media) {
 	/* Read JSON config file */
 	if(file_get_contents(string, &content) == 0) {
 		/* Validate JSON and turn into JSON object */
-		if(json_validate(content) == false) {
-			logprintf(LOG_ERR, "config is not in a valid json format");
+		struct JsonError jerror;
+		if((root = json_decode_ex(content, &jerror)) == NULL) {
+			logprintf(LOG_ERR, "config is not in a valid json format, %s at line %d, column %d",
+				jerror.message, jerror.line, jerror.column);
 			FREE(content);
 			return NULL;
 		}
 
-		root = json_decode(content);
-
 		struct JsonNode *jchild1 = config_devices_sync(level, media);
 		struct JsonNode *jchild = json_find_member(root, "devices");
 		json_remove_from_parent(jchild);
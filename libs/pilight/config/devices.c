@@ -36,6 +36,8 @@
 #include "../core/ssdp.h"
 #include "../core/firmware.h"
 #include "../core/datetime.h"
+#include "../core/history.h"
+#include "../core/atom.h"
 #include "../config/config.h"
 
 #include "../protocols/protocol.h"
@@ -52,6 +54,658 @@ struct config_t *config_devices;
 /* Struct to store the locations */
 static struct devices_t *devices = NULL;
 
+static int devices_value_packed(struct devices_t *dev, struct devices_values_t *val) {
+	return (val->type == JSON_STRING && dev->pack != NULL &&
+		val->string_ >= (char *)dev->pack && val->string_ < (char *)dev->pack+dev->packsize);
+}
+
+/*
+ * A packed string has room for at least DEVICES_VALUE_INLINE
+ * bytes, so short strings replace it in place.
+ */
+static void devices_value_set_string(struct devices_t *dev, struct devices_values_t *val, char *str) {
+	int len = strlen(str);
+	int packed = devices_value_packed(dev, val);
+
+	if(packed == 1 && len < DEVICES_VALUE_INLINE) {
+		memcpy(val->string_, str, len+1);
+		return;
+	}
+	if(packed == 0 && val->type == JSON_STRING && val->string_ != NULL) {
+		if((val->string_ = REALLOC(val->string_, len+1)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	} else if((val->string_ = MALLOC(len+1)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memcpy(val->string_, str, len+1);
+	val->type = JSON_STRING;
+}
+
+static void devices_value_free(struct devices_t *dev, struct devices_values_t *val) {
+	if(val->type == JSON_STRING && val->string_ != NULL && devices_value_packed(dev, val) == 0) {
+		FREE(val->string_);
+	}
+}
+
+/*
+ * Moves the settings and values of a parsed device into
+ * a single block. The values come first, so their doubles
+ * stay aligned on 32 bits platforms as well. The strings
+ * follow the settings, each in at least DEVICES_VALUE_INLINE
+ * bytes.
+ */
+static int devices_pack_string(char *str) {
+	int len = strlen(str)+1;
+	return (len < DEVICES_VALUE_INLINE) ? DEVICES_VALUE_INLINE : len;
+}
+
+static void devices_pack(struct devices_t *dev) {
+	struct devices_settings_t *sptr = NULL, *snext = NULL, *settings = NULL;
+	struct devices_values_t *vptr = NULL, *vnext = NULL, *values = NULL;
+	int nrsettings = 0, nrvalues = 0, i = 0, x = 0, len = 0;
+	size_t strings = 0;
+	char *str = NULL;
+
+	if(dev->pack != NULL || dev->settings == NULL) {
+		return;
+	}
+
+	sptr = dev->settings;
+	while(sptr) {
+		nrsettings++;
+		vptr = sptr->values;
+		while(vptr) {
+			nrvalues++;
+			if(vptr->type == JSON_STRING && vptr->string_ != NULL) {
+				strings += devices_pack_string(vptr->string_);
+			}
+			vptr = vptr->next;
+		}
+		sptr = sptr->next;
+	}
+
+	dev->packsize = sizeof(struct devices_values_t)*nrvalues+sizeof(struct devices_settings_t)*nrsettings+strings;
+	if((dev->pack = MALLOC(dev->packsize)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	values = dev->pack;
+	settings = (struct devices_settings_t *)&values[nrvalues];
+	str = (char *)&settings[nrsettings];
+
+	sptr = dev->settings;
+	while(sptr) {
+		snext = sptr->next;
+		settings[i].name = sptr->name;
+		settings[i].values = NULL;
+		settings[i].next = (snext != NULL) ? &settings[i+1] : NULL;
+
+		vptr = sptr->values;
+		while(vptr) {
+			vnext = vptr->next;
+			memcpy(&values[x], vptr, sizeof(struct devices_values_t));
+			if(vptr->type == JSON_STRING && vptr->string_ != NULL) {
+				len = devices_pack_string(vptr->string_);
+				strcpy(str, vptr->string_);
+				values[x].string_ = str;
+				str += len;
+				FREE(vptr->string_);
+			}
+			if(settings[i].values == NULL) {
+				settings[i].values = &values[x];
+			}
+			values[x].next = (vnext != NULL) ? &values[x+1] : NULL;
+			FREE(vptr);
+			vptr = vnext;
+			x++;
+		}
+
+		FREE(sptr);
+		sptr = snext;
+		i++;
+	}
+	dev->settings = settings;
+}
+
+/*
+ * Index of the devices by the protocol and the
+ * values of its DEVICES_ID options. This allows
+ * devices_update to only visit the devices that
+ * can match a received message.
+ */
+#define DEVICES_INDEX_SIZE	1024
+
+typedef struct devices_index_t {
+	struct protocol_t *protocol;
+	struct devices_t *device;
+	unsigned int hash;
+	char *key;
+	struct devices_index_t *next;
+} devices_index_t;
+
+/*
+ * Protocols of which one or more devices couldn't
+ * be indexed. These still walk all devices.
+ */
+typedef struct devices_unindexed_t {
+	struct protocol_t *protocol;
+	struct devices_unindexed_t *next;
+} devices_unindexed_t;
+
+static struct devices_index_t *devices_index[DEVICES_INDEX_SIZE];
+static struct devices_unindexed_t *devices_unindexed = NULL;
+static int devices_indexed = 0;
+
+static unsigned int devices_index_hash(struct protocol_t *protocol, const char *key) {
+	unsigned int hash = (unsigned int)(((unsigned long)protocol) >> 4);
+	while(*key != '\0') {
+		hash = ((hash << 5) + hash) + (unsigned char)*key++;
+	}
+	return hash;
+}
+
+/*
+ * Append a single id value to an index key. Numbers
+ * are only indexed when they are integers, so values
+ * that match within EPSILON always share a key.
+ */
+static int devices_index_key_add(char **key, int *len, int type, char *string_, double number_) {
+	char tmp[64], *value = tmp;
+	int n = 0;
+
+	if(type == JSON_STRING) {
+		value = string_;
+		n = strlen(string_)+1;
+	} else if(type == JSON_NUMBER) {
+		if(fabs(number_-round(number_)) >= EPSILON || fabs(number_) > 1e15) {
+			return -1;
+		}
+		n = snprintf(tmp, sizeof(tmp), "%.0f", round(number_))+1;
+	} else {
+		return -1;
+	}
+
+	if((*key = REALLOC(*key, *len+n+1)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	(*key)[(*len)++] = (type == JSON_STRING) ? 's' : 'n';
+	memcpy(&(*key)[*len], value, n);
+	*len += n;
+	return 0;
+}
+
+static char *devices_index_key_device(struct protocol_t *protocol, struct devices_settings_t *sptr) {
+	struct devices_values_t *vptr = NULL, *found = NULL;
+	struct options_t *opt = protocol->options;
+	char *key = NULL;
+	int len = 0, nr = 0;
+
+	while(opt) {
+		if(opt->conftype == DEVICES_ID) {
+			nr = 0;
+			vptr = sptr->values;
+			while(vptr) {
+				if(strcmp(vptr->name, opt->name) == 0) {
+					found = vptr;
+					nr++;
+				}
+				vptr = vptr->next;
+			}
+			if(nr != 1 || devices_index_key_add(&key, &len, found->type, found->string_, found->number_) != 0) {
+				if(key != NULL) {
+					FREE(key);
+				}
+				return NULL;
+			}
+		}
+		opt = opt->next;
+	}
+	return key;
+}
+
+static char *devices_index_key_message(struct protocol_t *protocol, struct JsonNode *message) {
+	struct options_t *opt = protocol->options;
+	struct JsonNode *jtmp = NULL, *found = NULL;
+	char *key = NULL;
+	int len = 0, nr = 0;
+
+	while(opt) {
+		if(opt->conftype == DEVICES_ID) {
+			nr = 0;
+			jtmp = json_first_child(message);
+			while(jtmp) {
+				if(strcmp(jtmp->key, opt->name) == 0) {
+					found = jtmp;
+					nr++;
+				}
+				jtmp = jtmp->next;
+			}
+			if(nr != 1 || devices_index_key_add(&key, &len, found->tag,
+				 (found->tag == JSON_STRING) ? found->string_ : NULL, found->number_) != 0) {
+				if(key != NULL) {
+					FREE(key);
+				}
+				return NULL;
+			}
+		}
+		opt = opt->next;
+	}
+	return key;
+}
+
+static void devices_index_gc(void) {
+	struct devices_unindexed_t *utmp = NULL;
+	struct devices_index_t *tmp = NULL;
+	int i = 0;
+
+	for(i=0;i<DEVICES_INDEX_SIZE;i++) {
+		while(devices_index[i]) {
+			tmp = devices_index[i];
+			devices_index[i] = devices_index[i]->next;
+			FREE(tmp->key);
+			FREE(tmp);
+		}
+	}
+	while(devices_unindexed) {
+		utmp = devices_unindexed;
+		devices_unindexed = devices_unindexed->next;
+		FREE(utmp);
+	}
+	devices_indexed = 0;
+}
+
+static void devices_index_build(void) {
+	struct protocols_t *pnode = protocols, *tmp_protocols = NULL;
+	struct devices_settings_t *sptr = NULL;
+	struct devices_index_t *node = NULL, *tail = NULL;
+	struct devices_t *dptr = NULL;
+	struct protocol_t *protocol = NULL;
+	unsigned int hash = 0;
+	char *key = NULL;
+	int nrid = 0;
+
+	devices_index_gc();
+
+	while(pnode) {
+		protocol = pnode->listener;
+		nrid = 0;
+		struct options_t *opt = protocol->options;
+		while(opt) {
+			if(opt->conftype == DEVICES_ID) {
+				nrid++;
+			}
+			opt = opt->next;
+		}
+
+		dptr = devices;
+		while(dptr && nrid > 0) {
+			tmp_protocols = dptr->protocols;
+			while(tmp_protocols) {
+				if(protocol_device_exists(protocol, tmp_protocols->name) == 0) {
+					break;
+				}
+				tmp_protocols = tmp_protocols->next;
+			}
+			if(tmp_protocols != NULL) {
+				sptr = dptr->settings;
+				while(sptr) {
+					if(strcmp(sptr->name, "id") == 0) {
+						if((key = devices_index_key_device(protocol, sptr)) == NULL) {
+							break;
+						}
+						if((node = MALLOC(sizeof(struct devices_index_t))) == NULL) {
+							OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+						}
+						hash = devices_index_hash(protocol, key);
+						node->protocol = protocol;
+						node->device = dptr;
+						node->hash = hash;
+						node->key = key;
+						node->next = NULL;
+
+						/* Keep the devices order within each bucket */
+						tail = devices_index[hash % DEVICES_INDEX_SIZE];
+						if(tail == NULL) {
+							devices_index[hash % DEVICES_INDEX_SIZE] = node;
+						} else {
+							while(tail->next != NULL) {
+								tail = tail->next;
+							}
+							tail->next = node;
+						}
+					}
+					sptr = sptr->next;
+				}
+				if(sptr != NULL) {
+					break;
+				}
+			}
+			dptr = dptr->next;
+		}
+
+		if(dptr != NULL || nrid == 0) {
+			struct devices_unindexed_t *unode = MALLOC(sizeof(struct devices_unindexed_t));
+			if(unode == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+			unode->protocol = protocol;
+			unode->next = devices_unindexed;
+			devices_unindexed = unode;
+		}
+		pnode = pnode->next;
+	}
+	devices_indexed = 1;
+}
+
+static struct devices_index_t *devices_index_next(struct devices_index_t *node, struct protocol_t *protocol, unsigned int hash, char *key) {
+	struct devices_t *prev = (node != NULL) ? node->device : NULL;
+
+	node = (node != NULL) ? node->next : devices_index[hash % DEVICES_INDEX_SIZE];
+	while(node) {
+		if(node->hash == hash && node->protocol == protocol &&
+		   node->device != prev && strcmp(node->key, key) == 0) {
+			return node;
+		}
+		node = node->next;
+	}
+	return NULL;
+}
+
+/*
+ * Returns the first index entry of the devices that can
+ * match the message, or -1 when all devices must be
+ * walked instead.
+ */
+static int devices_index_find(struct protocol_t *protocol, struct JsonNode *message, struct devices_index_t **node, unsigned int *hash, char **key) {
+	struct devices_unindexed_t *unode = devices_unindexed;
+
+	if(devices_indexed == 0 || message == NULL) {
+		return -1;
+	}
+	while(unode) {
+		if(unode->protocol == protocol) {
+			return -1;
+		}
+		unode = unode->next;
+	}
+	if((*key = devices_index_key_message(protocol, message)) == NULL) {
+		return -1;
+	}
+	*hash = devices_index_hash(protocol, *key);
+	*node = devices_index_next(NULL, protocol, *hash, *key);
+	return 0;
+}
+
+/*
+ * Filter of the received codes a node forwards to its
+ * master. For every RF protocol that has devices, the
+ * master advertises a bloom filter of the indexed device
+ * ids, or true when its devices can't be indexed:
+ *
+ * "filter":{"arctech_switch":"AAgQ...","alecto_wx500":true}
+ *
+ * The node drops codes of RF protocols that aren't in
+ * the filter, or of which the id isn't in the bloom
+ * filter. Codes of all other protocols are forwarded.
+ */
+#define DEVICES_FILTER_BITS		10
+#define DEVICES_FILTER_HASHES	4
+
+typedef struct devices_filter_t {
+	struct protocol_t *protocol;
+	unsigned char *bits;
+	unsigned int size;
+	struct devices_filter_t *next;
+} devices_filter_t;
+
+static struct devices_filter_t *devices_filters = NULL;
+static int devices_filtered = 0;
+
+static int devices_filter_rf(struct protocol_t *protocol) {
+	return (protocol->hwtype == RF433 || protocol->hwtype == RF868);
+}
+
+/*
+ * Hashes all id values of an index key, not just
+ * the first, so each id combination gets its own bits.
+ */
+static void devices_filter_hash(struct protocol_t *protocol, char *key, unsigned int *h1, unsigned int *h2) {
+	struct options_t *opt = protocol->options;
+	char *p = key;
+	int nr = 0;
+
+	*h1 = 5381;
+	*h2 = 0;
+	while(opt) {
+		if(opt->conftype == DEVICES_ID) {
+			nr++;
+		}
+		opt = opt->next;
+	}
+	while(nr-- > 0) {
+		do {
+			*h1 = ((*h1 << 5) + *h1) + (unsigned char)*p;
+			*h2 = (unsigned char)*p + (*h2 << 6) + (*h2 << 16) - *h2;
+		} while(*p++ != '\0');
+	}
+	*h2 |= 1;
+}
+
+int devices_protocol_used(struct protocol_t *protocol) {
+	struct devices_t *dptr = NULL;
+	struct protocols_t *tmp_protocols = NULL;
+
+	pthread_mutex_lock(&mutex_lock);
+	dptr = devices;
+	while(dptr) {
+		tmp_protocols = dptr->protocols;
+		while(tmp_protocols) {
+			if(protocol_device_exists(protocol, tmp_protocols->name) == 0) {
+				pthread_mutex_unlock(&mutex_lock);
+				return 1;
+			}
+			tmp_protocols = tmp_protocols->next;
+		}
+		dptr = dptr->next;
+	}
+	pthread_mutex_unlock(&mutex_lock);
+	return 0;
+}
+
+static void devices_filter_gc(void) {
+	struct devices_filter_t *tmp = NULL;
+
+	while(devices_filters) {
+		tmp = devices_filters;
+		devices_filters = devices_filters->next;
+		if(tmp->bits != NULL) {
+			FREE(tmp->bits);
+		}
+		FREE(tmp);
+	}
+	devices_filtered = 0;
+}
+
+/*
+ * Returns the filter of the current devices, or NULL
+ * when the devices couldn't be indexed.
+ */
+struct JsonNode *devices_filter_print(void) {
+	struct protocols_t *pnode = protocols;
+	struct devices_unindexed_t *unode = NULL;
+	struct devices_index_t *inode = NULL;
+	struct protocol_t *protocol = NULL;
+	struct JsonNode *jfilter = NULL;
+	unsigned int h1 = 0, h2 = 0, size = 0;
+	int i = 0, x = 0, nr = 0;
+
+	pthread_mutex_lock(&mutex_lock);
+	if(devices_indexed == 0) {
+		pthread_mutex_unlock(&mutex_lock);
+		return NULL;
+	}
+
+	jfilter = json_mkobject();
+	while(pnode) {
+		protocol = pnode->listener;
+		if(devices_filter_rf(protocol) == 0) {
+			pnode = pnode->next;
+			continue;
+		}
+
+		unode = devices_unindexed;
+		while(unode) {
+			if(unode->protocol == protocol) {
+				break;
+			}
+			unode = unode->next;
+		}
+		if(unode != NULL) {
+			if(devices_protocol_used(protocol) == 1) {
+				json_append_member(jfilter, protocol->id, json_mkbool(1));
+			}
+			pnode = pnode->next;
+			continue;
+		}
+
+		nr = 0;
+		for(i=0;i<DEVICES_INDEX_SIZE;i++) {
+			for(inode=devices_index[i];inode!=NULL;inode=inode->next) {
+				if(inode->protocol == protocol) {
+					nr++;
+				}
+			}
+		}
+		if(nr > 0) {
+			size = ((nr*DEVICES_FILTER_BITS)+7)/8;
+			if(size < 8) {
+				size = 8;
+			}
+			unsigned char bits[size];
+			memset(bits, 0, size);
+			for(i=0;i<DEVICES_INDEX_SIZE;i++) {
+				for(inode=devices_index[i];inode!=NULL;inode=inode->next) {
+					if(inode->protocol == protocol) {
+						devices_filter_hash(protocol, inode->key, &h1, &h2);
+						for(x=0;x<DEVICES_FILTER_HASHES;x++) {
+							unsigned int bit = (h1+x*h2) % (size*8);
+							bits[bit/8] |= (1 << (bit%8));
+						}
+					}
+				}
+			}
+			char *enc = base64encode((char *)bits, size);
+			json_append_member(jfilter, protocol->id, json_mkstring(enc));
+			FREE(enc);
+		}
+		pnode = pnode->next;
+	}
+	pthread_mutex_unlock(&mutex_lock);
+
+	return jfilter;
+}
+
+/*
+ * Replaces the filter advertised by the master.
+ * A NULL filter forwards all codes again.
+ */
+void devices_filter_set(struct JsonNode *jfilter) {
+	struct devices_filter_t *node = NULL;
+	struct protocols_t *pnode = NULL;
+	struct JsonNode *jchild = NULL;
+	size_t size = 0;
+
+	pthread_mutex_lock(&mutex_lock);
+	devices_filter_gc();
+	if(jfilter == NULL || jfilter->tag != JSON_OBJECT) {
+		pthread_mutex_unlock(&mutex_lock);
+		return;
+	}
+
+	jchild = json_first_child(jfilter);
+	while(jchild) {
+		pnode = protocols;
+		while(pnode) {
+			if(strcmp(pnode->listener->id, jchild->key) == 0) {
+				break;
+			}
+			pnode = pnode->next;
+		}
+		if(pnode != NULL && (jchild->tag == JSON_BOOL || jchild->tag == JSON_STRING)) {
+			if((node = MALLOC(sizeof(struct devices_filter_t))) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+			node->protocol = pnode->listener;
+			node->bits = NULL;
+			node->size = 0;
+			if(jchild->tag == JSON_STRING) {
+				node->bits = (unsigned char *)base64decode(jchild->string_, strlen(jchild->string_), &size);
+				node->size = size*8;
+			}
+			node->next = devices_filters;
+			devices_filters = node;
+		}
+		jchild = jchild->next;
+	}
+	devices_filtered = 1;
+	pthread_mutex_unlock(&mutex_lock);
+}
+
+/*
+ * Returns 0 when a received code must be forwarded
+ * to the master and -1 when it can be dropped.
+ */
+int devices_filter_match(char *protoname, struct JsonNode *json) {
+	struct devices_filter_t *node = NULL;
+	struct protocols_t *pnode = protocols;
+	struct JsonNode *message = json_find_member(json, "message");
+	unsigned int h1 = 0, h2 = 0, bit = 0;
+	char *key = NULL;
+	int ret = 0, x = 0;
+
+	pthread_mutex_lock(&mutex_lock);
+	if(devices_filtered == 0) {
+		pthread_mutex_unlock(&mutex_lock);
+		return 0;
+	}
+	while(pnode) {
+		if(strcmp(pnode->listener->id, protoname) == 0) {
+			break;
+		}
+		pnode = pnode->next;
+	}
+	if(pnode == NULL || devices_filter_rf(pnode->listener) == 0) {
+		pthread_mutex_unlock(&mutex_lock);
+		return 0;
+	}
+
+	node = devices_filters;
+	while(node) {
+		if(node->protocol == pnode->listener) {
+			break;
+		}
+		node = node->next;
+	}
+
+	if(node == NULL) {
+		ret = -1;
+	} else if(node->bits != NULL && node->size > 0 && message != NULL &&
+		 (key = devices_index_key_message(node->protocol, message)) != NULL) {
+		devices_filter_hash(node->protocol, key, &h1, &h2);
+		for(x=0;x<DEVICES_FILTER_HASHES;x++) {
+			bit = (h1+x*h2) % node->size;
+			if((node->bits[bit/8] & (1 << (bit%8))) == 0) {
+				ret = -1;
+				break;
+			}
+		}
+		FREE(key);
+	}
+	pthread_mutex_unlock(&mutex_lock);
+
+	return ret;
+}
+
 int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNode **out) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -92,6 +746,10 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 	int valueType = 0;
 	/* The UUID of this device */
 	char *uuid = NULL;
+	/* The device index lookup */
+	struct devices_index_t *inode = NULL;
+	unsigned int ihash = 0;
+	char *ikey = NULL;
 
 	if(vstring_ == NULL) {
 		fprintf(stderr, "out of memory\n");
@@ -133,8 +791,12 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 	json_find_string(json, "uuid", &uuid);
 
 	if((opt = protocol->options)) {
-		/* Loop through all devices */
+		/* Only visit the devices indexed for this message */
+		if(devices_index_find(protocol, message, &inode, &ihash, &ikey) == 0) {
+			dptr = (inode != NULL) ? inode->device : NULL;
+		}
 
+		/* Loop through all devices */
 		while(dptr) {
 			/*
 			 * uuid 				= The UUID of the pilight instance that received the specific information.
@@ -346,12 +1008,7 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 										   strlen(vstring_) > 0 &&
 										   sptr->values->type == JSON_STRING &&
 										   strcmp(sptr->values->string_, vstring_) != 0) {
-											if((sptr->values->string_ = REALLOC(sptr->values->string_, strlen(vstring_)+1)) == NULL) {
-												fprintf(stderr, "out of memory\n");
-												exit(EXIT_FAILURE);
-											}
-											strcpy(sptr->values->string_, vstring_);
-											sptr->values->type = JSON_STRING;
+											devices_value_set_string(dptr, sptr->values, vstring_);
 										} else if(valueType == JSON_NUMBER &&
 										   sptr->values->type == JSON_NUMBER &&
 										   fabs(sptr->values->number_-vnumber_) >= EPSILON) {
@@ -359,6 +1016,9 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 											sptr->values->decimals = vdecimals_;
 											sptr->values->type = JSON_NUMBER;
 										}
+										if(valueType == JSON_NUMBER) {
+											history_add(dptr->id, sptr->name, utct, vnumber_);
+										}
 										if(sptr->values->type == JSON_STRING && json_find_string(rval, sptr->name, &stmp) != 0) {
 											json_append_member(rval, sptr->name, json_mkstring(sptr->values->string_));
 											update = 1;
@@ -378,12 +1038,7 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 								if((stateType == JSON_STRING &&
 									sptr->values->type == JSON_STRING &&
 									strcmp(sptr->values->string_, sstring_) != 0)) {
-									if((sptr->values->string_ = REALLOC(sptr->values->string_, strlen(sstring_)+1)) == NULL) {
-										fprintf(stderr, "out of memory\n");
-										exit(EXIT_FAILURE);
-									}
-									strcpy(sptr->values->string_, sstring_);
-									sptr->values->type = JSON_STRING;
+									devices_value_set_string(dptr, sptr->values, sstring_);
 									dptr->timestamp = utct;
 									update = 1;
 								} else if((stateType == JSON_NUMBER &&
@@ -446,9 +1101,17 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 					}
 				}
 			}
-			dptr = dptr->next;
+			if(ikey != NULL) {
+				inode = devices_index_next(inode, protocol, ihash, ikey);
+				dptr = (inode != NULL) ? inode->device : NULL;
+			} else {
+				dptr = dptr->next;
+			}
 		}
 	}
+	if(ikey != NULL) {
+		FREE(ikey);
+	}
 
 	if(update == 1) {
 		json_append_member(rroot, "origin", json_mkstring("update"));
@@ -473,10 +1136,12 @@ int devices_get(char *sid, struct devices_t **dev) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	struct devices_t *dptr = NULL;
+	unsigned int hash = atom_hash(sid);
 
+	/* Device ids are atoms */
 	dptr = devices;
 	while(dptr) {
-		if(strcmp(dptr->id, sid) == 0) {
+		if(ATOM_HASH(dptr->id) == hash && strcmp(dptr->id, sid) == 0) {
 			if(dev != NULL) {
 				*dev = dptr;
 			}
@@ -796,11 +1461,7 @@ static void devices_save_setting(int i, struct JsonNode *jsetting, struct device
 					fprintf(stderr, "out of memory\n");
 					exit(EXIT_FAILURE);
 				}
-				if((snode->name = MALLOC(strlen(jsetting->key)+1)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				strcpy(snode->name, jsetting->key);
+				snode->name = atom_get(jsetting->key);
 				snode->values = NULL;
 				snode->next = NULL;
 				if(jtmp->tag == JSON_OBJECT) {
@@ -810,19 +1471,11 @@ static void devices_save_setting(int i, struct JsonNode *jsetting, struct device
 							fprintf(stderr, "out of memory\n");
 							exit(EXIT_FAILURE);
 						}
-						if((vnode->name = MALLOC(strlen(jtmp1->key)+1)) == NULL) {
-							fprintf(stderr, "out of memory\n");
-							exit(EXIT_FAILURE);
-						}
-						strcpy(vnode->name, jtmp1->key);
+						memset(vnode, 0, sizeof(struct devices_values_t));
+						vnode->name = atom_get(jtmp1->key);
 						vnode->next = NULL;
 						if(jtmp1->tag == JSON_STRING) {
-							if((vnode->string_ = MALLOC(strlen(jtmp1->string_)+1)) == NULL) {
-								fprintf(stderr, "out of memory\n");
-								exit(EXIT_FAILURE);
-							}
-							strcpy(vnode->string_, jtmp1->string_);
-							vnode->type = JSON_STRING;
+							devices_value_set_string(device, vnode, jtmp1->string_);
 						} else if(jtmp1->tag == JSON_NUMBER) {
 							vnode->number_ = jtmp1->number_;
 							vnode->decimals = jtmp1->decimals_;
@@ -862,11 +1515,7 @@ static void devices_save_setting(int i, struct JsonNode *jsetting, struct device
 			fprintf(stderr, "out of memory\n");
 			exit(EXIT_FAILURE);
 		}
-		if((snode->name = MALLOC(strlen(jsetting->key)+1)) == NULL) {
-			fprintf(stderr, "out of memory\n");
-			exit(EXIT_FAILURE);
-		}
-		strcpy(snode->name, jsetting->key);
+		snode->name = atom_get(jsetting->key);
 		snode->values = NULL;
 		snode->next = NULL;
 
@@ -877,28 +1526,17 @@ static void devices_save_setting(int i, struct JsonNode *jsetting, struct device
 					fprintf(stderr, "out of memory\n");
 					exit(EXIT_FAILURE);
 				}
-				if((vnode->name = MALLOC(strlen(jtmp->key)+1)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				strcpy(vnode->name, jtmp->key);
-				if((vnode->string_ = MALLOC(strlen(jtmp->string_)+1)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				strcpy(vnode->string_, jtmp->string_);
-				vnode->type = JSON_STRING;
+				memset(vnode, 0, sizeof(struct devices_values_t));
+				vnode->name = atom_get(jtmp->key);
+				devices_value_set_string(device, vnode, jtmp->string_);
 				vnode->next = NULL;
 			} else if(jtmp->tag == JSON_NUMBER) {
 				if((vnode = MALLOC(sizeof(struct devices_values_t))) == NULL) {
 					fprintf(stderr, "out of memory\n");
 					exit(EXIT_FAILURE);
 				}
-				if((vnode->name = MALLOC(strlen(jtmp->key)+1)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				strcpy(vnode->name, jtmp->key);
+				memset(vnode, 0, sizeof(struct devices_values_t));
+				vnode->name = atom_get(jtmp->key);
 				vnode->number_ = jtmp->number_;
 				vnode->decimals = jtmp->decimals_;
 				vnode->type = JSON_NUMBER;
@@ -936,11 +1574,7 @@ static void devices_save_setting(int i, struct JsonNode *jsetting, struct device
 			fprintf(stderr, "out of memory\n");
 			exit(EXIT_FAILURE);
 		}
-		if((snode->name = MALLOC(strlen(jsetting->key)+1)) == NULL) {
-			fprintf(stderr, "out of memory\n");
-			exit(EXIT_FAILURE);
-		}
-		strcpy(snode->name, jsetting->key);
+		snode->name = atom_get(jsetting->key);
 		snode->values = NULL;
 		snode->next = NULL;
 
@@ -948,21 +1582,15 @@ static void devices_save_setting(int i, struct JsonNode *jsetting, struct device
 			fprintf(stderr, "out of memory\n");
 			exit(EXIT_FAILURE);
 		}
+		memset(vnode, 0, sizeof(struct devices_values_t));
 		int valid = 0;
 		/* Cast and store the new value */
 		if(jsetting->tag == JSON_STRING && json_find_string(jsetting->parent, jsetting->key, &stmp) == 0) {
-			if((vnode->string_ = MALLOC(strlen(stmp)+1)) == NULL) {
-				fprintf(stderr, "out of memory\n");
-				exit(EXIT_FAILURE);
-			}
-			vnode->name = NULL;
-			strcpy(vnode->string_, stmp);
-			vnode->type = JSON_STRING;
+			devices_value_set_string(device, vnode, stmp);
 			valid = 1;
 		} else if(jsetting->tag == JSON_NUMBER &&
 		         (jtmp = json_find_member(jsetting->parent, jsetting->key)) != NULL &&
 				 jtmp->tag == JSON_NUMBER) {
-			vnode->name = NULL;
 			vnode->number_ = jtmp->number_;
 			vnode->decimals = jtmp->decimals_;
 			vnode->type = JSON_NUMBER;
@@ -979,6 +1607,8 @@ static void devices_save_setting(int i, struct JsonNode *jsetting, struct device
 				vnode->next = snode->values;
 				snode->values = vnode;
 			}
+		} else {
+			FREE(vnode);
 		}
 
 		tmp_settings = device->settings;
@@ -1572,15 +2202,13 @@ static int devices_parse(JsonNode *root) {
 					strcpy(dnode->ori_uuid, pilight_uuid);
 				}
 				dnode->cst_uuid = 0;
-				if((dnode->id = MALLOC(strlen(jdevices->key)+1)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				strcpy(dnode->id, jdevices->key);
+				dnode->id = atom_get(jdevices->key);
 				dnode->nrthreads = 0;
 				dnode->timestamp = 0;
 				dnode->protocol_threads = NULL;
 				dnode->settings = NULL;
+				dnode->pack = NULL;
+				dnode->packsize = 0;
 				dnode->next = NULL;
 				dnode->protocols = NULL;
 
@@ -1630,11 +2258,7 @@ static int devices_parse(JsonNode *root) {
 							exit(EXIT_FAILURE);
 						}
 						memcpy(pnode->listener, protocol, sizeof(struct protocol_t));
-						if((pnode->name = MALLOC(strlen(jprotocol->string_)+1)) == NULL) {
-							fprintf(stderr, "out of memory\n");
-							exit(EXIT_FAILURE);
-						}
-						strcpy(pnode->name, jprotocol->string_);
+						pnode->name = atom_get(jprotocol->string_);
 						pnode->next = NULL;
 						tmp_protocols = dnode->protocols;
 						if(tmp_protocols) {
@@ -1686,6 +2310,8 @@ int devices_gc(void) {
 	struct protocols_t *ptmp = NULL;
 
 	pthread_mutex_lock(&mutex_lock);
+	devices_index_gc();
+	devices_filter_gc();
 	/* Free devices structure */
 	while(devices) {
 		dtmp = devices;
@@ -1694,36 +2320,33 @@ int devices_gc(void) {
 		event_action_thread_free(dtmp);
 #endif
 
+		/* Packed nodes are freed with their block */
 		while(dtmp->settings) {
 			stmp = dtmp->settings;
 			while(stmp->values) {
 				vtmp = stmp->values;
-				if(vtmp->type == JSON_STRING && vtmp->string_ != NULL) {
-					FREE(vtmp->string_);
-				}
-				if(vtmp->name) {
-					FREE(vtmp->name);
-				}
+				devices_value_free(dtmp, vtmp);
+				atom_put(vtmp->name);
 				stmp->values = stmp->values->next;
-				FREE(vtmp);
-			}
-			if(stmp->values != NULL) {
-				FREE(stmp->values);
-			}
-			if(stmp->name) {
-				FREE(stmp->name);
+				if(dtmp->pack == NULL) {
+					FREE(vtmp);
+				}
 			}
+			atom_put(stmp->name);
 			dtmp->settings = dtmp->settings->next;
-			FREE(stmp);
+			if(dtmp->pack == NULL) {
+				FREE(stmp);
+			}
+		}
+		if(dtmp->pack != NULL) {
+			FREE(dtmp->pack);
 		}
 		while(dtmp->protocols) {
 			ptmp = dtmp->protocols;
 			if(ptmp->listener != NULL && ptmp->listener->threadGC != NULL) {
 				ptmp->listener->threadGC();
 			}
-			if(ptmp->name != NULL) {
-				FREE(ptmp->name);
-			}
+			atom_put(ptmp->name);
 			if(ptmp->listener != NULL) {
 				FREE(ptmp->listener);
 			}
@@ -1738,12 +2361,7 @@ int devices_gc(void) {
 		if(dtmp->protocols != NULL) {
 			FREE(dtmp->protocols);
 		}
-		if(dtmp->settings != NULL) {
-			FREE(dtmp->settings);
-		}
-		if(dtmp->id != NULL) {
-			FREE(dtmp->id);
-		}
+		atom_put(dtmp->id);
 		if(dtmp->protocol_threads != NULL) {
 			FREE(dtmp->protocol_threads);
 		}
@@ -1762,7 +2380,17 @@ int devices_gc(void) {
 }
 
 int config_devices_parse(struct JsonNode *root) {
+	struct devices_t *dptr = NULL;
+
 	if(devices_parse(root) == 0 && devices_validate_settings() == 0) {
+		pthread_mutex_lock(&mutex_lock);
+		dptr = devices;
+		while(dptr) {
+			devices_pack(dptr);
+			dptr = dptr->next;
+		}
+		pthread_mutex_unlock(&mutex_lock);
+		devices_index_build();
 		return 0;
 	} else {
 		return 1;
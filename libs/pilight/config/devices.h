@@ -56,14 +56,24 @@ typedef struct devices_t devices_t;
 |------------------|
 */
 
+/*
+ * Setting and value names are atoms. Once a device is
+ * parsed, its settings, values and strings are packed
+ * into one block, the lists are kept so they can be
+ * walked as before. Strings in the block keep at least
+ * DEVICES_VALUE_INLINE bytes, so short ones can be
+ * replaced in place.
+ */
+#define DEVICES_VALUE_INLINE	16
+
 struct devices_values_t {
 	union {
 		char *string_;
 		double number_;
 	};
 	int decimals;
-	char *name;
 	int type;
+	char *name;
 	struct devices_values_t *next;
 };
 
@@ -87,6 +97,8 @@ struct devices_t {
 #endif
 	struct protocols_t *protocols;
 	struct devices_settings_t *settings;
+	void *pack;
+	size_t packsize;
 	struct threadqueue_t **protocol_threads;
 	struct devices_t *next;
 };
@@ -98,6 +110,10 @@ int devices_get(char *sid, struct devices_t **dev);
 int devices_valid_state(char *sid, char *state);
 int devices_valid_value(char *sid, char *name, char *value);
 struct JsonNode *devices_values(const char *media);
+struct JsonNode *devices_filter_print(void);
+void devices_filter_set(struct JsonNode *jfilter);
+int devices_filter_match(char *protoname, struct JsonNode *json);
+int devices_protocol_used(struct protocol_t *protocol);
 int config_devices_parse(struct JsonNode *root);
 void devices_init(void);
 int devices_gc(void);
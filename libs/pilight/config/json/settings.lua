@@ -53,7 +53,7 @@ function M.read(f)
 		'smtp-port', 'smtp-user', 'smtp-password', 'smtp-host',
 		'smtp-sender', 'smtp-ssl',
 
-		'gpio-platform',
+		'gpio-platform', 'w1-root',
 
 		'firmware-gpio-sck', 'firmware-gpio-mosi', 'firmware-gpio-miso',
 		'firmware-gpio-reset',
@@ -72,6 +72,18 @@ function M.read(f)
 
 		'stats-enable',
 
+		'lua-states', 'lua-profile',
+
+		'coalesce-interval', 'coalesce-on-change',
+
+		'duty-cycle-433', 'duty-cycle-868',
+
+		'node-filter', 'shm-enable',
+
+		'history-root',
+
+		'protocol-prune', 'protocol-listen',
+
 		'whitelist'
 	};
 
@@ -95,7 +107,8 @@ function M.read(f)
 	local keys = {
 		'storage-root', 'protocol-root', 'hardware-root',
 		'actions-root', 'functions-root', 'operators-root',
-		'webserver-root', 'log-file', 'pid-file', 'pem-file' }
+		'webserver-root', 'log-file', 'pid-file', 'pem-file', 'w1-root',
+		'history-root' }
 	for k, v in pairs(keys) do
 		if settings[v] ~= nil then
 			s = settings[v];
@@ -113,7 +126,7 @@ function M.read(f)
 	--
 	-- These settings should be a valid positive number
 	--
-	keys = { 'port', 'arp-timeout', 'arp-interval', 'smtp-port' }
+	keys = { 'port', 'arp-timeout', 'arp-interval', 'smtp-port', 'coalesce-interval' }
 	for k, v in pairs(keys) do
 		if settings[v] ~= nil then
 			s = settings[v];
@@ -156,7 +169,9 @@ function M.read(f)
 	--
 	keys = {
 		'standalone', 'watchdog-enable', 'stats-enable', 'loopback',
-		'webserver-enable', 'webserver-cache', 'webgui-websockets', 'smtp-ssl' }
+		'webserver-enable', 'webserver-cache', 'webgui-websockets', 'smtp-ssl',
+		'coalesce-on-change', 'node-filter', 'shm-enable', 'protocol-prune',
+		'lua-profile' }
 	for k, v in pairs(keys) do
 		if settings[v] ~= nil then
 			s = settings[v];
@@ -174,6 +189,24 @@ function M.read(f)
 		end
 	end
 
+	v = 'lua-states';
+	if settings[v] ~= nil then
+		s = settings[v];
+		if type(tonumber(s)) ~= 'number' or tonumber(s) < 4 or tonumber(s) > 32 then
+			error('config setting "' .. v .. '" must be from 4 till 32');
+		end
+	end
+
+	keys = { 'duty-cycle-433', 'duty-cycle-868' }
+	for k, v in pairs(keys) do
+		if settings[v] ~= nil then
+			s = settings[v];
+			if type(tonumber(s)) ~= 'number' or tonumber(s) < 1 or tonumber(s) > 100 then
+				error('config setting "' .. v .. '" must be from 1 till 100');
+			end
+		end
+	end
+
 	v = 'webserver-authentication';
 	if settings[v] ~= nil then
 		if type(settings[v]) ~= 'table' or settings[v].len() ~= 2 then
@@ -205,6 +238,18 @@ function M.read(f)
 		end
 	end
 
+	v = 'protocol-listen';
+	if settings[v] ~= nil then
+		if type(settings[v]) ~= 'table' or settings[v].len() == 0 then
+			error('config setting "' .. v .. '" must be in the format of [ \"kaku_switch\", ... ]');
+		end
+		for k, x in pairs(settings[v]) do
+			if type(x) ~= 'string' then
+				error('config setting "' .. v .. '" must be in the format of [ \"kaku_switch\", ... ]');
+			end
+		end
+	end
+
 	v = 'smtp-host'
 	if settings[v] ~= nil then
 		s = settings[v];
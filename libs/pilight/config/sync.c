@@ -0,0 +1,246 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../core/log.h"
+#include "../core/json.h"
+#include "sync.h"
+
+/*
+ * A node keeps the last configuration it received from
+ * its master. When it reconnects, it sends a version of
+ * every section and of every device in it, which is the
+ * hash of its json. The master only sends back what
+ * differs, together with the devices that no longer
+ * exist:
+ *
+ * {"action":"request config","versions":{"devices":{"lamp":1234,...},"gui":5678,...}}
+ * {"message":"config","delta":1,"config":{"devices":{...}},"removed":["tv"]}
+ *
+ * A master that doesn't know about versions just sends
+ * the full configuration, which the node handles as
+ * before.
+ *
+ * Device values are not synced separately, nodes keep
+ * them up to date from the codes the master forwards.
+ */
+static struct JsonNode *cache = NULL;
+
+static unsigned int sync_hash(const char *str) {
+	unsigned int hash = 5381;
+	while(*str) {
+		hash = ((hash << 5) + hash) + (unsigned char)*str++;
+	}
+	return hash;
+}
+
+static unsigned int sync_version(struct JsonNode *jnode) {
+	char *content = json_stringify(jnode, NULL);
+	unsigned int hash = sync_hash(content);
+	json_free(content);
+	return hash;
+}
+
+static int sync_matches(struct JsonNode *jversions, struct JsonNode *jnode) {
+	struct JsonNode *jversion = NULL;
+
+	if(jversions == NULL || jnode->key == NULL ||
+	   (jversion = json_find_member(jversions, jnode->key)) == NULL ||
+		 jversion->tag != JSON_NUMBER) {
+		return 0;
+	}
+	return ((unsigned int)jversion->number_ == sync_version(jnode));
+}
+
+static struct JsonNode *sync_versions(struct JsonNode *jconfig) {
+	struct JsonNode *jversions = json_mkobject();
+	struct JsonNode *jsection = json_first_child(jconfig);
+
+	while(jsection) {
+		if(strcmp(jsection->key, "devices") == 0 && jsection->tag == JSON_OBJECT) {
+			struct JsonNode *jdevices = json_mkobject();
+			struct JsonNode *jdevice = json_first_child(jsection);
+			while(jdevice) {
+				json_append_member(jdevices, jdevice->key, json_mknumber(sync_version(jdevice), 0));
+				jdevice = jdevice->next;
+			}
+			json_append_member(jversions, "devices", jdevices);
+		} else {
+			json_append_member(jversions, jsection->key, json_mknumber(sync_version(jsection), 0));
+		}
+		jsection = jsection->next;
+	}
+	return jversions;
+}
+
+/*
+ * Strips all sections and devices the node already has
+ * from the configuration. The names of the devices the
+ * node knows, but which no longer exist, are returned.
+ */
+struct JsonNode *sync_delta(struct JsonNode *jconfig, struct JsonNode *jversions) {
+	struct JsonNode *jremoved = json_mkarray();
+	struct JsonNode *jsection = json_first_child(jconfig), *jnext = NULL;
+	struct JsonNode *jdevices = json_find_member(jversions, "devices");
+	struct JsonNode *jdevice = NULL;
+
+	if(jdevices != NULL && jdevices->tag == JSON_OBJECT) {
+		struct JsonNode *jcurrent = json_find_member(jconfig, "devices");
+		jdevice = json_first_child(jdevices);
+		while(jdevice) {
+			if(jcurrent == NULL || json_find_member(jcurrent, jdevice->key) == NULL) {
+				json_append_element(jremoved, json_mkstring(jdevice->key));
+			}
+			jdevice = jdevice->next;
+		}
+	} else {
+		jdevices = NULL;
+	}
+
+	while(jsection) {
+		jnext = jsection->next;
+		if(strcmp(jsection->key, "devices") == 0 && jsection->tag == JSON_OBJECT) {
+			jdevice = json_first_child(jsection);
+			while(jdevice) {
+				struct JsonNode *jtmp = jdevice->next;
+				if(sync_matches(jdevices, jdevice) == 1) {
+					json_delete(jdevice);
+				}
+				jdevice = jtmp;
+			}
+			if(jdevices != NULL && json_first_child(jsection) == NULL) {
+				json_delete(jsection);
+			}
+		} else if(sync_matches(jversions, jsection) == 1) {
+			json_delete(jsection);
+		}
+		jsection = jnext;
+	}
+
+	return jremoved;
+}
+
+void sync_request(struct JsonNode *jrequest) {
+	if(cache != NULL) {
+		json_append_member(jrequest, "versions", sync_versions(cache));
+	}
+}
+
+void sync_reset(void) {
+	if(cache != NULL) {
+		json_delete(cache);
+		cache = NULL;
+	}
+}
+
+/*
+ * Merges the configuration the master sent into the
+ * cached one. Returns 1 when something changed, 0 when
+ * nothing did and -1 when the message can't be used.
+ */
+int sync_receive(struct JsonNode *jmessage, struct JsonNode **jconfig) {
+	struct JsonNode *jnew = json_find_member(jmessage, "config");
+	struct JsonNode *jremoved = json_find_member(jmessage, "removed");
+	struct JsonNode *jsection = NULL, *jnext = NULL, *jold = NULL;
+	int changed = 0;
+
+	if(jnew == NULL || jnew->tag != JSON_OBJECT) {
+		return -1;
+	}
+
+	if(json_find_member(jmessage, "delta") == NULL) {
+		json_remove_from_parent(jnew);
+		sync_reset();
+		cache = jnew;
+		*jconfig = cache;
+		return 1;
+	}
+
+	if(cache == NULL) {
+		return -1;
+	}
+
+	struct JsonNode *jdevices = json_find_member(cache, "devices");
+	if(jremoved != NULL && jremoved->tag == JSON_ARRAY && jdevices != NULL) {
+		jsection = json_first_child(jremoved);
+		while(jsection) {
+			if(jsection->tag == JSON_STRING &&
+			   (jold = json_find_member(jdevices, jsection->string_)) != NULL) {
+				json_delete(jold);
+				changed = 1;
+			}
+			jsection = jsection->next;
+		}
+	}
+
+	jsection = json_first_child(jnew);
+	while(jsection) {
+		jnext = jsection->next;
+		char key[strlen(jsection->key)+1];
+		strcpy(key, jsection->key);
+
+		if(strcmp(key, "devices") == 0 && jsection->tag == JSON_OBJECT && jdevices != NULL) {
+			if(json_first_child(jsection) == NULL) {
+				jsection = jnext;
+				continue;
+			}
+			/*
+			 * Rebuild the devices so changed ones keep
+			 * their place and new ones are appended.
+			 */
+			struct JsonNode *jmerged = json_mkobject();
+			struct JsonNode *jdevice = json_first_child(jdevices), *jtmp = NULL;
+			while(jdevice) {
+				jtmp = jdevice->next;
+				char name[strlen(jdevice->key)+1];
+				strcpy(name, jdevice->key);
+				json_remove_from_parent(jdevice);
+				if((jold = json_find_member(jsection, name)) != NULL) {
+					json_remove_from_parent(jold);
+					json_delete(jdevice);
+					jdevice = jold;
+				}
+				json_append_member(jmerged, name, jdevice);
+				jdevice = jtmp;
+			}
+			jdevice = json_first_child(jsection);
+			while(jdevice) {
+				jtmp = jdevice->next;
+				char name[strlen(jdevice->key)+1];
+				strcpy(name, jdevice->key);
+				json_remove_from_parent(jdevice);
+				json_append_member(jmerged, name, jdevice);
+				jdevice = jtmp;
+			}
+			json_delete(jdevices);
+			json_append_member(cache, "devices", jmerged);
+			jdevices = jmerged;
+		} else {
+			if((jold = json_find_member(cache, key)) != NULL) {
+				json_delete(jold);
+			}
+			json_remove_from_parent(jsection);
+			json_append_member(cache, key, jsection);
+		}
+		changed = 1;
+		jsection = jnext;
+	}
+
+	*jconfig = cache;
+	return changed;
+}
+
+int sync_gc(void) {
+	sync_reset();
+
+	logprintf(LOG_DEBUG, "garbage collected config sync library");
+	return 0;
+}
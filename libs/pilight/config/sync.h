@@ -0,0 +1,28 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _SYNC_H_
+#define _SYNC_H_
+
+#include "../core/json.h"
+
+/*
+ * Master side
+ */
+struct JsonNode *sync_delta(struct JsonNode *jconfig, struct JsonNode *jversions);
+
+/*
+ * Node side
+ */
+void sync_request(struct JsonNode *jrequest);
+int sync_receive(struct JsonNode *jmessage, struct JsonNode **jconfig);
+void sync_reset(void);
+
+int sync_gc(void);
+
+#endif
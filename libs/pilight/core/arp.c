@@ -36,6 +36,15 @@
  *
  */
 
+#include <stdint.h>
+#ifdef _WIN32
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+#else
+	#include <netinet/in.h>
+	#include <arpa/inet.h>
+#endif
+
 #include "log.h"
 
 #ifdef __aarch64__
@@ -429,14 +438,19 @@ static int recvfrom_wto(long unsigned int tmo, pcap_t *pcap_handle) {
 	return -1;
 }
 
-int arp_resolv(char *if_name, char *srcmac, char *dstmac, char **ip) {
+/*
+ * Sends an ARP request to all hosts added with arp_add_host
+ * and calls found for every host that replied. The host
+ * list is emptied afterwards.
+ */
+static int arp_sweep(char *if_name, char *srcmac, void (*found)(uint8_t *, struct in_addr *, void *), void *userdata) {
 	struct timeval now, diff, last_packet_time;
 	pcap_t *pcap_handle = NULL;
 	unsigned long int loop_timediff = 0, host_timediff = 0;
 	unsigned long int req_interval = 0, select_timeout = 0;
 	unsigned long int cum_err = 0, interval = 0;
 	char *if_cpy = NULL, error[PCAP_ERRBUF_SIZE], *e = error;
-	int found = -1;
+	int ret = -1;
 	int reset_cum_err = 0, first_timeout = 1;
 	int i = 0;
 
@@ -557,20 +571,10 @@ int arp_resolv(char *if_name, char *srcmac, char *dstmac, char **ip) {
 
 	for(i=0;i<num_hosts;i++) {
 		if(helist[i]->found == 1) {
-			char fmac[ETH_ALEN];
-			memset(fmac, '\0', ETH_ALEN);
-			sprintf(fmac, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",
-													helist[i]->mac[0], helist[i]->mac[1],
-													helist[i]->mac[2], helist[i]->mac[3],
-													helist[i]->mac[4], helist[i]->mac[5]);
-			if(strcmp(fmac, dstmac) == 0) {
-				memset(*ip, '\0', INET_ADDRSTRLEN+1);
-				inet_ntop(AF_INET, (void *)&(helist[i]->addr), *ip, INET_ADDRSTRLEN+1);
-				found = 1;
-				break;
-			}
+			found(helist[i]->mac, &helist[i]->addr, userdata);
 		}
 	}
+	ret = 0;
 
 close:
 	if(pcap_handle != NULL) {
@@ -586,11 +590,388 @@ close:
 	helist = NULL;
 	num_hosts = 0;
 
-	if(found == 1) {
+	return ret;
+}
+
+typedef struct arp_resolv_t {
+	char *dstmac;
+	char *ip;
+	int found;
+} arp_resolv_t;
+
+static void arp_resolv_found(uint8_t *mac, struct in_addr *addr, void *userdata) {
+	struct arp_resolv_t *data = userdata;
+	char fmac[18];
+
+	if(data->found == 1) {
+		return;
+	}
+
+	memset(fmac, '\0', sizeof(fmac));
+	snprintf(fmac, sizeof(fmac), "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",
+		mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+	if(strcmp(fmac, data->dstmac) == 0) {
+		memset(data->ip, '\0', INET_ADDRSTRLEN+1);
+		inet_ntop(AF_INET, (void *)addr, data->ip, INET_ADDRSTRLEN+1);
+		data->found = 1;
+	}
+}
+
+int arp_resolv(char *if_name, char *srcmac, char *dstmac, char **ip) {
+	struct arp_resolv_t data;
+
+	data.dstmac = dstmac;
+	data.ip = *ip;
+	data.found = 0;
+
+	if(arp_sweep(if_name, srcmac, arp_resolv_found, &data) == 0 && data.found == 1) {
 		return 0;
+	}
+	return -1;
+}
+
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifndef _WIN32
+	#ifdef __mips__
+		#define __USE_UNIX98
+	#endif
+#endif
+#include <pthread.h>
+
+#include "../../libuv/uv.h"
+#include "network.h"
+#include "common.h"
+#include "mem.h"
+#include "eventpool.h"
+#include "eventpool_structs.h"
+#include "arp.h"
+
+/*
+ * Hosts are resolved by a single scanner per interface.
+ * When a lookup finds the scanner table older than half
+ * the poll interval, one sweep is done for all devices.
+ * The sweep only probes the last known addresses of the
+ * watched devices, unless one of them is missing. Only
+ * then the whole /24 is swept.
+ */
+typedef struct arp_host_t {
+	char mac[18];
+	char ip[INET_ADDRSTRLEN+1];
+	uint64_t last_seen;
+	int watched;
+	int connected;
+	int seen;
+	struct arp_host_t *next;
+} arp_host_t;
+
+typedef struct arp_scanner_t {
+	char *dev;
+	char srcmac[ETH_ALEN];
+	int srcip[4];
+	int scanning;
+	uint64_t stamp;
+	struct arp_host_t *hosts;
+	struct arp_scanner_t *next;
+} arp_scanner_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t sweep_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t arp_signal = PTHREAD_COND_INITIALIZER;
+static struct arp_scanner_t *scanners = NULL;
+
+static void *reason_arp_device_free(void *param) {
+	struct reason_arp_device_t *data = param;
+	FREE(data);
+	return NULL;
+}
+
+static void arp_trigger(int reason, struct arp_host_t *host) {
+	struct reason_arp_device_t *data = MALLOC(sizeof(struct reason_arp_device_t));
+	if(data == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(data, 0, sizeof(struct reason_arp_device_t));
+	strncpy(data->mac, host->mac, sizeof(data->mac)-1);
+	strncpy(data->ip, host->ip, sizeof(data->ip)-1);
+
+	eventpool_trigger(reason, reason_arp_device_free, data);
+}
+
+static struct arp_host_t *arp_host_get(struct arp_scanner_t *scanner, char *mac) {
+	struct arp_host_t *node = scanner->hosts;
+	while(node) {
+		if(strcmp(node->mac, mac) == 0) {
+			return node;
+		}
+		node = node->next;
+	}
+
+	if((node = MALLOC(sizeof(struct arp_host_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(node, 0, sizeof(struct arp_host_t));
+	strncpy(node->mac, mac, sizeof(node->mac)-1);
+
+	node->next = scanner->hosts;
+	scanner->hosts = node;
+
+	return node;
+}
+
+static struct arp_scanner_t *arp_scanner_get(char *dev) {
+	struct arp_scanner_t *node = scanners;
+	char ip[INET_ADDRSTRLEN+1], *p = ip, *a = NULL;
+
+	while(node) {
+		if(strcmp(node->dev, dev) == 0) {
+			return node;
+		}
+		node = node->next;
+	}
+
+	if((node = MALLOC(sizeof(struct arp_scanner_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(node, 0, sizeof(struct arp_scanner_t));
+	a = node->srcmac;
+
+	memset(&ip, '\0', INET_ADDRSTRLEN+1);
+	if(dev2ip(dev, &p, AF_INET) != 0) {
+		logprintf(LOG_ERR, "could not determine host ip address");
+		FREE(node);
+		return NULL;
+	}
+
+	if(dev2mac(dev, &a) != 0 || (node->srcmac[0] == 0 && node->srcmac[1] == 0 &&
+		node->srcmac[2] == 0 && node->srcmac[3] == 0 &&
+		node->srcmac[4] == 0 && node->srcmac[5] == 0)) {
+		logprintf(LOG_ERR, "could not obtain MAC address for interface %s", dev);
+		FREE(node);
+		return NULL;
+	}
+
+	if(sscanf(ip, "%d.%d.%d.%d", &node->srcip[0], &node->srcip[1], &node->srcip[2], &node->srcip[3]) != 4) {
+		logprintf(LOG_ERR, "could not extract ip address");
+		FREE(node);
+		return NULL;
+	}
+
+	if((node->dev = STRDUP(dev)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+
+	node->next = scanners;
+	scanners = node;
+
+	return node;
+}
+
+/*
+ * Use the addresses the kernel already knows as a
+ * starting point for the watched devices.
+ */
+static void arp_seed(struct arp_scanner_t *scanner) {
+	struct arp_host_t *host = NULL;
+	char line[256], ip[INET_ADDRSTRLEN+1], mac[18], dev[32];
+	unsigned int flags = 0;
+	FILE *fp = NULL;
+	int i = 0;
+
+	if((fp = fopen("/proc/net/arp", "r")) == NULL) {
+		return;
+	}
+
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		if(sscanf(line, "%16s %*s %x %17s %*s %31s", ip, &flags, mac, dev) != 4) {
+			continue;
+		}
+		if((flags & 0x2) == 0 || strcmp(dev, scanner->dev) != 0) {
+			continue;
+		}
+		for(i=0;i<strlen(mac);i++) {
+			mac[i] = (char)tolower(mac[i]);
+		}
+		host = scanner->hosts;
+		while(host) {
+			if(host->watched == 1 && strlen(host->ip) == 0 && strcmp(host->mac, mac) == 0) {
+				strcpy(host->ip, ip);
+				break;
+			}
+			host = host->next;
+		}
+	}
+	fclose(fp);
+}
+
+#ifndef __aarch64__
+static void arp_scanner_found(uint8_t *mac, struct in_addr *addr, void *userdata) {
+	struct arp_scanner_t *scanner = userdata;
+	struct arp_host_t *host = NULL;
+	char fmac[18], ip[INET_ADDRSTRLEN+1];
+
+	memset(fmac, '\0', sizeof(fmac));
+	snprintf(fmac, sizeof(fmac), "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",
+		mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+	memset(ip, '\0', sizeof(ip));
+	inet_ntop(AF_INET, (void *)addr, ip, sizeof(ip));
+
+	pthread_mutex_lock(&lock);
+	host = arp_host_get(scanner, fmac);
+	if(host->watched == 1 && host->connected == 1 && strcmp(host->ip, ip) != 0) {
+		logprintf(LOG_NOTICE, "ip address of %s changed from %s to %s", fmac, host->ip, ip);
+		strcpy(host->ip, ip);
+		arp_trigger(REASON_ARP_CHANGED_DEVICE, host);
+	}
+	strcpy(host->ip, ip);
+	host->seen = 1;
+	host->last_seen = uv_hrtime()/1000000;
+	pthread_mutex_unlock(&lock);
+}
+#endif
+
+/*
+ * Called with the lock held. The lock is released
+ * while the interface is being swept.
+ */
+static void arp_scanner_refresh(struct arp_scanner_t *scanner) {
+	struct arp_host_t *host = NULL;
+	char **ips = NULL;
+	int full = 0, nrips = 0, i = 0;
+
+	scanner->scanning = 1;
+
+	arp_seed(scanner);
+
+	host = scanner->hosts;
+	while(host) {
+		if(host->watched == 1 && (strlen(host->ip) == 0 || host->connected == 0)) {
+			full = 1;
+		}
+		host->seen = 0;
+		host = host->next;
+	}
+
+	if(full == 1) {
+		if((ips = MALLOC(sizeof(char *)*255)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		for(i=0;i<255;i++) {
+			if((ips[nrips] = MALLOC(INET_ADDRSTRLEN+1)) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+			snprintf(ips[nrips++], INET_ADDRSTRLEN+1, "%d.%d.%d.%d", scanner->srcip[0], scanner->srcip[1], scanner->srcip[2], i);
+		}
 	} else {
+		host = scanner->hosts;
+		while(host) {
+			if(host->watched == 1) {
+				if((ips = REALLOC(ips, sizeof(char *)*(nrips+1))) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+				}
+				if((ips[nrips++] = STRDUP(host->ip)) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+				}
+			}
+			host = host->next;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	/*
+	 * The host list of the sweep is shared, so
+	 * only one interface can be swept at a time.
+	 */
+	pthread_mutex_lock(&sweep_lock);
+	for(i=0;i<nrips;i++) {
+		arp_add_host(ips[i]);
+	}
+#ifdef __aarch64__
+	logprintf(LOG_ERR, "the ARP library is not supported on aarch64");
+#else
+	arp_sweep(scanner->dev, scanner->srcmac, arp_scanner_found, scanner);
+#endif
+	pthread_mutex_unlock(&sweep_lock);
+
+	array_free(&ips, nrips);
+
+	pthread_mutex_lock(&lock);
+	host = scanner->hosts;
+	while(host) {
+		if(host->watched == 1) {
+			if(host->seen == 1 && host->connected == 0) {
+				host->connected = 1;
+				arp_trigger(REASON_ARP_FOUND_DEVICE, host);
+			} else if(host->seen == 0 && host->connected == 1) {
+				host->connected = 0;
+				arp_trigger(REASON_ARP_LOST_DEVICE, host);
+			}
+		}
+		host = host->next;
+	}
+
+	scanner->stamp = uv_hrtime()/1000000;
+	scanner->scanning = 0;
+	pthread_cond_broadcast(&arp_signal);
+}
+
+int arp_lookup(char *if_name, char *mac, int interval, char *ip) {
+	struct arp_scanner_t *scanner = NULL;
+	struct arp_host_t *host = NULL;
+	int ret = -1;
+
+	pthread_mutex_lock(&lock);
+	if((scanner = arp_scanner_get(if_name)) == NULL) {
+		pthread_mutex_unlock(&lock);
 		return -1;
 	}
+	host = arp_host_get(scanner, mac);
+	host->watched = 1;
+
+	while(scanner->stamp == 0 || (uv_hrtime()/1000000)-scanner->stamp >= (uint64_t)interval*500) {
+		if(scanner->scanning == 1) {
+			pthread_cond_wait(&arp_signal, &lock);
+		} else {
+			arp_scanner_refresh(scanner);
+			break;
+		}
+	}
+
+	if(host->connected == 1) {
+		strcpy(ip, host->ip);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return ret;
 }
 
-#endif
+int arp_gc(void) {
+	struct arp_scanner_t *scanner = NULL;
+	struct arp_host_t *host = NULL;
+
+	pthread_mutex_lock(&lock);
+	while(scanners) {
+		scanner = scanners;
+		while(scanner->scanning == 1) {
+			pthread_cond_wait(&arp_signal, &lock);
+		}
+		while(scanner->hosts) {
+			host = scanner->hosts;
+			scanner->hosts = scanner->hosts->next;
+			FREE(host);
+		}
+		scanners = scanners->next;
+		FREE(scanner->dev);
+		FREE(scanner);
+	}
+	pthread_mutex_unlock(&lock);
+
+	logprintf(LOG_DEBUG, "garbage collected arp library");
+	return 0;
+}
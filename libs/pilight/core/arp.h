@@ -27,3 +27,5 @@
 
 void arp_add_host(const char *host_name);
 int arp_resolv(char *if_name, char *srcmac, char *dstmac, char **ip);
+int arp_lookup(char *if_name, char *mac, int interval, char *ip);
+int arp_gc(void);
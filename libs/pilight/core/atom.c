@@ -0,0 +1,108 @@
+/*
+	Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mem.h"
+#include "log.h"
+#include "atom.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct atom_t *atoms[ATOM_SIZE];
+
+unsigned int atom_hash(const char *str) {
+	unsigned int hash = 5381;
+	int c = 0;
+
+	while((c = *str++) != '\0') {
+		hash = ((hash << 5) + hash) + c;
+	}
+	return hash;
+}
+
+char *atom_get(const char *str) {
+	struct atom_t *node = NULL;
+	unsigned int hash = atom_hash(str);
+	int len = 0;
+
+	pthread_mutex_lock(&lock);
+	node = atoms[hash % ATOM_SIZE];
+	while(node) {
+		if(node->hash == hash && strcmp(node->name, str) == 0) {
+			node->refs++;
+			pthread_mutex_unlock(&lock);
+			return node->name;
+		}
+		node = node->next;
+	}
+
+	len = strlen(str);
+	if((node = MALLOC(sizeof(struct atom_t)+len+1)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	node->hash = hash;
+	node->refs = 1;
+	memcpy(node->name, str, len+1);
+	node->next = atoms[hash % ATOM_SIZE];
+	atoms[hash % ATOM_SIZE] = node;
+	pthread_mutex_unlock(&lock);
+
+	return node->name;
+}
+
+void atom_put(char *atom) {
+	struct atom_t *node = NULL, *prev = NULL, *tmp = NULL;
+
+	if(atom == NULL) {
+		return;
+	}
+
+	node = (struct atom_t *)(atom-offsetof(struct atom_t, name));
+
+	pthread_mutex_lock(&lock);
+	if(--node->refs > 0) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	tmp = atoms[node->hash % ATOM_SIZE];
+	while(tmp != NULL && tmp != node) {
+		prev = tmp;
+		tmp = tmp->next;
+	}
+	if(tmp != NULL) {
+		if(prev == NULL) {
+			atoms[node->hash % ATOM_SIZE] = node->next;
+		} else {
+			prev->next = node->next;
+		}
+		FREE(node);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+int atom_gc(void) {
+	struct atom_t *node = NULL;
+	int i = 0;
+
+	pthread_mutex_lock(&lock);
+	for(i=0;i<ATOM_SIZE;i++) {
+		while(atoms[i]) {
+			node = atoms[i];
+			atoms[i] = atoms[i]->next;
+			FREE(node);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	logprintf(LOG_DEBUG, "garbage collected atom library");
+	return 0;
+}
@@ -0,0 +1,42 @@
+/*
+	Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _ATOM_H_
+#define _ATOM_H_
+
+#include <stddef.h>
+
+/*
+ * Atoms are strings that are stored only once. Getting
+ * the same string twice returns the same pointer, so a
+ * thousand devices with a "state" setting share a single
+ * copy of it. Every atom_get must be matched by an
+ * atom_put, the atom is freed when the last one is put.
+ *
+ * Two atoms are equal when their pointers are. A plain
+ * string can be compared with an atom by first checking
+ * the hash stored in front of the atom against that of
+ * the string.
+ */
+#define ATOM_SIZE		1024
+
+typedef struct atom_t {
+	unsigned int hash;
+	int refs;
+	struct atom_t *next;
+	char name[];
+} atom_t;
+
+#define ATOM_HASH(a) (((struct atom_t *)((a)-offsetof(struct atom_t, name)))->hash)
+
+unsigned int atom_hash(const char *str);
+char *atom_get(const char *str);
+void atom_put(char *atom);
+int atom_gc(void);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+	Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+#include "log.h"
+#include "capture.h"
+
+static void varint_write(FILE *fp, unsigned long long value) {
+	do {
+		unsigned char byte = value & 0x7F;
+		value >>= 7;
+		if(value > 0) {
+			byte |= 0x80;
+		}
+		fputc(byte, fp);
+	} while(value > 0);
+}
+
+static int varint_read(FILE *fp, unsigned long long *value) {
+	int c = 0, shift = 0;
+
+	*value = 0;
+	while((c = fgetc(fp)) != EOF) {
+		if(shift > 63) {
+			return -1;
+		}
+		*value |= (unsigned long long)(c & 0x7F) << shift;
+		if((c & 0x80) == 0) {
+			return 0;
+		}
+		shift += 7;
+	}
+	return -1;
+}
+
+struct capture_t *capture_open(char *file, int write) {
+	struct capture_t *capture = NULL;
+	char magic[5];
+	FILE *fp = NULL;
+
+	if((fp = fopen(file, (write == 1) ? "wb" : "rb")) == NULL) {
+		logprintf(LOG_ERR, "cannot open capture file %s", file);
+		return NULL;
+	}
+
+	if(write == 1) {
+		fwrite(CAPTURE_MAGIC, 1, 4, fp);
+		fputc(CAPTURE_VERSION, fp);
+	} else {
+		memset(&magic, 0, 5);
+		if(fread(magic, 1, 4, fp) != 4 || strcmp(magic, CAPTURE_MAGIC) != 0 ||
+			 fgetc(fp) != CAPTURE_VERSION) {
+			logprintf(LOG_ERR, "%s is not a valid capture file", file);
+			fclose(fp);
+			return NULL;
+		}
+	}
+
+	if((capture = MALLOC(sizeof(struct capture_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	capture->fp = fp;
+	capture->write = write;
+	capture->last = 0;
+	capture->flushed = 0;
+#ifdef _WIN32
+	uv_mutex_init(&capture->lock);
+#else
+	pthread_mutex_init(&capture->lock, NULL);
+#endif
+
+	return capture;
+}
+
+int capture_write(struct capture_t *capture, unsigned long long timestamp, char *hardware, int *pulses, int length) {
+	int i = 0, len = strlen(hardware);
+
+	if(capture == NULL || capture->write == 0 || length <= 0) {
+		return -1;
+	}
+	if(len > 255) {
+		len = 255;
+	}
+
+	/* Every hardware module receives in its own thread */
+#ifdef _WIN32
+	uv_mutex_lock(&capture->lock);
+#else
+	pthread_mutex_lock(&capture->lock);
+#endif
+	varint_write(capture->fp, (timestamp > capture->last) ? timestamp - capture->last : 0);
+	capture->last = timestamp;
+
+	fputc(len, capture->fp);
+	fwrite(hardware, 1, len, capture->fp);
+
+	varint_write(capture->fp, length);
+	for(i=0;i<length;i++) {
+		varint_write(capture->fp, (pulses[i] > 0) ? pulses[i] : 0);
+	}
+	if(timestamp-capture->flushed >= CAPTURE_FLUSH*1000000ULL) {
+		fflush(capture->fp);
+		capture->flushed = timestamp;
+	}
+#ifdef _WIN32
+	uv_mutex_unlock(&capture->lock);
+#else
+	pthread_mutex_unlock(&capture->lock);
+#endif
+
+	return 0;
+}
+
+/*
+ * Returns 1 when a record was read, 0 at the
+ * end of the file and -1 on a corrupt record.
+ */
+int capture_read(struct capture_t *capture, unsigned long long *timestamp, char *hardware, int hwlen, int *pulses, int *length, int max) {
+	unsigned long long value = 0;
+	int i = 0, len = 0, c = 0;
+
+	if(capture == NULL || capture->write == 1) {
+		return -1;
+	}
+
+	if((c = fgetc(capture->fp)) == EOF) {
+		return 0;
+	}
+	ungetc(c, capture->fp);
+
+	if(varint_read(capture->fp, &value) == -1) {
+		return -1;
+	}
+	capture->last += value;
+	*timestamp = capture->last;
+
+	if((len = fgetc(capture->fp)) == EOF || len >= hwlen) {
+		return -1;
+	}
+	if(fread(hardware, 1, len, capture->fp) != len) {
+		return -1;
+	}
+	hardware[len] = '\0';
+
+	if(varint_read(capture->fp, &value) == -1 || value > max) {
+		return -1;
+	}
+	*length = (int)value;
+
+	for(i=0;i<*length;i++) {
+		if(varint_read(capture->fp, &value) == -1) {
+			return -1;
+		}
+		pulses[i] = (int)value;
+	}
+
+	return 1;
+}
+
+void capture_close(struct capture_t *capture) {
+	if(capture == NULL) {
+		return;
+	}
+	fclose(capture->fp);
+#ifdef _WIN32
+	uv_mutex_destroy(&capture->lock);
+#else
+	pthread_mutex_destroy(&capture->lock);
+#endif
+	FREE(capture);
+}
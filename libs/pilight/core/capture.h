@@ -0,0 +1,52 @@
+/*
+	Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdio.h>
+#ifdef _WIN32
+	#include "../../libuv/uv.h"
+#else
+	#include <pthread.h>
+#endif
+
+/*
+ * Pulse train capture files start with the four byte
+ * magic "PLCP" followed by a single version byte. Each
+ * record then consists of:
+ * - varint: microseconds since the previous record
+ * - byte: length of the hardware name
+ * - bytes: hardware name (not null terminated)
+ * - varint: number of pulses
+ * - varint: each pulse
+ * Varints are unsigned LEB128.
+ */
+#define CAPTURE_MAGIC		"PLCP"
+#define CAPTURE_VERSION	1
+/* Seconds written records may stay buffered */
+#define CAPTURE_FLUSH		5
+
+typedef struct capture_t {
+	FILE *fp;
+	int write;
+	unsigned long long last;
+	unsigned long long flushed;
+#ifdef _WIN32
+	uv_mutex_t lock;
+#else
+	pthread_mutex_t lock;
+#endif
+} capture_t;
+
+struct capture_t *capture_open(char *file, int write);
+int capture_write(struct capture_t *capture, unsigned long long timestamp, char *hardware, int *pulses, int length);
+int capture_read(struct capture_t *capture, unsigned long long *timestamp, char *hardware, int hwlen, int *pulses, int *length, int max);
+void capture_close(struct capture_t *capture);
+
+#endif
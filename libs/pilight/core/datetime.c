@@ -17,6 +17,7 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <limits.h>
 #include <assert.h>
 #ifndef _WIN32
 	#ifdef __mips__
@@ -1153,11 +1154,149 @@ static uv_mutex_t mutex_lock;
 // static pthread_mutexattr_t mutex_attr;
 static unsigned short mutex_init = 0;
 
+/*
+ * The timezone polygons are indexed in a grid of
+ * TZGRID_CELL by TZGRID_CELL degrees. Each cell lists,
+ * in tzdata order, the timezones of which the bounding
+ * box widened by the largest search margin overlaps
+ * with that cell. coord2tz only has to look at the
+ * timezones in the cell of the requested coordinate.
+ */
+#define TZGRID_CELL		5
+#define TZGRID_COLS		(360/TZGRID_CELL)
+#define TZGRID_ROWS		(180/TZGRID_CELL)
+#define TZMEMO_SIZE		16
+
+struct tzbbox_t {
+	int minx;
+	int maxx;
+	int miny;
+	int maxy;
+};
+
+struct tzcell_t {
+	int nr;
+	unsigned short *tz;
+};
+
+static struct tzbbox_t *tzbbox = NULL;
+static struct tzcell_t tzgrid[TZGRID_COLS][TZGRID_ROWS];
+static int tzgrid_init = 0;
+
+/*
+ * The lookup only depends on the rounded
+ * coordinates, so recent results are
+ * remembered by those.
+ */
+static struct {
+	int x;
+	int y;
+	char *tz;
+} tzmemo[TZMEMO_SIZE];
+static int tzmemo_nr = 0;
+static int tzmemo_pos = 0;
+
+/*
+ * Timezone names are looked up through an open
+ * addressing hash table of indexes into timezones[].
+ * An index is stored incremented by one, so zero
+ * marks an empty slot.
+ */
+#define NRTIMEZONES		(sizeof(timezones)/sizeof(timezones[0]))
+#define TZHASH_SIZE		1024
+
+static const char *tznames[NRTIMEZONES];
+static unsigned short tzhash[TZHASH_SIZE];
+static uv_once_t tzhash_once = UV_ONCE_INIT;
+
+/*
+ * For each timezone the offset of the last conversion
+ * is remembered, together with the period in which
+ * that offset is known not to change. That period
+ * ends at the first possible DST transition, the end
+ * of the era, or the end of the year.
+ */
+struct tzcache_t {
+	time_t from;
+	time_t until;
+	int gmtoff;
+	int isdst;
+};
+
+static struct tzcache_t tzcache[NRTIMEZONES];
+static uv_mutex_t tzcache_lock;
+
+static int tzgrid_col(int x) {
+	int i = (x+(180*(int)pow(10, PRECISION)))/(TZGRID_CELL*(int)pow(10, PRECISION));
+	return min(max(i, 0), TZGRID_COLS-1);
+}
+
+static int tzgrid_row(int y) {
+	int i = (y+(90*(int)pow(10, PRECISION)))/(TZGRID_CELL*(int)pow(10, PRECISION));
+	return min(max(i, 0), TZGRID_ROWS-1);
+}
+
+static void tzgrid_create(void) {
+	int nrtz = sizeof(tzdata)/sizeof(tzdata[0]);
+	int margin = 5*(int)pow(10, PRECISION);
+	int i = 0, a = 0, col = 0, row = 0;
+
+	if((tzbbox = MALLOC(sizeof(struct tzbbox_t)*nrtz)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(&tzgrid, 0, sizeof(tzgrid));
+
+	for(i=0;i<nrtz;i++) {
+		tzbbox[i].minx = tzbbox[i].miny = INT_MAX;
+		tzbbox[i].maxx = tzbbox[i].maxy = INT_MIN;
+		for(a=0;a<tzdata[i].nrcoords;a++) {
+			tzbbox[i].minx = min(tzbbox[i].minx, tzdata[i].coords[a][0]);
+			tzbbox[i].maxx = max(tzbbox[i].maxx, tzdata[i].coords[a][0]);
+			tzbbox[i].miny = min(tzbbox[i].miny, tzdata[i].coords[a][1]);
+			tzbbox[i].maxy = max(tzbbox[i].maxy, tzdata[i].coords[a][1]);
+		}
+		if(tzdata[i].nrcoords == 0) {
+			continue;
+		}
+		for(col=tzgrid_col(tzbbox[i].minx-margin);col<=tzgrid_col(tzbbox[i].maxx+margin);col++) {
+			for(row=tzgrid_row(tzbbox[i].miny-margin);row<=tzgrid_row(tzbbox[i].maxy+margin);row++) {
+				struct tzcell_t *cell = &tzgrid[col][row];
+				if((cell->tz = REALLOC(cell->tz, sizeof(unsigned short)*(cell->nr+1))) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+				}
+				cell->tz[cell->nr++] = i;
+			}
+		}
+	}
+	tzgrid_init = 1;
+}
+
+static void tzgrid_gc(void) {
+	int col = 0, row = 0;
+
+	if(tzgrid_init == 0) {
+		return;
+	}
+	for(col=0;col<TZGRID_COLS;col++) {
+		for(row=0;row<TZGRID_ROWS;row++) {
+			if(tzgrid[col][row].tz != NULL) {
+				FREE(tzgrid[col][row].tz);
+			}
+			tzgrid[col][row].nr = 0;
+		}
+	}
+	FREE(tzbbox);
+	tzmemo_nr = 0;
+	tzmemo_pos = 0;
+	tzgrid_init = 0;
+}
+
 void datetime_init(void) {
 	// pthread_mutexattr_init(&mutex_attr);
 	// pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_RECURSIVE);
 	// pthread_mutex_init(&mutex_lock, &mutex_attr);
 	uv_mutex_init(&mutex_lock);
+	uv_mutex_init(&tzcache_lock);
 	mutex_init = 1;
 }
 
@@ -1169,6 +1308,13 @@ int datetime_gc(void) {
   usleep(10);
 #endif
 	}
+	if(mutex_init == 1) {
+		uv_mutex_lock(&mutex_lock);
+	}
+	tzgrid_gc();
+	if(mutex_init == 1) {
+		uv_mutex_unlock(&mutex_lock);
+	}
 	logprintf(LOG_DEBUG, "garbage collected datetime library");
 	return EXIT_SUCCESS;
 }
@@ -1182,16 +1328,37 @@ char *coord2tz(double longitude, double latitude) {
 		uv_mutex_lock(&mutex_lock);
 	}
 	searchingtz++;
-	int i = 0, a = 0, margin = 1, inside = 0;
-	int nrtz = sizeof(tzdata)/sizeof(tzdata[0]);
+	int i = 0, a = 0, c = 0, margin = 1, inside = 0;
 	char *tz = NULL;
 
 	margin *= (int)pow(10, PRECISION);
 	int y = (int)round(latitude*(int)pow(10, PRECISION));
 	int x = (int)round(longitude*(int)pow(10, PRECISION));
 
+	for(i=0;i<tzmemo_nr;i++) {
+		if(tzmemo[i].x == x && tzmemo[i].y == y) {
+			tz = tzmemo[i].tz;
+			goto done;
+		}
+	}
+
+	if(tzgrid_init == 0) {
+		tzgrid_create();
+	}
+
+	struct tzcell_t *cell = &tzgrid[tzgrid_col(x)][tzgrid_row(y)];
+
 	while(!inside && margin < (5*(int)pow(10, PRECISION))) {
-		for(i=0;i<nrtz;i++) {
+		for(c=0;c<cell->nr;c++) {
+			i = cell->tz[c];
+			/*
+			 * Only timezones with a coordinate within
+			 * the current margin can match.
+			 */
+			if(x <= tzbbox[i].minx-margin || x >= tzbbox[i].maxx+margin ||
+				 y <= tzbbox[i].miny-margin || y >= tzbbox[i].maxy+margin) {
+				continue;
+			}
 			unsigned int n = tzdata[i].nrcoords;
 			if(n > 0) {
 				int p1x = 0;
@@ -1238,6 +1405,15 @@ char *coord2tz(double longitude, double latitude) {
 		margin *= (int)pow(10, PRECISION);
 	}
 
+	tzmemo[tzmemo_pos].x = x;
+	tzmemo[tzmemo_pos].y = y;
+	tzmemo[tzmemo_pos].tz = tz;
+	tzmemo_pos = (tzmemo_pos+1) % TZMEMO_SIZE;
+	if(tzmemo_nr < TZMEMO_SIZE) {
+		tzmemo_nr++;
+	}
+
+done:
 	searchingtz--;
 	if(mutex_init == 1) {
 		uv_mutex_unlock(&mutex_lock);
@@ -1621,7 +1797,111 @@ int __localtime_utc(time_t timer, struct tm *tm) {
 	}
 }
 
+static unsigned int tzname_hash(const char *name) {
+	unsigned int hash = 5381;
+	while(*name != '\0') {
+		hash = ((hash << 5) + hash) + (unsigned char)*name++;
+	}
+	return hash;
+}
+
+static void tzhash_create(void) {
+	const char *timezone_name = timezone_names;
+	unsigned int h = 0;
+	int x = 0;
+
+	memset(&tzhash, 0, sizeof(tzhash));
+	while(*timezone_name != '\0' && x < NRTIMEZONES) {
+		tznames[x] = timezone_name;
+		h = tzname_hash(timezone_name) & (TZHASH_SIZE-1);
+		while(tzhash[h] != 0) {
+			h = (h+1) & (TZHASH_SIZE-1);
+		}
+		tzhash[h] = x+1;
+		++x;
+		timezone_name += strlen(timezone_name) + 1;
+	}
+}
+
+static int tzname_lookup(const char *timezone) {
+	unsigned int h = 0;
+
+	uv_once(&tzhash_once, tzhash_create);
+
+	h = tzname_hash(timezone) & (TZHASH_SIZE-1);
+	while(tzhash[h] != 0) {
+		if(strcmp(tznames[tzhash[h]-1], timezone) == 0) {
+			return tzhash[h]-1;
+		}
+		h = (h+1) & (TZHASH_SIZE-1);
+	}
+	return -1;
+}
+
+static time_t days_since_epoch(int year, int month, int day) {
+	time_t days = 0;
+	int i = 0;
+
+	for(i=1970;i<year;i++) {
+		days += 365 + is_leap(i);
+	}
+	for(i=1969;i>=year;i--) {
+		days -= 365 + is_leap(i);
+	}
+	return days + get_months_cumulative(year)[month] + day - 1;
+}
+
+/*
+ * Determine the earliest moment after t at which the
+ * offset of a DST era can change. Returns zero when
+ * a rule might fire that close to t that the moment
+ * can't be determined without the full rule lookup.
+ */
+static time_t next_transition(const struct lc_timezone_era *era, const struct tm *std, time_t t) {
+	time_t until = 0, earliest = 0, latest = 0, days = 0;
+	int year = std->tm_year, maxsave = 0, wday = 0;
+	size_t i = 0;
+
+	for(i=0; i<era->rules_count; ++i) {
+		maxsave = max(maxsave, (int)era->rules[i].save);
+	}
+
+	/*
+	 * The set of applicable rules is determined per year.
+	 */
+	until = days_since_epoch(year+1901, 0, 1)*86400 - era->gmtoff;
+
+	for(i=0; i<era->rules_count; ++i) {
+		const struct lc_timezone_rule *rule = &era->rules[i];
+		if(rule->year_from > year || (rule->year_to != UINT8_MAX && rule->year_to < year)) {
+			continue;
+		}
+		days = days_since_epoch(year+1900, rule->month, rule->monthday);
+		if(rule->weekday != 7) {
+			wday = (int)(((days + 4) % 7 + 7) % 7);
+			days += ((int)rule->weekday - wday + 7) % 7;
+		}
+		latest = days*86400 + rule->minute*60;
+		if(rule->timebase != TIMEBASE_UTC) {
+			latest -= era->gmtoff;
+		}
+		earliest = latest;
+		if(rule->timebase == TIMEBASE_CUR) {
+			earliest -= maxsave*600;
+		}
+		if(latest <= t) {
+			continue;
+		}
+		if(earliest <= t) {
+			return 0;
+		}
+		until = min(until, earliest);
+	}
+	return until;
+}
+
 int localtime_l(time_t t, struct tm *result, char *timezone) {
+	struct tzcache_t cache;
 	size_t i = 0;
 	int x = 0;
 	/*
@@ -1631,14 +1911,27 @@ int localtime_l(time_t t, struct tm *result, char *timezone) {
 		return EINVAL;
 	}
 
-	const char *timezone_name = timezone_names;
-	do {
-		if(strcmp(timezone, timezone_name) == 0) {
-			break;
-		}
-		++x;
-		timezone_name += strlen(timezone_name) + 1;
-	} while(*timezone_name != '\0');
+	if((x = tzname_lookup(timezone)) == -1) {
+		return EINVAL;
+	}
+
+	if(mutex_init == 1) {
+		uv_mutex_lock(&tzcache_lock);
+	}
+	cache = tzcache[x];
+	if(mutex_init == 1) {
+		uv_mutex_unlock(&tzcache_lock);
+	}
+
+	if(t >= cache.from && t < cache.until) {
+		int error = __localtime_utc(t + cache.gmtoff, result);
+		result->tm_isdst = cache.isdst;
+#ifndef _WIN32
+		result->tm_gmtoff = cache.gmtoff;
+#endif
+		return error;
+	}
+	memset(&cache, 0, sizeof(struct tzcache_t));
 
 	/*
 	 * Obtain the last era from the timezone that does not end before the
@@ -1684,6 +1977,12 @@ int localtime_l(time_t t, struct tm *result, char *timezone) {
 		result->tm_gmtoff = gmtoff;
 		// result->tm_zone = compute_zone_abbreviation(era, rule);
 #endif
+
+		if(timer_std > era_start) {
+			cache.until = next_transition(era, &std, t);
+			cache.gmtoff = gmtoff;
+			cache.isdst = result->tm_isdst;
+		}
   } else {
 		/*
 		 * Timezone has no daylight saving time rules. Compute local time
@@ -1695,6 +1994,27 @@ int localtime_l(time_t t, struct tm *result, char *timezone) {
 		// static const struct lc_timezone_rule rule = {};
 		// result->tm_zone = compute_zone_abbreviation(era, &rule);
 #endif
+
+		/*
+		 * Recheck at least once a year, so the
+		 * cached period stays small enough.
+		 */
+		cache.until = t + (ERALENGTH/400);
+		cache.gmtoff = era->gmtoff;
+	}
+
+	if(cache.until > t && era != &tz->eras[tz->eras_count-1]) {
+		cache.until = min(cache.until, (time_t)era->end);
+	}
+	if(error == 0 && cache.until > t) {
+		cache.from = t;
+		if(mutex_init == 1) {
+			uv_mutex_lock(&tzcache_lock);
+		}
+		tzcache[x] = cache;
+		if(mutex_init == 1) {
+			uv_mutex_unlock(&tzcache_lock);
+		}
 	}
 
 	return error;
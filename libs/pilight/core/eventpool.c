@@ -669,6 +669,12 @@ void uv_custom_poll_cb(uv_poll_t *req, int status, int events) {
 		if(custom_poll_data->host != NULL) {
 			mbedtls_ssl_set_hostname(&custom_poll_data->ssl.ctx, custom_poll_data->host);
 		}
+		/*
+		 * Try to resume a previously negotiated session
+		 */
+		if(custom_poll_data->ssl.session != NULL) {
+			mbedtls_ssl_set_session(&custom_poll_data->ssl.ctx, custom_poll_data->ssl.session);
+		}
 	}
 
 	if(custom_poll_data->is_ssl == 1 && custom_poll_data->ssl.handshake == 0) {
@@ -726,7 +732,7 @@ void uv_custom_poll_cb(uv_poll_t *req, int status, int events) {
 					/*LCOV_EXCL_STOP*/
 				}
 			} else {
-				n = (int)send((unsigned int)fd, send_io->buf, send_io->len, 0);
+				n = (int)send((unsigned int)fd, send_io->buf, send_io->len, MSG_NOSIGNAL);
 			}
 			if(n > 0) {
 				iobuf_remove(send_io, n);
@@ -176,6 +176,7 @@ struct uv_custom_poll_t {
 		int init;
 		int handshake;
 		mbedtls_ssl_context ctx;
+		mbedtls_ssl_session *session;
 	} ssl;
 
   struct iobuf_t recv_iobuf;
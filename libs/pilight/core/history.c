@@ -0,0 +1,907 @@
+/*
+	Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+	#ifdef __mips__
+		#define __USE_UNIX98
+	#endif
+	#include <sys/mman.h>
+#endif
+#include <pthread.h>
+
+#include "mem.h"
+#include "log.h"
+#include "json.h"
+#include "history.h"
+
+typedef struct history_header_t {
+	uint32_t magic;
+	uint16_t count;
+	uint16_t tier;
+	uint32_t bits;
+	uint32_t reserved;
+	uint64_t seq;
+	int64_t first;
+	int64_t last;
+} history_header_t;
+
+#define HISTORY_DATA_SIZE	(HISTORY_BLOCK_SIZE-sizeof(struct history_header_t))
+/* The most bits a single value can take */
+#define HISTORY_POINT_BITS	113
+
+typedef struct history_block_t {
+	struct history_header_t header;
+	uint8_t data[HISTORY_DATA_SIZE];
+} history_block_t;
+
+/* Encoder and decoder state of a block */
+typedef struct history_state_t {
+	uint32_t pos;
+	int64_t ts;
+	int64_t delta;
+	uint64_t value;
+	int leading;
+	int trailing;
+} history_state_t;
+
+typedef struct history_tier_t {
+	unsigned int index;
+	int dirty;
+	struct history_block_t block;
+	struct history_state_t state;
+	/* The bucket that is being averaged */
+	int64_t bucket;
+	double sum;
+	int nr;
+} history_tier_t;
+
+typedef struct history_series_t {
+	char *device;
+	char *value;
+	unsigned int hash;
+	int64_t flushed;
+	struct history_tier_t tiers[HISTORY_TIERS];
+	struct history_series_t *next;
+} history_series_t;
+
+/*
+ * Values are queued by history_add and stored by the
+ * writer thread, so the callers never wait for disk.
+ */
+typedef struct history_sample_t {
+	char *device;
+	char *value;
+	int64_t ts;
+	double number;
+	struct history_sample_t *next;
+} history_sample_t;
+
+#define HISTORY_QUEUE	4096
+
+typedef struct history_point_t {
+	int64_t ts;
+	double value;
+} history_point_t;
+
+typedef struct history_points_t {
+	struct history_point_t *points;
+	int nr;
+	int size;
+	int64_t from;
+	int64_t to;
+} history_points_t;
+
+/* Seconds averaged in each tier and the blocks each file holds */
+static const int history_interval[HISTORY_TIERS] = { 0, 300, 3600 };
+static const unsigned int history_blocks[HISTORY_TIERS] = { 256, 64, 64 };
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct history_series_t *series = NULL;
+static char *root = NULL;
+
+static pthread_mutex_t samples_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t samples_signal = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t samples_drained = PTHREAD_COND_INITIALIZER;
+static struct history_sample_t *samples = NULL;
+static struct history_sample_t *samples_tail = NULL;
+static int nrsamples = 0;
+static int running = 0;
+static pthread_t writer;
+
+static unsigned int history_hash(char *device, char *value) {
+	unsigned int hash = 5381;
+	while(*device) {
+		hash = ((hash << 5) + hash) + (unsigned char)*device++;
+	}
+	hash = ((hash << 5) + hash) + '.';
+	while(*value) {
+		hash = ((hash << 5) + hash) + (unsigned char)*value++;
+	}
+	return hash;
+}
+
+/*
+ * Escapes everything but alphanumerics, dashes and
+ * underscores, so the name can't leave the root.
+ */
+static void history_escape(char *out, char *name) {
+	static const char *hex = "0123456789ABCDEF";
+	while(*name) {
+		if(isalnum((unsigned char)*name) || *name == '-' || *name == '_') {
+			*out++ = *name;
+		} else {
+			*out++ = '%';
+			*out++ = hex[((unsigned char)*name) >> 4];
+			*out++ = hex[((unsigned char)*name) & 0xF];
+		}
+		name++;
+	}
+	*out = '\0';
+}
+
+static int history_path(char *dir, char *device, char *value, int tier, char **path) {
+	int len = strlen(dir)+(strlen(device)*3)+(strlen(value)*3)+16;
+	char edevice[(strlen(device)*3)+1], evalue[(strlen(value)*3)+1];
+
+	history_escape(edevice, device);
+	history_escape(evalue, value);
+	if((*path = MALLOC(len)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	return snprintf(*path, len, "%s/%s.%s.%d", dir, edevice, evalue, tier);
+}
+
+static int history_bits_put(struct history_block_t *block, uint64_t value, int nr) {
+	uint32_t bits = block->header.bits;
+	int i = 0;
+
+	for(i=nr-1;i>=0;i--) {
+		if(((value >> i) & 1) == 1) {
+			block->data[bits/8] |= (0x80 >> (bits%8));
+		}
+		bits++;
+	}
+	block->header.bits = bits;
+	return 0;
+}
+
+static int history_bits_get(struct history_block_t *block, struct history_state_t *state, int nr, uint64_t *value) {
+	int i = 0;
+
+	if(state->pos+nr > block->header.bits) {
+		return -1;
+	}
+	*value = 0;
+	for(i=0;i<nr;i++) {
+		*value = (*value << 1) | ((block->data[state->pos/8] >> (7-(state->pos%8))) & 1);
+		state->pos++;
+	}
+	return 0;
+}
+
+/*
+ * Appends a value to a block. Returns -1 when it
+ * doesn't fit, so a new block must be started.
+ */
+static int history_encode(struct history_block_t *block, struct history_state_t *state, int64_t ts, double number) {
+	struct history_header_t *header = &block->header;
+	uint64_t value = 0, x = 0;
+	int64_t delta = 0, dod = 0;
+	int lz = 0, tz = 0;
+
+	memcpy(&value, &number, sizeof(uint64_t));
+
+	if(header->count == 0) {
+		header->first = ts;
+		header->last = ts;
+		history_bits_put(block, value, 64);
+		state->ts = ts;
+		state->delta = 0;
+		state->value = value;
+		state->leading = -1;
+		state->trailing = 0;
+		header->count++;
+		return 0;
+	}
+
+	if(header->count == 0xFFFF || header->bits+HISTORY_POINT_BITS > HISTORY_DATA_SIZE*8) {
+		return -1;
+	}
+
+	delta = ts-state->ts;
+	dod = delta-state->delta;
+	if(dod < INT32_MIN || dod > INT32_MAX) {
+		return -1;
+	}
+
+	if(dod == 0) {
+		history_bits_put(block, 0, 1);
+	} else if(dod >= -64 && dod <= 63) {
+		history_bits_put(block, 0x2, 2);
+		history_bits_put(block, (uint64_t)dod, 7);
+	} else if(dod >= -256 && dod <= 255) {
+		history_bits_put(block, 0x6, 3);
+		history_bits_put(block, (uint64_t)dod, 9);
+	} else if(dod >= -2048 && dod <= 2047) {
+		history_bits_put(block, 0xE, 4);
+		history_bits_put(block, (uint64_t)dod, 12);
+	} else {
+		history_bits_put(block, 0xF, 4);
+		history_bits_put(block, (uint64_t)dod, 32);
+	}
+
+	x = value ^ state->value;
+	if(x == 0) {
+		history_bits_put(block, 0, 1);
+	} else {
+		lz = __builtin_clzll(x);
+		tz = __builtin_ctzll(x);
+		if(lz > 31) {
+			lz = 31;
+		}
+		history_bits_put(block, 1, 1);
+		if(state->leading != -1 && lz >= state->leading && tz >= state->trailing) {
+			history_bits_put(block, 0, 1);
+			history_bits_put(block, x >> state->trailing, 64-state->leading-state->trailing);
+		} else {
+			history_bits_put(block, 1, 1);
+			history_bits_put(block, lz, 5);
+			history_bits_put(block, 64-lz-tz-1, 6);
+			history_bits_put(block, x >> tz, 64-lz-tz);
+			state->leading = lz;
+			state->trailing = tz;
+		}
+	}
+
+	state->ts = ts;
+	state->delta = delta;
+	state->value = value;
+	header->last = ts;
+	header->count++;
+	return 0;
+}
+
+static int64_t history_signed(uint64_t value, int nr) {
+	if((value >> (nr-1)) & 1) {
+		return (int64_t)(value | (~0ULL << nr));
+	}
+	return (int64_t)value;
+}
+
+/*
+ * Decodes the next value of a block. The state must
+ * be zeroed before the first value is read.
+ */
+static int history_decode(struct history_block_t *block, struct history_state_t *state, int nr, int64_t *ts, double *number) {
+	uint64_t bit = 0, tmp = 0, x = 0;
+	int64_t dod = 0;
+	int i = 0, len = 0;
+	static const int widths[4] = { 7, 9, 12, 32 };
+
+	if(nr >= block->header.count) {
+		return -1;
+	}
+
+	if(nr == 0) {
+		if(history_bits_get(block, state, 64, &state->value) != 0) {
+			return -1;
+		}
+		state->ts = block->header.first;
+		state->delta = 0;
+		state->leading = -1;
+	} else {
+		for(i=0;i<4;i++) {
+			if(history_bits_get(block, state, 1, &bit) != 0) {
+				return -1;
+			}
+			if(bit == 0) {
+				break;
+			}
+		}
+		if(i > 0) {
+			if(history_bits_get(block, state, widths[i-1], &tmp) != 0) {
+				return -1;
+			}
+			dod = history_signed(tmp, widths[i-1]);
+		}
+		state->delta += dod;
+		state->ts += state->delta;
+
+		if(history_bits_get(block, state, 1, &bit) != 0) {
+			return -1;
+		}
+		if(bit == 1) {
+			if(history_bits_get(block, state, 1, &bit) != 0) {
+				return -1;
+			}
+			if(bit == 1) {
+				if(history_bits_get(block, state, 5, &tmp) != 0) {
+					return -1;
+				}
+				state->leading = (int)tmp;
+				if(history_bits_get(block, state, 6, &tmp) != 0) {
+					return -1;
+				}
+				len = (int)tmp+1;
+				state->trailing = 64-state->leading-len;
+			} else if(state->leading == -1) {
+				return -1;
+			}
+			len = 64-state->leading-state->trailing;
+			if(history_bits_get(block, state, len, &x) != 0) {
+				return -1;
+			}
+			state->value ^= (x << state->trailing);
+		}
+	}
+
+	*ts = state->ts;
+	memcpy(number, &state->value, sizeof(double));
+	return 0;
+}
+
+#ifndef _WIN32
+/*
+ * Files are only opened while a block is written,
+ * so the number of series doesn't cost descriptors.
+ */
+static void history_write(struct history_series_t *node, int nr) {
+	struct history_tier_t *tier = &node->tiers[nr];
+	char *path = NULL;
+	int fd = -1;
+
+	if(tier->dirty == 0) {
+		return;
+	}
+	tier->dirty = 0;
+
+	history_path(root, node->device, node->value, nr, &path);
+	if((fd = open(path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
+		logprintf(LOG_ERR, "cannot open history file %s", path);
+		FREE(path);
+		return;
+	}
+	if(pwrite(fd, &tier->block, HISTORY_BLOCK_SIZE, (off_t)tier->index*HISTORY_BLOCK_SIZE) != HISTORY_BLOCK_SIZE) {
+		logprintf(LOG_ERR, "cannot write history block");
+	}
+	close(fd);
+	FREE(path);
+}
+
+static void history_next(struct history_series_t *node, int nr) {
+	struct history_tier_t *tier = &node->tiers[nr];
+	uint64_t seq = tier->block.header.seq+1;
+
+	history_write(node, nr);
+	tier->index = (tier->index+1) % history_blocks[nr];
+	memset(&tier->block, 0, sizeof(struct history_block_t));
+	memset(&tier->state, 0, sizeof(struct history_state_t));
+	tier->block.header.magic = HISTORY_MAGIC;
+	tier->block.header.tier = nr;
+	tier->block.header.seq = seq;
+}
+
+/*
+ * Continues after the newest block in the file,
+ * so existing blocks are never rewritten.
+ */
+static void history_open(struct history_series_t *node, int nr) {
+	struct history_tier_t *tier = &node->tiers[nr];
+	struct history_header_t header;
+	struct stat st;
+	char *path = NULL;
+	unsigned int i = 0, blocks = 0, index = history_blocks[nr]-1;
+	uint64_t seq = 0;
+	int fd = -1;
+
+	memset(tier, 0, sizeof(struct history_tier_t));
+	history_path(root, node->device, node->value, nr, &path);
+	if((fd = open(path, O_RDONLY)) >= 0) {
+		if(fstat(fd, &st) == 0) {
+			blocks = st.st_size/HISTORY_BLOCK_SIZE;
+			for(i=0;i<blocks && i<history_blocks[nr];i++) {
+				if(pread(fd, &header, sizeof(header), (off_t)i*HISTORY_BLOCK_SIZE) == sizeof(header) &&
+					 header.magic == HISTORY_MAGIC && header.seq >= seq) {
+					seq = header.seq;
+					index = i;
+				}
+			}
+		}
+		close(fd);
+	}
+	FREE(path);
+
+	tier->block.header.seq = seq;
+	tier->index = index;
+	history_next(node, nr);
+}
+
+static struct history_series_t *history_series(char *device, char *value, int create) {
+	struct history_series_t *node = series;
+	unsigned int hash = history_hash(device, value);
+	int i = 0;
+
+	while(node) {
+		if(node->hash == hash && strcmp(node->device, device) == 0 && strcmp(node->value, value) == 0) {
+			return node;
+		}
+		node = node->next;
+	}
+	if(create == 0) {
+		return NULL;
+	}
+
+	if((node = MALLOC(sizeof(struct history_series_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((node->device = STRDUP(device)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((node->value = STRDUP(value)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	node->hash = hash;
+	node->flushed = 0;
+	for(i=0;i<HISTORY_TIERS;i++) {
+		history_open(node, i);
+	}
+	node->next = series;
+	series = node;
+	return node;
+}
+
+static void history_append(struct history_series_t *node, int nr, int64_t ts, double number) {
+	struct history_tier_t *tier = &node->tiers[nr];
+
+	if(history_encode(&tier->block, &tier->state, ts, number) != 0) {
+		history_next(node, nr);
+		history_encode(&tier->block, &tier->state, ts, number);
+	}
+	tier->dirty = 1;
+	if(tier->block.header.bits+HISTORY_POINT_BITS > HISTORY_DATA_SIZE*8) {
+		history_next(node, nr);
+	}
+}
+
+/* Called with the lock held */
+static void history_store(char *device, char *value, int64_t timestamp, double number) {
+	struct history_series_t *node = NULL;
+	struct history_tier_t *tier = NULL;
+	int64_t bucket = 0;
+	int i = 0;
+
+	if(root == NULL) {
+		return;
+	}
+
+	node = history_series(device, value, 1);
+	history_append(node, 0, timestamp, number);
+
+	for(i=1;i<HISTORY_TIERS;i++) {
+		tier = &node->tiers[i];
+		bucket = timestamp-(timestamp % history_interval[i]);
+		if(tier->nr > 0 && bucket != tier->bucket) {
+			history_append(node, i, tier->bucket, tier->sum/tier->nr);
+			tier->sum = 0;
+			tier->nr = 0;
+		}
+		tier->bucket = bucket;
+		tier->sum += number;
+		tier->nr++;
+	}
+
+	if(timestamp-node->flushed >= HISTORY_FLUSH) {
+		for(i=0;i<HISTORY_TIERS;i++) {
+			history_write(node, i);
+		}
+		node->flushed = timestamp;
+	}
+}
+
+static void *history_writer(void *param) {
+	struct history_sample_t *list = NULL, *tmp = NULL;
+
+	pthread_mutex_lock(&samples_lock);
+	while(1) {
+		while(samples == NULL && running == 1) {
+			pthread_cond_wait(&samples_signal, &samples_lock);
+		}
+		if(samples == NULL) {
+			break;
+		}
+		list = samples;
+		samples = NULL;
+		samples_tail = NULL;
+		nrsamples = 0;
+		pthread_cond_broadcast(&samples_drained);
+		pthread_mutex_unlock(&samples_lock);
+
+		pthread_mutex_lock(&lock);
+		while(list) {
+			tmp = list;
+			history_store(tmp->device, tmp->value, tmp->ts, tmp->number);
+			list = list->next;
+			FREE(tmp);
+		}
+		pthread_mutex_unlock(&lock);
+
+		pthread_mutex_lock(&samples_lock);
+	}
+	pthread_mutex_unlock(&samples_lock);
+
+	return NULL;
+}
+#endif
+
+int history_init(char *path) {
+#ifdef _WIN32
+	return -1;
+#else
+	struct stat st;
+
+	if(stat(path, &st) != 0 || S_ISDIR(st.st_mode) == 0) {
+		logprintf(LOG_ERR, "history root %s is not a directory", path);
+		return -1;
+	}
+
+	pthread_mutex_lock(&lock);
+	if(root != NULL) {
+		FREE(root);
+	}
+	if((root = STRDUP(path)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	pthread_mutex_unlock(&lock);
+
+	pthread_mutex_lock(&samples_lock);
+	if(running == 0) {
+		if(pthread_create(&writer, NULL, history_writer, NULL) != 0) {
+			logprintf(LOG_ERR, "cannot start the history writer");
+			pthread_mutex_unlock(&samples_lock);
+			return -1;
+		}
+		running = 1;
+	}
+	pthread_mutex_unlock(&samples_lock);
+	return 0;
+#endif
+}
+
+void history_add(char *device, char *value, int64_t timestamp, double number) {
+#ifndef _WIN32
+	struct history_sample_t *node = NULL;
+	int dlen = strlen(device)+1, vlen = strlen(value)+1;
+
+	pthread_mutex_lock(&samples_lock);
+	/* Wait for the writer when it can't keep up */
+	while(running == 1 && nrsamples >= HISTORY_QUEUE) {
+		pthread_cond_wait(&samples_drained, &samples_lock);
+	}
+	if(running == 0) {
+		pthread_mutex_unlock(&samples_lock);
+		return;
+	}
+
+	if((node = MALLOC(sizeof(struct history_sample_t)+dlen+vlen)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	node->device = (char *)&node[1];
+	node->value = &node->device[dlen];
+	memcpy(node->device, device, dlen);
+	memcpy(node->value, value, vlen);
+	node->ts = timestamp;
+	node->number = number;
+	node->next = NULL;
+
+	if(samples_tail == NULL) {
+		samples = node;
+	} else {
+		samples_tail->next = node;
+	}
+	samples_tail = node;
+	nrsamples++;
+	pthread_cond_signal(&samples_signal);
+	pthread_mutex_unlock(&samples_lock);
+#endif
+}
+
+#ifndef _WIN32
+static void history_point(struct history_points_t *points, int64_t ts, double number) {
+	if(ts < points->from || ts > points->to) {
+		return;
+	}
+	if(points->nr == points->size) {
+		points->size = (points->size == 0) ? 64 : points->size*2;
+		if((points->points = REALLOC(points->points, sizeof(struct history_point_t)*points->size)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+	points->points[points->nr].ts = ts;
+	points->points[points->nr].value = number;
+	points->nr++;
+}
+
+static void history_scan_block(struct history_block_t *block, struct history_points_t *points) {
+	struct history_state_t state;
+	double number = 0.0;
+	int64_t ts = 0;
+	int i = 0;
+
+	if(block->header.count == 0 || block->header.bits > HISTORY_DATA_SIZE*8 ||
+	   block->header.last < points->from || block->header.first > points->to) {
+		return;
+	}
+	memset(&state, 0, sizeof(struct history_state_t));
+	for(i=0;i<block->header.count;i++) {
+		if(history_decode(block, &state, i, &ts, &number) != 0) {
+			break;
+		}
+		history_point(points, ts, number);
+	}
+}
+
+static int history_cmp_seq(const void *a, const void *b) {
+	const struct history_block_t *x = *(const struct history_block_t **)a;
+	const struct history_block_t *y = *(const struct history_block_t **)b;
+	return (x->header.seq > y->header.seq) - (x->header.seq < y->header.seq);
+}
+
+/*
+ * Collects the values of a single tier, oldest first.
+ * The block that is still being filled is taken from
+ * memory, as the file only holds its last flush. Only
+ * that block is copied under the lock, the files are
+ * decoded without it.
+ */
+static void history_scan(char *dir, char *device, char *value, int nr, struct history_points_t *points) {
+	struct history_series_t *node = NULL;
+	struct history_tier_t *current = NULL;
+	struct history_block_t *blocks = NULL, **sorted = NULL;
+	struct stat st;
+	char *path = NULL;
+	int fd = -1, found = 0;
+	unsigned int i = 0, x = 0, size = 0;
+
+	if((current = MALLOC(sizeof(struct history_tier_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	pthread_mutex_lock(&lock);
+	if((node = history_series(device, value, 0)) != NULL) {
+		memcpy(current, &node->tiers[nr], sizeof(struct history_tier_t));
+		found = 1;
+	}
+	pthread_mutex_unlock(&lock);
+
+	history_path(dir, device, value, nr, &path);
+	if((fd = open(path, O_RDONLY)) >= 0 && fstat(fd, &st) == 0 && st.st_size >= HISTORY_BLOCK_SIZE) {
+		size = st.st_size/HISTORY_BLOCK_SIZE;
+		blocks = mmap(NULL, (size_t)size*HISTORY_BLOCK_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+		if(blocks == MAP_FAILED) {
+			blocks = NULL;
+		}
+	}
+	if(fd >= 0) {
+		close(fd);
+	}
+	FREE(path);
+
+	if(blocks != NULL) {
+		if((sorted = MALLOC(sizeof(struct history_block_t *)*size)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		for(i=0;i<size;i++) {
+			if(blocks[i].header.magic != HISTORY_MAGIC || blocks[i].header.tier != nr) {
+				continue;
+			}
+			if(found == 1 && i == current->index && current->block.header.count > 0) {
+				continue;
+			}
+			sorted[x++] = &blocks[i];
+		}
+		qsort(sorted, x, sizeof(struct history_block_t *), history_cmp_seq);
+		for(i=0;i<x;i++) {
+			history_scan_block(sorted[i], points);
+		}
+		FREE(sorted);
+		munmap(blocks, (size_t)size*HISTORY_BLOCK_SIZE);
+	}
+
+	if(found == 1) {
+		history_scan_block(&current->block, points);
+		if(nr > 0 && current->nr > 0) {
+			history_point(points, current->bucket, current->sum/current->nr);
+		}
+	}
+	FREE(current);
+}
+
+static int history_decimals(double number) {
+	int i = 0;
+	double f = 1;
+
+	for(i=0;i<6;i++) {
+		if(fabs((number*f)-round(number*f)) < 1e-6) {
+			return i;
+		}
+		f *= 10;
+	}
+	return 6;
+}
+
+static struct JsonNode *history_values(char *dir, char *device, char *value, int nr, int64_t from, int64_t to, int step) {
+	struct JsonNode *jvalues = json_mkarray(), *jpoint = NULL;
+	struct history_points_t points;
+	double sum = 0.0;
+	int64_t bucket = 0;
+	int i = 0, count = 0;
+
+	memset(&points, 0, sizeof(struct history_points_t));
+	points.from = from;
+	points.to = to;
+	history_scan(dir, device, value, nr, &points);
+
+	for(i=0;i<=points.nr;i++) {
+		if(step > 0 && i < points.nr) {
+			int64_t b = points.points[i].ts-(points.points[i].ts % step);
+			if(count == 0 || b == bucket) {
+				bucket = b;
+				sum += points.points[i].value;
+				count++;
+				continue;
+			}
+		}
+		if(step > 0 && count > 0) {
+			jpoint = json_mkarray();
+			json_append_element(jpoint, json_mknumber((double)bucket, 0));
+			json_append_element(jpoint, json_mknumber(sum/count, history_decimals(sum/count)));
+			json_append_element(jvalues, jpoint);
+			if(i < points.nr) {
+				bucket = points.points[i].ts-(points.points[i].ts % step);
+				sum = points.points[i].value;
+				count = 1;
+			}
+		} else if(step == 0 && i < points.nr) {
+			jpoint = json_mkarray();
+			json_append_element(jpoint, json_mknumber((double)points.points[i].ts, 0));
+			json_append_element(jpoint, json_mknumber(points.points[i].value, history_decimals(points.points[i].value)));
+			json_append_element(jvalues, jpoint);
+		}
+	}
+	if(points.points != NULL) {
+		FREE(points.points);
+	}
+	return jvalues;
+}
+#endif
+
+/*
+ * Returns the values of a device between two timestamps,
+ * averaged per step seconds when step is larger than 0.
+ * Without a value name, all values of the device are
+ * returned. The coarsest tier that still fits the step
+ * is used.
+ */
+struct JsonNode *history_print(char *device, char *value, int64_t from, int64_t to, int step) {
+#ifdef _WIN32
+	return NULL;
+#else
+	struct JsonNode *jsend = NULL, *jvalues = NULL;
+	struct dirent *file = NULL;
+	DIR *d = NULL;
+	char *dir = NULL;
+	int i = 0, nr = 0;
+
+	pthread_mutex_lock(&lock);
+	if(root == NULL) {
+		pthread_mutex_unlock(&lock);
+		return NULL;
+	}
+	if((dir = STRDUP(root)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	pthread_mutex_unlock(&lock);
+
+	for(i=1;i<HISTORY_TIERS;i++) {
+		if(step >= history_interval[i]) {
+			nr = i;
+		}
+	}
+
+	jsend = json_mkobject();
+	jvalues = json_mkobject();
+	json_append_member(jsend, "message", json_mkstring("history"));
+	json_append_member(jsend, "device", json_mkstring(device));
+	json_append_member(jsend, "from", json_mknumber((double)from, 0));
+	json_append_member(jsend, "to", json_mknumber((double)to, 0));
+	json_append_member(jsend, "step", json_mknumber(step, 0));
+
+	if(value != NULL) {
+		json_append_member(jvalues, value, history_values(dir, device, value, nr, from, to, step));
+	} else if((d = opendir(dir)) != NULL) {
+		char edevice[(strlen(device)*3)+2], suffix[4];
+		int len = 0;
+
+		history_escape(edevice, device);
+		strcat(edevice, ".");
+		len = strlen(edevice);
+		snprintf(suffix, sizeof(suffix), ".%d", nr);
+
+		while((file = readdir(d)) != NULL) {
+			int flen = strlen(file->d_name);
+			if(strncmp(file->d_name, edevice, len) == 0 && flen > len+2 &&
+			   strcmp(&file->d_name[flen-2], suffix) == 0) {
+				char name[flen-len-1];
+				memcpy(name, &file->d_name[len], flen-len-2);
+				name[flen-len-2] = '\0';
+				/* Value names are never escaped by pilight */
+				if(strchr(name, '%') == NULL && json_find_member(jvalues, name) == NULL) {
+					json_append_member(jvalues, name, history_values(dir, device, name, nr, from, to, step));
+				}
+			}
+		}
+		closedir(d);
+	}
+	json_append_member(jsend, "values", jvalues);
+	FREE(dir);
+
+	return jsend;
+#endif
+}
+
+int history_gc(void) {
+#ifndef _WIN32
+	struct history_series_t *tmp = NULL;
+	struct history_tier_t *tier = NULL;
+	int i = 0, join = 0;
+
+	/* The writer stores the queued values before it stops */
+	pthread_mutex_lock(&samples_lock);
+	join = running;
+	running = 0;
+	pthread_cond_signal(&samples_signal);
+	pthread_cond_broadcast(&samples_drained);
+	pthread_mutex_unlock(&samples_lock);
+	if(join == 1) {
+		pthread_join(writer, NULL);
+	}
+
+	pthread_mutex_lock(&lock);
+	while(series) {
+		tmp = series;
+		for(i=0;i<HISTORY_TIERS;i++) {
+			tier = &tmp->tiers[i];
+			if(i > 0 && tier->nr > 0) {
+				history_append(tmp, i, tier->bucket, tier->sum/tier->nr);
+			}
+			history_write(tmp, i);
+		}
+		series = series->next;
+		FREE(tmp->device);
+		FREE(tmp->value);
+		FREE(tmp);
+	}
+	if(root != NULL) {
+		FREE(root);
+		root = NULL;
+	}
+	pthread_mutex_unlock(&lock);
+#endif
+
+	logprintf(LOG_DEBUG, "garbage collected history library");
+	return 0;
+}
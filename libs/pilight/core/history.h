@@ -0,0 +1,53 @@
+/*
+	Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stdint.h>
+
+#include "json.h"
+
+/*
+ * The numeric values of each device are stored in their
+ * own files, one per tier: <device>.<value>.<tier>. Tier
+ * 0 holds every value, tier 1 and 2 hold the averages of
+ * 5 minutes and of an hour. Device names are escaped
+ * like urls.
+ *
+ * A file is a ring of blocks of HISTORY_BLOCK_SIZE bytes.
+ * Each block starts with a header holding the magic
+ * "PLTS", the number of values, the number of bits used,
+ * a sequence number and the first and last timestamp.
+ * The values follow as a bit stream:
+ * - The first timestamp is taken from the header, the
+ *   first value is stored as is in 64 bits.
+ * - Timestamps are stored as the difference between
+ *   their delta and the previous delta: '0' for none,
+ *   '10' + 7 bits, '110' + 9 bits, '1110' + 12 bits or
+ *   '1111' + 32 bits.
+ * - Values are stored as the xor with the previous
+ *   value: '0' when equal, '10' + the meaningful bits
+ *   when they fit in those of the previous value, or
+ *   '11' + 5 bits leading zeros + 6 bits length + the
+ *   meaningful bits.
+ *
+ * Blocks are only written once they are full and every
+ * HISTORY_FLUSH seconds, to spare SD cards.
+ */
+#define HISTORY_MAGIC				0x53544c50
+#define HISTORY_BLOCK_SIZE	4096
+#define HISTORY_TIERS				3
+#define HISTORY_FLUSH				600
+
+int history_init(char *root);
+void history_add(char *device, char *value, int64_t timestamp, double number);
+struct JsonNode *history_print(char *device, char *value, int64_t from, int64_t to, int step);
+int history_gc(void);
+
+#endif
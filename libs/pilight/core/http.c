@@ -41,6 +41,7 @@
 
 #include "../../libuv/uv.h"
 #include "pilight.h"
+#include "common.h"
 #include "socket.h"
 #include "log.h"
 #include "network.h"
@@ -54,13 +55,46 @@
 #define STEP_WRITE					0
 #define STEP_READ						1
 
+/*
+ * Maximum number of simultaneous connections per
+ * host and the time in milliseconds an unused
+ * keep-alive connection is kept open.
+ */
+#define HTTP_POOL_MAX_CONNECTIONS		4
+#define HTTP_POOL_IDLE_TIMEOUT			10000
+
 typedef struct http_clients_t {
 	uv_poll_t *req;
 	int fd;
+	int idle;
+	uv_timer_t *idle_req;
+	struct http_pool_t *pool;
 	struct uv_custom_poll_t *data;
 	struct http_clients_t *next;
 } http_clients_t;
 
+/*
+ * Connections are pooled per host, port and
+ * scheme. Idle keep-alive connections are reused
+ * by the next request to the same pool and requests
+ * exceeding the connection limit are queued until
+ * a connection becomes available. The first TLS
+ * session of a pool is stored so new connections
+ * can resume it instead of doing a full handshake.
+ */
+typedef struct http_pool_t {
+	char *host;
+	int port;
+	int is_ssl;
+	int active;
+
+	int has_session;
+	mbedtls_ssl_session session;
+
+	struct request_t *queue;
+	struct http_pool_t *next;
+} http_pool_t;
+
 #ifdef _WIN32
 	static uv_mutex_t http_lock;
 #else
@@ -69,7 +103,10 @@ typedef struct http_clients_t {
 #endif
 
 struct http_clients_t *http_clients = NULL;
+static struct http_pool_t *http_pools = NULL;
 static int http_lock_init = 0;
+static unsigned long http_pool_hits = 0;
+static unsigned long http_pool_misses = 0;
 
 typedef struct request_t {
 	int fd;
@@ -91,6 +128,8 @@ typedef struct request_t {
 	int request_method;
 	int has_length;
 	int has_chunked;
+	int keepalive;
+	int reused;
 
   char *content;
 	char mimetype[255];
@@ -102,13 +141,34 @@ typedef struct request_t {
 	size_t bytes_read;
 
 	void (*callback)(int code, char *data, int size, char *type, void *userdata);
+
+	struct http_pool_t *pool;
+	struct request_t *next;
 } request_t;
 
 
 static void timeout(uv_timer_t *req);
 static void http_client_close(uv_poll_t *req);
+static void http_dispatch(struct request_t *request);
+static void http_resolved(char *host, int inet, char *ip, void *userdata);
+
+static void close_cb(uv_handle_t *handle) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	FREE(handle);
+}
 
 static void free_request(struct request_t *request) {
+	if(request->timer_req != NULL) {
+		uv_timer_stop(request->timer_req);
+		if(!uv_is_closing((uv_handle_t *)request->timer_req)) {
+			uv_close((uv_handle_t *)request->timer_req, close_cb);
+		}
+	}
 	if(request->host != NULL) {
 		FREE(request->host);
 	}
@@ -155,21 +215,49 @@ int http_gc(void) {
 			uv_custom_poll_free(custom_poll_data);
 		}
 
+		if(http_clients->idle_req != NULL) {
+			uv_timer_stop(http_clients->idle_req);
+			if(!uv_is_closing((uv_handle_t *)http_clients->idle_req)) {
+				uv_close((uv_handle_t *)http_clients->idle_req, close_cb);
+			}
+		}
+
 		http_clients = http_clients->next;
 		FREE(node);
 	}
 
+	struct http_pool_t *pool = NULL;
+	struct request_t *request = NULL;
+	while(http_pools) {
+		pool = http_pools;
+		while(pool->queue) {
+			request = pool->queue;
+			pool->queue = pool->queue->next;
+			free_request(request);
+		}
+		mbedtls_ssl_session_free(&pool->session);
+		FREE(pool->host);
+		http_pools = http_pools->next;
+		FREE(pool);
+	}
+
 #ifdef _WIN32
 	uv_mutex_unlock(&http_lock);
 #else
 	pthread_mutex_unlock(&http_lock);
 #endif
 
+	logprintf(LOG_DEBUG, "http connection pool: %lu hits, %lu misses", http_pool_hits, http_pool_misses);
 	logprintf(LOG_DEBUG, "garbage collected http library");
 	return 1;
 }
 
-static void http_client_add(uv_poll_t *req, struct uv_custom_poll_t *data) {
+void http_pool_stats(unsigned long *hits, unsigned long *misses) {
+	*hits = http_pool_hits;
+	*misses = http_pool_misses;
+}
+
+static void http_client_add(uv_poll_t *req, struct uv_custom_poll_t *data, struct http_pool_t *pool) {
 #ifdef _WIN32
 	uv_mutex_lock(&http_lock);
 #else
@@ -186,9 +274,11 @@ static void http_client_add(uv_poll_t *req, struct uv_custom_poll_t *data) {
 	if(node == NULL) {
 		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 	}
+	memset(node, 0, sizeof(struct http_clients_t));
 	node->req = req;
 	node->data = data;
 	node->fd = fd;
+	node->pool = pool;
 
 	node->next = http_clients;
 	http_clients = node;
@@ -217,6 +307,13 @@ static void http_client_remove(uv_poll_t *req) {
 				prevP->next = currP->next;
 			}
 
+			if(currP->idle_req != NULL) {
+				uv_timer_stop(currP->idle_req);
+				if(!uv_is_closing((uv_handle_t *)currP->idle_req)) {
+					uv_close((uv_handle_t *)currP->idle_req, close_cb);
+				}
+			}
+
 			FREE(currP);
 			break;
 		}
@@ -465,14 +562,263 @@ static void process_chunk(char **buf, ssize_t *size, struct request_t *request)
 	}
 }
 
-static void close_cb(uv_handle_t *handle) {
+static struct http_clients_t *http_client_get(uv_poll_t *req) {
+	struct http_clients_t *node = NULL;
+
+#ifdef _WIN32
+	uv_mutex_lock(&http_lock);
+#else
+	pthread_mutex_lock(&http_lock);
+#endif
+	node = http_clients;
+	while(node) {
+		if(node->req == req) {
+			break;
+		}
+		node = node->next;
+	}
+#ifdef _WIN32
+	uv_mutex_unlock(&http_lock);
+#else
+	pthread_mutex_unlock(&http_lock);
+#endif
+
+	return node;
+}
+
+static struct http_pool_t *http_pool_get(char *host, int port, int is_ssl) {
+	struct http_pool_t *pool = http_pools;
+
+	while(pool) {
+		if(pool->port == port && pool->is_ssl == is_ssl && strcmp(pool->host, host) == 0) {
+			return pool;
+		}
+		pool = pool->next;
+	}
+
+	if((pool = MALLOC(sizeof(struct http_pool_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(pool, 0, sizeof(struct http_pool_t));
+	if((pool->host = STRDUP(host)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	pool->port = port;
+	pool->is_ssl = is_ssl;
+	mbedtls_ssl_session_init(&pool->session);
+
+	pool->next = http_pools;
+	http_pools = pool;
+
+	return pool;
+}
+
+/*
+ * Start the next queued request of a pool
+ * when a connection slot became available.
+ */
+static void http_pool_next(struct http_pool_t *pool) {
+	struct request_t *request = NULL;
+
+	if(pool != NULL && pool->queue != NULL && pool->active < HTTP_POOL_MAX_CONNECTIONS) {
+		request = pool->queue;
+		pool->queue = pool->queue->next;
+		request->next = NULL;
+		http_dispatch(request);
+	}
+}
+
+/*
+ * Check if an idle connection was not closed
+ * by the server in the meantime.
+ */
+static int http_client_alive(int fd) {
+	char c = 0;
+	int n = 0;
+
+#ifdef _WIN32
+	n = recv(fd, &c, 1, MSG_PEEK);
+	if(n < 0 && WSAGetLastError() == WSAEWOULDBLOCK) {
+		return 0;
+	}
+#else
+	n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return 0;
+	}
+#endif
+	return -1;
+}
+
+static void http_request_start(struct request_t *request) {
+	if(request->timer_req == NULL) {
+		if((request->timer_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		request->timer_req->data = request;
+		uv_timer_init(uv_default_loop(), request->timer_req);
+	}
+	uv_timer_start(request->timer_req, (void (*)(uv_timer_t *))timeout, 3000, 0);
+
+	request->steps = STEP_WRITE;
+	uv_custom_write(request->poll_req);
+}
+
+static void http_client_attach(struct http_clients_t *node, struct request_t *request) {
+	node->idle = 0;
+	if(node->idle_req != NULL) {
+		uv_timer_stop(node->idle_req);
+	}
+	node->pool->active++;
+	http_pool_hits++;
+
+	request->reused = 1;
+	request->fd = node->fd;
+	request->poll_req = node->req;
+
+	node->data->data = request;
+	node->data->doread = 0;
+
+	http_request_start(request);
+}
+
+static void idle_timeout(uv_timer_t *req) {
+	uv_custom_close((uv_poll_t *)req->data);
+}
+
+/*
+ * Hand a connection of which the response was
+ * fully read to the next queued request or keep
+ * it open for the next request to the same host.
+ */
+static void http_client_release(uv_poll_t *req) {
+	struct uv_custom_poll_t *custom_poll_data = req->data;
+	struct request_t *request = custom_poll_data->data;
+	struct http_clients_t *node = http_client_get(req);
+	struct http_pool_t *pool = NULL;
+
+	if(node == NULL) {
+		uv_custom_close(req);
+		return;
+	}
+	pool = node->pool;
+
+	custom_poll_data->data = NULL;
+	if(request != NULL) {
+		free_request(request);
+	}
+	if(custom_poll_data->recv_iobuf.len > 0) {
+		iobuf_remove(&custom_poll_data->recv_iobuf, custom_poll_data->recv_iobuf.len);
+	}
+	pool->active--;
+
+	if(pool->queue != NULL) {
+		request = pool->queue;
+		pool->queue = pool->queue->next;
+		request->next = NULL;
+		http_client_attach(node, request);
+		return;
+	}
+
+	node->idle = 1;
+	if(node->idle_req == NULL) {
+		if((node->idle_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		node->idle_req->data = req;
+		uv_timer_init(uv_default_loop(), node->idle_req);
+	}
+	uv_timer_start(node->idle_req, idle_timeout, HTTP_POOL_IDLE_TIMEOUT, 0);
+
 	/*
-	 * Make sure we execute in the main thread
+	 * Keep reading so we notice when the
+	 * server closes the connection.
 	 */
-	const uv_thread_t pth_cur_id = uv_thread_self();
-	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+	uv_custom_read(req);
+}
 
-	FREE(handle);
+/*
+ * Reports a request that never reached the server to
+ * its caller and hands its connection slot to the
+ * next request queued in the pool.
+ */
+static void http_request_fail(struct request_t *request) {
+	struct http_pool_t *pool = request->pool;
+
+	if(request->callback != NULL && request->called == 0) {
+		request->called = 1;
+		request->callback(404, NULL, 0, 0, request->userdata);
+	}
+	if(request->fd > 0) {
+#ifdef _WIN32
+		closesocket(request->fd);
+#else
+		close(request->fd);
+#endif
+	}
+	free_request(request);
+
+	pool->active--;
+	http_pool_next(pool);
+}
+
+static void http_dispatch(struct request_t *request) {
+	struct http_pool_t *pool = request->pool;
+	struct http_clients_t *node = NULL;
+
+	while(1) {
+#ifdef _WIN32
+		uv_mutex_lock(&http_lock);
+#else
+		pthread_mutex_lock(&http_lock);
+#endif
+		node = http_clients;
+		while(node) {
+			if(node->pool == pool && node->idle == 1) {
+				break;
+			}
+			node = node->next;
+		}
+#ifdef _WIN32
+		uv_mutex_unlock(&http_lock);
+#else
+		pthread_mutex_unlock(&http_lock);
+#endif
+		if(node == NULL) {
+			break;
+		}
+		if(http_client_alive(node->fd) == 0) {
+			http_client_attach(node, request);
+			return;
+		}
+		uv_custom_close(node->req);
+	}
+
+	if(pool->active >= HTTP_POOL_MAX_CONNECTIONS) {
+		struct request_t *tmp = pool->queue;
+		request->next = NULL;
+		if(tmp == NULL) {
+			pool->queue = request;
+		} else {
+			while(tmp->next != NULL) {
+				tmp = tmp->next;
+			}
+			tmp->next = request;
+		}
+		return;
+	}
+
+	pool->active++;
+	http_pool_misses++;
+
+	/*
+	 * The connection is set up as soon as the
+	 * host is resolved, which can be right away
+	 * when it is still cached.
+	 */
+	if(host2ip_async(request->host, http_resolved, request) == -1) {
+		http_request_fail(request);
+	}
 }
 
 static void http_client_close(uv_poll_t *req) {
@@ -484,38 +830,60 @@ static void http_client_close(uv_poll_t *req) {
 
 	struct uv_custom_poll_t *custom_poll_data = req->data;
 	struct request_t *request = custom_poll_data->data;
-	uv_timer_stop(request->timer_req);
+	struct request_t *retry = NULL;
+	struct http_clients_t *node = http_client_get(req);
+	struct http_pool_t *pool = NULL;
+	int fd = -1, idle = 0;
+
+	if(node != NULL) {
+		pool = node->pool;
+		idle = node->idle;
+		fd = node->fd;
+	} else if(request != NULL) {
+		fd = request->fd;
+	}
+
+	if(request != NULL) {
+		uv_timer_stop(request->timer_req);
 
-	if(request->reading == 1) {
-		if(request->has_length == 0 && request->has_chunked == 0) {
-			if(request->callback != NULL && request->called == 0) {
-				request->called = 1;
-				request->callback(request->status_code, request->content, strlen(request->content), request->mimetype, request->userdata);
-			}
-		} else {
 		/*
-		 * Callback when we were receiving data
-		 * that was disrupted early.
+		 * The server closed a reused keep-alive
+		 * connection before it answered, so retry
+		 * the request on another connection.
 		 */
+		if(request->reused == 1 && request->gotheader == 0 && request->called == 0) {
+			retry = request;
+		} else if(request->reading == 1) {
+			if(request->has_length == 0 && request->has_chunked == 0) {
+				if(request->callback != NULL && request->called == 0) {
+					request->called = 1;
+					request->callback(request->status_code, request->content, strlen(request->content), request->mimetype, request->userdata);
+				}
+			} else {
+			/*
+			 * Callback when we were receiving data
+			 * that was disrupted early.
+			 */
+				if(request->callback != NULL && request->called == 0) {
+					request->called = 1;
+					request->callback(408, NULL, 0, NULL, request->userdata);
+				}
+			}
+		} else if(request->error == 1) {
 			if(request->callback != NULL && request->called == 0) {
 				request->called = 1;
-				request->callback(408, NULL, 0, NULL, request->userdata);
+				request->callback(404, NULL, 0, 0, request->userdata);
 			}
 		}
-	} else if(request->error == 1) {
-		if(request->callback != NULL && request->called == 0) {
-			request->called = 1;
-			request->callback(404, NULL, 0, 0, request->userdata);
-		}
 	}
 
-	if(request->fd > -1) {
+	if(fd > -1) {
 #ifdef _WIN32
-		shutdown(request->fd, SD_BOTH);
-		closesocket(request->fd);
+		shutdown(fd, SD_BOTH);
+		closesocket(fd);
 #else
-		shutdown(request->fd, SHUT_RDWR);
-		close(request->fd);
+		shutdown(fd, SHUT_RDWR);
+		close(fd);
 #endif
 	}
 
@@ -526,15 +894,34 @@ static void http_client_close(uv_poll_t *req) {
 		uv_close((uv_handle_t *)req, close_cb);
 	}
 
-	if(request != NULL) {
+	if(request != NULL && retry == NULL) {
 		free_request(request);
-		custom_poll_data->data = NULL;
 	}
+	custom_poll_data->data = NULL;
 
 	if(custom_poll_data != NULL) {
 		uv_custom_poll_free(custom_poll_data);
 		req->data = NULL;
 	}
+
+	/*
+	 * Idle connections don't occupy a slot
+	 */
+	if(pool != NULL && idle == 0) {
+		pool->active--;
+	}
+
+	if(retry != NULL) {
+		retry->reused = 0;
+		retry->fd = -1;
+		retry->poll_req = NULL;
+		retry->error = 1;
+		http_dispatch(retry);
+	}
+
+	if(idle == 0) {
+		http_pool_next(pool);
+	}
 }
 
 static void poll_close_cb(uv_poll_t *req) {
@@ -549,6 +936,7 @@ static void timeout(uv_timer_t *req) {
 	if(request->timer_req != NULL) {
 		uv_timer_stop(request->timer_req);
 	}
+	request->reused = 0;
 	http_client_close(request->poll_req);
 	if(callback != NULL && called == 0) {
 		callback(408, NULL, 0, NULL, userdata);
@@ -568,6 +956,15 @@ static void read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 	const char *a = NULL, *b = NULL;
 	int pos = 0;
 
+	/*
+	 * Data or a close notification
+	 * on an idle connection.
+	 */
+	if(request == NULL) {
+		uv_custom_close(req);
+		return;
+	}
+
 	if(*nread > 0) {
 		buf[*nread] = '\0';
 	}
@@ -597,9 +994,23 @@ static void read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 					request->callback(c.status_code, location, strlen(location), NULL, request->userdata);
 				}
 				FREE(header);
-				return;
+				goto close;
 			}
 			request->status_code = c.status_code;
+
+			/*
+			 * HTTP/1.1 connections are persistent
+			 * unless the server tells otherwise.
+			 */
+			request->keepalive = (strcmp(c.request_method, "HTTP/1.1") == 0);
+			if((a = http_get_header(&c, "Connection")) != NULL || (a = http_get_header(&c, "connection")) != NULL) {
+				if(stricmp(a, "close") == 0) {
+					request->keepalive = 0;
+				} else if(stricmp(a, "keep-alive") == 0) {
+					request->keepalive = 1;
+				}
+			}
+			a = NULL;
 			if((a = http_get_header(&c, "Content-Type")) != NULL || (b = http_get_header(&c, "Content-type")) != NULL) {
 				int len = 0, i = 0;
 				if(a != NULL) {
@@ -630,20 +1041,29 @@ static void read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 				}
 			}
 			FREE(header);
+			/*
+			 * Without a length or chunked encoding the
+			 * end of the content is marked by the server
+			 * closing the connection.
+			 */
+			if(request->has_length == 0 && request->has_chunked == 0) {
+				request->keepalive = 0;
+			}
 			/*
 			 * 0 bytes left is not always an indication
 			 * there is no more data to be received.
 			 * In Tasmota packages the header is sent
 			 * separately from the chunked data. So
 			 * when chunked data is announced, we wait
-			 * for it.
+			 * for it. The same goes for content of
+			 * which the length was announced.
 			 */
-			if(*nread == 0 && request->chunked == 0) {
+			if(*nread == 0 && request->chunked == 0 && (request->has_length == 0 || request->content_len == 0)) {
 				uv_timer_stop(request->timer_req);
 				if(request->callback != NULL && request->called == 0) {
 					request->called = 1;
 					request->callback(request->status_code, "", request->content_len, request->mimetype, request->userdata);
-					goto close;
+					goto done;
 				}
 			}
 		}
@@ -678,7 +1098,7 @@ static void read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 			if(request->callback != NULL && request->called == 0) {
 				request->called = 1;
 				request->callback(request->status_code, request->content, request->content_len, request->mimetype, request->userdata);
-				goto close;
+				goto done;
 			}
 		}
 		request->error = 0;
@@ -689,6 +1109,12 @@ static void read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 		return;
 	}
 
+done:
+	if(request->keepalive == 1) {
+		http_client_release(req);
+		return;
+	}
+
 close:
 	uv_custom_close(req);
 }
@@ -704,15 +1130,30 @@ static void write_cb(uv_poll_t *req) {
 	struct request_t *request = custom_poll_data->data;
 	char *header = NULL;
 
+	if(request == NULL) {
+		return;
+	}
+
 	switch(request->steps) {
 		case STEP_WRITE: {
+			/*
+			 * Store the first negotiated TLS session
+			 * so new connections can resume it.
+			 */
+			if(custom_poll_data->is_ssl == 1 && custom_poll_data->ssl.handshake == 1 &&
+				 request->pool != NULL && request->pool->has_session == 0) {
+				if(mbedtls_ssl_get_session(&custom_poll_data->ssl.ctx, &request->pool->session) == 0) {
+					request->pool->has_session = 1;
+				}
+			}
 			if(request->request_method == HTTP_POST) {
-				append_to_header(&header, "POST %s HTTP/1.0\r\n", request->uri);
+				append_to_header(&header, "POST %s HTTP/1.1\r\n", request->uri);
 				append_to_header(&header, "Host: %s\r\n", request->host);
 				if(request->auth64 != NULL) {
 					append_to_header(&header, "Authorization: Basic %s\r\n", request->auth64);
 				}
 				append_to_header(&header, "User-Agent: %s\r\n", USERAGENT);
+				append_to_header(&header, "Connection: keep-alive\r\n");
 				append_to_header(&header, "Content-Type: %s\r\n", request->mimetype);
 				append_to_header(&header, "Content-Length: %lu\r\n\r\n", request->content_len);
 				append_to_header(&header, "%s", request->content);
@@ -723,7 +1164,7 @@ static void write_cb(uv_poll_t *req) {
 					append_to_header(&header, "Authorization: Basic %s\r\n", request->auth64);
 				}
 				append_to_header(&header, "User-Agent: %s\r\n", USERAGENT);
-				append_to_header(&header, "Connection: close\r\n\r\n");
+				append_to_header(&header, "Connection: keep-alive\r\n\r\n");
 			}
 			iobuf_append(&custom_poll_data->send_iobuf, (void *)header, strlen(header));
 
@@ -739,166 +1180,157 @@ static void write_cb(uv_poll_t *req) {
 	}
 }
 
-char *http_process(int type, char *url, const char *conttype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata) {
-	struct request_t *request = NULL;
+static void http_resolved(char *host, int inet, char *ip, void *userdata) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct request_t *request = userdata;
 	struct uv_custom_poll_t *custom_poll_data = NULL;
 	struct sockaddr_in addr4;
 	struct sockaddr_in6 addr6;
-	char *ip = NULL;
 	int r = 0;
 
-	if(http_lock_init == 0) {
-		http_lock_init = 1;
-#ifdef _WIN32
-		uv_mutex_init(&http_lock);
-#else
-		pthread_mutexattr_init(&http_attr);
-		pthread_mutexattr_settype(&http_attr, PTHREAD_MUTEX_RECURSIVE);
-		pthread_mutex_init(&http_lock, &http_attr);
-#endif
-	}
-
-#ifdef _WIN32
-	WSADATA wsa;
-
-	if(WSAStartup(0x202, &wsa) != 0) {
-		logprintf(LOG_ERR, "WSAStartup");
-		exit(EXIT_FAILURE);
-	}
-#endif
-
 	memset(&addr4, 0, sizeof(addr4));
 	memset(&addr6, 0, sizeof(addr6));
-	if(prepare_request(&request, type, url, conttype, post, callback, userdata) == 0) {
-		int inet = host2ip(request->host, &ip);
-		switch(inet) {
-			case AF_INET: {
-				memset(&addr4, '\0', sizeof(struct sockaddr_in));
-				r = uv_ip4_addr(ip, request->port, &addr4);
-				if(r != 0) {
-					/*LCOV_EXCL_START*/
-					logprintf(LOG_ERR, "uv_ip4_addr: %s", uv_strerror(r));
-					goto freeuv;
-					/*LCOV_EXCL_END*/
-				}
-			} break;
-			case AF_INET6: {
-				memset(&addr6, '\0', sizeof(struct sockaddr_in6));
-				r = uv_ip6_addr(ip, request->port, &addr6);
-				if(r != 0) {
-					/*LCOV_EXCL_START*/
-					logprintf(LOG_ERR, "uv_ip6_addr: %s", uv_strerror(r));
-					goto freeuv;
-					/*LCOV_EXCL_END*/
-				}
-			} break;
-			default: {
+
+	switch(inet) {
+		case AF_INET: {
+			memset(&addr4, '\0', sizeof(struct sockaddr_in));
+			r = uv_ip4_addr(ip, request->port, &addr4);
+			if(r != 0) {
 				/*LCOV_EXCL_START*/
-				logprintf(LOG_ERR, "host2ip");
+				logprintf(LOG_ERR, "uv_ip4_addr: %s", uv_strerror(r));
 				goto freeuv;
 				/*LCOV_EXCL_END*/
-			} break;
-		}
-		FREE(ip);
-
-		/*
-		 * Partly bypass libuv in case of ssl connections
-		 */
-		if((request->fd = socket(inet, SOCK_STREAM, 0)) < 0){
+			}
+		} break;
+		case AF_INET6: {
+			memset(&addr6, '\0', sizeof(struct sockaddr_in6));
+			r = uv_ip6_addr(ip, request->port, &addr6);
+			if(r != 0) {
+				/*LCOV_EXCL_START*/
+				logprintf(LOG_ERR, "uv_ip6_addr: %s", uv_strerror(r));
+				goto freeuv;
+				/*LCOV_EXCL_END*/
+			}
+		} break;
+		default: {
 			/*LCOV_EXCL_START*/
-			logprintf(LOG_ERR, "socket: %s", strerror(errno));
+			logprintf(LOG_ERR, "host2ip");
 			goto freeuv;
-			/*LCOV_EXCL_STOP*/
-		}
+			/*LCOV_EXCL_END*/
+		} break;
+	}
+
+	/*
+	 * Partly bypass libuv in case of ssl connections
+	 */
+	if((request->fd = socket(inet, SOCK_STREAM, 0)) < 0){
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "socket: %s", strerror(errno));
+		goto freeuv;
+		/*LCOV_EXCL_STOP*/
+	}
 
 #ifdef _WIN32
-		unsigned long on = 1;
-		ioctlsocket(request->fd, FIONBIO, &on);
+	unsigned long on = 1;
+	ioctlsocket(request->fd, FIONBIO, &on);
 #else
-		long arg = fcntl(request->fd, F_GETFL, NULL);
-		fcntl(request->fd, F_SETFL, arg | O_NONBLOCK);
+	long arg = fcntl(request->fd, F_GETFL, NULL);
+	fcntl(request->fd, F_SETFL, arg | O_NONBLOCK);
 #endif
 
-		switch(inet) {
-			case AF_INET: {
-				r = connect(request->fd, (struct sockaddr *)&addr4, sizeof(addr4));
-			} break;
-			case AF_INET6: {
-				r = connect(request->fd, (struct sockaddr *)&addr6, sizeof(addr6));
-			} break;
-			default: {
-			} break;
-		}
+	switch(inet) {
+		case AF_INET: {
+			r = connect(request->fd, (struct sockaddr *)&addr4, sizeof(addr4));
+		} break;
+		case AF_INET6: {
+			r = connect(request->fd, (struct sockaddr *)&addr6, sizeof(addr6));
+		} break;
+		default: {
+		} break;
+	}
 
-		if(r < 0) {
+	if(r < 0) {
 #ifdef _WIN32
-			if(!(WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAEISCONN)) {
+		if(!(WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAEISCONN)) {
 #else
-			if(!(errno == EINPROGRESS || errno == EISCONN)) {
+		if(!(errno == EINPROGRESS || errno == EISCONN)) {
 #endif
-				/*LCOV_EXCL_START*/
-				logprintf(LOG_ERR, "connect: %s", strerror(errno));
-				goto freeuv;
-				/*LCOV_EXCL_STOP*/
-			}
-		}
-
-		request->poll_req = NULL;
-		if((request->poll_req = MALLOC(sizeof(uv_poll_t))) == NULL) {
-			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
-		}
-		if((request->timer_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
-			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
-		}
-		uv_custom_poll_init(&custom_poll_data, request->poll_req, (void *)request);
-		custom_poll_data->is_ssl = request->is_ssl;
-		custom_poll_data->write_cb = write_cb;
-		custom_poll_data->read_cb = read_cb;
-		custom_poll_data->close_cb = poll_close_cb;
-		if((custom_poll_data->host = STRDUP(request->host)) == NULL) {
-			OUT_OF_MEMORY
-		}
-
-		request->timer_req->data = request;
-
-		r = uv_poll_init_socket(uv_default_loop(), request->poll_req, request->fd);
-		if(r != 0) {
 			/*LCOV_EXCL_START*/
-			logprintf(LOG_ERR, "uv_poll_init_socket: %s", uv_strerror(r));
-			FREE(request->poll_req);
+			logprintf(LOG_ERR, "connect: %s", strerror(errno));
 			goto freeuv;
 			/*LCOV_EXCL_STOP*/
 		}
+	}
 
-		uv_timer_init(uv_default_loop(), request->timer_req);
-		uv_timer_start(request->timer_req, (void (*)(uv_timer_t *))timeout, 3000, 0);
+	request->poll_req = NULL;
+	if((request->poll_req = MALLOC(sizeof(uv_poll_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	uv_custom_poll_init(&custom_poll_data, request->poll_req, (void *)request);
+	custom_poll_data->is_ssl = request->is_ssl;
+	custom_poll_data->write_cb = write_cb;
+	custom_poll_data->read_cb = read_cb;
+	custom_poll_data->close_cb = poll_close_cb;
+	if((custom_poll_data->host = STRDUP(request->host)) == NULL) {
+		OUT_OF_MEMORY
+	}
+	if(request->is_ssl == 1 && request->pool->has_session == 1) {
+		custom_poll_data->ssl.session = &request->pool->session;
+	}
 
-		http_client_add(request->poll_req, custom_poll_data);
-		request->steps = STEP_WRITE;
-		uv_custom_write(request->poll_req);
+	r = uv_poll_init_socket(uv_default_loop(), request->poll_req, request->fd);
+	if(r != 0) {
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "uv_poll_init_socket: %s", uv_strerror(r));
+		FREE(request->poll_req);
+		uv_custom_poll_free(custom_poll_data);
+		goto freeuv;
+		/*LCOV_EXCL_STOP*/
 	}
 
-	return NULL;
+	http_client_add(request->poll_req, custom_poll_data, request->pool);
+	http_request_start(request);
+
+	return;
 
 freeuv:
-	if(request->timer_req != NULL) {
-		uv_timer_stop(request->timer_req);
-	}
-	if(request->callback != NULL && request->called == 0) {
-		request->called = 1;
-		request->callback(404, NULL, 0, 0, request->userdata);
-	}
-	FREE(request->uri);
-	FREE(request->host);
+	http_request_fail(request);
+}
 
-	if(request->fd > 0) {
+char *http_process(int type, char *url, const char *conttype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata) {
+	struct request_t *request = NULL;
+
+	if(http_lock_init == 0) {
+		http_lock_init = 1;
 #ifdef _WIN32
-		closesocket(request->fd);
+		uv_mutex_init(&http_lock);
 #else
-		close(request->fd);
+		pthread_mutexattr_init(&http_attr);
+		pthread_mutexattr_settype(&http_attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&http_lock, &http_attr);
 #endif
 	}
-	FREE(request);
+
+#ifdef _WIN32
+	WSADATA wsa;
+
+	if(WSAStartup(0x202, &wsa) != 0) {
+		logprintf(LOG_ERR, "WSAStartup");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	if(prepare_request(&request, type, url, conttype, post, callback, userdata) == 0) {
+		request->fd = -1;
+		request->pool = http_pool_get(request->host, request->port, request->is_ssl);
+		http_dispatch(request);
+	}
+
 	return NULL;
 }
 
@@ -12,5 +12,6 @@
 char *http_post_content(char *url, const char *contype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata);
 char *http_get_content(char *url, void (*callback)(int, char *, int, char *, void *), void *userdata);
 int http_gc(void);
+void http_pool_stats(unsigned long *hits, unsigned long *misses);
 
 #endif
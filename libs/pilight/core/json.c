@@ -361,17 +361,54 @@ static void append_member(JsonNode *object, char *key, JsonNode *value);
 static bool tag_is_valid(unsigned int tag);
 static bool number_is_valid(const char *num);
 
-JsonNode *json_decode(const char *json)
+/*
+ * Records where parsing stopped. The parse functions leave
+ * *sp at (or right behind) the offending character when
+ * they fail, so this is also where the error is.
+ */
+static void set_error(JsonError *err, const char *json, const char *s, const char *reason)
+{
+	const char *p;
+
+	if (err == NULL)
+		return;
+
+	err->offset = s - json;
+	err->line = 1;
+	err->column = 1;
+	for (p = json; p < s; p++) {
+		if (*p == '\n') {
+			err->line++;
+			err->column = 1;
+		} else {
+			err->column++;
+		}
+	}
+
+	if (reason != NULL)
+		snprintf(err->message, sizeof(err->message), "%s", reason);
+	else if (*s == '\0')
+		snprintf(err->message, sizeof(err->message), "unexpected end of input");
+	else if ((unsigned char)*s < 0x20 || (unsigned char)*s >= 0x7F)
+		snprintf(err->message, sizeof(err->message), "unexpected character 0x%02x", (unsigned char)*s);
+	else
+		snprintf(err->message, sizeof(err->message), "unexpected character '%c'", *s);
+}
+
+JsonNode *json_decode_ex(const char *json, JsonError *err)
 {
 	const char *s = json;
 	JsonNode *ret;
 
 	skip_space(&s);
-	if (!parse_value(&s, &ret))
+	if (!parse_value(&s, &ret)) {
+		set_error(err, json, s, NULL);
 		return NULL;
+	}
 
 	skip_space(&s);
 	if (*s != 0) {
+		set_error(err, json, s, "unexpected data after value");
 		json_delete(ret);
 		return NULL;
 	}
@@ -379,6 +416,11 @@ JsonNode *json_decode(const char *json)
 	return ret;
 }
 
+JsonNode *json_decode(const char *json)
+{
+	return json_decode_ex(json, NULL);
+}
+
 char *json_encode(const JsonNode *node)
 {
 	return json_stringify(node, NULL);
@@ -433,21 +475,34 @@ void json_delete(JsonNode *node)
 	}
 }
 
-bool json_validate(const char *json)
+/*
+ * Walks the input without building a tree, so
+ * validating never allocates any memory.
+ */
+bool json_validate_ex(const char *json, JsonError *err)
 {
 	const char *s = json;
 
 	skip_space(&s);
-	if (!parse_value(&s, NULL))
+	if (!parse_value(&s, NULL)) {
+		set_error(err, json, s, NULL);
 		return false;
+	}
 
 	skip_space(&s);
-	if (*s != 0)
+	if (*s != 0) {
+		set_error(err, json, s, "unexpected data after value");
 		return false;
+	}
 
 	return true;
 }
 
+bool json_validate(const char *json)
+{
+	return json_validate_ex(json, NULL);
+}
+
 JsonNode *json_find_element(JsonNode *array, int index)
 {
 	JsonNode *element;
@@ -636,7 +691,7 @@ static bool parse_value(const char **sp, JsonNode **out)
 				*sp = s;
 				return true;
 			}
-			return false;
+			break;
 
 		case 'f':
 			if (expect_literal(&s, "false")) {
@@ -645,7 +700,7 @@ static bool parse_value(const char **sp, JsonNode **out)
 				*sp = s;
 				return true;
 			}
-			return false;
+			break;
 
 		case 't':
 			if (expect_literal(&s, "true")) {
@@ -654,7 +709,7 @@ static bool parse_value(const char **sp, JsonNode **out)
 				*sp = s;
 				return true;
 			}
-			return false;
+			break;
 
 		case '"': {
 			char *str;
@@ -664,7 +719,7 @@ static bool parse_value(const char **sp, JsonNode **out)
 				*sp = s;
 				return true;
 			}
-			return false;
+			break;
 		}
 
 		case '[':
@@ -672,14 +727,14 @@ static bool parse_value(const char **sp, JsonNode **out)
 				*sp = s;
 				return true;
 			}
-			return false;
+			break;
 
 		case '{':
 			if (parse_object(&s, out)) {
 				*sp = s;
 				return true;
 			}
-			return false;
+			break;
 
 		default: {
 			double num;
@@ -690,9 +745,12 @@ static bool parse_value(const char **sp, JsonNode **out)
 				*sp = s;
 				return true;
 			}
-			return false;
+			break;
 		}
 	}
+
+	*sp = s;
+	return false;
 }
 
 static bool parse_array(const char **sp, JsonNode **out)
@@ -723,8 +781,9 @@ static bool parse_array(const char **sp, JsonNode **out)
 			goto success;
 		}
 
-		if (*s++ != ',')
+		if (*s != ',')
 			goto failure;
+		s++;
 		skip_space(&s);
 	}
 
@@ -735,6 +794,7 @@ success:
 	return true;
 
 failure:
+	*sp = s;
 	json_delete(ret);
 	return false;
 }
@@ -760,8 +820,9 @@ static bool parse_object(const char **sp, JsonNode **out)
 			goto failure;
 		skip_space(&s);
 
-		if (*s++ != ':')
+		if (*s != ':')
 			goto failure_free_key;
+		s++;
 		skip_space(&s);
 
 		if (!parse_value(&s, out ? &value : NULL))
@@ -776,8 +837,9 @@ static bool parse_object(const char **sp, JsonNode **out)
 			goto success;
 		}
 
-		if (*s++ != ',')
+		if (*s != ',')
 			goto failure;
+		s++;
 		skip_space(&s);
 	}
 
@@ -791,6 +853,7 @@ failure_free_key:
 	if (out)
 		free(key);
 failure:
+	*sp = s;
 	json_delete(ret);
 	return false;
 }
@@ -871,6 +934,7 @@ bool parse_string(const char **sp, char **out)
 			}
 		} else if (c <= 0x1F) {
 			/* Control characters are not allowed in string literals. */
+			s--;
 			goto failed;
 		} else {
 			/* Validate and echo a UTF-8 character. */
@@ -905,6 +969,7 @@ bool parse_string(const char **sp, char **out)
 	return true;
 
 failed:
+	*sp = s;
 	if (out)
 		sb_free(&sb);
 	return false;
@@ -936,7 +1001,7 @@ bool parse_number(const char **sp, double *out, int *decimals)
 		s++;
 	} else {
 		if (!is_digit(*s))
-			return false;
+			goto failed;
 		do {
 			s++;
 		} while (is_digit(*s));
@@ -946,7 +1011,7 @@ bool parse_number(const char **sp, double *out, int *decimals)
 	if (*s == '.') {
 		s++;
 		if (!is_digit(*s))
-			return false;
+			goto failed;
 		do {
 			s++;
 			if(decimals != NULL) {
@@ -961,7 +1026,7 @@ bool parse_number(const char **sp, double *out, int *decimals)
 		if (*s == '+' || *s == '-')
 			s++;
 		if (!is_digit(*s))
-			return false;
+			goto failed;
 		do {
 			s++;
 		} while (is_digit(*s));
@@ -972,6 +1037,10 @@ bool parse_number(const char **sp, double *out, int *decimals)
 
 	*sp = s;
 	return true;
+
+failed:
+	*sp = s;
+	return false;
 }
 
 static void skip_space(const char **sp)
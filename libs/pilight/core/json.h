@@ -68,15 +68,25 @@ struct JsonNode
 	int decimals_;
 };
 
+typedef struct JsonError
+{
+	size_t offset;
+	int line;
+	int column;
+	char message[64];
+} JsonError;
+
 /*** Encoding, decoding, and validation ***/
 
 JsonNode   *json_decode         (const char *json);
+JsonNode   *json_decode_ex      (const char *json, JsonError *err);
 char       *json_encode         (const JsonNode *node);
 char       *json_encode_string  (const char *str);
 char       *json_stringify      (const JsonNode *node, const char *space);
 void        json_delete         (JsonNode *node);
 
 bool        json_validate       (const char *json);
+bool        json_validate_ex    (const char *json, JsonError *err);
 
 /*** Lookup and traversal ***/
 
@@ -77,6 +77,7 @@ typedef struct request_t {
   const char *login;
 	const char *pass;
 	unsigned short port;
+	int is_ssl;
 
 	char *content;
 	int content_len;
@@ -527,61 +528,23 @@ static void write_cb(uv_poll_t *req) {
 	}
 }
 
-int sendmail(char *host, char *login, char *pass, unsigned short port, int is_ssl, struct mail_t *mail, void (*callback)(int, struct mail_t *)) {
-	struct request_t *request = NULL;
+static void mail_resolved(char *host, int type, char *ip, void *userdata) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct request_t *request = userdata;
 	struct uv_custom_poll_t *custom_poll_data = NULL;
 	struct sockaddr_in addr4;
 	struct sockaddr_in6 addr6;
-	char *ip = NULL;
-	int type = 0, sockfd = 0, r = 0;
-
-	if(mail->from == NULL) {
-		logprintf(LOG_ERR, "SMTP: sender not set");
-		return -1;
-	}
-	if(mail->subject == NULL) {
-		logprintf(LOG_ERR, "SMTP: subject not set");
-		return -1;
-	}
-	if(mail->message == NULL) {
-		logprintf(LOG_ERR, "SMTP: message not set");
-		return -1;
-	}
-	if(mail->to == NULL) {
-		logprintf(LOG_ERR, "SMTP: recipient not set");
-		return -1;
-	}
-	if(strcmp(mail->message, ".") == 0) {
-		logprintf(LOG_ERR, "SMTP: message cannot be a single .");
-		return -1;
-	}
-
-	if((request = MALLOC(sizeof(struct request_t))) == NULL) {
-		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
-	}
-	memset(request, 0, sizeof(struct request_t));
-	request->host = host;
-	request->login = login;
-	request->pass = pass;
-	request->port = port;
-	request->mail = mail;
-	request->authtype = UNSUPPORTED;
-	request->callback = callback;
+	int sockfd = 0, r = 0;
 
-#ifdef _WIN32
-	WSADATA wsa;
-
-	if(WSAStartup(0x202, &wsa) != 0) {
-		logprintf(LOG_ERR, "WSAStartup");
-		exit(EXIT_FAILURE);
-	}
-#endif
-
-	type = host2ip(host, &ip);
 	switch(type) {
 		case AF_INET: {
 			memset(&addr4, '\0', sizeof(struct sockaddr_in));
-			r = uv_ip4_addr(ip, port, &addr4);
+			r = uv_ip4_addr(ip, request->port, &addr4);
 			if(r != 0) {
 				/*LCOV_EXCL_START*/
 				logprintf(LOG_ERR, "uv_ip4_addr: %s", uv_strerror(r));
@@ -591,7 +554,7 @@ int sendmail(char *host, char *login, char *pass, unsigned short port, int is_ss
 		} break;
 		case AF_INET6: {
 			memset(&addr6, '\0', sizeof(struct sockaddr_in6));
-			r = uv_ip6_addr(ip, port, &addr6);
+			r = uv_ip6_addr(ip, request->port, &addr6);
 			if(r != 0) {
 				/*LCOV_EXCL_START*/
 				logprintf(LOG_ERR, "uv_ip6_addr: %s", uv_strerror(r));
@@ -606,7 +569,6 @@ int sendmail(char *host, char *login, char *pass, unsigned short port, int is_ss
 			/*LCOV_EXCL_END*/
 		} break;
 	}
-	FREE(ip);
 
 	if((sockfd = socket(type, SOCK_STREAM, 0)) < 0){
 		logprintf(LOG_ERR, "socket: %s", strerror(errno)); /*LCOV_EXCL_LINE*/
@@ -651,12 +613,12 @@ int sendmail(char *host, char *login, char *pass, unsigned short port, int is_ss
 
 	uv_custom_poll_init(&custom_poll_data, poll_req, (void *)request);
 
-	custom_poll_data->is_ssl = is_ssl;
+	custom_poll_data->is_ssl = request->is_ssl;
 
 	if(custom_poll_data->is_ssl == 1 && ssl_client_init_status() == -1) {
 		logprintf(LOG_ERR, "secure e-mails require a properly initialized SSL library");
 		abort_cb(poll_req);
-		return -1;
+		return;
 	}
 	custom_poll_data->write_cb = write_cb;
 	custom_poll_data->read_cb = read_cb;
@@ -674,7 +636,7 @@ int sendmail(char *host, char *login, char *pass, unsigned short port, int is_ss
 	request->step = SMTP_STEP_RECV_WELCOME;
 	uv_custom_write(poll_req);
 
-	return 0;
+	return;
 
 free:
 	if(request != NULL && request->callback != NULL) {
@@ -691,5 +653,59 @@ free:
 		close(sockfd);
 #endif
 	}
-	return -1;
+}
+
+int sendmail(char *host, char *login, char *pass, unsigned short port, int is_ssl, struct mail_t *mail, void (*callback)(int, struct mail_t *)) {
+	struct request_t *request = NULL;
+
+	if(mail->from == NULL) {
+		logprintf(LOG_ERR, "SMTP: sender not set");
+		return -1;
+	}
+	if(mail->subject == NULL) {
+		logprintf(LOG_ERR, "SMTP: subject not set");
+		return -1;
+	}
+	if(mail->message == NULL) {
+		logprintf(LOG_ERR, "SMTP: message not set");
+		return -1;
+	}
+	if(mail->to == NULL) {
+		logprintf(LOG_ERR, "SMTP: recipient not set");
+		return -1;
+	}
+	if(strcmp(mail->message, ".") == 0) {
+		logprintf(LOG_ERR, "SMTP: message cannot be a single .");
+		return -1;
+	}
+
+	if((request = MALLOC(sizeof(struct request_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(request, 0, sizeof(struct request_t));
+	request->host = host;
+	request->login = login;
+	request->pass = pass;
+	request->port = port;
+	request->is_ssl = is_ssl;
+	request->mail = mail;
+	request->authtype = UNSUPPORTED;
+	request->callback = callback;
+
+#ifdef _WIN32
+	WSADATA wsa;
+
+	if(WSAStartup(0x202, &wsa) != 0) {
+		logprintf(LOG_ERR, "WSAStartup");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	/*
+	 * Connection failures from here on are
+	 * reported through the callback.
+	 */
+	host2ip_async(host, mail_resolved, request);
+
+	return 0;
 }
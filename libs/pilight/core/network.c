@@ -310,9 +310,30 @@ int dev2ip(char *dev, char **ip, sa_family_t type) {
 	return 0;
 }
 
+static int addrinfo2ip(struct addrinfo *servinfo, char *ip, size_t len) {
+	struct addrinfo *p = NULL;
+
+	for(p = servinfo; p != NULL; p = p->ai_next) {
+		memset(ip, '\0', len);
+		if(p->ai_family == AF_INET6) {
+			struct sockaddr_in6 *h = NULL;
+			memcpy(&h, &p->ai_addr, sizeof(struct sockaddr_in6 *));
+			uv_inet_ntop(p->ai_family, (void *)&(h->sin6_addr), ip, len);
+		} else if(p->ai_family == AF_INET) {
+			struct sockaddr_in *h = NULL;
+			memcpy(&h, &p->ai_addr, sizeof(struct sockaddr_in *));
+			uv_inet_ntop(p->ai_family, (void *)&(h->sin_addr), ip, len);
+		}
+		if(strlen(ip) > 0) {
+			return p->ai_family;
+		}
+	}
+	return -1;
+}
+
 int host2ip(char *host, char **ip) {
 	int rv = 0;
-	struct addrinfo hints, *servinfo, *p;
+	struct addrinfo *servinfo = NULL;
 
 #ifdef _WIN32
 	WSADATA wsa;
@@ -323,10 +344,6 @@ int host2ip(char *host, char **ip) {
 	}
 #endif
 
-	memset(&hints, 0, sizeof hints);
-	hints.ai_family = AF_INET6;
-	hints.ai_socktype = SOCK_STREAM;
-
 	if((rv = getaddrinfo(host, NULL , NULL, &servinfo)) != 0) {
 		/*LCOV_EXCL_START*/
 		logprintf(LOG_NOTICE, "getaddrinfo: %s, %s", host, gai_strerror(rv));
@@ -334,33 +351,240 @@ int host2ip(char *host, char **ip) {
 		/*LCOV_EXCL_STOP*/
 	}
 
-	for(p = servinfo; p != NULL; p = p->ai_next) {
-		if(p->ai_family == AF_INET6) {
-			if((*ip = MALLOC(INET6_ADDRSTRLEN+1)) == NULL) {
-				OUT_OF_MEMORY
-			}
-			struct sockaddr_in6 *h = NULL;
-			memcpy(&h, &p->ai_addr, sizeof(struct sockaddr_in6 *));
-			memset(*ip, '\0', INET6_ADDRSTRLEN+1);
-			uv_inet_ntop(p->ai_family, (void *)&(h->sin6_addr), *ip, INET6_ADDRSTRLEN+1);
-		} else if(p->ai_family == AF_INET) {
-			if((*ip = MALLOC(INET_ADDRSTRLEN+1)) == NULL) {
-				OUT_OF_MEMORY
+	if((*ip = MALLOC(INET6_ADDRSTRLEN+1)) == NULL) {
+		OUT_OF_MEMORY
+	}
+
+	rv = addrinfo2ip(servinfo, *ip, INET6_ADDRSTRLEN+1);
+	freeaddrinfo(servinfo);
+
+	if(rv == -1) {
+		FREE(*ip);
+	}
+	return rv;
+}
+
+/*
+ * Asynchronous counterpart of host2ip. Lookups are
+ * done in the libuv threadpool so the main loop is
+ * never blocked by a slow resolver. Results are kept
+ * in a small cache, failed lookups as well, and
+ * concurrent lookups of the same host are coalesced
+ * into a single getaddrinfo call.
+ */
+typedef struct host2ip_waiter_t {
+	void (*callback)(char *, int, char *, void *);
+	void *userdata;
+	struct host2ip_waiter_t *next;
+} host2ip_waiter_t;
+
+typedef struct host2ip_cache_t {
+	char *host;
+	char ip[INET6_ADDRSTRLEN+1];
+	int type;
+	uint64_t expires;
+	uv_getaddrinfo_t *req;
+
+	struct host2ip_waiter_t *waiters;
+	struct host2ip_cache_t *next;
+} host2ip_cache_t;
+
+static struct host2ip_cache_t *host2ip_cache = NULL;
+
+static void host2ip_cache_free(struct host2ip_cache_t *node) {
+	struct host2ip_waiter_t *tmp = NULL;
+	while(node->waiters) {
+		tmp = node->waiters;
+		node->waiters = node->waiters->next;
+		FREE(tmp);
+	}
+	FREE(node->host);
+	FREE(node);
+}
+
+static void host2ip_cb(uv_getaddrinfo_t *req, int status, struct addrinfo *res) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct host2ip_cache_t *node = req->data;
+	struct host2ip_waiter_t *waiters = NULL, *tmp = NULL;
+
+	FREE(req);
+
+	/*
+	 * The cache was cleared while this lookup
+	 * was still running.
+	 */
+	if(node == NULL) {
+		if(res != NULL) {
+			uv_freeaddrinfo(res);
+		}
+		return;
+	}
+
+	node->req = NULL;
+	node->type = -1;
+
+	if(status < 0) {
+		logprintf(LOG_NOTICE, "getaddrinfo: %s, %s", node->host, uv_strerror(status));
+	} else {
+		node->type = addrinfo2ip(res, node->ip, sizeof(node->ip));
+	}
+	if(res != NULL) {
+		uv_freeaddrinfo(res);
+	}
+
+	if(node->type == -1) {
+		node->expires = uv_now(uv_default_loop()) + (HOST2IP_NEGATIVE_TTL*1000);
+	} else {
+		node->expires = uv_now(uv_default_loop()) + (HOST2IP_POSITIVE_TTL*1000);
+	}
+
+	/*
+	 * Detach the waiters first, so callbacks
+	 * can safely start new lookups.
+	 */
+	waiters = node->waiters;
+	node->waiters = NULL;
+
+	while(waiters) {
+		tmp = waiters;
+		waiters = waiters->next;
+		if(node->type == -1) {
+			tmp->callback(node->host, -1, NULL, tmp->userdata);
+		} else {
+			tmp->callback(node->host, node->type, node->ip, tmp->userdata);
+		}
+		FREE(tmp);
+	}
+}
+
+int host2ip_async(char *host, void (*callback)(char *host, int type, char *ip, void *userdata), void *userdata) {
+	/*
+	 * Make sure we are called from the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	if(uv_thread_equal(&pth_main_id, &pth_cur_id) == 0) {
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "host2ip_async can only be called from the main thread");
+		return -1;
+		/*LCOV_EXCL_STOP*/
+	}
+
+	struct host2ip_cache_t *node = host2ip_cache, *prev = NULL, *match = NULL;
+	struct host2ip_waiter_t *waiter = NULL;
+	struct addrinfo hints;
+	uint64_t now = uv_now(uv_default_loop());
+	int r = 0;
+
+	while(node) {
+		if(strcmp(node->host, host) == 0) {
+			match = node;
+		} else if(node->req == NULL && node->expires <= now) {
+			struct host2ip_cache_t *tmp = node;
+			if(prev == NULL) {
+				host2ip_cache = node->next;
+			} else {
+				prev->next = node->next;
 			}
-			struct sockaddr_in *h = NULL;
-			memcpy(&h, &p->ai_addr, sizeof(struct sockaddr_in *));
-			memset(*ip, '\0', INET_ADDRSTRLEN+1);
-			uv_inet_ntop(p->ai_family, (void *)&(h->sin_addr), *ip, INET_ADDRSTRLEN+1);
+			node = node->next;
+			host2ip_cache_free(tmp);
+			continue;
 		}
-		if(*ip != NULL && strlen(*ip) > 0) {
-			int r = p->ai_family;
-			freeaddrinfo(servinfo);
-			return r;
+		prev = node;
+		node = node->next;
+	}
+
+	if(match != NULL && match->req == NULL && match->expires > now) {
+		if(match->type == -1) {
+			callback(match->host, -1, NULL, userdata);
+		} else {
+			callback(match->host, match->type, match->ip, userdata);
 		}
+		return 0;
 	}
 
-	freeaddrinfo(servinfo);
-	return -1;
+	if(match == NULL) {
+		if((match = MALLOC(sizeof(struct host2ip_cache_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		memset(match, 0, sizeof(struct host2ip_cache_t));
+		if((match->host = STRDUP(host)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		match->type = -1;
+		match->next = host2ip_cache;
+		host2ip_cache = match;
+	}
+
+	if((waiter = MALLOC(sizeof(struct host2ip_waiter_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	waiter->callback = callback;
+	waiter->userdata = userdata;
+	waiter->next = match->waiters;
+	match->waiters = waiter;
+
+	/*
+	 * A lookup for this host is already running
+	 */
+	if(match->req != NULL) {
+		return 0;
+	}
+
+	if((match->req = MALLOC(sizeof(uv_getaddrinfo_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	match->req->data = match;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if((r = uv_getaddrinfo(uv_default_loop(), match->req, host2ip_cb, match->host, NULL, &hints)) != 0) {
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "uv_getaddrinfo: %s", uv_strerror(r));
+		FREE(match->req);
+		match->req = NULL;
+		match->waiters = NULL;
+		match->expires = now + (HOST2IP_NEGATIVE_TTL*1000);
+		FREE(waiter);
+		callback(match->host, -1, NULL, userdata);
+		/*LCOV_EXCL_STOP*/
+	}
+
+	return 0;
+}
+
+void host2ip_gc(void) {
+	struct host2ip_cache_t *tmp = NULL;
+	struct host2ip_waiter_t *waiter = NULL;
+
+	/*
+	 * The waiters are told the lookup failed, so they
+	 * can release their requests. They may start new
+	 * lookups, which are cleared by this loop as well.
+	 */
+	while(host2ip_cache) {
+		tmp = host2ip_cache;
+		host2ip_cache = host2ip_cache->next;
+		if(tmp->req != NULL) {
+			/* The request itself is freed by host2ip_cb */
+			tmp->req->data = NULL;
+			uv_cancel((uv_req_t *)tmp->req);
+			tmp->req = NULL;
+		}
+		while(tmp->waiters) {
+			waiter = tmp->waiters;
+			tmp->waiters = waiter->next;
+			waiter->callback(tmp->host, -1, NULL, waiter->userdata);
+			FREE(waiter);
+		}
+		host2ip_cache_free(tmp);
+	}
 }
 
 #ifdef _WIN32
@@ -33,6 +33,10 @@
 #define ETH_ALEN 6
 #endif
 
+/* Seconds a resolved or failed host2ip_async lookup is cached */
+#define HOST2IP_POSITIVE_TTL	300
+#define HOST2IP_NEGATIVE_TTL	30
+
 #ifdef _WIN32
 #define sa_family_t uint16_t
 int inet_pton(int af, const char *src, void *dst);
@@ -47,6 +51,8 @@ int dev2ip(char *dev, char **ip, __sa_family_t type);
 int dev2ip(char *dev, char **ip, sa_family_t type);
 #endif
 int host2ip(char *host, char **ip);
+int host2ip_async(char *host, void (*callback)(char *host, int type, char *ip, void *userdata), void *userdata);
+void host2ip_gc(void);
 int whitelist_check(char *ip);
 void whitelist_free(void);
 
@@ -194,25 +194,14 @@ static void on_send(uv_udp_send_t *req, int status) {
 	FREE(req);
 }
 
-static void loop(uv_timer_t *req) {
+static void loop(uv_timer_t *req);
+
+static void resolved(char *host, int type, char *ip, void *userdata) {
 	/*
-	 * Make sure we are called from the main thread
+	 * Make sure we execute in the main thread
 	 */
 	const uv_thread_t pth_cur_id = uv_thread_self();
-	if(uv_thread_equal(&pth_main_id, &pth_cur_id) == 0) {
-		/*LCOV_EXCL_START*/
-		logprintf(LOG_ERR, "ntpsync can only be started from the main thread");
-		return;
-		/*LCOV_EXCL_STOP*/
-	}
-
-	if(init == 0) {
-		if((timer_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
-			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
-		}
-		uv_timer_init(uv_default_loop(), timer_req);
-		init = 1;
-	}
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
 
 	struct sockaddr_in addr4;
 	struct sockaddr_in6 addr6;
@@ -220,39 +209,34 @@ static void loop(uv_timer_t *req) {
 	uv_udp_t *client_req = NULL;
 	uv_udp_send_t *send_req = NULL;
 	uv_timer_t *timeout_req = NULL;
-	char *ip = NULL;
 	char buffer[BUFFER_SIZE];
-	int r = 0, type = 0;
-
-#ifdef _WIN32
-	WSADATA wsa;
+	int r = 0, i = (intptr_t)userdata;
 
-	if(WSAStartup(0x202, &wsa) != 0) {
-		logprintf(LOG_ERR, "WSAStartup");
-		exit(EXIT_FAILURE);
+	/*
+	 * The ntp servers were cleared while
+	 * the lookup was still running.
+	 */
+	if(i >= ntp_servers.nrservers) {
+		return;
 	}
-#endif
 
-	type = host2ip(ntp_servers.server[nr].host, &ip);
 	switch(type) {
 		case AF_INET: {
 			memset(&addr4, '\0', sizeof(struct sockaddr_in));
-			r = uv_ip4_addr(ip, ntp_servers.server[nr].port, &addr4);
+			r = uv_ip4_addr(ip, ntp_servers.server[i].port, &addr4);
 			if(r != 0) {
 				/*LCOV_EXCL_START*/
 				logprintf(LOG_ERR, "uv_ip4_addr: %s", uv_strerror(r));
-				FREE(ip);
 				return;
 				/*LCOV_EXCL_END*/
 			}
 		} break;
 		case AF_INET6: {
 			memset(&addr6, '\0', sizeof(struct sockaddr_in6));
-			r = uv_ip6_addr(ip, ntp_servers.server[nr].port, &addr6);
+			r = uv_ip6_addr(ip, ntp_servers.server[i].port, &addr6);
 			if(r != 0) {
 				/*LCOV_EXCL_START*/
 				logprintf(LOG_ERR, "uv_ip6_addr: %s", uv_strerror(r));
-				FREE(ip);
 				return;
 				/*LCOV_EXCL_END*/
 			}
@@ -260,11 +244,10 @@ static void loop(uv_timer_t *req) {
 		default: {
 			/*LCOV_EXCL_START*/
 			logprintf(LOG_ERR, "host2ip");
-			FREE(ip);
+			return;
 			/*LCOV_EXCL_END*/
 		} break;
 	}
-	FREE(ip);
 
 	if((client_req = MALLOC(sizeof(uv_udp_t))) == NULL) {
 		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
@@ -338,7 +321,43 @@ static void loop(uv_timer_t *req) {
 		return;
 		/*LCOV_EXCL_STOP*/
 	}
-	logprintf(LOG_DEBUG, "syncing with ntp-server %s", ntp_servers.server[nr].host);
+	logprintf(LOG_DEBUG, "syncing with ntp-server %s", ntp_servers.server[i].host);
+}
+
+static void loop(uv_timer_t *req) {
+	/*
+	 * Make sure we are called from the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	if(uv_thread_equal(&pth_main_id, &pth_cur_id) == 0) {
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "ntpsync can only be started from the main thread");
+		return;
+		/*LCOV_EXCL_STOP*/
+	}
+
+	if(init == 0) {
+		if((timer_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		uv_timer_init(uv_default_loop(), timer_req);
+		init = 1;
+	}
+
+#ifdef _WIN32
+	WSADATA wsa;
+
+	if(WSAStartup(0x202, &wsa) != 0) {
+		logprintf(LOG_ERR, "WSAStartup");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	/*
+	 * The server index is passed along because nr
+	 * will have moved on when the lookup finishes.
+	 */
+	host2ip_async(ntp_servers.server[nr].host, resolved, (void *)(intptr_t)nr);
 
 	if(nr+1 < ntp_servers.nrservers) {
 		uv_timer_start(timer_req, loop, 1.5*1000, 0);
@@ -89,11 +89,16 @@
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <assert.h>
 
+#include "../../libuv/uv.h"
+#include "pilight.h"
 #include "common.h"
 #include "network.h"
 #include "log.h"
 #include "mem.h"
+#include "ping.h"
 
 #ifdef _WIN32
 	typedef unsigned char u_int8_t;
@@ -329,3 +334,315 @@ int ping(char *addr) {
 	close(sockfd);
 	return 0;
 }
+
+/*
+ * All hosts are pinged from a single ICMP socket polled
+ * by the event loop. Each host has its own probe timer.
+ * Replies are matched to the outstanding probe of a host
+ * by source address and sequence number.
+ */
+#define PING_TIMEOUT	1000
+#define PING_LENGTH		16
+
+typedef struct ping_host_t {
+	char ip[INET_ADDRSTRLEN+1];
+	struct sockaddr_in addr;
+	uint16_t seq;
+	int pending;
+	uint64_t sent;
+	int timeout;
+
+	struct ping_stats_t stats;
+
+	uv_timer_t *interval_req;
+	uv_timer_t *timeout_req;
+
+	void (*callback)(char *, int, struct ping_stats_t *, void *);
+	void *userdata;
+
+	struct ping_host_t *next;
+} ping_host_t;
+
+static struct ping_host_t *hosts = NULL;
+static uv_poll_t *poll_req = NULL;
+static int sockfd = -1;
+static int israw = 0;
+static uint16_t ping_id = 0;
+
+static void close_cb(uv_handle_t *handle) {
+	FREE(handle);
+}
+
+static uint16_t ping_cksum(uint16_t *addr, int len) {
+	uint32_t sum = 0;
+
+	while(len > 1) {
+		sum += *addr++;
+		len -= 2;
+	}
+	if(len == 1) {
+		sum += *(uint8_t *)addr;
+	}
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+static void ping_timeout(uv_timer_t *req) {
+	struct ping_host_t *host = req->data;
+
+	if(host->pending == 0) {
+		return;
+	}
+	host->pending = 0;
+
+	if(host->callback != NULL) {
+		host->callback(host->ip, -1, &host->stats, host->userdata);
+	}
+}
+
+static void ping_reply(struct ping_host_t *host) {
+	double rtt = (double)(uv_hrtime()-host->sent)/1000000;
+
+	host->pending = 0;
+	uv_timer_stop(host->timeout_req);
+
+	host->stats.received++;
+	host->stats.rtt = rtt;
+	if(host->stats.received == 1 || rtt < host->stats.rtt_min) {
+		host->stats.rtt_min = rtt;
+	}
+	if(rtt > host->stats.rtt_max) {
+		host->stats.rtt_max = rtt;
+	}
+	host->stats.rtt_avg += (rtt-host->stats.rtt_avg)/host->stats.received;
+
+	if(host->callback != NULL) {
+		host->callback(host->ip, 0, &host->stats, host->userdata);
+	}
+}
+
+static void ping_read(uv_poll_t *req, int status, int events) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct ping_host_t *host = NULL;
+	struct sockaddr_in from;
+	struct icmp *icmp = NULL;
+	socklen_t fromlen = sizeof(from);
+	char buf[1500];
+	int n = 0, offset = 0;
+
+	if(status < 0) {
+		logprintf(LOG_ERR, "ping: %s", uv_strerror(status));
+		return;
+	}
+
+	while((n = recvfrom(sockfd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen)) > 0) {
+		fromlen = sizeof(from);
+		offset = 0;
+		/*
+		 * Raw sockets include the IP header,
+		 * unprivileged ICMP sockets do not.
+		 */
+		if(israw == 1) {
+			offset = ((struct ip *)buf)->ip_hl << 2;
+		}
+		if(n < offset+8) {
+			continue;
+		}
+		icmp = (struct icmp *)&buf[offset];
+		if(icmp->icmp_type != ICMP_ECHOREPLY) {
+			continue;
+		}
+		if(israw == 1 && ntohs(icmp->icmp_id) != ping_id) {
+			continue;
+		}
+
+		host = hosts;
+		while(host) {
+			if(host->pending == 1 && host->seq == ntohs(icmp->icmp_seq) &&
+				 host->addr.sin_addr.s_addr == from.sin_addr.s_addr) {
+				ping_reply(host);
+				break;
+			}
+			host = host->next;
+		}
+	}
+}
+
+static void ping_send(uv_timer_t *req) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct ping_host_t *host = req->data;
+	struct icmp *icmp = NULL;
+	char buf[PING_LENGTH];
+
+	/*
+	 * The previous probe is still unanswered.
+	 */
+	if(host->pending == 1) {
+		uv_timer_stop(host->timeout_req);
+		ping_timeout(host->timeout_req);
+	}
+
+	memset(buf, '\0', PING_LENGTH);
+	icmp = (struct icmp *)buf;
+	icmp->icmp_type = ICMP_ECHO;
+	icmp->icmp_code = 0;
+	icmp->icmp_id = htons(ping_id);
+	icmp->icmp_seq = htons(++host->seq);
+	icmp->icmp_cksum = 0;
+	icmp->icmp_cksum = ping_cksum((uint16_t *)buf, PING_LENGTH);
+
+	host->sent = uv_hrtime();
+	host->stats.sent++;
+
+	if(sendto(sockfd, buf, PING_LENGTH, 0, (struct sockaddr *)&host->addr, sizeof(host->addr)) < 0) {
+		logperror(LOG_DEBUG, "sendto");
+		host->pending = 1;
+		ping_timeout(host->timeout_req);
+		return;
+	}
+
+	host->pending = 1;
+	uv_timer_start(host->timeout_req, ping_timeout, host->timeout, 0);
+}
+
+static int ping_socket(void) {
+#ifdef _WIN32
+	unsigned long on = 1;
+	WSADATA wsa;
+
+	if(WSAStartup(0x202, &wsa) != 0) {
+		logprintf(LOG_ERR, "could not initialize new socket");
+		return -1;
+	}
+#endif
+
+	if((sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) >= 0) {
+		israw = 1;
+#ifdef __linux__
+	} else if((sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP)) >= 0) {
+		israw = 0;
+#endif
+	} else {
+		logperror(LOG_ERR, "socket");
+		return -1;
+	}
+
+#ifdef _WIN32
+	ioctlsocket(sockfd, FIONBIO, &on);
+#else
+	fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	ping_id = (uint16_t)(getpid() & 0xFFFF);
+
+	if((poll_req = MALLOC(sizeof(uv_poll_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	uv_poll_init_socket(uv_default_loop(), poll_req, sockfd);
+	uv_poll_start(poll_req, UV_READABLE, ping_read);
+
+	return 0;
+}
+
+int ping_add(char *addr, int interval, void (*callback)(char *, int, struct ping_stats_t *, void *), void *userdata) {
+	struct ping_host_t *host = NULL;
+
+	if(interval <= 0) {
+		return -1;
+	}
+
+	if((host = MALLOC(sizeof(struct ping_host_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(host, 0, sizeof(struct ping_host_t));
+
+	host->addr.sin_family = AF_INET;
+	if(inet_pton(AF_INET, addr, &host->addr.sin_addr) != 1) {
+		logprintf(LOG_ERR, "ping: %s is not a valid ip address", addr);
+		FREE(host);
+		return -1;
+	}
+	strncpy(host->ip, addr, INET_ADDRSTRLEN);
+
+	if(sockfd == -1 && ping_socket() != 0) {
+		FREE(host);
+		return -1;
+	}
+
+	host->callback = callback;
+	host->userdata = userdata;
+	host->timeout = (interval*1000 > PING_TIMEOUT) ? PING_TIMEOUT : (interval*1000)/2;
+
+	if((host->interval_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((host->timeout_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	host->interval_req->data = host;
+	host->timeout_req->data = host;
+	uv_timer_init(uv_default_loop(), host->interval_req);
+	uv_timer_init(uv_default_loop(), host->timeout_req);
+	uv_timer_start(host->interval_req, ping_send, interval*1000, interval*1000);
+
+	host->next = hosts;
+	hosts = host;
+
+	return 0;
+}
+
+int ping_stats(char *addr, struct ping_stats_t *stats) {
+	struct ping_host_t *host = hosts;
+
+	while(host) {
+		if(strcmp(host->ip, addr) == 0) {
+			memcpy(stats, &host->stats, sizeof(struct ping_stats_t));
+			return 0;
+		}
+		host = host->next;
+	}
+	return -1;
+}
+
+int ping_gc(void) {
+	struct ping_host_t *tmp = NULL;
+
+	while(hosts) {
+		tmp = hosts;
+		hosts = hosts->next;
+
+		uv_timer_stop(tmp->interval_req);
+		uv_timer_stop(tmp->timeout_req);
+		uv_close((uv_handle_t *)tmp->interval_req, close_cb);
+		uv_close((uv_handle_t *)tmp->timeout_req, close_cb);
+		FREE(tmp);
+	}
+
+	if(poll_req != NULL) {
+		uv_poll_stop(poll_req);
+		uv_close((uv_handle_t *)poll_req, close_cb);
+		poll_req = NULL;
+	}
+	if(sockfd != -1) {
+#ifdef _WIN32
+		closesocket(sockfd);
+#else
+		close(sockfd);
+#endif
+		sockfd = -1;
+	}
+
+	logprintf(LOG_DEBUG, "garbage collected ping library");
+	return 0;
+}
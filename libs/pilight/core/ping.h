@@ -63,6 +63,19 @@
 #ifndef _LIBPROC_H_
 #define _LIBPROC_H_
 
+typedef struct ping_stats_t {
+	unsigned long sent;
+	unsigned long received;
+	/* Round trip times in milliseconds */
+	double rtt;
+	double rtt_min;
+	double rtt_max;
+	double rtt_avg;
+} ping_stats_t;
+
 int ping(char *addr);
+int ping_add(char *addr, int interval, void (*callback)(char *, int, struct ping_stats_t *, void *), void *userdata);
+int ping_stats(char *addr, struct ping_stats_t *stats);
+int ping_gc(void);
 
 #endif
@@ -0,0 +1,313 @@
+/*
+	Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef _WIN32
+	#ifdef __mips__
+		#define __USE_UNIX98
+	#endif
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <sys/time.h>
+#endif
+#include <pthread.h>
+
+#include "log.h"
+#include "shm.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct shm_ring_t *ring = NULL;
+/* The next slot a client reads */
+static uint64_t next = 0;
+
+#ifndef _WIN32
+static uint64_t shm_stamp(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return 1000000ULL * tv.tv_sec + tv.tv_usec;
+}
+
+/*
+ * Called with the lock held. Returns the slot to
+ * write, which is marked as being written.
+ */
+static struct shm_slot_t *shm_begin(void) {
+	struct shm_slot_t *slot = &ring->slot[ring->head % SHM_SLOTS];
+
+	slot->seq = 2*ring->head+1;
+	__sync_synchronize();
+	slot->stamp = shm_stamp();
+	return slot;
+}
+
+static void shm_commit(struct shm_slot_t *slot) {
+	__sync_synchronize();
+	slot->seq = 2*(ring->head+1);
+	__sync_synchronize();
+	ring->head++;
+}
+#endif
+
+int shm_init(void) {
+#ifdef _WIN32
+	return -1;
+#else
+	int fd = -1;
+
+	if((fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1) {
+		logprintf(LOG_ERR, "cannot create shared memory %s", SHM_NAME);
+		return -1;
+	}
+	if(ftruncate(fd, sizeof(struct shm_ring_t)) == -1) {
+		logprintf(LOG_ERR, "cannot resize shared memory %s", SHM_NAME);
+		close(fd);
+		shm_unlink(SHM_NAME);
+		return -1;
+	}
+
+	pthread_mutex_lock(&lock);
+	ring = mmap(NULL, sizeof(struct shm_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(ring == MAP_FAILED) {
+		ring = NULL;
+		pthread_mutex_unlock(&lock);
+		logprintf(LOG_ERR, "cannot map shared memory %s", SHM_NAME);
+		shm_unlink(SHM_NAME);
+		return -1;
+	}
+
+	memset(ring, 0, sizeof(struct shm_ring_t));
+	ring->version = SHM_VERSION;
+	ring->slots = SHM_SLOTS;
+	ring->slotsize = sizeof(struct shm_slot_t);
+	__sync_synchronize();
+	ring->magic = SHM_MAGIC;
+	pthread_mutex_unlock(&lock);
+
+	logprintf(LOG_DEBUG, "publishing received codes in shared memory %s", SHM_NAME);
+	return 0;
+#endif
+}
+
+#ifndef _WIN32
+/*
+ * Copies the values of a message into its binary form.
+ * Returns -1 when they don't fit.
+ */
+static int shm_message(struct JsonNode *json, struct shm_message_t *msg) {
+	struct JsonNode *jmessage = json_find_member(json, "message");
+	struct JsonNode *jchild = NULL;
+	struct shm_value_t *value = NULL;
+	char *str = NULL;
+	double repeats = -1;
+
+	if(jmessage == NULL || jmessage->tag != JSON_OBJECT) {
+		return -1;
+	}
+
+	if(json_find_string(json, "origin", &str) == 0) {
+		snprintf(msg->origin, SHM_ORIGIN_SIZE, "%s", str);
+	}
+	if(json_find_string(json, "uuid", &str) == 0) {
+		snprintf(msg->uuid, SHM_UUID_SIZE, "%s", str);
+	}
+	json_find_number(json, "repeats", &repeats);
+	msg->repeats = (int32_t)repeats;
+
+	jchild = json_first_child(jmessage);
+	while(jchild) {
+		if(msg->nrvalues == SHM_VALUES || strlen(jchild->key) >= SHM_KEY_SIZE) {
+			return -1;
+		}
+		value = &msg->values[msg->nrvalues];
+		if(jchild->tag == JSON_NUMBER) {
+			value->type = SHM_VALUE_NUMBER;
+			value->number = jchild->number_;
+			value->decimals = jchild->decimals_;
+		} else if(jchild->tag == JSON_STRING && strlen(jchild->string_) < SHM_STRING_SIZE) {
+			value->type = SHM_VALUE_STRING;
+			strcpy(value->string, jchild->string_);
+		} else {
+			return -1;
+		}
+		strcpy(value->name, jchild->key);
+		msg->nrvalues++;
+		jchild = jchild->next;
+	}
+	return 0;
+}
+#endif
+
+void shm_publish_message(char *protocol, struct JsonNode *json) {
+#ifndef _WIN32
+	struct shm_slot_t *slot = NULL;
+	struct shm_message_t msg;
+
+	if(ring == NULL) {
+		return;
+	}
+
+	memset(&msg, 0, sizeof(struct shm_message_t));
+	if(shm_message(json, &msg) == -1) {
+		logprintf(LOG_DEBUG, "message of %s does not fit in shared memory", protocol);
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	if(ring == NULL) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	slot = shm_begin();
+	slot->type = SHM_TYPE_MESSAGE;
+	slot->hwtype = -1;
+	slot->length = 0;
+	snprintf(slot->name, SHM_NAME_SIZE, "%s", protocol);
+	memcpy(&slot->message, &msg, sizeof(struct shm_message_t));
+	shm_commit(slot);
+	pthread_mutex_unlock(&lock);
+#endif
+}
+
+void shm_publish_pulses(char *hardware, int hwtype, int *pulses, int length) {
+#ifndef _WIN32
+	struct shm_slot_t *slot = NULL;
+	int i = 0;
+
+	if(length > SHM_PULSES_SIZE) {
+		length = SHM_PULSES_SIZE;
+	}
+
+	pthread_mutex_lock(&lock);
+	if(ring == NULL) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	slot = shm_begin();
+	slot->type = SHM_TYPE_PULSES;
+	slot->hwtype = hwtype;
+	slot->length = length;
+	snprintf(slot->name, SHM_NAME_SIZE, "%s", hardware);
+	for(i=0;i<length;i++) {
+		slot->pulses[i] = pulses[i];
+	}
+	shm_commit(slot);
+	pthread_mutex_unlock(&lock);
+#endif
+}
+
+int shm_gc(void) {
+#ifndef _WIN32
+	pthread_mutex_lock(&lock);
+	if(ring != NULL) {
+		/* Tell the clients we are gone */
+		ring->magic = 0;
+		__sync_synchronize();
+		munmap(ring, sizeof(struct shm_ring_t));
+		ring = NULL;
+		shm_unlink(SHM_NAME);
+	}
+	pthread_mutex_unlock(&lock);
+#endif
+
+	logprintf(LOG_DEBUG, "garbage collected shm library");
+	return 0;
+}
+
+/*
+ * Clients start reading at the slot the daemon
+ * writes next.
+ */
+int shm_attach(void) {
+#ifdef _WIN32
+	return -1;
+#else
+	struct shm_ring_t *tmp = NULL;
+	int fd = -1;
+
+	if((fd = shm_open(SHM_NAME, O_RDONLY, 0)) == -1) {
+		return -1;
+	}
+	tmp = mmap(NULL, sizeof(struct shm_ring_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(tmp == MAP_FAILED) {
+		return -1;
+	}
+	if(tmp->magic != SHM_MAGIC || tmp->version != SHM_VERSION ||
+	   tmp->slots != SHM_SLOTS || tmp->slotsize != sizeof(struct shm_slot_t)) {
+		munmap(tmp, sizeof(struct shm_ring_t));
+		return -1;
+	}
+	ring = tmp;
+	__sync_synchronize();
+	next = ring->head;
+	return 0;
+#endif
+}
+
+/*
+ * Copies the next slot. Returns 0 when a slot was read,
+ * 1 when there is none yet and -1 when the daemon is
+ * gone. The number of slots that were overwritten
+ * before they could be read is added to lost.
+ */
+int shm_next(struct shm_slot_t *slot, unsigned long *lost) {
+#ifdef _WIN32
+	return -1;
+#else
+	struct shm_slot_t *src = NULL;
+	uint64_t head = 0, seq = 0;
+
+	if(ring == NULL) {
+		return -1;
+	}
+
+	while(1) {
+		if(ring->magic != SHM_MAGIC) {
+			return -1;
+		}
+		head = ring->head;
+		__sync_synchronize();
+		if(next == head) {
+			return 1;
+		}
+		if(head-next > SHM_SLOTS) {
+			*lost += head-next-SHM_SLOTS;
+			next = head-SHM_SLOTS;
+		}
+
+		src = &ring->slot[next % SHM_SLOTS];
+		seq = src->seq;
+		__sync_synchronize();
+		if(seq == 2*(next+1)) {
+			memcpy(slot, src, sizeof(struct shm_slot_t));
+			__sync_synchronize();
+			if(src->seq == seq) {
+				next++;
+				return 0;
+			}
+		}
+		/* Overwritten while we were reading */
+		(*lost)++;
+		next++;
+	}
+#endif
+}
+
+void shm_detach(void) {
+#ifndef _WIN32
+	if(ring != NULL) {
+		munmap(ring, sizeof(struct shm_ring_t));
+		ring = NULL;
+	}
+#endif
+}
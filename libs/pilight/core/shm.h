@@ -0,0 +1,114 @@
+/*
+	Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _SHM_H_
+#define _SHM_H_
+
+#include <stdint.h>
+
+#include "json.h"
+
+/*
+ * The daemon can publish received pulse trains and the
+ * messages decoded from them in a shared memory ring, so
+ * local consumers don't need a socket connection. The
+ * ring consists of a header followed by SHM_SLOTS slots
+ * of a fixed size. The head counts all slots written
+ * so far, slot n lives at index n % SHM_SLOTS.
+ *
+ * The sequence of a slot is odd while the daemon writes
+ * it, and 2*(n+1) once slot n is complete. A reader that
+ * sees another sequence before and after copying a slot
+ * knows it was overwritten, and readers that fall more
+ * than SHM_SLOTS behind lose the oldest slots.
+ */
+#define SHM_NAME						"/pilight"
+#define SHM_MAGIC						0x504c5348
+#define SHM_VERSION					2
+#define SHM_SLOTS						256
+#define SHM_PULSES_SIZE			512
+#define SHM_NAME_SIZE				64
+
+#define SHM_TYPE_MESSAGE		1
+#define SHM_TYPE_PULSES			2
+
+/*
+ * A decoded message is stored as the flat list of its
+ * values, so readers don't need to parse json. Messages
+ * with more values, longer names or strings, or nested
+ * values are not published.
+ */
+#define SHM_VALUES					16
+#define SHM_KEY_SIZE				24
+#define SHM_STRING_SIZE			48
+#define SHM_ORIGIN_SIZE			16
+#define SHM_UUID_SIZE				24
+
+#define SHM_VALUE_NUMBER		1
+#define SHM_VALUE_STRING		2
+
+typedef struct shm_value_t {
+	char name[SHM_KEY_SIZE];
+	int32_t type;
+	int32_t decimals;
+	union {
+		double number;
+		char string[SHM_STRING_SIZE];
+	};
+} shm_value_t;
+
+typedef struct shm_message_t {
+	char origin[SHM_ORIGIN_SIZE];
+	char uuid[SHM_UUID_SIZE];
+	/* -1 when unknown */
+	int32_t repeats;
+	int32_t nrvalues;
+	struct shm_value_t values[SHM_VALUES];
+} shm_message_t;
+
+typedef struct shm_slot_t {
+	volatile uint64_t seq;
+	/* Microseconds since the epoch */
+	uint64_t stamp;
+	int32_t type;
+	int32_t hwtype;
+	/* Number of pulses */
+	int32_t length;
+	/* Protocol of a message or hardware of a pulse train */
+	char name[SHM_NAME_SIZE];
+	union {
+		struct shm_message_t message;
+		int32_t pulses[SHM_PULSES_SIZE];
+	};
+} shm_slot_t;
+
+typedef struct shm_ring_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint32_t slotsize;
+	volatile uint64_t head;
+	struct shm_slot_t slot[SHM_SLOTS];
+} shm_ring_t;
+
+/*
+ * Daemon side
+ */
+int shm_init(void);
+void shm_publish_message(char *protocol, struct JsonNode *json);
+void shm_publish_pulses(char *hardware, int hwtype, int *pulses, int length);
+int shm_gc(void);
+
+/*
+ * Client side
+ */
+int shm_attach(void);
+int shm_next(struct shm_slot_t *slot, unsigned long *lost);
+void shm_detach(void);
+
+#endif
@@ -0,0 +1,301 @@
+/*
+	Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+	#ifdef __mips__
+		#define __USE_UNIX98
+	#endif
+#endif
+#include <pthread.h>
+
+#include "../../libuv/uv.h"
+#include "common.h"
+#include "mem.h"
+#include "log.h"
+#include "w1.h"
+
+/*
+ * All 1-wire temperature sensors are read by a single
+ * service. When a protocol asks for a sensor of which
+ * the cached value is too old, all known sensors are
+ * refreshed at once. A bulk conversion is triggered on
+ * every bus master that supports it, after which each
+ * sensor is read in its own thread. Other requests
+ * wait for that refresh and are served from the cache.
+ */
+typedef struct w1_sensor_t {
+	char *name;
+	double temp;
+	int valid;
+	uint64_t stamp;
+	struct w1_sensor_t *next;
+} w1_sensor_t;
+
+typedef struct w1_job_t {
+	pthread_t pth;
+	int started;
+	char *path;
+	double temp;
+	int valid;
+} w1_job_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t w1_signal = PTHREAD_COND_INITIALIZER;
+static struct w1_sensor_t *sensors = NULL;
+static char *root = NULL;
+static int refreshing = 0;
+
+void w1_set_root(char *path) {
+	pthread_mutex_lock(&lock);
+	if(root != NULL) {
+		FREE(root);
+	}
+	if((root = STRDUP(path)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+static struct w1_sensor_t *w1_sensor_get(char *family, char *id) {
+	struct w1_sensor_t *node = sensors, *tail = NULL;
+	char name[strlen(family)+strlen(id)+2];
+
+	snprintf(name, sizeof(name), "%s-%s", family, id);
+	while(node) {
+		if(strcmp(node->name, name) == 0) {
+			return node;
+		}
+		tail = node;
+		node = node->next;
+	}
+
+	if((node = MALLOC(sizeof(struct w1_sensor_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((node->name = STRDUP(name)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	node->temp = 0.0;
+	node->valid = 0;
+	node->stamp = 0;
+	node->next = NULL;
+
+	if(tail == NULL) {
+		sensors = node;
+	} else {
+		tail->next = node;
+	}
+	return node;
+}
+
+int w1_register(char *family, char *id) {
+	pthread_mutex_lock(&lock);
+	w1_sensor_get(family, id);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+#ifndef _WIN32
+static void *w1_read(void *param) {
+	struct w1_job_t *job = param;
+	struct stat st;
+	FILE *fp = NULL;
+	char crcVar[5], *content = NULL;
+	size_t bytes = 0;
+
+	job->valid = 0;
+
+	if((fp = fopen(job->path, "rb")) == NULL) {
+		logprintf(LOG_ERR, "cannot read w1 file: %s", job->path);
+		return NULL;
+	}
+
+	fstat(fileno(fp), &st);
+	/*
+	 * Sysfs reports a fixed size, so
+	 * read at least a full w1_slave.
+	 */
+	bytes = ((size_t)st.st_size > 256) ? (size_t)st.st_size : 256;
+
+	if((content = MALLOC(bytes+1)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(content, '\0', bytes+1);
+
+	if(fread(content, sizeof(char), bytes, fp) <= 0) {
+		logprintf(LOG_ERR, "cannot read w1 file: %s", job->path);
+		fclose(fp);
+		FREE(content);
+		return NULL;
+	}
+	fclose(fp);
+
+	char **array = NULL;
+	unsigned int n = explode(content, "\n", &array);
+	if(n > 0) {
+		memset(crcVar, '\0', sizeof(crcVar));
+		sscanf(array[0], "%*x %*x %*x %*x %*x %*x %*x %*x %*x : crc=%*x %4s", crcVar);
+		if(strncmp(crcVar, "YES", 3) == 0 && n > 1) {
+			if(sscanf(array[1], "%*x %*x %*x %*x %*x %*x %*x %*x %*x t=%lf", &job->temp) == 1) {
+				job->temp /= 1000;
+				job->valid = 1;
+			}
+		}
+	}
+	array_free(&array, n);
+	FREE(content);
+
+	return NULL;
+}
+
+static void w1_bulk_trigger(char *path) {
+	struct dirent *file = NULL;
+	DIR *d = NULL;
+	FILE *fp = NULL;
+
+	if((d = opendir(path)) == NULL) {
+		return;
+	}
+	while((file = readdir(d)) != NULL) {
+		if(strncmp(file->d_name, "w1_bus_master", 13) == 0) {
+			char bulk[strlen(path)+strlen(file->d_name)+18];
+			snprintf(bulk, sizeof(bulk), "%s/%s/therm_bulk_read", path, file->d_name);
+			if((fp = fopen(bulk, "w")) != NULL) {
+				fputs("trigger\n", fp);
+				fclose(fp);
+			}
+		}
+	}
+	closedir(d);
+}
+
+/*
+ * Called with the lock held. The lock is released
+ * while the sensors are being read.
+ */
+static void w1_refresh(void) {
+	struct w1_sensor_t *node = sensors;
+	struct w1_job_t *jobs = NULL;
+	char *path = NULL;
+	int nr = 0, i = 0;
+
+	refreshing = 1;
+
+	if((path = STRDUP((root != NULL) ? root : W1_ROOT)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	while(node) {
+		nr++;
+		node = node->next;
+	}
+	if((jobs = MALLOC(sizeof(struct w1_job_t)*(nr+1))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	for(i=0, node=sensors;i<nr;i++, node=node->next) {
+		int len = strlen(path)+strlen(node->name)+11;
+		if((jobs[i].path = MALLOC(len)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		snprintf(jobs[i].path, len, "%s/%s/w1_slave", path, node->name);
+		jobs[i].valid = 0;
+		jobs[i].started = 0;
+	}
+	pthread_mutex_unlock(&lock);
+
+	w1_bulk_trigger(path);
+
+	for(i=0;i<nr;i++) {
+		if(pthread_create(&jobs[i].pth, NULL, w1_read, &jobs[i]) == 0) {
+			jobs[i].started = 1;
+		} else {
+			w1_read(&jobs[i]);
+		}
+	}
+	for(i=0;i<nr;i++) {
+		if(jobs[i].started == 1) {
+			pthread_join(jobs[i].pth, NULL);
+		}
+	}
+
+	pthread_mutex_lock(&lock);
+	uint64_t now = uv_hrtime()/1000000;
+	for(i=0, node=sensors;i<nr;i++, node=node->next) {
+		node->valid = jobs[i].valid;
+		node->temp = jobs[i].temp;
+		node->stamp = now;
+		FREE(jobs[i].path);
+	}
+	FREE(jobs);
+	FREE(path);
+
+	refreshing = 0;
+	pthread_cond_broadcast(&w1_signal);
+}
+#endif
+
+/*
+ * Returns the temperature of a sensor in degrees, read
+ * no longer than half the poll interval (in seconds) ago.
+ */
+int w1_temperature(char *family, char *id, int interval, double *temp) {
+#ifdef _WIN32
+	return -1;
+#else
+	struct w1_sensor_t *node = NULL;
+	int ret = -1;
+
+	pthread_mutex_lock(&lock);
+	node = w1_sensor_get(family, id);
+
+	while(node->stamp == 0 || (uv_hrtime()/1000000)-node->stamp >= (uint64_t)interval*500) {
+		if(refreshing == 1) {
+			pthread_cond_wait(&w1_signal, &lock);
+		} else {
+			w1_refresh();
+			break;
+		}
+	}
+
+	if(node->valid == 1) {
+		*temp = node->temp;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+#endif
+}
+
+int w1_gc(void) {
+	struct w1_sensor_t *tmp = NULL;
+
+	pthread_mutex_lock(&lock);
+	while(refreshing == 1) {
+		pthread_cond_wait(&w1_signal, &lock);
+	}
+	while(sensors) {
+		tmp = sensors;
+		sensors = sensors->next;
+		FREE(tmp->name);
+		FREE(tmp);
+	}
+	if(root != NULL) {
+		FREE(root);
+	}
+	pthread_mutex_unlock(&lock);
+
+	logprintf(LOG_DEBUG, "garbage collected w1 library");
+	return 0;
+}
@@ -0,0 +1,19 @@
+/*
+	Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _W1_H_
+#define _W1_H_
+
+#define W1_ROOT		"/sys/bus/w1/devices/"
+
+void w1_set_root(char *root);
+int w1_register(char *family, char *id);
+int w1_temperature(char *family, char *id, int interval, double *temp);
+int w1_gc(void);
+
+#endif
@@ -58,6 +58,8 @@
 	#include "../config/settings.h"
 	#include "../config/registry.h"
 #endif
+#include "../lua_c/profile.h"
+#include "history.h"
 
 #include "eventpool.h"
 #include "sha256cache.h"
@@ -842,6 +844,71 @@ clear:
 	return MG_TRUE;
 }
 
+/*
+ * /history?device=x[&value=y][&from=ts][&to=ts][&step=seconds]
+ * Without a range, the last day is returned.
+ */
+static int parse_history(uv_poll_t *req) {
+	struct uv_custom_poll_t *custom_poll_data = req->data;
+	struct connection_t *conn = custom_poll_data->data;
+	struct JsonNode *jsend = NULL;
+	char **array = NULL, **array1 = NULL;
+	char *decoded = NULL, *device = NULL, *value = NULL;
+	int64_t to = (int64_t)time(NULL), from = to-86400;
+	int a = 0, b = 0, c = 0, len = 0, step = 0;
+
+	if(conn->query_string == NULL || (len = urldecode(conn->query_string, NULL)) == -1) {
+		char *z = "{\"message\":\"failed\",\"error\":\"no device was sent\"}";
+		send_data(req, "application/json", z, strlen(z));
+		return MG_TRUE;
+	}
+	if((decoded = MALLOC(len+1)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if(urldecode(conn->query_string, decoded) == -1) {
+		char *z = "{\"message\":\"failed\",\"error\":\"cannot decode url\"}";
+		send_data(req, "application/json", z, strlen(z));
+		FREE(decoded);
+		return MG_TRUE;
+	}
+
+	a = explode(decoded, "&", &array);
+	for(b=0;b<a;b++) {
+		c = explode(array[b], "=", &array1);
+		if(c == 2) {
+			if(strcmp(array1[0], "device") == 0) {
+				device = array[b]+7;
+			} else if(strcmp(array1[0], "value") == 0) {
+				value = array[b]+6;
+			} else if(strcmp(array1[0], "from") == 0 && isNumeric(array1[1]) == 0) {
+				from = atoll(array1[1]);
+			} else if(strcmp(array1[0], "to") == 0 && isNumeric(array1[1]) == 0) {
+				to = atoll(array1[1]);
+			} else if(strcmp(array1[0], "step") == 0 && isNumeric(array1[1]) == 0) {
+				step = atoi(array1[1]);
+			}
+		}
+		array_free(&array1, c);
+	}
+
+	if(device == NULL) {
+		char *z = "{\"message\":\"failed\",\"error\":\"no device was sent\"}";
+		send_data(req, "application/json", z, strlen(z));
+	} else if((jsend = history_print(device, value, from, to, (step > 0) ? step : 0)) == NULL) {
+		char *z = "{\"message\":\"failed\",\"error\":\"history is not enabled\"}";
+		send_data(req, "application/json", z, strlen(z));
+	} else {
+		char *output = json_stringify(jsend, NULL);
+		send_data(req, "application/json", output, strlen(output));
+		json_free(output);
+		json_delete(jsend);
+	}
+
+	array_free(&array, a);
+	FREE(decoded);
+	return MG_TRUE;
+}
+
 static void close_cb(uv_handle_t *handle) {
 	/*
 	 * Make sure we execute in the main thread
@@ -970,6 +1037,15 @@ static int request_handler(uv_poll_t *req) {
 				}
 				jsend = NULL;
 				return MG_TRUE;
+			} else if(strcmp(conn->uri, "/history") == 0) {
+				return parse_history(req);
+			} else if(strcmp(conn->uri, "/profile") == 0) {
+				struct JsonNode *jsend = plua_profile_print();
+				char *output = json_stringify(jsend, NULL);
+				send_data(req, "application/json", output, strlen(output));
+				json_delete(jsend);
+				json_free(output);
+				return MG_TRUE;
 			} else if(strstr(conn->uri, "/") != NULL && strcmp(&conn->uri[(rstrstr(conn->uri, "/")-conn->uri)], "/") == 0) {
 				char indexes[2][11] = {"index.html","index.htm"};
 
@@ -1123,7 +1199,12 @@ static int request_handler(uv_poll_t *req) {
 		strncpy(input, conn->content, conn->content_len);
 		input[conn->content_len] = '\0';
 
-		if(json_validate(input) == true) {
+		/* Only validated here, it is decoded once it is handled */
+		struct JsonError jerror;
+		if(json_validate_ex(input, &jerror) == false) {
+			logprintf(LOG_DEBUG, "(webserver) invalid json at line %d, column %d: %s",
+				jerror.line, jerror.column, jerror.message);
+		} else {
 			struct reason_socket_received_t *data = MALLOC(sizeof(struct reason_socket_received_t));
 			if(data == NULL) {
 				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
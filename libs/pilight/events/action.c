@@ -334,49 +334,26 @@ static int event_action_prepare_call(char *module, char *func, struct event_acti
 	}
 
 	char *lower = STRDUP(module);
-	char name[255], *p = name;
-	memset(name, '\0', 255);
 
 	if(lower == NULL) {
 		OUT_OF_MEMORY
 	}
 
 	strtolower(&lower);
-	sprintf(p, "action.%s", lower);
-	lua_getglobal(L, name);
-	FREE(lower);
-
-	if(lua_isnil(L, -1) != 0) {
+	if(plua_get_module(L, "action", lower) == NULL) {
+		FREE(lower);
 		event_action_free_argument(args);
-		lua_remove(L, -1);
 		assert(plua_check_stack(L, 0) == 0);
 		plua_clear_state(state);
 		return -1;
 	}
-	if(lua_istable(L, -1) != 0) {
-		char *file = NULL;
-		struct plua_module_t *tmp = plua_get_modules();
-		while(tmp) {
-			if(stricmp(module, tmp->name) == 0) {
-				file = tmp->file;
-				state->module = tmp;
-				break;
-			}
-			tmp = tmp->next;
-		}
-		if(file != NULL) {
-			if(plua_action_module_call(L, file, func, args) == -1) {
-				lua_pop(L, -1);
-				assert(plua_check_stack(L, 0) == 0);
-				plua_clear_state(state);
-				return -1;
-			}
-		} else {
-			event_action_free_argument(args);
-			assert(plua_check_stack(L, 0) == 0);
-			plua_clear_state(state);
-			return -1;
-		}
+	FREE(lower);
+
+	if(plua_action_module_call(L, state->module->file, func, args) == -1) {
+		lua_pop(L, -1);
+		assert(plua_check_stack(L, 0) == 0);
+		plua_clear_state(state);
+		return -1;
 	}
 
 	assert(plua_check_stack(L, 0) == 0);
@@ -451,42 +428,26 @@ int event_action_get_parameters(char *module, int *nr, char ***ret) {
 	}
 
 	char *lower = STRDUP(module);
-	char name[255], *p = name;
-	memset(name, '\0', 255);
 
 	if(lower == NULL) {
 		OUT_OF_MEMORY
 	}
 
 	strtolower(&lower);
-	sprintf(p, "action.%s", lower);
-	lua_getglobal(L, name);
+	if(plua_get_module(L, "action", lower) == NULL) {
+		FREE(lower);
+		assert(plua_check_stack(L, 0) == 0);
+		plua_clear_state(state);
+		return -1;
+	}
 	FREE(lower);
 
-	if(lua_isnil(L, -1) != 0) {
-		lua_remove(L, -1);
+	if(event_action_parameters_run(L, state->module->file, nr, ret) == -1) {
+		lua_pop(L, -1);
 		assert(plua_check_stack(L, 0) == 0);
 		plua_clear_state(state);
 		return -1;
 	}
-	if(lua_istable(L, -1) != 0) {
-		char *file = NULL;
-		struct plua_module_t *tmp = plua_get_modules();
-		while(tmp) {
-			if(strcmp(module, tmp->name) == 0) {
-				file = tmp->file;
-				state->module = tmp;
-				break;
-			}
-			tmp = tmp->next;
-		}
-		if(event_action_parameters_run(L, file, nr, ret) == -1) {
-			lua_pop(L, -1);
-			assert(plua_check_stack(L, 0) == 0);
-			plua_clear_state(state);
-			return -1;
-		}
-	}
 	lua_pop(L, -1);
 
 	assert(plua_check_stack(L, 0) == 0);
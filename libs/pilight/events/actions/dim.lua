@@ -158,27 +158,42 @@ function M.check(parameters)
 	return 1;
 end
 
-function M.timer_for(timer)
-	local data = timer.getUserdata();
-	local devname = data['device'];
+--
+-- Dims every device of the action in one go, in the
+-- listed order. Devices a newer action took over are
+-- left alone.
+--
+local function dim_devices(data, dimlevel, restore)
 	local config = pilight.config();
-	local devobj = config.getDevice(devname);
+	local devices = data['devices'];
 
-	if(devobj.getActionId() ~= data['action_id']) then
-		error("skipping overridden action dim for device " .. devname);
-		return;
-	end
+	for i = 1, devices.len(), 1 do
+		local devname = devices[i]['device'];
+		local devobj = config.getDevice(devname);
+		local level = dimlevel;
 
-	if devobj.setState("on") == false then
-		error("device \"" .. devname .. "\" could not be set to state \"on\"")
-	end
+		if restore == true then
+			level = devices[i]['old_dimlevel'];
+		end
 
-	if devobj.setDimlevel(data['old_dimlevel']) == false then
-		error("device \"" .. devname .. "\" could not be set to dimlevel \"" .. data['old_dimlevel'] .. "\"")
+		if devobj.getActionId() ~= devices[i]['action_id'] then
+			pilight.log(LOG_DEBUG, "skipping overridden action dim for device " .. devname);
+		elseif level ~= nil then
+			if devobj.setState("on") == false then
+				pilight.log(LOG_ERR, "device \"" .. devname .. "\" could not be set to state \"on\"");
+			elseif devobj.setDimlevel(level) == false then
+				pilight.log(LOG_ERR, "device \"" .. devname .. "\" could not be set to dimlevel \"" .. level .. "\"");
+			else
+				devobj.send();
+			end
+		end
 	end
+end
 
-	devobj.send();
+function M.timer_for(timer)
+	local data = timer.getUserdata();
 
+	dim_devices(data, nil, true);
 end
 
 function M.execute_for(data)
@@ -208,19 +223,8 @@ end
 
 function M.timer_in(timer)
 	local data = timer.getUserdata();
-	local devname = data['device'];
-	local config = pilight.config();
-	local devobj = config.getDevice(devname);
-
-	if devobj.setState("on") == false then
-		error("device \"" .. devname .. "\" could not be set to state \"on\"")
-	end
-
-	if devobj.setDimlevel(data['from_dimlevel']) == false then
-		error("device \"" .. devname .. "\" could not be set to dimlevel \"" .. data['from_dimlevel'] .. "\"")
-	end
 
-	devobj.send();
+	dim_devices(data, data['from_dimlevel'], false);
 
 	if data['direction'] == false then
 		data['from_dimlevel'] = data['from_dimlevel'] + 1;
@@ -273,23 +277,8 @@ end
 
 function M.thread(thread)
 	local data = thread.getUserdata();
-	local devname = data['device'];
-	local config = pilight.config();
-	local devobj = config.getDevice(devname);
-
-	if(devobj.getActionId() ~= data['action_id']) then
-		error("skipping overridden action dim for device " .. devname);
-	end
-
-	if devobj.setState("on") == false then
-		error("device \"" .. devname .. "\" could not be set to state \"on\"")
-	end
-
-	if devobj.setDimlevel(data['new_dimlevel']) == false then
-		error("device \"" .. devname .. "\" could not be set to dimlevel \"" .. data['new_dimlevel'] .. "\"")
-	end
 
-	devobj.send();
+	dim_devices(data, data['new_dimlevel'], false);
 
 	if data['time_for'] ~= 0 and data['type_for'] ~= nil then
 		M.execute_for(data);
@@ -298,26 +287,12 @@ end
 
 function M.timer_after(timer)
 	local data = timer.getUserdata();
-	local devname = data['device'];
-	local config = pilight.config();
-	local devobj = config.getDevice(devname);
-
-	if(devobj.getActionId() ~= data['action_id']) then
-		error("skipping overridden action dim for device " .. devname);
-	end
-
-	if devobj.setState("on") == false then
-		error("device \"" .. devname .. "\" could not be set to state \"on\"")
-	end
 
 	if data['time_in'] > 0 and data['type_in'] ~= nil then
 		M.execute_in(data);
 	else
-		if devobj.setDimlevel(data['new_dimlevel']) == false then
-			error("device \"" .. devname .. "\" could not be set to dimlevel \"" .. data['new_dimlevel'] .. "\"")
-		end
+		dim_devices(data, data['new_dimlevel'], false);
 
-		devobj.send();
 		if data['time_for'] > 0 and data['type_for'] ~= nil then
 			M.execute_for(data);
 		end
@@ -326,34 +301,56 @@ end
 
 function M.run(parameters)
 	local nrdev = #parameters['DEVICE']['value'];
+	local config = pilight.config();
+	local new_dimlevel = parameters['TO']['value'][1];
+	local from_dimlevel = nil;
+	local after = nil;
+	local in_ = nil;
+	local for_ = nil;
+	local async = nil;
+
+	if parameters['FROM'] ~= nil then
+		if #parameters['FROM']['value'] == 1 then
+			from_dimlevel = parameters['FROM']['value'][1];
+		end
+	end
+
+	if parameters['IN'] ~= nil then
+		in_ = pilight.common.explode(parameters['IN']['value'][1], " ");
+	end
+	if parameters['AFTER'] ~= nil then
+		after = pilight.common.explode(parameters['AFTER']['value'][1], " ");
+	end
+	if parameters['FOR'] ~= nil then
+		for_ = pilight.common.explode(parameters['FOR']['value'][1], " ");
+	end
+
+	if in_ ~= nil and #in_ == 2 then
+		async = pilight.async.timer();
+	elseif after ~= nil and #after == 2 then
+		async = pilight.async.timer();
+	else
+		async = pilight.async.thread();
+	end
+
+	local data = async.getUserdata();
+
+	data['devices'] = {};
+	data['time_after'] = 0;
+	data['type_after'] = nil;
+	data['time_for'] = 0;
+	data['type_for'] = nil;
+	data['time_in'] = 0;
+	data['type_in'] = nil;
+	data['direction'] = nil;
+	data['steps'] = 1;
+	data['new_dimlevel'] = tonumber(new_dimlevel);
+	data['from_dimlevel'] = tonumber(from_dimlevel);
 
 	for i = 1, nrdev, 1 do
 		local devname = parameters['DEVICE']['value'][i];
-		local config = pilight.config();
 		local devobj = config.getDevice(devname);
 		local old_dimlevel = nil;
-		local new_dimlevel = parameters['TO']['value'][1];
-		local from_dimlevel = nil;
-		local after = nil;
-		local in_ = nil;
-		local for_ = nil;
-		local async = nil;
-
-		if parameters['FROM'] ~= nil then
-			if #parameters['FROM']['value'] == 1 then
-				from_dimlevel = parameters['FROM']['value'][1];
-			end
-		end
-
-		if parameters['IN'] ~= nil then
-			in_ = pilight.common.explode(parameters['IN']['value'][1], " ");
-		end
-		if parameters['AFTER'] ~= nil then
-			after = pilight.common.explode(parameters['AFTER']['value'][1], " ");
-		end
-		if parameters['FOR'] ~= nil then
-			for_ = pilight.common.explode(parameters['FOR']['value'][1], " ");
-		end
 
 		if devobj.hasSetting("dimlevel") == true then
 			if devobj.getDimlevel ~= nil then
@@ -361,72 +358,54 @@ function M.run(parameters)
 			end
 		end
 
-		if in_ ~= nil and #in_ == 2 then
-			async = pilight.async.timer();
-		elseif after ~= nil and #after == 2 then
-			async = pilight.async.timer();
-		else
-			async = pilight.async.thread();
-		end
-
-		local data = async.getUserdata();
-
-		data['device'] = devname;
-		data['time_after'] = 0;
-		data['type_after'] = nil;
-		data['time_for'] = 0;
-		data['type_for'] = nil;
-		data['time_in'] = 0;
-		data['type_in'] = nil;
-		data['direction'] = nil;
-		data['steps'] = 1;
-		data['old_dimlevel'] = tonumber(old_dimlevel);
-		data['new_dimlevel'] = tonumber(new_dimlevel);
-		data['from_dimlevel'] = tonumber(from_dimlevel);
-		data['action_id'] = devobj.setActionId();
-
-		if from_dimlevel ~= nil then
-			data['direction'] = tonumber(from_dimlevel) > tonumber(new_dimlevel);
-		end
+		data['devices'][i] = {
+			device = devname,
+			old_dimlevel = tonumber(old_dimlevel),
+			action_id = devobj.setActionId()
+		};
+	end
 
-		if in_ ~= nil and #in_ == 2 then
-			local steps = math.abs(data['from_dimlevel']-data['new_dimlevel']);
-			data['time_in'] = tonumber(in_[1])/steps;
-			data['type_in'] = in_[2];
-		end
+	if from_dimlevel ~= nil then
+		data['direction'] = tonumber(from_dimlevel) > tonumber(new_dimlevel);
+	end
 
-		if for_ ~= nil and #for_ == 2 then
-			data['time_for'] = tonumber(for_[1]);
-			data['type_for'] = for_[2];
-		end
+	if in_ ~= nil and #in_ == 2 then
+		local steps = math.abs(data['from_dimlevel']-data['new_dimlevel']);
+		data['time_in'] = tonumber(in_[1])/steps;
+		data['type_in'] = in_[2];
+	end
 
-		if after ~= nil and #after == 2 then
-			data['time_after'] = tonumber(after[1]);
-			data['type_after'] = after[2];
-		end
+	if for_ ~= nil and #for_ == 2 then
+		data['time_for'] = tonumber(for_[1]);
+		data['type_for'] = for_[2];
+	end
 
-		if data['time_after'] > 0 and data['type_after'] ~= nil then
-			if(data['type_after'] == 'SECOND') then
-				async.setTimeout(data['time_after']*1000);
-			elseif(data['type_after'] == 'MINUTE') then
-				async.setTimeout(data['time_after']*1000*60);
-			elseif(data['type_after'] == 'HOUR') then
-				async.setTimeout(data['time_after']*1000*60*60);
-			elseif(data['type_after'] == 'DAY') then
-				async.setTimeout(data['time_after']*1000*60*60);
-			else
-				async.setTimeout(data['time_after']);
-			end
+	if after ~= nil and #after == 2 then
+		data['time_after'] = tonumber(after[1]);
+		data['type_after'] = after[2];
+	end
 
-			async.setRepeat(0);
-			async.setCallback("timer_after");
-			async.start();
-		elseif data['time_in'] > 0 and data['type_in'] ~= nil then
-			M.execute_in(data);
+	if data['time_after'] > 0 and data['type_after'] ~= nil then
+		if(data['type_after'] == 'SECOND') then
+			async.setTimeout(data['time_after']*1000);
+		elseif(data['type_after'] == 'MINUTE') then
+			async.setTimeout(data['time_after']*1000*60);
+		elseif(data['type_after'] == 'HOUR') then
+			async.setTimeout(data['time_after']*1000*60*60);
+		elseif(data['type_after'] == 'DAY') then
+			async.setTimeout(data['time_after']*1000*60*60);
 		else
-			async.setCallback("thread");
-			async.trigger();
+			async.setTimeout(data['time_after']);
 		end
+
+		async.setRepeat(0);
+		async.setCallback("timer_after");
+		async.start();
+	elseif data['time_in'] > 0 and data['type_in'] ~= nil then
+		M.execute_in(data);
+	else
+		async.setCallback("thread");
+		async.trigger();
 	end
 
 	return 1;
@@ -439,7 +418,7 @@ end
 function M.info()
 	return {
 		name = "dim",
-		version = "4.1",
+		version = "4.2",
 		reqversion = "8.1.2",
 		reqcommit = "23"
 	}
@@ -118,21 +118,50 @@ function M.check(parameters)
 	return 1;
 end
 
-function M.timer_for(timer)
-	local data = timer.getUserdata();
-	local devname = data['device'];
+--
+-- Labels all devices of the action at once, except
+-- those taken over by a later action.
+--
+local function label_devices(data, restore)
 	local config = pilight.config();
-	local devobj = config.getDevice(devname);
+	local devices = data['devices'];
 
-	if devobj.setColor(data['old_color']) == false then
-		error("device \"" .. devname .. "\" could not be set to state \"" .. data['new_color'] .. "\"")
-	end
+	for i = 1, devices.len(), 1 do
+		local devname = devices[i]['device'];
+		local devobj = config.getDevice(devname);
+		local label = data['new_label'];
+		local color = data['new_color'];
+		local ok = true;
+
+		if restore == true then
+			label = devices[i]['old_label'];
+			color = devices[i]['old_color'];
+		end
 
-	if devobj.setLabel(data['old_label']) == false then
-		error("device \"" .. devname .. "\" could not be set to state \"" .. data['new_label'] .. "\"")
+		if devobj.getActionId() ~= devices[i]['action_id'] then
+			pilight.log(LOG_DEBUG, "skipping overridden action label for device " .. devname);
+		else
+			if color ~= nil and devobj.setColor(color) == false then
+				pilight.log(LOG_ERR, "device \"" .. devname .. "\" could not be set to color \"" .. color .. "\"");
+				ok = false;
+			end
+
+			if label ~= nil and devobj.setLabel(label) == false then
+				pilight.log(LOG_ERR, "device \"" .. devname .. "\" could not be set to label \"" .. label .. "\"");
+				ok = false;
+			end
+
+			if ok == true then
+				devobj.send();
+			end
+		end
 	end
+end
+
+function M.timer_for(timer)
+	local data = timer.getUserdata();
 
-	devobj.send();
+	label_devices(data, true);
 end
 
 function execute_for(data)
@@ -158,27 +187,8 @@ end
 
 function M.thread(thread)
 	local data = thread.getUserdata();
-	local devname = data['device'];
-	local config = pilight.config();
-	local devobj = config.getDevice(devname);
 
-	if(devobj.getActionId() ~= data['action_id']) then
-		error("skipping overridden action label for device " .. devname);
-	end
-
-	if data['new_color'] ~= nil then
-		if devobj.setColor(data['new_color']) == false then
-			error("device \"" .. devname .. "\" could not be set to state \"" .. data['new_color'] .. "\"")
-		end
-	end
-
-	if data['new_label'] ~= nil then
-		if devobj.setLabel(data['new_label']) == false then
-			error("device \"" .. devname .. "\" could not be set to state \"" .. data['new_label'] .. "\"")
-		end
-	end
-
-	devobj.send();
+	label_devices(data, false);
 
 	if data['time_for'] ~= 0 and data['type_for'] ~= nil then
 		execute_for(data);
@@ -187,66 +197,64 @@ end
 
 function M.timer_after(timer)
 	local data = timer.getUserdata();
-	local devname = data['device'];
-	local config = pilight.config();
-	local devobj = config.getDevice(devname);
 
-	if(devobj.getActionId() ~= data['action_id']) then
-		error("skipping overridden action label for device " .. devname);
+	label_devices(data, false);
+
+	if data['time_for'] > 0 and data['type_for'] ~= nil then
+		execute_for(data);
 	end
+end
+
+function M.run(parameters)
+	local nrdev = #parameters['DEVICE']['value'];
+	local config = pilight.config();
+	local new_color = nil;
+	local new_label = nil;
+	local after = nil;
+	local for_ = nil;
+	local async = nil;
 
-	if data['new_color'] ~= nil then
-		if devobj.setColor(data['new_color']) == false then
-			error("device \"" .. devname .. "\" could not be set to state \"" .. data['new_color'] .. "\"")
+	if parameters['COLOR'] ~= nil then
+		if #parameters['COLOR']['value'] == 1 then
+			new_color = parameters['COLOR']['value'][1];
 		end
 	end
 
-	if data['new_label'] ~= nil then
-		if devobj.setLabel(data['new_label']) == false then
-			error("device \"" .. devname .. "\" could not be set to state \"" .. data['new_label'] .. "\"")
+	if parameters['TO'] ~= nil then
+		if #parameters['TO']['value'] == 1 then
+			new_label = parameters['TO']['value'][1];
 		end
 	end
 
-	devobj.send();
+	if parameters['AFTER'] ~= nil then
+		after = pilight.common.explode(parameters['AFTER']['value'][1], " ");
+	end
+	if parameters['FOR'] ~= nil then
+		for_ = pilight.common.explode(parameters['FOR']['value'][1], " ");
+	end
 
-	if data['time_for'] > 0 and data['type_for'] ~= nil then
-		execute_for(data);
+	if after ~= nil and #after == 2 then
+		async = pilight.async.timer();
+	else
+		async = pilight.async.thread();
 	end
-end
 
-function M.run(parameters)
-	local nrdev = #parameters['DEVICE']['value'];
+	local data = async.getUserdata();
+
+	data['devices'] = {};
+	data['time_after'] = 0;
+	data['type_after'] = nil;
+	data['time_for'] = 0;
+	data['type_for'] = nil;
+	data['steps'] = 1;
+	data['new_label'] = new_label;
+	data['new_color'] = new_color;
 
 	for i = 1, nrdev, 1 do
 		local devname = parameters['DEVICE']['value'][i];
-		local config = pilight.config();
 		local devobj = config.getDevice(devname);
 		local old_color = nil;
-		local new_color = nil;
 		local old_label = nil;
-		local new_label = nil;
-		local after = nil;
-		local for_ = nil;
-		local async = nil;
-
-		if parameters['COLOR'] ~= nil then
-			if #parameters['COLOR']['value'] == 1 then
-				new_color = parameters['COLOR']['value'][1];
-			end
-		end
-
-		if parameters['TO'] ~= nil then
-			if #parameters['TO']['value'] == 1 then
-				new_label = parameters['TO']['value'][1];
-			end
-		end
-
-		if parameters['AFTER'] ~= nil then
-			after = pilight.common.explode(parameters['AFTER']['value'][1], " ");
-		end
-		if parameters['FOR'] ~= nil then
-			for_ = pilight.common.explode(parameters['FOR']['value'][1], " ");
-		end
 
 		if devobj.hasSetting("label") == true then
 			if devobj.getLabel ~= nil then
@@ -260,56 +268,43 @@ function M.run(parameters)
 			end
 		end
 
-		if after ~= nil and #after == 2 then
-			async = pilight.async.timer();
-		else
-			async = pilight.async.thread();
-		end
-
-		local data = async.getUserdata();
-
-		data['device'] = devname;
-		data['time_after'] = 0;
-		data['type_after'] = nil;
-		data['time_for'] = 0;
-		data['type_for'] = nil;
-		data['steps'] = 1;
-		data['old_label'] = old_label;
-		data['new_label'] = new_label;
-		data['old_color'] = old_color;
-		data['new_color'] = new_color;
-		data['action_id'] = devobj.setActionId();
-
-		if for_ ~= nil and #for_ == 2 then
-			data['time_for'] = tonumber(for_[1]);
-			data['type_for'] = for_[2];
-		end
+		data['devices'][i] = {
+			device = devname,
+			old_label = old_label,
+			old_color = old_color,
+			action_id = devobj.setActionId()
+		};
+	end
 
-		if after ~= nil and #after == 2 then
-			data['time_after'] = tonumber(after[1]);
-			data['type_after'] = after[2];
-		end
+	if for_ ~= nil and #for_ == 2 then
+		data['time_for'] = tonumber(for_[1]);
+		data['type_for'] = for_[2];
+	end
 
-		if data['time_after'] > 0 and data['type_after'] ~= nil then
-			if(data['type_after'] == 'SECOND') then
-				async.setTimeout(data['time_after']*1000);
-			elseif(data['type_after'] == 'MINUTE') then
-				async.setTimeout(data['time_after']*1000*60);
-			elseif(data['type_after'] == 'HOUR') then
-				async.setTimeout(data['time_after']*1000*60*60);
-			elseif(data['type_after'] == 'DAY') then
-				async.setTimeout(data['time_after']*1000*60*60);
-			else
-				async.setTimeout(data['time_after']);
-			end
+	if after ~= nil and #after == 2 then
+		data['time_after'] = tonumber(after[1]);
+		data['type_after'] = after[2];
+	end
 
-			async.setRepeat(0);
-			async.setCallback("timer_after");
-			async.start();
+	if data['time_after'] > 0 and data['type_after'] ~= nil then
+		if(data['type_after'] == 'SECOND') then
+			async.setTimeout(data['time_after']*1000);
+		elseif(data['type_after'] == 'MINUTE') then
+			async.setTimeout(data['time_after']*1000*60);
+		elseif(data['type_after'] == 'HOUR') then
+			async.setTimeout(data['time_after']*1000*60*60);
+		elseif(data['type_after'] == 'DAY') then
+			async.setTimeout(data['time_after']*1000*60*60);
 		else
-			async.setCallback("thread");
-			async.trigger();
+			async.setTimeout(data['time_after']);
 		end
+
+		async.setRepeat(0);
+		async.setCallback("timer_after");
+		async.start();
+	else
+		async.setCallback("thread");
+		async.trigger();
 	end
 
 	return 1;
@@ -322,7 +317,7 @@ end
 function M.info()
 	return {
 		name = "label",
-		version = "4.1",
+		version = "4.2",
 		reqversion = "8.1.2",
 		reqcommit = "23"
 	}
@@ -95,22 +95,40 @@ function M.check(parameters)
 	return 1;
 end
 
-function M.timer_for(timer)
-	local data = timer.getUserdata();
-	local devname = data['device'];
+--
+-- All devices of an action are switched as one batch
+-- in the order they were listed. Devices that were taken
+-- over by a later action in the meantime are skipped.
+--
+local function switch_devices(data, restore)
 	local config = pilight.config();
-	local devobj = config.getDevice(devname);
+	local devices = data['devices'];
 
-	if(devobj.getActionId() ~= data['action_id']) then
-		error("skipping overridden action switch for device " .. devname);
-	end
+	for i = 1, devices.len(), 1 do
+		local devname = devices[i]['device'];
+		local devobj = config.getDevice(devname);
+		local state = data['new_state'];
 
-	if devobj.setState(data['old_state']) == false then
-		error("device \"" .. devname .. "\" could not be set to state \"" .. data['old_state'] .. "\"")
+		if restore == true then
+			state = devices[i]['old_state'];
+		end
+
+		if devobj.getActionId() ~= devices[i]['action_id'] then
+			pilight.log(LOG_DEBUG, "skipping overridden action switch for device " .. devname);
+		elseif state ~= nil then
+			if devobj.setState(state) == false then
+				pilight.log(LOG_ERR, "device \"" .. devname .. "\" could not be set to state \"" .. state .. "\"");
+			else
+				devobj.send();
+			end
+		end
 	end
+end
 
-	devobj.send();
+function M.timer_for(timer)
+	local data = timer.getUserdata();
 
+	switch_devices(data, true);
 end
 
 function execute_for(data)
@@ -136,19 +154,8 @@ end
 
 function M.thread(thread)
 	local data = thread.getUserdata();
-	local devname = data['device'];
-	local config = pilight.config();
-	local devobj = config.getDevice(devname);
-
-	if(devobj.getActionId() ~= data['action_id']) then
-		error("skipping overridden action switch for device " .. devname);
-	end
-
-	if devobj.setState(data['new_state']) == false then
-		error("device \"" .. devname .. "\" could not be set to state \"" .. data['new_state'] .. "\"")
-	end
 
-	devobj.send();
+	switch_devices(data, false);
 
 	if data['time_for'] ~= 0 and data['type_for'] ~= nil then
 		execute_for(data);
@@ -157,19 +164,8 @@ end
 
 function M.timer_after(timer)
 	local data = timer.getUserdata();
-	local devname = data['device'];
-	local config = pilight.config();
-	local devobj = config.getDevice(devname);
-
-	if(devobj.getActionId() ~= data['action_id']) then
-		error("skipping overridden action switch for device " .. devname);
-	end
 
-	if devobj.setState(data['new_state']) == false then
-		error("device \"" .. devname .. "\" could not be set to state \"" .. data['new_state'] .. "\"")
-	end
-
-	devobj.send();
+	switch_devices(data, false);
 
 	if data['time_for'] > 0 and data['type_for'] ~= nil then
 		execute_for(data);
@@ -178,23 +174,39 @@ end
 
 function M.run(parameters)
 	local nrdev = #parameters['DEVICE']['value'];
+	local config = pilight.config();
+	local new_state = parameters['TO']['value'][1];
+	local after = nil;
+	local for_ = nil;
+	local async = nil;
+
+	if parameters['AFTER'] ~= nil then
+		after = pilight.common.explode(parameters['AFTER']['value'][1], " ");
+	end
+	if parameters['FOR'] ~= nil then
+		for_ = pilight.common.explode(parameters['FOR']['value'][1], " ");
+	end
+
+	if after ~= nil and #after == 2 then
+		async = pilight.async.timer();
+	else
+		async = pilight.async.thread();
+	end
+
+	local data = async.getUserdata();
+
+	data['devices'] = {};
+	data['time_after'] = 0;
+	data['type_after'] = nil;
+	data['time_for'] = 0;
+	data['type_for'] = nil;
+	data['steps'] = 1;
+	data['new_state'] = new_state;
 
 	for i = 1, nrdev, 1 do
 		local devname = parameters['DEVICE']['value'][i];
-		local config = pilight.config();
 		local devobj = config.getDevice(devname);
 		local old_state = nil;
-		local new_state = parameters['TO']['value'][1];
-		local after = nil;
-		local for_ = nil;
-		local async = nil;
-
-		if parameters['AFTER'] ~= nil then
-			after = pilight.common.explode(parameters['AFTER']['value'][1], " ");
-		end
-		if parameters['FOR'] ~= nil then
-			for_ = pilight.common.explode(parameters['FOR']['value'][1], " ");
-		end
 
 		if parameters['FROM'] ~= nil then
 			old_state = parameters['FROM']['value'][1];
@@ -206,54 +218,42 @@ function M.run(parameters)
 			end
 		end
 
-		if after ~= nil and #after == 2 then
-			async = pilight.async.timer();
-		else
-			async = pilight.async.thread();
-		end
-
-		local data = async.getUserdata();
-
-		data['device'] = devname;
-		data['time_after'] = 0;
-		data['type_after'] = nil;
-		data['time_for'] = 0;
-		data['type_for'] = nil;
-		data['steps'] = 1;
-		data['old_state'] = old_state;
-		data['new_state'] = new_state;
-		data['action_id'] = devobj.setActionId();
-
-		if for_ ~= nil and #for_ == 2 then
-			data['time_for'] = tonumber(for_[1]);
-			data['type_for'] = for_[2];
-		end
+		data['devices'][i] = {
+			device = devname,
+			old_state = old_state,
+			action_id = devobj.setActionId()
+		};
+	end
 
-		if after ~= nil and #after == 2 then
-			data['time_after'] = tonumber(after[1]);
-			data['type_after'] = after[2];
-		end
+	if for_ ~= nil and #for_ == 2 then
+		data['time_for'] = tonumber(for_[1]);
+		data['type_for'] = for_[2];
+	end
 
-		if data['time_after'] > 0 and data['type_after'] ~= nil then
-			if(data['type_after'] == 'SECOND') then
-				async.setTimeout(data['time_after']*1000);
-			elseif(data['type_after'] == 'MINUTE') then
-				async.setTimeout(data['time_after']*1000*60);
-			elseif(data['type_after'] == 'HOUR') then
-				async.setTimeout(data['time_after']*1000*60*60);
-			elseif(data['type_after'] == 'DAY') then
-				async.setTimeout(data['time_after']*1000*60*60);
-			else
-				async.setTimeout(data['time_after']);
-			end
+	if after ~= nil and #after == 2 then
+		data['time_after'] = tonumber(after[1]);
+		data['type_after'] = after[2];
+	end
 
-			async.setRepeat(0);
-			async.setCallback("timer_after");
-			async.start();
+	if data['time_after'] > 0 and data['type_after'] ~= nil then
+		if(data['type_after'] == 'SECOND') then
+			async.setTimeout(data['time_after']*1000);
+		elseif(data['type_after'] == 'MINUTE') then
+			async.setTimeout(data['time_after']*1000*60);
+		elseif(data['type_after'] == 'HOUR') then
+			async.setTimeout(data['time_after']*1000*60*60);
+		elseif(data['type_after'] == 'DAY') then
+			async.setTimeout(data['time_after']*1000*60*60);
 		else
-			async.setCallback("thread");
-			async.trigger();
+			async.setTimeout(data['time_after']);
 		end
+
+		async.setRepeat(0);
+		async.setCallback("timer_after");
+		async.start();
+	else
+		async.setCallback("thread");
+		async.trigger();
 	end
 
 	return 1;
@@ -266,7 +266,7 @@ end
 function M.info()
 	return {
 		name = "switch",
-		version = "4.2",
+		version = "4.3",
 		reqversion = "8.1.2",
 		reqcommit = "23"
 	}
@@ -2081,6 +2081,16 @@ int events_running(void) {
 static void events_queue(char *message) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
+	struct JsonNode *jconfig = NULL;
+	struct JsonError jerror;
+
+	/* Decode before taking the lock */
+	if((jconfig = json_decode_ex(message, &jerror)) == NULL) {
+		logprintf(LOG_DEBUG, "invalid json at line %d, column %d: %s",
+			jerror.line, jerror.column, jerror.message);
+		return;
+	}
+
 	if(eventslock_init == 1) {
 		pthread_mutex_lock(&events_lock);
 	}
@@ -2090,7 +2100,7 @@ static void events_queue(char *message) {
 			fprintf(stderr, "out of memory\n");
 			exit(EXIT_FAILURE);
 		}
-		enode->jconfig = json_decode(message);
+		enode->jconfig = jconfig;
 
 		if(eventsqueue_number == 0) {
 			eventsqueue = enode;
@@ -2103,6 +2113,7 @@ static void events_queue(char *message) {
 		eventsqueue_number++;
 	} else {
 		logprintf(LOG_ERR, "event queue full");
+		json_delete(jconfig);
 	}
 	if(eventslock_init == 1) {
 		pthread_mutex_unlock(&events_lock);
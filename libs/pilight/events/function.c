@@ -245,43 +245,17 @@ int event_function_callback(char *module, struct event_function_args_t *args, st
 		return -1;
 	}
 
-	char name[255], *p = name;
-	memset(name, '\0', 255);
-
-	sprintf(p, "function.%s", module);
-
-	lua_getglobal(L, name);
-	if(lua_isnil(L, -1) != 0) {
+	if(plua_get_module(L, "function", module) == NULL) {
 		event_function_free_argument(args);
-		lua_remove(L, -1);
 		assert(plua_check_stack(L, 0) == 0);
 		plua_clear_state(state);
 		return -1;
 	}
-	if(lua_istable(L, -1) != 0) {
-		char *file = NULL;
-		struct plua_module_t *tmp = plua_get_modules();
-		while(tmp) {
-			if(strcmp(module, tmp->name) == 0) {
-				file = tmp->file;
-				state->module = tmp;
-				break;
-			}
-			tmp = tmp->next;
-		}
-		if(file != NULL) {
-			if(plua_function_module_run(L, file, args, v) == -1) {
-				lua_pop(L, -1);
-				assert(plua_check_stack(L, 0) == 0);
-				plua_clear_state(state);
-				return -1;
-			}
-		} else {
-			event_function_free_argument(args);
-			assert(plua_check_stack(L, 0) == 0);
-			plua_clear_state(state);
-			return -1;
-		}
+	if(plua_function_module_run(L, state->module->file, args, v) == -1) {
+		lua_pop(L, -1);
+		assert(plua_check_stack(L, 0) == 0);
+		plua_clear_state(state);
+		return -1;
 	}
 	lua_pop(L, -1);
 
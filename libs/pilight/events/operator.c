@@ -238,33 +238,16 @@ int event_operator_precedence(char *module, int *ret) {
 		return -1;
 	}
 
-	char name[255], *p = name;
-	memset(name, '\0', 255);
-
-	sprintf(p, "operator.%s", module);
-
-	lua_getglobal(L, name);
-	if(lua_isnil(L, -1) != 0) {
+	if(plua_get_module(L, "operator", module) == NULL) {
 		assert(plua_check_stack(L, 0) == 0);
+		plua_clear_state(state);
 		return -1;
 	}
-	if(lua_istable(L, -1) != 0) {
-		char *file = NULL;
-		struct plua_module_t *tmp = plua_get_modules();
-		while(tmp) {
-			if(strcmp(module, tmp->name) == 0) {
-				file = tmp->file;
-				state->module = tmp;
-				break;
-			}
-			tmp = tmp->next;
-		}
-		if(plua_operator_precedence_run(L, file, ret) == 0) {
-			lua_pop(L, -1);
-			assert(plua_check_stack(L, 0) == 0);
-			plua_clear_state(state);
-			return -1;
-		}
+	if(plua_operator_precedence_run(L, state->module->file, ret) == 0) {
+		lua_pop(L, -1);
+		assert(plua_check_stack(L, 0) == 0);
+		plua_clear_state(state);
+		return -1;
 	}
 	lua_pop(L, -1);
 
@@ -288,34 +271,16 @@ int event_operator_associativity(char *module, int *ret) {
 		return -1;
 	}
 
-	char name[255], *p = name;
-	memset(name, '\0', 255);
-
-	sprintf(p, "operator.%s", module);
-
-	lua_getglobal(L, name);
-	if(lua_isnil(L, -1) != 0) {
+	if(plua_get_module(L, "operator", module) == NULL) {
 		assert(plua_check_stack(L, 0) == 0);
 		plua_clear_state(state);
 		return -1;
 	}
-	if(lua_istable(L, -1) != 0) {
-		char *file = NULL;
-		struct plua_module_t *tmp = plua_get_modules();
-		while(tmp) {
-			if(strcmp(module, tmp->name) == 0) {
-				file = tmp->file;
-				state->module = tmp;
-				break;
-			}
-			tmp = tmp->next;
-		}
-		if(plua_operator_associativity_run(L, file, ret) == 0) {
-			lua_pop(L, -1);
-			assert(plua_check_stack(L, 0) == 0);
-			plua_clear_state(state);
-			return -1;
-		}
+	if(plua_operator_associativity_run(L, state->module->file, ret) == 0) {
+		lua_pop(L, -1);
+		assert(plua_check_stack(L, 0) == 0);
+		plua_clear_state(state);
+		return -1;
 	}
 	lua_pop(L, -1);
 
@@ -339,34 +304,16 @@ int event_operator_callback(char *module, struct varcont_t *a, struct varcont_t
 		return -1;
 	}
 
-	char name[255], *p = name;
-	memset(name, '\0', 255);
-
-	sprintf(p, "operator.%s", module);
-
-	lua_getglobal(L, name);
-	if(lua_isnil(L, -1) != 0) {
+	if(plua_get_module(L, "operator", module) == NULL) {
 		assert(plua_check_stack(L, 0) == 0);
 		plua_clear_state(state);
 		return -1;
 	}
-	if(lua_istable(L, -1) != 0) {
-		char *file = NULL;
-		struct plua_module_t *tmp = plua_get_modules();
-		while(tmp) {
-			if(strcmp(module, tmp->name) == 0) {
-				file = tmp->file;
-				state->module = tmp;
-				break;
-			}
-			tmp = tmp->next;
-		}
-		if(plua_operator_module_run(L, file, a, b, v) == -1) {
-			lua_pop(L, -1);
-			assert(plua_check_stack(L, 0) == 0);
-			plua_clear_state(state);
-			return -1;
-		}
+	if(plua_operator_module_run(L, state->module->file, a, b, v) == -1) {
+		lua_pop(L, -1);
+		assert(plua_check_stack(L, 0) == 0);
+		plua_clear_state(state);
+		return -1;
 	}
 	lua_pop(L, -1);
 
@@ -24,6 +24,9 @@
 	#include <unistd.h>
 #endif
 
+#include <mbedtls/sha256.h>
+#include <luajit-2.0/luajit.h>
+
 #include "lua.h"
 #include "lualibrary.h"
 
@@ -32,6 +35,7 @@
 #include "../core/mem.h"
 #include "../core/common.h"
 #include "table.h"
+#include "profile.h"
 
 #ifdef PILIGHT_UNITTEST
 static struct info_t {
@@ -64,9 +68,34 @@ static int init = 0;
  * Last state is a global state for global
  * garbage collection on pilight shutdown.
  */
-static struct lua_state_t lua_state[NRLUASTATES+1];
+static struct lua_state_t lua_state[NRLUASTATES_MAX+1];
 static uv_sem_t sem_used_states;
 static struct plua_module_t *modules = NULL;
+/* Guards walking the modules list outside the pool lock */
+static uv_mutex_t modules_lock;
+
+/*
+ * The pool lock guards growing the pool and
+ * everything a new state must replay: the
+ * overridden globals, the package path and
+ * the loaded modules. Only one state is grown
+ * at a time.
+ */
+static uv_mutex_t pool_lock;
+static int nrstates = 0;
+static int maxstates = NRLUASTATES_DEFAULT;
+static int growing = 0;
+
+/* The registry of each state points back to its lua_state_t */
+static char plua_state_key;
+static struct plua_pool_stats_t pool_stats;
+
+static struct plua_override_t {
+	char *name;
+	int (*func)(lua_State *L);
+	struct plua_override_t *next;
+} *overrides = NULL;
+static char *package_path = NULL;
 
 static int plua_metatable_index(lua_State *L, struct plua_metatable_t *node);
 static int plua_metatable_pairs(lua_State *, struct plua_metatable_t *node);
@@ -198,45 +227,81 @@ static int luaB_ipairs (lua_State *L) {
   return pairsmeta(L, "__ipairs", 1, ipairsaux);
 }
 
-int plua_namespace(struct plua_module_t *module, char *p) {
-	switch(module->type) {
+static const char *plua_type_namespace(int type) {
+	switch(type) {
 #ifdef PILIGHT_UNITTEST
-		case UNITTEST: {
-			sprintf(p, "unittest.%s", module->name);
-			return 0;
-		} break;
+		case UNITTEST:
+			return "unittest";
 #endif
-		case FUNCTION: {
-			sprintf(p, "function.%s", module->name);
-			return 0;
-		} break;
-		case OPERATOR: {
-			sprintf(p, "operator.%s", module->name);
-			return 0;
-		} break;
-		case ACTION: {
-			sprintf(p, "action.%s", module->name);
-			return 0;
-		} break;
-		case STORAGE: {
-			sprintf(p, "storage.%s", module->name);
-			return 0;
-		} break;
-		case HARDWARE: {
-			sprintf(p, "hardware.%s", module->name);
-			return 0;
-		} break;
-		case PROTOCOL: {
-			sprintf(p, "protocol.%s", module->name);
-			return 0;
-		} break;
+		case FUNCTION:
+			return "function";
+		case OPERATOR:
+			return "operator";
+		case ACTION:
+			return "action";
+		case STORAGE:
+			return "storage";
+		case HARDWARE:
+			return "hardware";
+		case PROTOCOL:
+			return "protocol";
 	}
-	return -1;
+	return NULL;
 }
 
+int plua_namespace(struct plua_module_t *module, char *p) {
+	const char *namespace = plua_type_namespace(module->type);
+	if(namespace == NULL) {
+		return -1;
+	}
+	sprintf(p, "%s.%s", namespace, module->name);
+	return 0;
+}
+
+/*
+ * Modules are indexed by namespace and name
+ */
+#define PLUA_MODULE_BUCKETS	64
+
+static struct plua_module_t *module_index[PLUA_MODULE_BUCKETS];
+
+static unsigned int plua_module_hash(const char *namespace, const char *name) {
+	unsigned int hash = 5381;
+	while(*namespace) {
+		hash = ((hash << 5) + hash) + (unsigned char)*namespace++;
+	}
+	hash = ((hash << 5) + hash) + '.';
+	while(*name) {
+		hash = ((hash << 5) + hash) + (unsigned char)*name++;
+	}
+	return hash;
+}
+
+static struct plua_module_t *plua_module_find(const char *namespace, const char *module) {
+	struct plua_module_t *node = NULL;
+	const char *ns = NULL;
+	unsigned int hash = plua_module_hash(namespace, module);
+
+	node = module_index[hash % PLUA_MODULE_BUCKETS];
+	while(node) {
+		if(node->hash == hash && strcmp(node->name, module) == 0 &&
+			 (ns = plua_type_namespace(node->type)) != NULL && strcmp(ns, namespace) == 0) {
+			return node;
+		}
+		node = node->hnext;
+	}
+	return NULL;
+}
+
+/*
+ * Pushes the module table on the stack of the state
+ * belonging to L and sets the state module. The table
+ * is looked up by name once per state, afterwards it's
+ * taken directly from the registry.
+ */
 struct lua_state_t *plua_get_module(lua_State *L, char *namespace, char *module) {
 	struct lua_state_t *state = NULL;
-	int match = 0;
+	struct plua_module_t *node = NULL;
 
 	state = plua_get_current_state(L);
 
@@ -249,37 +314,31 @@ struct lua_state_t *plua_get_module(lua_State *L, char *namespace, char *module)
 		return NULL;
 	}
 
-	char name[255], *p = name;
-	memset(name, '\0', 255);
-
-	sprintf(p, "%s.%s", namespace, module);
-	lua_getglobal(L, name);
-
-	if(lua_isnil(L, -1) != 0) {
-		lua_pop(L, -1);
+	if((node = plua_module_find(namespace, module)) == NULL) {
 		assert(plua_check_stack(L, 0) == 0);
 		return NULL;
 	}
-	if(lua_istable(L, -1) != 0) {
-		struct plua_module_t *tmp = plua_get_modules();
-		while(tmp) {
-			if(strcmp(module, tmp->name) == 0) {
-				state->module = tmp;
-				match = 1;
-				break;
-			}
-			tmp = tmp->next;
-		}
-		if(match == 1) {
-			return state;
-		}
-	}
 
-	lua_pop(L, -1);
+	if(node->ref[state->idx] > 0) {
+		lua_rawgeti(L, LUA_REGISTRYINDEX, node->ref[state->idx]);
+	} else {
+		char name[512], *p = name;
+		memset(name, '\0', sizeof(name));
 
-	assert(plua_check_stack(L, 0) == 0);
+		snprintf(p, sizeof(name), "%s.%s", namespace, module);
+		lua_getglobal(L, name);
 
-	return NULL;
+		if(lua_istable(L, -1) == 0) {
+			lua_pop(L, 1);
+			assert(plua_check_stack(L, 0) == 0);
+			return NULL;
+		}
+		lua_pushvalue(L, -1);
+		node->ref[state->idx] = luaL_ref(L, LUA_REGISTRYINDEX);
+	}
+	state->module = node;
+
+	return state;
 }
 
 static int plua_metatable_len(lua_State *L, struct plua_metatable_t *node) {
@@ -1537,18 +1596,187 @@ static int plua_metatable___gc(lua_State *L) {
 	return 0;
 }
 
+#ifdef PILIGHT_UNITTEST
+static void hook(lua_State *L, lua_Debug *ar);
+#endif
+static int plua_module_preload(lua_State *L, struct plua_module_t *module);
+static int plua_atpanic(lua_State *L);
+
+static void plua_set_current_state(lua_State *L, struct lua_state_t *state) {
+	lua_pushlightuserdata(L, &plua_state_key);
+	lua_pushlightuserdata(L, state);
+	lua_rawset(L, LUA_REGISTRYINDEX);
+}
+
+/*
+ * Sets the overridden globals and package path
+ * on a new state. Called with the pool lock held.
+ */
+static void plua_replay_globals(lua_State *L) {
+	struct plua_override_t *tmp = overrides;
+
+	while(tmp) {
+		lua_getglobal(L, "_G");
+		lua_pushcfunction(L, tmp->func);
+		lua_setfield(L, -2, tmp->name);
+		lua_remove(L, -1);
+		tmp = tmp->next;
+	}
+
+	if(package_path != NULL) {
+		lua_getglobal(L, "package");
+		lua_pushstring(L, package_path);
+		lua_setfield(L, -2, "path");
+		lua_pop(L, 1);
+	}
+}
+
+/*
+ * Called by the thread that set growing. The new
+ * state is created and its modules are run without
+ * the pool lock. It's published under the lock once
+ * no module was added in the meantime, and returned
+ * locked, so it can't be taken by another thread
+ * before the caller gets it.
+ */
+static struct lua_state_t *plua_grow_states(void) {
+	struct plua_module_t *module = NULL, *head = NULL, *done = NULL;
+	struct lua_state_t *state = NULL;
+	int i = __sync_add_and_fetch(&nrstates, 0);
+
+	state = &lua_state[i];
+	memset(state, 0, sizeof(struct lua_state_t));
+	uv_mutex_init(&state->lock);
+	uv_mutex_init(&state->gc.lock);
+	uv_mutex_lock(&state->lock);
+
+	lua_State *L = luaL_newstate();
+
+	luaL_openlibs(L);
+	plua_register_library(L);
+	plua_set_current_state(L, state);
+	state->L = L;
+	state->idx = i;
+	state->file = NULL;
+	state->line = -1;
+
+	lua_atpanic(L, &plua_atpanic);
+#ifdef PILIGHT_UNITTEST
+	lua_sethook(L, hook, LUA_MASKLINE, 0);
+#endif
+
+	uv_mutex_lock(&pool_lock);
+	while(1) {
+		plua_replay_globals(L);
+		if(modules == done) {
+			break;
+		}
+		head = modules;
+		uv_mutex_unlock(&pool_lock);
+
+		module = head;
+		while(module != done) {
+			plua_module_preload(L, module);
+			module = module->next;
+		}
+		assert(plua_check_stack(L, 0) == 0);
+		done = head;
+
+		uv_mutex_lock(&pool_lock);
+	}
+
+	__sync_add_and_fetch(&nrstates, 1);
+	growing = 0;
+	pool_stats.grows++;
+	uv_mutex_unlock(&pool_lock);
+
+	logprintf(LOG_DEBUG, "lua state pool grown to %d states", i+1);
+
+	return state;
+}
+
+static void plua_wait_stats(uint64_t waited) {
+	int bucket = 0;
+
+	if(waited < 1000) {
+		bucket = 0;
+	} else if(waited < 10000) {
+		bucket = 1;
+	} else if(waited < 100000) {
+		bucket = 2;
+	} else if(waited < 1000000) {
+		bucket = 3;
+	} else {
+		bucket = 4;
+	}
+
+	uv_mutex_lock(&pool_lock);
+	pool_stats.waits++;
+	pool_stats.wait[bucket]++;
+	if(waited > pool_stats.wait_max) {
+		pool_stats.wait_max = waited;
+	}
+	uv_mutex_unlock(&pool_lock);
+}
+
+/*
+ * A free state is taken in the following order:
+ * - a state last used by the calling thread,
+ * - any other free state,
+ * - a newly created state while below the limit,
+ * - the first state that is released.
+ */
 struct lua_state_t *plua_get_free_state(void) {
-	int i = 0;
+	struct lua_state_t *state = NULL;
+	uv_thread_t self = uv_thread_self();
+	uint64_t start = 0;
+	int i = 0, nr = 0, grow = 0;
 	int error = 0;
 
 	while(1) {
-		for(i=0;i<NRLUASTATES;i++) {
-			if(uv_mutex_trylock(&lua_state[i].lock) == 0) {
-				return &lua_state[i];
+		nr = __sync_add_and_fetch(&nrstates, 0);
+		for(i=0;i<nr;i++) {
+			if(uv_thread_equal(&lua_state[i].thread_id, &self) &&
+				 uv_mutex_trylock(&lua_state[i].lock) == 0) {
+				__sync_add_and_fetch(&pool_stats.affine, 1);
+				state = &lua_state[i];
+				break;
+			}
+		}
+		if(state == NULL) {
+			for(i=0;i<nr;i++) {
+				if(uv_mutex_trylock(&lua_state[i].lock) == 0) {
+					state = &lua_state[i];
+					break;
+				}
 			}
 		}
+		if(state == NULL && nr < maxstates) {
+			uv_mutex_lock(&pool_lock);
+			if((grow = (growing == 0 && nrstates < maxstates)) == 1) {
+				growing = 1;
+			}
+			uv_mutex_unlock(&pool_lock);
+			if(grow == 1) {
+				state = plua_grow_states();
+				/*
+				 * Let a thread that waited for this
+				 * state grow the pool further.
+				 */
+				uv_sem_post(&sem_used_states);
+			}
+		}
+		if(state != NULL) {
+			state->thread_id = self;
+			__sync_add_and_fetch(&pool_stats.acquires, 1);
+			if(start > 0) {
+				plua_wait_stats((uv_hrtime()-start)/1000);
+			}
+			return state;
+		}
 		if(error == 0) {
 			error = 1;
+			start = uv_hrtime();
 			logprintf(LOG_DEBUG, "waiting free lua state to become available");
 		}
 		uv_sem_wait(&sem_used_states);
@@ -1557,13 +1785,37 @@ struct lua_state_t *plua_get_free_state(void) {
 }
 
 struct lua_state_t *plua_get_current_state(lua_State *L) {
-	int i = 0;
-	for(i=0;i<NRLUASTATES;i++) {
-		if(lua_state[i].L == L) {
-			return &lua_state[i];
-		}
+	struct lua_state_t *state = NULL;
+
+	lua_pushlightuserdata(L, &plua_state_key);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	state = (struct lua_state_t *)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+
+	if(state == NULL || state->L != L) {
+		return NULL;
 	}
-	return NULL;
+	return state;
+}
+
+void plua_set_max_states(int max) {
+	if(max < NRLUASTATES) {
+		max = NRLUASTATES;
+	}
+	if(max > NRLUASTATES_MAX) {
+		max = NRLUASTATES_MAX;
+	}
+	uv_mutex_lock(&pool_lock);
+	maxstates = max;
+	uv_mutex_unlock(&pool_lock);
+}
+
+void plua_pool_stats(struct plua_pool_stats_t *stats) {
+	uv_mutex_lock(&pool_lock);
+	memcpy(stats, &pool_stats, sizeof(struct plua_pool_stats_t));
+	stats->states = nrstates;
+	stats->max = maxstates;
+	uv_mutex_unlock(&pool_lock);
 }
 
 void _plua_clear_state(struct lua_state_t *state, char *file, int line) {
@@ -1929,32 +2181,294 @@ static int plua_writer(lua_State *L, const void* p, size_t sz, void* ud) {
 	return 0;
 }
 
+static int plua_module_preload(lua_State *L, struct plua_module_t *module) {
+	char name[512] = { '\0' };
+
+	if(plua_namespace(module, name) == -1) {
+		return -1;
+	}
+
+	luaL_loadbuffer(L, module->bytecode, module->size, module->name);
+	assert(plua_check_stack(L, 1, PLUA_TFUNCTION) == 0);
+	if(plua_pcall(L, module->file, 0, LUA_MULTRET) == -1) {
+		assert(plua_check_stack(L, 0) == 0);
+		return -1;
+	}
+	assert(plua_check_stack(L, 1, PLUA_TTABLE) == 0);
+	lua_setglobal(L, name);
+
+	return 0;
+}
+
+/*
+ * Compiled modules are cached in LUA_CACHE_ROOT,
+ * one file per module. Each file starts with the
+ * magic "PLBC", a version byte and the sha256 of
+ * the LuaJIT version, pointer size and module
+ * source. Then follow the size and the sha256 of
+ * the dumped bytecode and the bytecode itself. A
+ * cache file is only used when both hashes still
+ * match.
+ */
+#define PLUA_CACHE_MAGIC		"PLBC"
+#define PLUA_CACHE_VERSION	2
+#define PLUA_CACHE_HEADER		73
+
+static int cache_disabled = 0;
+
+static void plua_cache_hash(char *content, int len, unsigned char *hash) {
+	mbedtls_sha256_context ctx;
+	unsigned char ptrsize = sizeof(void *);
+
+	mbedtls_sha256_init(&ctx);
+	mbedtls_sha256_starts(&ctx, 0);
+	mbedtls_sha256_update(&ctx, (unsigned char *)LUAJIT_VERSION, strlen(LUAJIT_VERSION));
+	mbedtls_sha256_update(&ctx, &ptrsize, 1);
+	mbedtls_sha256_update(&ctx, (unsigned char *)content, len);
+	mbedtls_sha256_finish(&ctx, hash);
+	mbedtls_sha256_free(&ctx);
+}
+
+static void plua_cache_checksum(char *bytecode, int len, unsigned char *hash) {
+	mbedtls_sha256_context ctx;
+
+	mbedtls_sha256_init(&ctx);
+	mbedtls_sha256_starts(&ctx, 0);
+	mbedtls_sha256_update(&ctx, (unsigned char *)bytecode, len);
+	mbedtls_sha256_finish(&ctx, hash);
+	mbedtls_sha256_free(&ctx);
+}
+
+static int plua_cache_path(char *file, char *path, int len) {
+	struct stat st;
+	char *p = NULL;
+	int x = 0;
+
+	if(cache_disabled == 1) {
+		return -1;
+	}
+
+	/*
+	 * Create the cache folder and its parents
+	 */
+	if(stat(LUA_CACHE_ROOT, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		char tmp[strlen(LUA_CACHE_ROOT)+1];
+		strcpy(tmp, LUA_CACHE_ROOT);
+		for(p=&tmp[1];*p!='\0';p++) {
+			if(*p == '/' || *(p+1) == '\0') {
+				char c = *p;
+				if(*p == '/') {
+					*p = '\0';
+				}
+#ifdef _WIN32
+				mkdir(tmp);
+#else
+				mkdir(tmp, 0755);
+#endif
+				*p = c;
+			}
+		}
+		if(stat(LUA_CACHE_ROOT, &st) != 0 || !S_ISDIR(st.st_mode)) {
+			logprintf(LOG_DEBUG, "lua bytecode cache %s not available", LUA_CACHE_ROOT);
+			cache_disabled = 1;
+			return -1;
+		}
+	}
+
+	if(strlen(LUA_CACHE_ROOT)+strlen(file)+7 > len) {
+		return -1;
+	}
+
+	/*
+	 * /usr/local/lib/pilight/operators/and.lua becomes
+	 * LUA_CACHE_ROOT/_usr_local_lib_pilight_operators_and.lua.luac
+	 */
+	x = snprintf(path, len, "%s", LUA_CACHE_ROOT);
+	if(x > 0 && path[x-1] != '/') {
+		path[x++] = '/';
+	}
+	for(p=file;*p!='\0';p++) {
+		path[x++] = (*p == '/' || *p == '\\' || *p == ':') ? '_' : *p;
+	}
+	strcpy(&path[x], ".luac");
+
+	return 0;
+}
+
+static int plua_cache_read(char *path, unsigned char *hash, struct plua_module_t *module) {
+	unsigned char header[PLUA_CACHE_HEADER], checksum[32];
+	struct stat st;
+	FILE *fp = NULL;
+	int size = 0;
+
+	if((fp = fopen(path, "rb")) == NULL) {
+		return -1;
+	}
+	if(fstat(fileno(fp), &st) != 0 || st.st_size <= PLUA_CACHE_HEADER ||
+		 fread(header, 1, PLUA_CACHE_HEADER, fp) != PLUA_CACHE_HEADER ||
+		 memcmp(header, PLUA_CACHE_MAGIC, 4) != 0 ||
+		 header[4] != PLUA_CACHE_VERSION ||
+		 memcmp(&header[5], hash, 32) != 0) {
+		fclose(fp);
+		return -1;
+	}
+
+	size = (header[37] << 24) | (header[38] << 16) | (header[39] << 8) | header[40];
+	if(size <= 0 || st.st_size != PLUA_CACHE_HEADER+size) {
+		fclose(fp);
+		unlink(path);
+		return -1;
+	}
+	if((module->bytecode = MALLOC(size)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if(fread(module->bytecode, 1, size, fp) != size) {
+		FREE(module->bytecode);
+		fclose(fp);
+		unlink(path);
+		return -1;
+	}
+	fclose(fp);
+
+	plua_cache_checksum(module->bytecode, size, checksum);
+	if(memcmp(&header[41], checksum, 32) != 0) {
+		logprintf(LOG_DEBUG, "lua bytecode cache %s is corrupt", path);
+		FREE(module->bytecode);
+		unlink(path);
+		return -1;
+	}
+	module->size = size;
+
+	return 0;
+}
+
+static void plua_cache_write(char *path, unsigned char *hash, struct plua_module_t *module) {
+	char tmp[strlen(path)+5];
+	unsigned char size[4], checksum[32];
+	FILE *fp = NULL;
+	int ok = 1;
+
+	size[0] = (module->size >> 24) & 0xFF;
+	size[1] = (module->size >> 16) & 0xFF;
+	size[2] = (module->size >> 8) & 0xFF;
+	size[3] = module->size & 0xFF;
+	plua_cache_checksum(module->bytecode, module->size, checksum);
+
+	/*
+	 * Write to a temporary file first, so a partially
+	 * written cache file is never picked up.
+	 */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if((fp = fopen(tmp, "wb")) == NULL) {
+		return;
+	}
+	ok &= (fwrite(PLUA_CACHE_MAGIC, 1, 4, fp) == 4);
+	ok &= (fputc(PLUA_CACHE_VERSION, fp) != EOF);
+	ok &= (fwrite(hash, 1, 32, fp) == 32);
+	ok &= (fwrite(size, 1, 4, fp) == 4);
+	ok &= (fwrite(checksum, 1, 32, fp) == 32);
+	ok &= (fwrite(module->bytecode, 1, module->size, fp) == module->size);
+	ok &= (fclose(fp) == 0);
+
+	if(ok == 0 || rename(tmp, path) != 0) {
+		unlink(tmp);
+		logprintf(LOG_DEBUG, "cannot write lua bytecode cache %s", path);
+	}
+}
+
+/*
+ * Reads a module source with a single open file, so
+ * the length used matches what was actually read.
+ */
+static int plua_source_read(char *file, char **content, int *len) {
+	struct stat st;
+	FILE *fp = NULL;
+
+	if((fp = fopen(file, "rb")) == NULL) {
+		return -1;
+	}
+	if(fstat(fileno(fp), &st) != 0) {
+		fclose(fp);
+		return -1;
+	}
+	if((*content = MALLOC(st.st_size+1)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	*len = (int)fread(*content, 1, st.st_size, fp);
+	fclose(fp);
+	if(*len != st.st_size) {
+		FREE(*content);
+		return -1;
+	}
+	(*content)[*len] = '\0';
+
+	return 0;
+}
+
 void plua_module_load(char *file, int type) {
 	struct plua_module_t *module = MALLOC(sizeof(struct plua_module_t));
 	lua_State *L = lua_state[0].L;
-	char name[512] = { '\0' }, *p = name;
-	int i = 0;
+	char name[512] = { '\0' }, *p = name, *content = NULL;
+	char cache[PATH_MAX+1] = { '\0' };
+	unsigned char hash[32];
+	int i = 0, cached = -1, len = 0, nr = 0;
 	if(module == NULL) {
 		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 	}
 	memset(module, 0, sizeof(struct plua_module_t));
 
-	if(luaL_loadfile(L, file) != 0) {
+	if(plua_source_read(file, &content, &len) != 0) {
 		logprintf(LOG_ERR, "cannot load lua file: %s", file);
-		lua_remove(L, -1);
-		assert(plua_check_stack(L, 0) == 0);
 		FREE(module);
 		return;
 	}
-	strcpy(module->file, file);
-	if(lua_dump(L, plua_writer, module) != 0) {
-		logprintf(LOG_ERR, "cannot dump lua file: %s", file);
-		lua_remove(L, -1);
-		assert(plua_check_stack(L, 0) == 0);
-		FREE(module->bytecode);
-		FREE(module);
-		return;
+	plua_cache_hash(content, len, hash);
+
+#ifndef PILIGHT_UNITTEST
+	if(plua_cache_path(file, cache, sizeof(cache)) == 0) {
+		cached = plua_cache_read(cache, hash, module);
 	}
+#endif
+
+	if(cached == 0) {
+		if(luaL_loadbuffer(L, module->bytecode, module->size, file) != 0) {
+			/*
+			 * Fall back to the source when the cached
+			 * bytecode is rejected.
+			 */
+			lua_remove(L, -1);
+			FREE(module->bytecode);
+			module->size = 0;
+			cached = -1;
+		}
+	}
+
+	if(cached == -1) {
+		char chunk[strlen(file)+2];
+		snprintf(chunk, sizeof(chunk), "@%s", file);
+		if(luaL_loadbuffer(L, content, len, chunk) != 0) {
+			logprintf(LOG_ERR, "cannot load lua file: %s", file);
+			lua_remove(L, -1);
+			assert(plua_check_stack(L, 0) == 0);
+			FREE(content);
+			FREE(module);
+			return;
+		}
+		if(lua_dump(L, plua_writer, module) != 0) {
+			logprintf(LOG_ERR, "cannot dump lua file: %s", file);
+			lua_remove(L, -1);
+			assert(plua_check_stack(L, 0) == 0);
+			FREE(module->bytecode);
+			FREE(content);
+			FREE(module);
+			return;
+		}
+		if(strlen(cache) > 0) {
+			plua_cache_write(cache, hash, module);
+		}
+	}
+	FREE(content);
+	strcpy(module->file, file);
 
 	assert(plua_check_stack(L, 1, PLUA_TFUNCTION) == 0);
 	if(plua_pcall(L, file, 0, LUA_MULTRET) == -1) {
@@ -1973,35 +2487,18 @@ void plua_module_load(char *file, int type) {
 
 	module->type = type;
 	strcpy(module->file, file);
-	if(plua_module_init(L, file, module) != -1) {
-		memset(p, '\0', sizeof(name));
-		switch(module->type) {
-#ifdef PILIGHT_UNITTEST
-			case UNITTEST:
-				sprintf(p, "unittest.%s", module->name);
-			break;
-#endif
-			case OPERATOR:
-				sprintf(p, "operator.%s", module->name);
-			break;
-			case FUNCTION:
-				sprintf(p, "function.%s", module->name);
-			break;
-			case ACTION:
-				sprintf(p, "action.%s", module->name);
-			break;
-			case PROTOCOL:
-				sprintf(p, "protocol.%s", module->name);
-			break;
-			case STORAGE:
-				sprintf(p, "storage.%s", module->name);
-			break;
-			case HARDWARE:
-				sprintf(p, "hardware.%s", module->name);
-			break;
-		}
+	if(plua_module_init(L, file, module) != -1 && plua_namespace(module, p) == 0) {
+		module->hash = plua_module_hash(plua_type_namespace(module->type), module->name);
+
+		uv_mutex_lock(&pool_lock);
+		uv_mutex_lock(&modules_lock);
 		module->next = modules;
 		modules = module;
+		module->hnext = module_index[module->hash % PLUA_MODULE_BUCKETS];
+		module_index[module->hash % PLUA_MODULE_BUCKETS] = module;
+		uv_mutex_unlock(&modules_lock);
+		nr = nrstates;
+		uv_mutex_unlock(&pool_lock);
 	} else {
 		FREE(module->bytecode);
 		FREE(module);
@@ -2017,16 +2514,14 @@ void plua_module_load(char *file, int type) {
 	assert(lua_type(L, -1) == LUA_TTABLE);
 	lua_setglobal(L, name);
 
-	for(i=1;i<NRLUASTATES;i++) {
-		lua_State *L = lua_state[i].L;
-		luaL_loadbuffer(L, module->bytecode, module->size, module->name);
-		assert(plua_check_stack(L, 1, PLUA_TFUNCTION) == 0);
-		if(plua_pcall(L, module->file, 0, LUA_MULTRET) == -1) {
-			assert(plua_check_stack(L, 0) == 0);
+	/*
+	 * States published after the module was
+	 * added preload it from the modules list.
+	 */
+	for(i=1;i<nr;i++) {
+		if(plua_module_preload(lua_state[i].L, module) == -1) {
 			return;
 		}
-		assert(plua_check_stack(L, 1, PLUA_TTABLE) == 0);
-		lua_setglobal(L, name);
 	}
 
 	lua_getglobal(L, name);
@@ -2091,7 +2586,7 @@ void plua_module_load(char *file, int type) {
 #endif
 	lua_pop(L, -1);
 
-	for(i=0;i<NRLUASTATES;i++) {
+	for(i=0;i<nrstates;i++) {
 		assert(plua_check_stack(lua_state[i].L, 0) == 0);
 	}
 }
@@ -2282,9 +2777,13 @@ void plua_init(void) {
 	init = 1;
 
 	uv_sem_init(&sem_used_states, 0);
+	uv_mutex_init(&pool_lock);
+	uv_mutex_init(&modules_lock);
+	memset(&pool_stats, 0, sizeof(struct plua_pool_stats_t));
+	plua_profile_init();
 
 	int i = 0;
-	for(i=0;i<NRLUASTATES+1;i++) {
+	for(i=0;i<NRLUASTATES;i++) {
 		memset(&lua_state[i], 0, sizeof(struct lua_state_t));
 		uv_mutex_init(&lua_state[i].lock);
 		uv_mutex_init(&lua_state[i].gc.lock);
@@ -2293,6 +2792,7 @@ void plua_init(void) {
 
 		luaL_openlibs(L);
 		plua_register_library(L);
+		plua_set_current_state(L, &lua_state[i]);
 		lua_state[i].L = L;
 		lua_state[i].idx = i;
 		lua_state[i].file = NULL;
@@ -2303,6 +2803,7 @@ void plua_init(void) {
 		lua_sethook(L, hook, LUA_MASKLINE, 0);
 #endif
 	}
+	nrstates = NRLUASTATES;
 
 	plua_override_global("pairs", luaB_pairs);
 	plua_override_global("ipairs", luaB_ipairs);
@@ -2311,51 +2812,17 @@ void plua_init(void) {
 	/*
 	 * Initialize global state garbage collector
 	 */
-	i--;
+	i = NRLUASTATES_MAX;
 	memset(&lua_state[i], 0, sizeof(struct lua_state_t));
 	uv_mutex_init(&lua_state[i].gc.lock);
 }
 
 int plua_module_exists(char *module, int type) {
-	struct lua_state_t *state = plua_get_free_state();
-	struct lua_State *L = NULL;
-
-	if(state == NULL) {
-		return 1;
-	}
-	if((L = state->L) == NULL) {
-		plua_clear_state(state);
-		return 1;
-	}
-
-	char name[512] = { '\0' }, *p = name;
-	memset(name, '\0', 512);
-
-	struct plua_module_t mod;
-	struct plua_module_t *a = &mod;
-	a->type = type;
-	strcpy(a->name, module);
+	const char *namespace = plua_type_namespace(type);
 
-	plua_namespace(a, p);
-
-	lua_getglobal(L, name);
-	if(lua_type(L, -1) == LUA_TNIL) {
-		lua_pop(L, -1);
-		assert(plua_check_stack(L, 0) == 0);
-		plua_clear_state(state);
+	if(namespace == NULL || plua_module_find(namespace, module) == NULL) {
 		return -1;
 	}
-	if(lua_type(L, -1) != LUA_TTABLE) {
-		lua_pop(L, -1);
-		assert(plua_check_stack(L, 0) == 0);
-		plua_clear_state(state);
-		return -1;
-	}
-	lua_pop(L, -1);
-
-	assert(plua_check_stack(L, 0) == 0);
-	plua_clear_state(state);
-
 	return 0;
 }
 
@@ -2363,7 +2830,7 @@ void plua_gc_unreg(lua_State *L, void *ptr) {
 	struct lua_state_t *state = NULL;
 
 	if(L == NULL) {
-		state = &lua_state[NRLUASTATES];
+		state = &lua_state[NRLUASTATES_MAX];
 	} else {
 		state = plua_get_current_state(L);
 	}
@@ -2388,7 +2855,7 @@ void plua_gc_reg(lua_State *L, void *ptr, void (*callback)(void *ptr)) {
 	struct lua_state_t *state = NULL;
 
 	if(L == NULL) {
-		state = &lua_state[NRLUASTATES];
+		state = &lua_state[NRLUASTATES_MAX];
 	} else {
 		state = plua_get_current_state(L);
 	}
@@ -2482,8 +2949,22 @@ int plua_check_stack(lua_State *L, int numargs, ...) {
 
 //#ifdef PILIGHT_UNITTEST
 void plua_override_global(char *name, int (*func)(lua_State *L)) {
+	struct plua_override_t *node = NULL;
 	int i = 0;
-	for(i=0;i<NRLUASTATES;i++) {
+
+	if((node = MALLOC(sizeof(struct plua_override_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((node->name = STRDUP(name)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	node->func = func;
+
+	uv_mutex_lock(&pool_lock);
+	node->next = overrides;
+	overrides = node;
+
+	for(i=0;i<nrstates;i++) {
 		uv_mutex_lock(&lua_state[i].lock);
 
 		lua_getglobal(lua_state[i].L, "_G");
@@ -2495,6 +2976,7 @@ void plua_override_global(char *name, int (*func)(lua_State *L)) {
 
 		uv_mutex_unlock(&lua_state[i].lock);
 	}
+	uv_mutex_unlock(&pool_lock);
 }
 //#endif
 
@@ -2575,12 +3057,98 @@ static int plua_error_handler(lua_State* L) {
 	return 1;
 }
 
+static long plua_heap_size(lua_State *L) {
+	return (long)lua_gc(L, LUA_GCCOUNT, 0)*1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+/*
+ * Finds the profile counters of the function at
+ * index fidx. The first time a function is called,
+ * its module and method name are looked up. The
+ * method name is the key of the function in the
+ * module table, which callers push just below it.
+ */
+static struct plua_profile_t *plua_pcall_profile(lua_State *L, int fidx) {
+	struct lua_state_t *state = NULL;
+	struct plua_profile_t *node = NULL;
+	struct plua_module_t *module = NULL;
+	char name[512] = { '\0' }, method[255] = { '\0' };
+	const char *file = NULL;
+	lua_Debug ar;
+
+	if(lua_type(L, fidx) != LUA_TFUNCTION) {
+		return NULL;
+	}
+	lua_pushvalue(L, fidx);
+	if(lua_getinfo(L, ">S", &ar) == 0 || strcmp(ar.what, "C") == 0) {
+		return NULL;
+	}
+	if((node = plua_profile_get(ar.source, ar.linedefined)) != NULL) {
+		return node;
+	}
+
+	if(ar.linedefined == 0) {
+		strcpy(method, "main");
+	} else {
+		snprintf(method, sizeof(method), "line %d", ar.linedefined);
+	}
+	if(fidx > 1 && lua_type(L, fidx-1) == LUA_TTABLE) {
+		lua_pushnil(L);
+		while(lua_next(L, fidx-1) != 0) {
+			if(lua_type(L, -2) == LUA_TSTRING && lua_rawequal(L, -1, fidx) == 1) {
+				snprintf(method, sizeof(method), "%s", lua_tostring(L, -2));
+				lua_pop(L, 2);
+				break;
+			}
+			lua_pop(L, 1);
+		}
+	}
+
+	file = (ar.source[0] == '@') ? &ar.source[1] : ar.short_src;
+	if((state = plua_get_current_state(L)) != NULL && state->module != NULL &&
+		 strcmp(state->module->file, file) == 0) {
+		if(plua_namespace(state->module, name) == -1) {
+			snprintf(name, sizeof(name), "%s", file);
+		}
+	} else {
+		uv_mutex_lock(&modules_lock);
+		module = modules;
+		while(module) {
+			if(strcmp(module->file, file) == 0) {
+				break;
+			}
+			module = module->next;
+		}
+		if(module == NULL || plua_namespace(module, name) == -1) {
+			snprintf(name, sizeof(name), "%s", file);
+		}
+		uv_mutex_unlock(&modules_lock);
+	}
+
+	return plua_profile_add(ar.source, ar.linedefined, name, method);
+}
+
 int plua_pcall(struct lua_State *L, char *file, int args, int ret) {
-	int hpos = lua_gettop(L) - args;
+	struct plua_profile_t *profile = NULL;
+	uint64_t start = 0;
+	long heap = 0;
+	int hpos = lua_gettop(L) - args, error = 0;
+
+	if(plua_profile_enabled() == 1) {
+		profile = plua_pcall_profile(L, hpos);
+		heap = plua_heap_size(L);
+		start = uv_hrtime();
+	}
+
 	lua_pushcfunction(L, plua_error_handler);
 	lua_insert(L, hpos);
 
-	if(lua_pcall(L, args, ret, hpos) == LUA_ERRRUN) {
+	error = lua_pcall(L, args, ret, hpos);
+	if(profile != NULL) {
+		plua_profile_update(profile, (uv_hrtime()-start)/1000, plua_heap_size(L)-heap, (error != 0));
+	}
+
+	if(error == LUA_ERRRUN) {
 		if(lua_type(L, -1) == LUA_TNIL) {
 			logprintf(LOG_ERR, "%s: syntax error", file);
 			lua_remove(L, -1);
@@ -2793,6 +3361,7 @@ int plua_gc(void) {
 		return -1;
 	}
 	struct plua_module_t *tmp = NULL;
+	uv_mutex_lock(&modules_lock);
 	while(modules) {
 		tmp = modules;
 		FREE(tmp->bytecode);
@@ -2803,10 +3372,33 @@ int plua_gc(void) {
 		FREE(tmp);
 	}
 
+	memset(module_index, 0, sizeof(module_index));
+	uv_mutex_unlock(&modules_lock);
+
+	struct plua_override_t *node = NULL;
+	while(overrides) {
+		node = overrides;
+		overrides = overrides->next;
+		FREE(node->name);
+		FREE(node);
+	}
+	if(package_path != NULL) {
+		FREE(package_path);
+	}
+
+	logprintf(LOG_DEBUG, "lua state pool: %d states, %lu acquires (%lu thread affine), %lu grows",
+		nrstates, pool_stats.acquires, pool_stats.affine, pool_stats.grows);
+	logprintf(LOG_DEBUG, "lua state waits: %lu (<1ms: %lu, <10ms: %lu, <100ms: %lu, <1s: %lu, >=1s: %lu), max %lu usec",
+		pool_stats.waits, pool_stats.wait[0], pool_stats.wait[1], pool_stats.wait[2],
+		pool_stats.wait[3], pool_stats.wait[4], (unsigned long)pool_stats.wait_max);
+
 	int i = 0, x = 0, _free = 1;
 	while(_free) {
 		_free = 0;
-		for(i=0;i<NRLUASTATES+1;i++) {
+		for(i=0;i<NRLUASTATES_MAX+1;i++) {
+			if(i >= nrstates && i < NRLUASTATES_MAX) {
+				continue;
+			}
 			if(uv_mutex_trylock(&lua_state[i].lock) == 0) {
 				for(x=0;x<lua_state[i].gc.nr;x++) {
 					if(lua_state[i].gc.list[x]->free == 0) {
@@ -2832,6 +3424,9 @@ int plua_gc(void) {
 		}
 	}
 
+	plua_profile_gc();
+
+	nrstates = 0;
 	init = 0;
 	logprintf(LOG_DEBUG, "garbage collected lua library");
 	return 0;
@@ -2916,7 +3511,8 @@ int plua_flush_coverage(void) {
 
 void plua_package_path(const char *path) {
 	int i = 0;
-	for(i=0;i<NRLUASTATES;i++) {
+	uv_mutex_lock(&pool_lock);
+	for(i=0;i<nrstates;i++) {
 		lua_getglobal(lua_state[i].L, "package");
 		lua_getfield(lua_state[i].L, -1, "path");
 		const char *tmp = lua_tostring(lua_state[i].L, -1);
@@ -2932,6 +3528,18 @@ void plua_package_path(const char *path) {
 
 		lua_pop(lua_state[i].L, 1);
 		assert(plua_check_stack(lua_state[i].L, 0) == 0);
-		FREE(newpath);
+
+		/*
+		 * Remember the path for states created later on
+		 */
+		if(i == 0) {
+			if(package_path != NULL) {
+				FREE(package_path);
+			}
+			package_path = newpath;
+		} else {
+			FREE(newpath);
+		}
 	}
+	uv_mutex_unlock(&pool_lock);
 }
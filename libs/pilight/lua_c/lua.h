@@ -17,7 +17,15 @@
 
 #include "../libs/pilight/core/common.h"
 
-#define NRLUASTATES	4
+/*
+ * The pool starts with NRLUASTATES states and
+ * grows on demand up to the lua-states setting,
+ * NRLUASTATES_DEFAULT when not set and never
+ * more than NRLUASTATES_MAX.
+ */
+#define NRLUASTATES					4
+#define NRLUASTATES_DEFAULT	8
+#define NRLUASTATES_MAX			32
 
 #define UNITTEST	0
 #define OPERATOR	1
@@ -46,7 +54,7 @@ typedef struct plua_metatable_t {
 		uv_mutex_t lock;
 	} *table;
 	int nrvar;
-	int iter[NRLUASTATES];
+	int iter[NRLUASTATES_MAX];
 
 	uv_mutex_t lock;
 	uv_sem_t *ref;
@@ -66,6 +74,14 @@ typedef struct plua_module_t {
 	const char *btfile;
 	// struct plua_metatable_t *table;
 
+	/*
+	 * Registry reference to the module
+	 * table in each lua state.
+	 */
+	int ref[NRLUASTATES_MAX];
+	unsigned int hash;
+	struct plua_module_t *hnext;
+
 	struct plua_module_t *next;
 } plua_module_t;
 
@@ -93,6 +109,22 @@ typedef struct lua_state_t {
 	uv_thread_t thread_id;
 } lua_state_t;
 
+/*
+ * Wait buckets: <1ms, <10ms, <100ms, <1s, >=1s
+ */
+#define PLUA_WAIT_BUCKETS	5
+
+typedef struct plua_pool_stats_t {
+	int states;
+	int max;
+	unsigned long acquires;
+	unsigned long affine;
+	unsigned long waits;
+	unsigned long grows;
+	unsigned long wait[PLUA_WAIT_BUCKETS];
+	uint64_t wait_max;
+} plua_pool_stats_t;
+
 #define PLUA_INTERFACE_FIELDS			\
   /* public */										\
 	lua_State *L;										\
@@ -122,6 +154,8 @@ void plua_metatable_clone(struct plua_metatable_t **, struct plua_metatable_t **
 struct lua_state_t *plua_get_free_state(void);
 void _plua_clear_state(struct lua_state_t *state, char *file, int line);
 struct lua_state_t *plua_get_current_state(lua_State *L);
+void plua_set_max_states(int max);
+void plua_pool_stats(struct plua_pool_stats_t *stats);
 struct plua_module_t *plua_get_modules(void);
 void plua_init(void);
 int plua_check_stack(lua_State *L, int numargs, ...);
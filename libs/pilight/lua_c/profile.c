@@ -0,0 +1,225 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../libuv/uv.h"
+#include "../core/log.h"
+#include "../core/mem.h"
+#include "../core/json.h"
+#include "profile.h"
+
+#define PROFILE_BUCKETS	64
+
+static struct plua_profile_t *profile[PROFILE_BUCKETS];
+static uv_mutex_t lock;
+static int init = 0;
+static int enabled = 0;
+static int nrprofile = 0;
+
+static unsigned int plua_profile_hash(const char *source, int line) {
+	unsigned int hash = 5381 + line;
+	while(*source) {
+		hash = ((hash << 5) + hash) + (unsigned char)*source++;
+	}
+	return hash;
+}
+
+void plua_profile_init(void) {
+	if(init == 1) {
+		return;
+	}
+	init = 1;
+
+	memset(profile, 0, sizeof(profile));
+	uv_mutex_init(&lock);
+}
+
+/*
+ * Profiling is off by default, so calls
+ * don't take the profile lock.
+ */
+void plua_profile_enable(int enable) {
+	enabled = enable;
+}
+
+int plua_profile_enabled(void) {
+	return enabled;
+}
+
+/* Called with the lock held */
+static struct plua_profile_t *plua_profile_find(const char *source, int line, unsigned int hash) {
+	struct plua_profile_t *node = profile[hash % PROFILE_BUCKETS];
+
+	while(node) {
+		if(node->hash == hash && node->line == line && strcmp(node->source, source) == 0) {
+			break;
+		}
+		node = node->next;
+	}
+	return node;
+}
+
+struct plua_profile_t *plua_profile_get(const char *source, int line) {
+	struct plua_profile_t *node = NULL;
+
+	uv_mutex_lock(&lock);
+	node = plua_profile_find(source, line, plua_profile_hash(source, line));
+	uv_mutex_unlock(&lock);
+
+	return node;
+}
+
+struct plua_profile_t *plua_profile_add(const char *source, int line, const char *module, const char *method) {
+	struct plua_profile_t *node = NULL;
+	unsigned int hash = plua_profile_hash(source, line);
+
+	/*
+	 * Another state could have added the same
+	 * function since it was looked up.
+	 */
+	uv_mutex_lock(&lock);
+	if((node = plua_profile_find(source, line, hash)) != NULL) {
+		uv_mutex_unlock(&lock);
+		return node;
+	}
+
+	if((node = MALLOC(sizeof(struct plua_profile_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(node, 0, sizeof(struct plua_profile_t));
+	if((node->source = STRDUP((char *)source)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((node->module = STRDUP((char *)module)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((node->method = STRDUP((char *)method)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	node->line = line;
+	node->hash = hash;
+
+	node->next = profile[node->hash % PROFILE_BUCKETS];
+	profile[node->hash % PROFILE_BUCKETS] = node;
+	nrprofile++;
+	uv_mutex_unlock(&lock);
+
+	return node;
+}
+
+void plua_profile_update(struct plua_profile_t *node, uint64_t usec, long memory, int error) {
+	uv_mutex_lock(&lock);
+	node->calls++;
+	node->total += usec;
+	if(usec > node->max) {
+		node->max = usec;
+	}
+	/*
+	 * The lua heap can shrink during a call when
+	 * the garbage collector runs, only count growth.
+	 */
+	if(memory > 0) {
+		node->memory += memory;
+	}
+	if(error == 1) {
+		node->errors++;
+	}
+	uv_mutex_unlock(&lock);
+}
+
+static int plua_profile_sort(const void *a, const void *b) {
+	const struct plua_profile_t *x = *(const struct plua_profile_t **)a;
+	const struct plua_profile_t *y = *(const struct plua_profile_t **)b;
+
+	if(x->total < y->total) {
+		return 1;
+	} else if(x->total > y->total) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Returns all counters as an array ordered
+ * by the total time spent in each function.
+ */
+struct JsonNode *plua_profile_print(void) {
+	struct JsonNode *jroot = json_mkarray();
+	struct plua_profile_t **list = NULL, *node = NULL;
+	int i = 0, nr = 0;
+
+	if(init == 0) {
+		return jroot;
+	}
+
+	uv_mutex_lock(&lock);
+	if(nrprofile > 0) {
+		if((list = MALLOC(sizeof(struct plua_profile_t *)*nrprofile)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		for(i=0;i<PROFILE_BUCKETS;i++) {
+			node = profile[i];
+			while(node && nr < nrprofile) {
+				list[nr++] = node;
+				node = node->next;
+			}
+		}
+		qsort(list, nr, sizeof(struct plua_profile_t *), plua_profile_sort);
+	}
+
+	for(i=0;i<nr;i++) {
+		struct JsonNode *jnode = json_mkobject();
+		json_append_member(jnode, "module", json_mkstring(list[i]->module));
+		json_append_member(jnode, "method", json_mkstring(list[i]->method));
+		json_append_member(jnode, "line", json_mknumber(list[i]->line, 0));
+		json_append_member(jnode, "calls", json_mknumber(list[i]->calls, 0));
+		json_append_member(jnode, "errors", json_mknumber(list[i]->errors, 0));
+		json_append_member(jnode, "total", json_mknumber((double)list[i]->total, 0));
+		json_append_member(jnode, "max", json_mknumber((double)list[i]->max, 0));
+		json_append_member(jnode, "avg", json_mknumber((list[i]->calls > 0) ? (double)(list[i]->total/list[i]->calls) : 0, 0));
+		json_append_member(jnode, "memory", json_mknumber((double)list[i]->memory, 0));
+		json_append_element(jroot, jnode);
+	}
+	uv_mutex_unlock(&lock);
+
+	if(list != NULL) {
+		FREE(list);
+	}
+
+	return jroot;
+}
+
+int plua_profile_gc(void) {
+	struct plua_profile_t *node = NULL;
+	int i = 0;
+
+	if(init == 0) {
+		return 0;
+	}
+
+	uv_mutex_lock(&lock);
+	for(i=0;i<PROFILE_BUCKETS;i++) {
+		while(profile[i]) {
+			node = profile[i];
+			profile[i] = profile[i]->next;
+			FREE(node->source);
+			FREE(node->module);
+			FREE(node->method);
+			FREE(node);
+		}
+	}
+	nrprofile = 0;
+	uv_mutex_unlock(&lock);
+	init = 0;
+
+	logprintf(LOG_DEBUG, "garbage collected lua profile library");
+	return 0;
+}
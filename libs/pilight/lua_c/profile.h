@@ -0,0 +1,45 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _LUA_PROFILE_H_
+#define _LUA_PROFILE_H_
+
+#include <stdint.h>
+
+#include "../core/json.h"
+
+/*
+ * Counters of a single lua function, identified
+ * by the file and line it was defined at.
+ */
+typedef struct plua_profile_t {
+	char *source;
+	int line;
+	char *module;
+	char *method;
+
+	unsigned long calls;
+	unsigned long errors;
+	uint64_t total;
+	uint64_t max;
+	uint64_t memory;
+
+	unsigned int hash;
+	struct plua_profile_t *next;
+} plua_profile_t;
+
+void plua_profile_init(void);
+void plua_profile_enable(int enable);
+int plua_profile_enabled(void);
+struct plua_profile_t *plua_profile_get(const char *source, int line);
+struct plua_profile_t *plua_profile_add(const char *source, int line, const char *module, const char *method);
+void plua_profile_update(struct plua_profile_t *node, uint64_t usec, long memory, int error);
+struct JsonNode *plua_profile_print(void);
+int plua_profile_gc(void);
+
+#endif
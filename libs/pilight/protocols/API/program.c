@@ -34,6 +34,7 @@
 	#include <sys/wait.h>
 #endif
 #include <pthread.h>
+#include <assert.h>
 
 #include "../../core/threads.h"
 #include "../../core/pilight.h"
@@ -47,11 +48,21 @@
 #include "program.h"
 
 #ifndef _WIN32
-static unsigned short loop = 1;
-static unsigned short threads = 0;
-
-static pthread_mutex_t lock;
-static pthread_mutexattr_t attr;
+/*
+ * Start and stop commands are spawned from the event loop.
+ * No more than PROGRAM_MAX_ACTIVE commands run at the same
+ * time, the rest is queued. The state of each program is
+ * checked by its last known pid, and only searched for in
+ * the process list when that pid is gone.
+ */
+#define PROGRAM_MAX_ACTIVE	8
+#define PROGRAM_OUTPUT			1024
+/*
+ * Commands that leave a child behind keep their
+ * output open, so it's read this many milliseconds
+ * longer once the command itself exited.
+ */
+#define PROGRAM_DRAIN				1000
 
 typedef struct settings_t {
 	char *name;
@@ -62,187 +73,416 @@ typedef struct settings_t {
 	int wait;
 	int currentstate;
 	int laststate;
-	pthread_t pth;
-	int hasthread;
-	protocol_threads_t *thread;
+	int pid;
+	int timeout;
+	uv_timer_t *timer_req;
 	struct settings_t *next;
 } settings_t;
 
+typedef struct command_t {
+	struct settings_t *settings;
+	uv_process_t *process_req;
+	uv_pipe_t *pipe_req[2];
+	uv_timer_t *timeout_req;
+	char output[PROGRAM_OUTPUT];
+	int length;
+	int64_t status;
+	int signal;
+	/* The process and both pipes that aren't done yet */
+	int pending;
+	struct command_t *next;
+} command_t;
+
+static pthread_mutex_t lock;
+static pthread_mutexattr_t attr;
+
 static struct settings_t *settings = NULL;
+static struct command_t *queue = NULL;
+static struct command_t *running = NULL;
+static uv_async_t *async_req = NULL;
+static int active = 0;
 
-static void *thread(void *param) {
-	struct protocol_threads_t *pnode = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)pnode->param;
-	struct JsonNode *jid = NULL;
-	struct JsonNode *jchild = NULL;
-	struct JsonNode *jchild1 = NULL;
-	char *prog = NULL, *args = NULL, *stopcmd = NULL, *startcmd = NULL;
+static void close_cb(uv_handle_t *handle) {
+	FREE(handle);
+}
 
-	int interval = 1, nrloops = 0;
-	double itmp = 0;
+static int program_state(struct settings_t *p) {
+	int *ret = NULL, n = 0;
 
-	threads++;
+	if(p->pid > 0 && kill(p->pid, 0) == 0) {
+		return 1;
+	}
+	p->pid = 0;
 
-	json_find_string(json, "program", &prog);
-	json_find_string(json, "arguments", &args);
-	json_find_string(json, "stop-command", &stopcmd);
-	json_find_string(json, "start-command", &startcmd);
+	if((n = (int)findproc(p->program, p->arguments, 0, &ret)) > 0) {
+		p->pid = ret[0];
+		FREE(ret);
+		return 1;
+	}
+	return 0;
+}
 
-	struct settings_t *lnode = MALLOC(sizeof(struct settings_t));
-	lnode->wait = 0;
-	lnode->hasthread = 0;
-	memset(&lnode->pth, '\0', sizeof(pthread_t));
-
-	if(args != NULL && strlen(args) > 0) {
-		if((lnode->arguments = MALLOC(strlen(args)+1)) == NULL) {
-			fprintf(stderr, "out of memory\n");
-			exit(EXIT_FAILURE);
+static void program_poll(uv_timer_t *req) {
+	struct settings_t *p = req->data;
+
+	pthread_mutex_lock(&lock);
+	if(p->wait == 0) {
+		struct JsonNode *message = json_mkobject();
+
+		JsonNode *code = json_mkobject();
+		json_append_member(code, "name", json_mkstring(p->name));
+
+		if((p->currentstate = program_state(p)) == 1) {
+			json_append_member(code, "state", json_mkstring("running"));
+			json_append_member(code, "pid", json_mknumber(p->pid, 0));
+		} else {
+			json_append_member(code, "state", json_mkstring("stopped"));
+			json_append_member(code, "pid", json_mknumber(0, 0));
 		}
-		strcpy(lnode->arguments, args);
-	} else {
-		lnode->arguments = NULL;
+		json_append_member(message, "message", code);
+		json_append_member(message, "origin", json_mkstring("receiver"));
+		json_append_member(message, "protocol", json_mkstring(program->id));
+
+		if(p->currentstate != p->laststate) {
+			p->laststate = p->currentstate;
+			if(pilight.broadcast != NULL) {
+				pilight.broadcast(program->id, message, PROTOCOL);
+			}
+		}
+		json_delete(message);
+		message = NULL;
 	}
+	pthread_mutex_unlock(&lock);
+}
 
-	if(prog != NULL) {
-		if((lnode->program = MALLOC(strlen(prog)+1)) == NULL) {
-			fprintf(stderr, "out of memory\n");
-			exit(EXIT_FAILURE);
-		}
-		strcpy(lnode->program, prog);
+static void alloc_cb(uv_handle_t *handle, size_t len, uv_buf_t *buf) {
+	static char discard[PROGRAM_OUTPUT];
+	struct command_t *cmd = handle->data;
+
+	/*
+	 * Keep draining the pipe once the output
+	 * buffer is full, so the command won't block.
+	 */
+	if(cmd->length >= PROGRAM_OUTPUT-1) {
+		buf->base = discard;
+		buf->len = PROGRAM_OUTPUT;
 	} else {
-		lnode->program = NULL;
+		buf->base = &cmd->output[cmd->length];
+		buf->len = PROGRAM_OUTPUT-cmd->length-1;
 	}
+}
 
-	if(stopcmd != NULL) {
-		if((lnode->stop = MALLOC(strlen(stopcmd)+1)) == NULL) {
-			fprintf(stderr, "out of memory\n");
-			exit(EXIT_FAILURE);
-		}
-		strcpy(lnode->stop, stopcmd);
-	} else {
-		lnode->stop = NULL;
+static void program_spawn(uv_async_t *handle);
+
+/*
+ * A command is finished once it exited
+ * and both its pipes reached EOF.
+ */
+static void program_done(struct command_t *cmd) {
+	struct settings_t *p = cmd->settings;
+	struct command_t *tmp = NULL;
+
+	if(--cmd->pending > 0) {
+		return;
 	}
 
-	if(startcmd != NULL) {
-		if((lnode->start = MALLOC(strlen(startcmd)+1)) == NULL) {
-			fprintf(stderr, "out of memory\n");
-			exit(EXIT_FAILURE);
+	if(p != NULL) {
+		if(cmd->status != 0 || cmd->signal != 0) {
+			logprintf(LOG_NOTICE, "program \"%s\" state change failed with status %d, signal %d: %s", p->name, (int)cmd->status, cmd->signal, cmd->output);
+		} else if(cmd->length > 0) {
+			logprintf(LOG_DEBUG, "program \"%s\": %s", p->name, cmd->output);
 		}
-		strcpy(lnode->start, startcmd);
+	}
+
+	uv_timer_stop(cmd->timeout_req);
+	uv_close((uv_handle_t *)cmd->timeout_req, close_cb);
+
+	pthread_mutex_lock(&lock);
+	if(running == cmd) {
+		running = cmd->next;
 	} else {
-		lnode->start = NULL;
+		tmp = running;
+		while(tmp != NULL && tmp->next != cmd) {
+			tmp = tmp->next;
+		}
+		if(tmp != NULL) {
+			tmp->next = cmd->next;
+		}
 	}
+	active--;
 
-	lnode->name = NULL;
-	if((jid = json_find_member(json, "id"))) {
-		jchild = json_first_child(jid);
-		while(jchild) {
-			jchild1 = json_first_child(jchild);
-			while(jchild1) {
-				if(strcmp(jchild1->key, "name") == 0) {
-					if((lnode->name = MALLOC(strlen(jchild1->string_)+1)) == NULL) {
-						fprintf(stderr, "out of memory\n");
-						exit(EXIT_FAILURE);
-					}
-					strcpy(lnode->name, jchild1->string_);
-				}
-				jchild1 = jchild1->next;
+	if(p != NULL) {
+		p->wait = 0;
+		p->laststate = -1;
+	}
+	pthread_mutex_unlock(&lock);
+
+	/*
+	 * Report the new state right away
+	 * instead of waiting for the next poll.
+	 */
+	if(p != NULL) {
+		program_poll(p->timer_req);
+	}
+	FREE(cmd);
+
+	program_spawn(async_req);
+}
+
+static void program_close_pipe(struct command_t *cmd, int i) {
+	uv_read_stop((uv_stream_t *)cmd->pipe_req[i]);
+	uv_close((uv_handle_t *)cmd->pipe_req[i], close_cb);
+	cmd->pipe_req[i] = NULL;
+	program_done(cmd);
+}
+
+static void read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+	struct command_t *cmd = stream->data;
+	int i = 0;
+
+	if(nread > 0 && buf->base == &cmd->output[cmd->length]) {
+		cmd->length += nread;
+		cmd->output[cmd->length] = '\0';
+	} else if(nread < 0) {
+		for(i=0;i<2;i++) {
+			if(cmd->pipe_req[i] == (uv_pipe_t *)stream) {
+				program_close_pipe(cmd, i);
+				break;
 			}
-			jchild = jchild->next;
 		}
 	}
+}
 
-	lnode->thread = pnode;
-	lnode->laststate = -1;
+static void program_timeout(uv_timer_t *req) {
+	struct command_t *cmd = req->data;
 
-	lnode->next = settings;
-	settings = lnode;
+	if(cmd->settings != NULL) {
+		logprintf(LOG_NOTICE, "program \"%s\" did not finish its state change within %d seconds", cmd->settings->name, cmd->settings->timeout);
+	}
+	uv_process_kill(cmd->process_req, SIGTERM);
+}
 
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
-		interval = (int)round(itmp);
+static void program_drain(uv_timer_t *req) {
+	struct command_t *cmd = req->data;
+	int i = 0;
 
-	while(loop) {
-		if(protocol_thread_wait(pnode, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			if(lnode->wait == 0) {
-				struct JsonNode *message = json_mkobject();
-
-				JsonNode *code = json_mkobject();
-				json_append_member(code, "name", json_mkstring(lnode->name));
-
-				int *ret = NULL, n = 0;
-				if((n = (int)findproc(lnode->program, lnode->arguments, 0, &ret)) > 0) {
-					lnode->currentstate = 1;
-					json_append_member(code, "state", json_mkstring("running"));
-					json_append_member(code, "pid", json_mknumber(ret[0], 0));
-					FREE(ret);
-				} else {
-					lnode->currentstate = 0;
-					json_append_member(code, "state", json_mkstring("stopped"));
-					json_append_member(code, "pid", json_mknumber(0, 0));
-				}
-				json_append_member(message, "message", code);
-				json_append_member(message, "origin", json_mkstring("receiver"));
-				json_append_member(message, "protocol", json_mkstring(program->id));
-
-				if(lnode->currentstate != lnode->laststate) {
-					lnode->laststate = lnode->currentstate;
-					if(pilight.broadcast != NULL) {
-						pilight.broadcast(program->id, message, PROTOCOL);
-					}
-				}
-				json_delete(message);
-				message = NULL;
+	for(i=0;i<2;i++) {
+		if(cmd->pipe_req[i] != NULL) {
+			program_close_pipe(cmd, i);
+		}
+	}
+}
+
+static void program_exit(uv_process_t *req, int64_t status, int signal) {
+	struct command_t *cmd = req->data;
+
+	cmd->status = status;
+	cmd->signal = signal;
+	uv_close((uv_handle_t *)req, close_cb);
+	cmd->process_req = NULL;
+
+	uv_timer_stop(cmd->timeout_req);
+	if(cmd->pipe_req[0] != NULL || cmd->pipe_req[1] != NULL) {
+		uv_timer_start(cmd->timeout_req, program_drain, PROGRAM_DRAIN, 0);
+	}
+	program_done(cmd);
+}
+
+static void program_spawn(uv_async_t *handle) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	uv_process_options_t options;
+	uv_stdio_container_t stdio[3];
+	struct command_t *cmd = NULL;
+	struct settings_t *p = NULL;
+	char *args[4], *command = NULL;
+	int r = 0, i = 0;
+
+	pthread_mutex_lock(&lock);
+	while(queue != NULL && active < PROGRAM_MAX_ACTIVE) {
+		cmd = queue;
+		queue = queue->next;
+		p = cmd->settings;
+
+		command = (program_state(p) == 1) ? p->stop : p->start;
+
+		for(i=0;i<2;i++) {
+			if((cmd->pipe_req[i] = MALLOC(sizeof(uv_pipe_t))) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 			}
-			pthread_mutex_unlock(&lock);
+			uv_pipe_init(uv_default_loop(), cmd->pipe_req[i], 0);
+			cmd->pipe_req[i]->data = cmd;
+		}
+		if((cmd->process_req = MALLOC(sizeof(uv_process_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		if((cmd->timeout_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		cmd->process_req->data = cmd;
+		cmd->timeout_req->data = cmd;
+		uv_timer_init(uv_default_loop(), cmd->timeout_req);
+
+		args[0] = "sh";
+		args[1] = "-c";
+		args[2] = command;
+		args[3] = NULL;
+
+		memset(&options, 0, sizeof(uv_process_options_t));
+		stdio[0].flags = UV_IGNORE;
+		stdio[1].flags = UV_CREATE_PIPE | UV_WRITABLE_PIPE;
+		stdio[1].data.stream = (uv_stream_t *)cmd->pipe_req[0];
+		stdio[2].flags = UV_CREATE_PIPE | UV_WRITABLE_PIPE;
+		stdio[2].data.stream = (uv_stream_t *)cmd->pipe_req[1];
+
+		options.file = "/bin/sh";
+		options.args = args;
+		options.stdio = stdio;
+		options.stdio_count = 3;
+		options.exit_cb = program_exit;
+
+		if((r = uv_spawn(uv_default_loop(), cmd->process_req, &options)) != 0) {
+			logprintf(LOG_ERR, "program \"%s\" could not be spawned: %s", p->name, uv_strerror(r));
+			uv_close((uv_handle_t *)cmd->process_req, close_cb);
+			uv_close((uv_handle_t *)cmd->timeout_req, close_cb);
+			for(i=0;i<2;i++) {
+				uv_close((uv_handle_t *)cmd->pipe_req[i], close_cb);
+			}
+			p->wait = 0;
+			p->laststate = -1;
+			FREE(cmd);
+			continue;
 		}
+
+		cmd->pending = 3;
+		for(i=0;i<2;i++) {
+			uv_read_start((uv_stream_t *)cmd->pipe_req[i], alloc_cb, read_cb);
+		}
+		if(p->timeout > 0) {
+			uv_timer_start(cmd->timeout_req, program_timeout, p->timeout*1000, 0);
+		}
+
+		cmd->next = running;
+		running = cmd;
+		active++;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+static void program_queue(struct settings_t *p) {
+	struct command_t *cmd = NULL, *tmp = NULL;
+
+	if((cmd = MALLOC(sizeof(struct command_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(cmd, 0, sizeof(struct command_t));
+	cmd->settings = p;
+
+	pthread_mutex_lock(&lock);
+	if(queue == NULL) {
+		queue = cmd;
+	} else {
+		tmp = queue;
+		while(tmp->next != NULL) {
+			tmp = tmp->next;
+		}
+		tmp->next = cmd;
 	}
 	pthread_mutex_unlock(&lock);
 
-	threads--;
-	return (void *)NULL;
+	uv_async_send(async_req);
 }
 
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
+static char *program_strdup(char *str) {
+	char *out = NULL;
 
-	struct protocol_threads_t *node = protocol_thread_init(program, json);
-	return threads_register("program", &thread, (void *)node, 0);
+	if(str == NULL || strlen(str) == 0) {
+		return NULL;
+	}
+	if((out = MALLOC(strlen(str)+1)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	strcpy(out, str);
+	return out;
 }
 
-static void *execute(void *param) {
-	struct settings_t *p = (struct settings_t *)param;
-	int result = 0;
-	int n = 0;
-	int *ret = NULL;
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
+	struct JsonNode *jid = NULL;
+	struct JsonNode *jchild = NULL;
+	struct JsonNode *jchild1 = NULL;
+	char *prog = NULL, *args = NULL, *stopcmd = NULL, *startcmd = NULL;
+	int interval = 1;
+	double itmp = 0;
 
-	if((n = (int)findproc(p->program, p->arguments, 0, &ret)) > 0) {
-		result = system(p->stop);
-		FREE(ret);
-	} else {
-		result = system(p->start);
+	json_find_string(jdevice, "program", &prog);
+	json_find_string(jdevice, "arguments", &args);
+	json_find_string(jdevice, "stop-command", &stopcmd);
+	json_find_string(jdevice, "start-command", &startcmd);
+
+	struct settings_t *lnode = MALLOC(sizeof(struct settings_t));
+	if(lnode == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(lnode, 0, sizeof(struct settings_t));
+
+	lnode->arguments = program_strdup(args);
+	lnode->program = program_strdup(prog);
+	lnode->stop = program_strdup(stopcmd);
+	lnode->start = program_strdup(startcmd);
+
+	if((jid = json_find_member(jdevice, "id"))) {
+		jchild = json_first_child(jid);
+		while(jchild) {
+			jchild1 = json_first_child(jchild);
+			while(jchild1) {
+				if(strcmp(jchild1->key, "name") == 0 && jchild1->tag == JSON_STRING) {
+					if(lnode->name != NULL) {
+						FREE(lnode->name);
+					}
+					lnode->name = program_strdup(jchild1->string_);
+				}
+				jchild1 = jchild1->next;
+			}
+			jchild = jchild->next;
+		}
 	}
 
-	/* Check of the user wanted to stop pilight */
-	if(WIFSIGNALED(result)) {
-		int n = 0, *ret = NULL;
-		/* Find the pilight daemon pid */
-		if((n = (int)findproc(progname, NULL, 0, &ret)) > 0) {
-			/* Send a sigint to ourself */
-			kill(ret[0], SIGINT);
+	if(json_find_number(jdevice, "poll-interval", &itmp) == 0)
+		interval = (int)round(itmp);
+	if(json_find_number(jdevice, "command-timeout", &itmp) == 0)
+		lnode->timeout = (int)round(itmp);
+
+	lnode->laststate = -1;
+
+	if(async_req == NULL) {
+		if((async_req = MALLOC(sizeof(uv_async_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 		}
+		uv_async_init(uv_default_loop(), async_req, program_spawn);
 	}
 
-	p->wait = 0;
-	memset(&p->pth, '\0', sizeof(pthread_t));
-	p->hasthread = 0;
-	p->laststate = -1;
+	if((lnode->timer_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	lnode->timer_req->data = lnode;
+	uv_timer_init(uv_default_loop(), lnode->timer_req);
+	if(interval <= 0) {
+		interval = 1;
+	}
+	/*
+	 * The program can also be started and stopped
+	 * outside pilight, which only a poll notices.
+	 */
+	uv_timer_start(lnode->timer_req, program_poll, interval*1000, interval*1000);
 
-	pthread_mutex_unlock(&p->thread->mutex);
-	pthread_cond_signal(&p->thread->cond);
+	pthread_mutex_lock(&lock);
+	lnode->next = settings;
+	settings = lnode;
+	pthread_mutex_unlock(&lock);
 
 	return NULL;
 }
@@ -252,22 +492,22 @@ static int createCode(JsonNode *code) {
 	double itmp = -1;
 	int state = -1;
 	int n = 0;
-	int *ret = NULL;
 
 	if(json_find_string(code, "name", &name) == 0) {
 		if(strstr(progname, "daemon") != NULL) {
+			pthread_mutex_lock(&lock);
 			struct settings_t *tmp = settings;
 			while(tmp) {
-				if(strcmp(tmp->name, name) == 0) {
+				if(tmp->name != NULL && strcmp(tmp->name, name) == 0) {
 					if(tmp->wait == 0) {
-						if(tmp->name != NULL && tmp->stop != NULL && tmp->start != NULL) {
+						if(tmp->stop != NULL && tmp->start != NULL) {
 
 							if(json_find_number(code, "running", &itmp) == 0)
 								state = 1;
 							else if(json_find_number(code, "stopped", &itmp) == 0)
 								state = 0;
 
-							if((n = (int)findproc(tmp->program, tmp->arguments, 0, &ret)) > 0 && state == 1) {
+							if((n = program_state(tmp)) > 0 && state == 1) {
 								logprintf(LOG_INFO, "program \"%s\" already running", tmp->name);
 							} else if(n == 0 && state == 0) {
 								logprintf(LOG_INFO, "program \"%s\" already stopped", tmp->name);
@@ -296,9 +536,7 @@ static int createCode(JsonNode *code) {
 								}
 
 								tmp->wait = 1;
-								threads_create(&tmp->pth, NULL, execute, (void *)tmp);
-								tmp->hasthread = 1;
-								pthread_detach(tmp->pth);
+								program_queue(tmp);
 
 								program->message = json_mkobject();
 								json_append_member(program->message, "name", json_mkstring(name));
@@ -314,6 +552,7 @@ static int createCode(JsonNode *code) {
 				}
 				tmp = tmp->next;
 			}
+			pthread_mutex_unlock(&lock);
 		} else {
 			program->message = json_mkobject();
 
@@ -333,28 +572,38 @@ static int createCode(JsonNode *code) {
 }
 
 static void threadGC(void) {
-	loop = 0;
-	protocol_thread_stop(program);
-	while(threads > 0) {
-		usleep(10);
+	struct settings_t *tmp = NULL;
+	struct command_t *cmd = NULL;
+
+	pthread_mutex_lock(&lock);
+	while(queue) {
+		cmd = queue;
+		queue = queue->next;
+		FREE(cmd);
+	}
+	/*
+	 * Commands that are still running are left
+	 * to finish, but no longer report back.
+	 */
+	cmd = running;
+	while(cmd) {
+		cmd->settings = NULL;
+		cmd = cmd->next;
 	}
-	protocol_thread_free(program);
 
-	struct settings_t *tmp;
 	while(settings) {
 		tmp = settings;
+		uv_timer_stop(tmp->timer_req);
+		uv_close((uv_handle_t *)tmp->timer_req, close_cb);
 		if(tmp->stop) FREE(tmp->stop);
 		if(tmp->start) FREE(tmp->start);
 		if(tmp->name) FREE(tmp->name);
 		if(tmp->arguments) FREE(tmp->arguments);
 		if(tmp->program) FREE(tmp->program);
-		if(tmp->hasthread > 0) pthread_cancel(tmp->pth);
 		settings = settings->next;
 		FREE(tmp);
 	}
-	if(settings != NULL) {
-		FREE(settings);
-	}
+	pthread_mutex_unlock(&lock);
 }
 
 static void printHelp(void) {
@@ -394,6 +643,7 @@ void programInit(void) {
 	options_add(&program->options, "0", "readonly", OPTION_HAS_VALUE, GUI_SETTING, JSON_NUMBER, (void *)0, "^[10]{1}$");
 	options_add(&program->options, "0", "confirm", OPTION_HAS_VALUE, GUI_SETTING, JSON_NUMBER, (void *)0, "^[10]{1}$");
 	options_add(&program->options, "0", "poll-interval", OPTION_HAS_VALUE, DEVICES_SETTING, JSON_NUMBER, (void *)1, "[0-9]");
+	options_add(&program->options, "0", "command-timeout", OPTION_HAS_VALUE, DEVICES_SETTING, JSON_NUMBER, (void *)0, "[0-9]");
 
 #ifndef _WIN32
 	program->createCode=&createCode;
@@ -406,7 +656,7 @@ void programInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "program";
-	module->version = "1.6";
+	module->version = "1.7";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
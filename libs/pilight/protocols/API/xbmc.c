@@ -258,8 +258,8 @@ static void *thread(void *param) {
 						pthread_mutex_unlock(&xbmclock);
 						break;
 					} else {
-						if(json_validate(recvBuff) == true) {
-							JsonNode *joutput = json_decode(recvBuff);
+						JsonNode *joutput = NULL;
+						if((joutput = json_decode(recvBuff)) != NULL) {
 							JsonNode *params = NULL;
 							JsonNode *data = NULL;
 							JsonNode *item = NULL;
@@ -33,6 +33,7 @@
 #endif
 
 #include <pthread.h>
+#include <assert.h>
 
 #include "../../core/threads.h"
 #include "../../core/pilight.h"
@@ -43,14 +44,12 @@
 #include "../../core/binary.h"
 #include "../../core/json.h"
 #include "../../core/gc.h"
+#include "../../core/w1.h"
+#include "../../config/settings.h"
 #include "ds18s20.h"
 
 static unsigned short loop = 1;
 static unsigned short threads = 0;
-static char source_path[21];
-
-static pthread_mutex_t lock;
-static pthread_mutexattr_t attr;
 
 static void *thread(void *param) {
 	struct protocol_threads_t *node = (struct protocol_threads_t *)param;
@@ -58,21 +57,9 @@ static void *thread(void *param) {
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
 
-#ifndef _WIN32
-	struct dirent *file = NULL;
-	struct stat st;
-
-	DIR *d = NULL;
-	FILE *fp = NULL;
-	char crcVar[5];
-	int w1valid = 0;
-	double w1temp = 0.0;
-	size_t bytes = 0;
-#endif
-	char **id = NULL, *stmp = NULL, *content = NULL;
-	char *ds18s20_sensor = NULL;
+	char **id = NULL, *stmp = NULL;
 	int nrid = 0, interval = 10, nrloops = 0, y = 0;
-	double temp_offset = 0.0, itmp = 0.0;
+	double temp_offset = 0.0, itmp = 0.0, w1temp = 0.0;
 
 	threads++;
 
@@ -89,6 +76,7 @@ static void *thread(void *param) {
 					exit(EXIT_FAILURE);
 				}
 				strcpy(id[nrid], stmp);
+				w1_register("10", id[nrid]);
 				nrid++;
 			}
 			jchild = jchild->next;
@@ -101,97 +89,31 @@ static void *thread(void *param) {
 
 	while(loop) {
 		if(protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-#ifndef _WIN32
-			pthread_mutex_lock(&lock);
 			for(y=0;y<nrid;y++) {
-				if((ds18s20_sensor = REALLOC(ds18s20_sensor, strlen(source_path)+strlen(id[y])+5)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				sprintf(ds18s20_sensor, "%s10-%s/", source_path, id[y]);
-				if((d = opendir(ds18s20_sensor))) {
-					while((file = readdir(d)) != NULL) {
-						if(file->d_type == DT_REG) {
-							if(strcmp(file->d_name, "w1_slave") == 0) {
-								size_t w1slavelen = strlen(ds18s20_sensor)+10;
-								char ds18s20_w1slave[w1slavelen];
-								memset(ds18s20_w1slave, '\0', w1slavelen);
-								strncpy(ds18s20_w1slave, ds18s20_sensor, strlen(ds18s20_sensor));
-								strcat(ds18s20_w1slave, "w1_slave");
-
-								if(!(fp = fopen(ds18s20_w1slave, "rb"))) {
-									logprintf(LOG_ERR, "cannot read w1 file: %s", ds18s20_w1slave);
-									break;
-								}
-
-								fstat(fileno(fp), &st);
-								bytes = (size_t)st.st_size;
-
-								if(!(content = REALLOC(content, bytes+1))) {
-									fprintf(stderr, "out of memory\n");
-									fclose(fp);
-									break;
-								}
-								memset(content, '\0', bytes+1);
-
-								if(fread(content, sizeof(char), bytes, fp) == -1) {
-									logprintf(LOG_ERR, "cannot read config file: %s", ds18s20_w1slave);
-									fclose(fp);
-									break;
-								}
-								fclose(fp);
-								w1valid = 0;
-
-								char **array = NULL;
-								unsigned int n = explode(content, "\n", &array);
-								if(n > 0) {
-									sscanf(array[0], "%*x %*x %*x %*x %*x %*x %*x %*x %*x : crc=%*x %s", crcVar);
-									if(strncmp(crcVar, "YES", 3) == 0 && n > 1) {
-										w1valid = 1;
-										sscanf(array[1], "%*x %*x %*x %*x %*x %*x %*x %*x %*x t=%lf", &w1temp);
-										w1temp = (w1temp/1000)+temp_offset;
-									}
-								}
-								array_free(&array, n);
-
-								if(w1valid) {
-									ds18s20->message = json_mkobject();
-
-									JsonNode *code = json_mkobject();
-
-									json_append_member(code, "id", json_mkstring(id[y]));
-									json_append_member(code, "temperature", json_mknumber(w1temp, 1));
-
-									json_append_member(ds18s20->message, "message", code);
-									json_append_member(ds18s20->message, "origin", json_mkstring("receiver"));
-									json_append_member(ds18s20->message, "protocol", json_mkstring(ds18s20->id));
-
-									if(pilight.broadcast != NULL) {
-										pilight.broadcast(ds18s20->id, ds18s20->message, PROTOCOL);
-									}
-									json_delete(ds18s20->message);
-									ds18s20->message = NULL;
-								}
-							}
-						}
+				if(w1_temperature("10", id[y], interval, &w1temp) == 0) {
+					w1temp += temp_offset;
+
+					ds18s20->message = json_mkobject();
+
+					JsonNode *code = json_mkobject();
+
+					json_append_member(code, "id", json_mkstring(id[y]));
+					json_append_member(code, "temperature", json_mknumber(w1temp, 1));
+
+					json_append_member(ds18s20->message, "message", code);
+					json_append_member(ds18s20->message, "origin", json_mkstring("receiver"));
+					json_append_member(ds18s20->message, "protocol", json_mkstring(ds18s20->id));
+
+					if(pilight.broadcast != NULL) {
+						pilight.broadcast(ds18s20->id, ds18s20->message, PROTOCOL);
 					}
-					closedir(d);
-				} else {
-					logprintf(LOG_ERR, "1-wire device %s does not exist", ds18s20_sensor);
+					json_delete(ds18s20->message);
+					ds18s20->message = NULL;
 				}
 			}
-#endif
-			pthread_mutex_unlock(&lock);
 		}
 	}
-	pthread_mutex_unlock(&lock);
 
-	if(ds18s20_sensor) {
-		FREE(ds18s20_sensor);
-	}
-	if(content) {
-		FREE(content);
-	}
 	for(y=0;y<nrid;y++) {
 		FREE(id[y]);
 	}
@@ -201,7 +123,18 @@ static void *thread(void *param) {
 }
 
 static struct threadqueue_t *initDev(JsonNode *jdevice) {
+	char *root = NULL;
+
 	loop = 1;
+
+	struct lua_state_t *state = plua_get_free_state();
+	if(config_setting_get_string(state->L, "w1-root", 0, &root) == 0) {
+		w1_set_root(root);
+		FREE(root);
+	}
+	assert(lua_gettop(state->L) == 0);
+	plua_clear_state(state);
+
 	char *output = json_stringify(jdevice, NULL);
 	JsonNode *json = json_decode(output);
 	json_free(output);
@@ -223,10 +156,6 @@ static void theadGC(void) {
 __attribute__((weak))
 #endif
 void ds18s20Init(void) {
-	pthread_mutexattr_init(&attr);
-	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-	pthread_mutex_init(&lock, &attr);
-
 	protocol_register(&ds18s20);
 	protocol_set_id(ds18s20, "ds18s20");
 	protocol_device_add(ds18s20, "ds18s20", "1-wire Temperature Sensor");
@@ -242,9 +171,6 @@ void ds18s20Init(void) {
 	options_add(&ds18s20->options, "0", "show-temperature", OPTION_HAS_VALUE, GUI_SETTING, JSON_NUMBER, (void *)1, "^[10]{1}$");
 	options_add(&ds18s20->options, "0", "poll-interval", OPTION_HAS_VALUE, DEVICES_SETTING, JSON_NUMBER, (void *)10, "[0-9]");
 
-	memset(source_path, '\0', 21);
-	strcpy(source_path, "/sys/bus/w1/devices/");
-
 	ds18s20->initDev=&initDev;
 	ds18s20->threadGC=&theadGC;
 }
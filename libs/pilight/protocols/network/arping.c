@@ -58,9 +58,6 @@
 static unsigned short loop = 1;
 static unsigned short threads = 0;
 
-static pthread_mutex_t lock;
-static pthread_mutexattr_t attr;
-
 #define CONNECTED				1
 #define DISCONNECTED 		0
 #define INTERVAL				5
@@ -70,11 +67,10 @@ static void *thread(void *param) {
 	struct JsonNode *json = (struct JsonNode *)node->param;
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
-	char *dstmac = NULL, srcmac[ETH_ALEN], *a = srcmac;
-	char *tmpip[INET_ADDRSTRLEN+1], dstip[INET_ADDRSTRLEN+1];
-	char ip[INET_ADDRSTRLEN+1], *p = ip, **devs = NULL;
+	char *dstmac = NULL, dstip[INET_ADDRSTRLEN+1];
+	char ip[INET_ADDRSTRLEN+1], **devs = NULL;
 	double itmp = 0.0;
-	int state = 0, nrloops = 0, interval = INTERVAL, i = 0, srcip[4], nrdevs = 0;
+	int state = 0, nrloops = 0, interval = INTERVAL, i = 0, nrdevs = 0;
 
 	threads++;
 
@@ -92,7 +88,6 @@ static void *thread(void *param) {
 		interval = (int)round(itmp);
 
 	memset(dstip, '\0', INET_ADDRSTRLEN+1);
-	memset(tmpip, '\0', INET_ADDRSTRLEN+1);
 
 	for(i=0;i<strlen(dstmac);i++) {
 		if(isNumeric(&dstmac[i]) != 0) {
@@ -103,53 +98,18 @@ static void *thread(void *param) {
 	if((nrdevs = inetdevs(&devs)) == 0) {
 		logprintf(LOG_ERR, "could not determine default network interface");
 		array_free(&devs, nrdevs);
-		return NULL;
-	}
-
-	memset(&ip, '\0', INET_ADDRSTRLEN+1);
-	if(dev2ip(devs[0], &p, AF_INET) != 0) {
-		logprintf(LOG_ERR, "could not determine host ip address");
-		array_free(&devs, nrdevs);
-		return NULL;
-	}
-
-	memset(&srcmac, '\0', ETH_ALEN);
-	if(dev2mac(devs[0], &a) != 0 || (srcmac[0] == 0 && srcmac[1] == 0 &&
-		srcmac[2] == 0 && srcmac[3] == 0 &&
-		srcmac[4] == 0 && srcmac[5] == 0)) {
-		logprintf(LOG_ERR, "could not obtain MAC address for interface %s", devs[0]);
-		array_free(&devs, nrdevs);
-		return NULL;
-	}
-
-	if(sscanf(ip, "%d.%d.%d.%d", &srcip[0], &srcip[1], &srcip[2], &srcip[3]) != 4) {
-		logprintf(LOG_ERR, "could not extract ip address");
-		array_free(&devs, nrdevs);
+		threads--;
 		return NULL;
 	}
 
 	while(loop) {
 		if(protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			if(strlen(dstip) == 0) {
-				for(i=0;i<255;i++) {
-					memset(ip, '\0', INET_ADDRSTRLEN+1);
-					snprintf(ip, sizeof(ip), "%d.%d.%d.%d", srcip[0], srcip[1], srcip[2], i);
-					arp_add_host(ip);
-				}
-			} else {
-				arp_add_host(dstip);
-			}
-
-			if(arp_resolv(devs[0], srcmac, dstmac, &p) == 0) {
-				if(strlen(dstip) == 0) {
-					strcpy(dstip, ip);
-				}
-				if(strcmp(dstip, ip) != 0) {
-					memset(dstip, '\0', INET_ADDRSTRLEN+1);
+			memset(ip, '\0', INET_ADDRSTRLEN+1);
+			if(arp_lookup(devs[0], dstmac, interval, ip) == 0) {
+				if(strlen(dstip) > 0 && strcmp(dstip, ip) != 0) {
 					logprintf(LOG_NOTICE, "ip address changed from %s to %s", dstip, ip);
-					strcpy(dstip, ip);
 				}
+				strcpy(dstip, ip);
 				if(state == DISCONNECTED) {
 					state = CONNECTED;
 					arping->message = json_mkobject();
@@ -187,10 +147,8 @@ static void *thread(void *param) {
 				json_delete(arping->message);
 				arping->message = NULL;
 			}
-			pthread_mutex_unlock(&lock);
 		}
 	}
-	pthread_mutex_unlock(&lock);
 
 	array_free(&devs, nrdevs);
 
@@ -216,6 +174,7 @@ static void threadGC(void) {
 		usleep(10);
 	}
 	protocol_thread_free(arping);
+	arp_gc();
 }
 
 static int checkValues(JsonNode *code) {
@@ -235,10 +194,6 @@ static int checkValues(JsonNode *code) {
 __attribute__((weak))
 #endif
 void arpingInit(void) {
-	pthread_mutexattr_init(&attr);
-	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-	pthread_mutex_init(&lock, &attr);
-
 	protocol_register(&arping);
 	protocol_set_id(arping, "arping");
 	protocol_device_add(arping, "arping", "Ping network devices");
@@ -262,7 +217,7 @@ void arpingInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "arping";
-	module->version = "2.2";
+	module->version = "2.3";
 	module->reqversion = "6.0";
 	module->reqcommit = "158";
 }
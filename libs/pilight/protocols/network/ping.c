@@ -44,28 +44,56 @@
 #include "../../core/gc.h"
 #include "ping.h"
 
-static unsigned short loop = 1;
-static unsigned short threads = 0;
-
-static pthread_mutex_t lock;
-static pthread_mutexattr_t attr;
-
 #define CONNECTED				1
 #define DISCONNECTED 		0
 
-static void *thread(void *param) {
-	struct protocol_threads_t *node = (struct protocol_threads_t *)param;
-	struct JsonNode *json = (struct JsonNode *)node->param;
+typedef struct data_t {
+	char *ip;
+	int state;
+	struct data_t *next;
+} data_t;
+
+static struct data_t *data = NULL;
+
+static void callback(char *ip, int status, struct ping_stats_t *stats, void *userdata) {
+	struct data_t *node = userdata;
+
+	if(status == 0 && node->state == DISCONNECTED) {
+		node->state = CONNECTED;
+	} else if(status != 0 && node->state == CONNECTED) {
+		node->state = DISCONNECTED;
+	} else {
+		return;
+	}
+
+	logprintf(LOG_DEBUG, "ping %s: %lu/%lu replies, rtt min/avg/max %.3f/%.3f/%.3f ms",
+		ip, stats->received, stats->sent, stats->rtt_min, stats->rtt_avg, stats->rtt_max);
+
+	pping->message = json_mkobject();
+	JsonNode *code = json_mkobject();
+	json_append_member(code, "ip", json_mkstring(ip));
+	json_append_member(code, "state", json_mkstring((node->state == CONNECTED) ? "connected" : "disconnected"));
+
+	json_append_member(pping->message, "message", code);
+	json_append_member(pping->message, "origin", json_mkstring("receiver"));
+	json_append_member(pping->message, "protocol", json_mkstring(pping->id));
+
+	if(pilight.broadcast != NULL) {
+		pilight.broadcast(pping->id, pping->message, PROTOCOL);
+	}
+	json_delete(pping->message);
+	pping->message = NULL;
+}
+
+static struct threadqueue_t *initDev(JsonNode *jdevice) {
 	struct JsonNode *jid = NULL;
 	struct JsonNode *jchild = NULL;
-	char *ip = NULL;
-	char *pstate = NULL;
+	struct data_t *node = NULL;
+	char *ip = NULL, *pstate = NULL;
 	double itmp = 0.0;
-	int state = 0, nrloops = 0, interval = 1;
+	int interval = 1;
 
-	threads++;
-
-	if((jid = json_find_member(json, "id"))) {
+	if((jid = json_find_member(jdevice, "id"))) {
 		jchild = json_first_child(jid);
 		while(jchild) {
 			if(json_find_string(jchild, "ip", &ip) == 0) {
@@ -75,89 +103,55 @@ static void *thread(void *param) {
 		}
 	}
 
-	if(json_find_number(json, "poll-interval", &itmp) == 0)
+	if(ip == NULL) {
+		return NULL;
+	}
+
+	if(json_find_number(jdevice, "poll-interval", &itmp) == 0)
 		interval = (int)round(itmp);
 
-   if(json_find_string(json, "state", &pstate) == 0) {
-      if(strcmp(pstate,"connected") == 0) state = CONNECTED;
-      if(strcmp(pstate,"disconnected") == 0) state = DISCONNECTED;
-      }
-
-	while(loop) {
-		if(protocol_thread_wait(node, interval, &nrloops) == ETIMEDOUT) {
-			pthread_mutex_lock(&lock);
-			if(ping(ip) == 0) {
-				if(state == DISCONNECTED) {
-					state = CONNECTED;
-					pping->message = json_mkobject();
-					JsonNode *code = json_mkobject();
-					json_append_member(code, "ip", json_mkstring(ip));
-					json_append_member(code, "state", json_mkstring("connected"));
-
-					json_append_member(pping->message, "message", code);
-					json_append_member(pping->message, "origin", json_mkstring("receiver"));
-					json_append_member(pping->message, "protocol", json_mkstring(pping->id));
-
-					if(pilight.broadcast != NULL) {
-						pilight.broadcast(pping->id, pping->message, PROTOCOL);
-					}
-					json_delete(pping->message);
-					pping->message = NULL;
-				}
-			} else if(state == CONNECTED) {
-				state = DISCONNECTED;
-
-				pping->message = json_mkobject();
-				JsonNode *code = json_mkobject();
-				json_append_member(code, "ip", json_mkstring(ip));
-				json_append_member(code, "state", json_mkstring("disconnected"));
-
-				json_append_member(pping->message, "message", code);
-				json_append_member(pping->message, "origin", json_mkstring("receiver"));
-				json_append_member(pping->message, "protocol", json_mkstring(pping->id));
-
-				if(pilight.broadcast != NULL) {
-					pilight.broadcast(pping->id, pping->message, PROTOCOL);
-				}
-				json_delete(pping->message);
-				pping->message = NULL;
-			}
-			pthread_mutex_unlock(&lock);
+	if((node = MALLOC(sizeof(struct data_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(node, '\0', sizeof(struct data_t));
+	node->state = DISCONNECTED;
+
+	if(json_find_string(jdevice, "state", &pstate) == 0) {
+		if(strcmp(pstate, "connected") == 0) {
+			node->state = CONNECTED;
 		}
 	}
-	pthread_mutex_unlock(&lock);
 
-	threads--;
-	return (void *)NULL;
-}
+	if((node->ip = MALLOC(strlen(ip)+1)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	strcpy(node->ip, ip);
 
-static struct threadqueue_t *initDev(JsonNode *jdevice) {
-	loop = 1;
-	char *output = json_stringify(jdevice, NULL);
-	JsonNode *json = json_decode(output);
-	json_free(output);
+	node->next = data;
+	data = node;
+
+	ping_add(node->ip, interval, callback, node);
 
-	struct protocol_threads_t *node = protocol_thread_init(pping, json);
-	return threads_register("ping", &thread, (void *)node, 0);
+	return NULL;
 }
 
 static void threadGC(void) {
-	loop = 0;
-	protocol_thread_stop(pping);
-	while(threads > 0) {
-		usleep(10);
+	struct data_t *tmp = NULL;
+
+	ping_gc();
+
+	while(data) {
+		tmp = data;
+		data = data->next;
+		FREE(tmp->ip);
+		FREE(tmp);
 	}
-	protocol_thread_free(pping);
 }
 
 #if !defined(MODULE) && !defined(_WIN32)
 __attribute__((weak))
 #endif
 void pingInit(void) {
-	pthread_mutexattr_init(&attr);
-	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-	pthread_mutex_init(&lock, &attr);
-
 	protocol_register(&pping);
 	protocol_set_id(pping, "ping");
 	protocol_device_add(pping, "ping", "Ping network devices");
@@ -179,7 +173,7 @@ void pingInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "ping";
-	module->version = "2.0";
+	module->version = "2.1";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
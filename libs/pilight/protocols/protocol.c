@@ -35,6 +35,7 @@
 #include "../core/dso.h"
 #include "../core/options.h"
 #include "../core/log.h"
+#include "../core/atom.h"
 
 #include "../config/settings.h"
 
@@ -75,12 +76,12 @@ void protocol_remove(char *name) {
 				currP->listener->gc();
 				logprintf(LOG_DEBUG, "ran garbage collector");
 			}
-			FREE(currP->listener->id);
+			atom_put(currP->listener->id);
 			options_delete(currP->listener->options);
 			if(currP->listener->devices) {
 				while(currP->listener->devices) {
 					dtmp = currP->listener->devices;
-					FREE(dtmp->id);
+					atom_put(dtmp->id);
 					FREE(dtmp->desc);
 					currP->listener->devices = currP->listener->devices->next;
 					FREE(dtmp);
@@ -325,11 +326,7 @@ void protocol_thread_free(protocol_t *proto) {
 void protocol_set_id(protocol_t *proto, const char *id) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	if((proto->id = MALLOC(strlen(id)+1)) == NULL) {
-		fprintf(stderr, "out of memory\n");
-		exit(EXIT_FAILURE);
-	}
-	strcpy(proto->id, id);
+	proto->id = atom_get(id);
 }
 
 void protocol_device_add(protocol_t *proto, const char *id, const char *desc) {
@@ -340,11 +337,7 @@ void protocol_device_add(protocol_t *proto, const char *id, const char *desc) {
 		fprintf(stderr, "out of memory\n");
 		exit(EXIT_FAILURE);
 	}
-	if((dnode->id = MALLOC(strlen(id)+1)) == NULL) {
-		fprintf(stderr, "out of memory\n");
-		exit(EXIT_FAILURE);
-	}
-	strcpy(dnode->id, id);
+	dnode->id = atom_get(id);
 	if((dnode->desc = MALLOC(strlen(desc)+1)) == NULL) {
 		fprintf(stderr, "out of memory\n");
 		exit(EXIT_FAILURE);
@@ -358,9 +351,20 @@ int protocol_device_exists(protocol_t *proto, const char *id) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	struct protocol_devices_t *temp = proto->devices;
+	unsigned int hash = 0;
 
+	/* Device ids are atoms, the protocols of config devices as well */
 	while(temp) {
-		if(strcmp(temp->id, id) == 0) {
+		if(temp->id == id) {
+			return 0;
+		}
+		temp = temp->next;
+	}
+
+	hash = atom_hash(id);
+	temp = proto->devices;
+	while(temp) {
+		if(ATOM_HASH(temp->id) == hash && strcmp(temp->id, id) == 0) {
 			return 0;
 		}
 		temp = temp->next;
@@ -372,6 +376,78 @@ int protocol_device_exists(protocol_t *proto, const char *id) {
 	return 1;
 }
 
+/*
+ * Try to decode a received pulse train with a single
+ * protocol. Returns 0 when the protocol recognized the
+ * pulse train and parsed it into proto->message.
+ */
+int protocol_parse_code(protocol_t *proto, int *raw, int rawlen, int plslen, int hwtype) {
+	struct timeval tv;
+
+	if((proto->hwtype != hwtype && proto->hwtype != -1 && hwtype != -1) ||
+		 (proto->parseCode == NULL || proto->validate == NULL)) {
+		return -1;
+	}
+
+	if(rawlen < MAXPULSESTREAMLENGTH) {
+		proto->raw = raw;
+	}
+	proto->rawlen = rawlen;
+
+	if(proto->validate() != 0) {
+		return -1;
+	}
+
+	logprintf(LOG_DEBUG, "possible %s protocol", proto->id);
+	gettimeofday(&tv, NULL);
+	if(proto->first > 0) {
+		proto->first = proto->second;
+	}
+	proto->second = 1000000 * (unsigned int)tv.tv_sec + (unsigned int)tv.tv_usec;
+	if(proto->first == 0) {
+		proto->first = proto->second;
+	}
+
+	/* Reset # of repeats after a certain delay */
+	if(((int)proto->second-(int)proto->first) > 500000) {
+		proto->repeats = 0;
+	}
+
+	proto->repeats++;
+	logprintf(LOG_DEBUG, "recevied pulse length of %d", plslen);
+	logprintf(LOG_DEBUG, "caught minimum # of repeats %d of %s", proto->repeats, proto->id);
+	logprintf(LOG_DEBUG, "called %s parseRaw()", proto->id);
+	proto->parseCode();
+
+	return 0;
+}
+
+/*
+ * Wrap the message of a protocol into the json object
+ * broadcasted by the receiver. The protocol message
+ * is consumed, the caller owns the returned object.
+ */
+struct JsonNode *protocol_create_message(protocol_t *proto, char *uuid) {
+	struct JsonNode *json = NULL;
+
+	if(proto->message != NULL) {
+		json = json_mkobject();
+
+		json_append_member(json, "message", proto->message);
+		json_append_member(json, "origin", json_mkstring("receiver"));
+		json_append_member(json, "protocol", json_mkstring(proto->id));
+		if(uuid != NULL && strlen(uuid) > 0) {
+			json_append_member(json, "uuid", json_mkstring(uuid));
+		}
+		if(proto->repeats > -1) {
+			json_append_member(json, "repeats", json_mknumber(proto->repeats, 0));
+		}
+	}
+	proto->message = NULL;
+
+	return json;
+}
+
 int protocol_gc(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -389,12 +465,12 @@ int protocol_gc(void) {
 			ptmp->listener->gc();
 			logprintf(LOG_DEBUG, "ran garbage collector");
 		}
-		FREE(ptmp->listener->id);
+		atom_put(ptmp->listener->id);
 		options_delete(ptmp->listener->options);
 		if(ptmp->listener->devices) {
 			while(ptmp->listener->devices) {
 				dtmp = ptmp->listener->devices;
-				FREE(dtmp->id);
+				atom_put(dtmp->id);
 				FREE(dtmp->desc);
 				ptmp->listener->devices = ptmp->listener->devices->next;
 				if(dtmp != NULL) {
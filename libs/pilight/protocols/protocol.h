@@ -129,6 +129,8 @@ void protocol_plslen_add(protocol_t *proto, int plslen);
 void protocol_register(protocol_t **proto);
 void protocol_device_add(protocol_t *proto, const char *id, const char *desc);
 int protocol_device_exists(protocol_t *proto, const char *id);
+int protocol_parse_code(protocol_t *proto, int *raw, int rawlen, int plslen, int hwtype);
+struct JsonNode *protocol_create_message(protocol_t *proto, char *uuid);
 int protocol_gc(void);
 
 #endif
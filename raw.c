@@ -14,6 +14,7 @@
 #include <limits.h>
 #include <errno.h>
 #include <time.h>
+#include <sys/time.h>
 #include <math.h>
 #include <string.h>
 #ifndef _WIN32
@@ -32,6 +33,7 @@
 #include "libs/pilight/core/threads.h"
 #include "libs/pilight/core/dso.h"
 #include "libs/pilight/core/gc.h"
+#include "libs/pilight/core/capture.h"
 #include "libs/pilight/config/config.h"
 #include "libs/pilight/config/hardware.h"
 #include "libs/pilight/lua_c/lua.h"
@@ -45,6 +47,7 @@ static uv_signal_t *signal_req = NULL;
 
 static unsigned short main_loop = 1;
 static unsigned short linefeed = 0;
+static struct capture_t *capture = NULL;
 
 static char *lua_root = LUA_ROOT;
 
@@ -52,6 +55,11 @@ int main_gc(void) {
 	log_shell_disable();
 	main_loop = 0;
 
+	if(capture != NULL) {
+		capture_close(capture);
+		capture = NULL;
+	}
+
 	datetime_gc();
 	ssdp_gc();
 #ifdef EVENTS
@@ -108,6 +116,12 @@ static void *listener(int reason, void *param, void *userdata) {
 		buffer[i] = (int)pulse;
 	}
 
+	if((int)length > 0 && capture != NULL) {
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		capture_write(capture, 1000000ULL * tv.tv_sec + tv.tv_usec, hardware, buffer, (int)length);
+	}
+
 	if((int)length > 0) {
 		for(i=0;i<(int)length;i++) {
 			if(linefeed == 1) {
@@ -201,6 +215,7 @@ int main(int argc, char **argv) {
 	options_add(&options, "V", "version", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "C", "config", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "L", "linefeed", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "W", "capture", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "Ls", "storage-root", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "Ll", "lua-root", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 
@@ -214,6 +229,7 @@ int main(int argc, char **argv) {
 		printf("\t -V  --version\t\t\tdisplay version\n");
 		printf("\t -L  --linefeed\t\t\tstructure raw printout\n");
 		printf("\t -C  --config\t\t\tconfig file\n");
+		printf("\t -W  --capture=xxxx\t\twrite pulse trains to capture file\n");
 		printf("\t -Ls --storage-root=xxxx\tlocation of the storage lua modules\n");
 		printf("\t -Ll --lua-root=xxxx\t\tlocation of the plain lua modules\n");
 		goto close;
@@ -304,6 +320,14 @@ int main(int argc, char **argv) {
 		goto close;
 	}
 
+	if(options_exists(options, "W") == 0) {
+		char *arg = NULL;
+		options_get_string(options, "W", &arg);
+		if((capture = capture_open(arg, 1)) == NULL) {
+			goto close;
+		}
+	}
+
 	eventpool_init(EVENTPOOL_THREADED);
 	eventpool_callback(REASON_RECEIVED_PULSETRAIN+10000, listener, NULL);
 	eventpool_callback(REASON_RECEIVED_OOK+10000, listener, NULL);
@@ -20,6 +20,8 @@
 #include "libs/pilight/core/socket.h"
 #include "libs/pilight/core/ssdp.h"
 #include "libs/pilight/core/gc.h"
+#include "libs/pilight/core/shm.h"
+#include "libs/pilight/core/atom.h"
 
 static int main_loop = 1;
 static int sockfd = 0;
@@ -27,6 +29,73 @@ static char *recvBuff = NULL;
 char **filters = NULL;
 unsigned int m = 0;
 
+static void print_json(struct JsonNode *jcontent, int filteropt) {
+	char *protocol = NULL;
+	struct JsonNode *jtype = json_find_member(jcontent, "type");
+	if(jtype != NULL) {
+		json_remove_from_parent(jtype);
+		json_delete(jtype);
+	}
+	if(filteropt == 1) {
+		int filtered = 0, j = 0;
+		json_find_string(jcontent, "protocol", &protocol);
+		for(j=0;j<m;j++) {
+			if(strcmp(filters[j], protocol) == 0) {
+				filtered = 1;
+				break;
+			}
+		}
+		if(filtered == 0) {
+			char *content = json_stringify(jcontent, "\t");
+			printf("%s\n", content);
+			json_free(content);
+		}
+	} else {
+		char *content = json_stringify(jcontent, "\t");
+		printf("%s\n", content);
+		json_free(content);
+	}
+}
+
+static void print_message(char *message, int filteropt) {
+	struct JsonNode *jcontent = json_decode(message);
+	print_json(jcontent, filteropt);
+	json_delete(jcontent);
+}
+
+static void print_slot(struct shm_slot_t *slot, int filteropt) {
+	struct JsonNode *jcontent = json_mkobject();
+	struct JsonNode *jmessage = json_mkobject();
+	struct shm_value_t *value = NULL;
+	int i = 0;
+
+	for(i=0;i<slot->message.nrvalues && i<SHM_VALUES;i++) {
+		value = &slot->message.values[i];
+		value->name[SHM_KEY_SIZE-1] = '\0';
+		if(value->type == SHM_VALUE_NUMBER) {
+			json_append_member(jmessage, value->name, json_mknumber(value->number, value->decimals));
+		} else if(value->type == SHM_VALUE_STRING) {
+			value->string[SHM_STRING_SIZE-1] = '\0';
+			json_append_member(jmessage, value->name, json_mkstring(value->string));
+		}
+	}
+	slot->name[SHM_NAME_SIZE-1] = '\0';
+	slot->message.origin[SHM_ORIGIN_SIZE-1] = '\0';
+	slot->message.uuid[SHM_UUID_SIZE-1] = '\0';
+
+	json_append_member(jcontent, "message", jmessage);
+	json_append_member(jcontent, "origin", json_mkstring(slot->message.origin));
+	json_append_member(jcontent, "protocol", json_mkstring(slot->name));
+	if(strlen(slot->message.uuid) > 0) {
+		json_append_member(jcontent, "uuid", json_mkstring(slot->message.uuid));
+	}
+	if(slot->message.repeats > -1) {
+		json_append_member(jcontent, "repeats", json_mknumber(slot->message.repeats, 0));
+	}
+	print_json(jcontent, filteropt);
+	json_delete(jcontent);
+}
+
 int main_gc(void) {
 	main_loop = 0;
 	sleep(1);
@@ -75,6 +144,7 @@ int main(int argc, char **argv) {
 	int port = 0;
 	int stats = 0;
 	int filteropt = 0;
+	int shm = 0;
 	int help = 0;
 
 	options_add(&options, "H", "help", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
@@ -83,6 +153,7 @@ int main(int argc, char **argv) {
 	options_add(&options, "P", "port", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "[0-9]{1,4}");
 	options_add(&options, "s", "stats", OPTION_NO_VALUE, 0, JSON_NULL, NULL, "[0-9]{1,4}");
 	options_add(&options, "F", "filter", OPTION_HAS_VALUE, 0, JSON_STRING, NULL, NULL);
+	options_add(&options, "m", "shm", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
 
 	if(options_parse(options, argc, argv, 1) == -1) {
 		printf("Usage: %s \n", progname);
@@ -96,6 +167,7 @@ int main(int argc, char **argv) {
 		printf("\t -P --port=xxxx\t\t\tconnect to server port\n");
 		printf("\t -s --stats\t\t\tshow CPU and RAM statistics\n");
 		printf("\t -F --filter=protocol\t\tfilter out protocol(s)\n");
+		printf("\t -m --shm\t\t\tread from the shared memory of a local daemon\n");
 		goto close;
 	}
 
@@ -121,6 +193,10 @@ int main(int argc, char **argv) {
 		filteropt = 1;
 	}
 
+	if(options_exists(options, "m") == 0) {
+		shm = 1;
+	}
+
 	if(filteropt == 1) {
 		struct protocol_t *protocol = NULL;
 		m = explode(filter, ",", &filters);
@@ -149,6 +225,33 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	if(shm == 1) {
+		struct shm_slot_t slot;
+		unsigned long lost = 0, reported = 0;
+
+		if(shm_attach() == -1) {
+			logprintf(LOG_ERR, "could not attach to the shared memory of pilight-daemon");
+			goto close;
+		}
+		while(main_loop) {
+			int ret = shm_next(&slot, &lost);
+			if(lost != reported) {
+				logprintf(LOG_NOTICE, "missed %lu codes", lost-reported);
+				reported = lost;
+			}
+			if(ret == -1) {
+				logprintf(LOG_NOTICE, "pilight-daemon stopped publishing codes");
+				break;
+			} else if(ret == 1) {
+				usleep(5000);
+			} else if(slot.type == SHM_TYPE_MESSAGE) {
+				print_slot(&slot, filteropt);
+			}
+		}
+		shm_detach();
+		goto close;
+	}
+
 	if(server != NULL && port > 0) {
 		if((sockfd = socket_connect(server, port)) == -1) {
 			logprintf(LOG_ERR, "could not connect to pilight-daemon");
@@ -193,37 +296,11 @@ int main(int argc, char **argv) {
 		if(socket_read(sockfd, &recvBuff, 0) != 0) {
 			goto close;
 		}
-		char *protocol = NULL;
 		char **array = NULL;
 		unsigned int n = explode(recvBuff, "\n", &array), i = 0;
 
 		for(i=0;i<n;i++) {
-			struct JsonNode *jcontent = json_decode(array[i]);
-			struct JsonNode *jtype = json_find_member(jcontent, "type");
-			if(jtype != NULL) {
-				json_remove_from_parent(jtype);
-				json_delete(jtype);
-			}
-			if(filteropt == 1) {
-				int filtered = 0, j = 0;
-				json_find_string(jcontent, "protocol", &protocol);
-				for(j=0;j<m;j++) {
-					if(strcmp(filters[j], protocol) == 0) {
-						filtered = 1;
-						break;
-					}
-				}
-				if(filtered == 0) {
-					char *content = json_stringify(jcontent, "\t");
-					printf("%s\n", content);
-					json_free(content);
-				}
-			} else {
-				char *content = json_stringify(jcontent, "\t");
-				printf("%s\n", content);
-				json_free(content);
-			}
-			json_delete(jcontent);
+			print_message(array[i], filteropt);
 		}
 		array_free(&array, n);
 	}
@@ -244,6 +321,7 @@ close:
 	options_gc();
 	log_shell_disable();
 	log_gc();
+	atom_gc();
 	FREE(progname);
 	return EXIT_SUCCESS;
 }
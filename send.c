@@ -27,6 +27,7 @@
 #include "libs/pilight/core/json.h"
 #include "libs/pilight/core/ssdp.h"
 #include "libs/pilight/core/dso.h"
+#include "libs/pilight/core/atom.h"
 #include "libs/pilight/config/config.h"
 
 #include "libs/pilight/protocols/protocol.h"
@@ -384,6 +385,7 @@ close:
 	threads_gc();
 	dso_gc();
 	log_gc();
+	atom_gc();
 	FREE(progname);
 	xfree();
 